@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "error.h"
+#include "mbtiles.h"
+#include "pmtiles.h"
+
+// Add in an error function.
+SIMPLET_ERROR_FUNC(archive_t)
+
+// Create an archive of format at path to append tiles to. Returns NULL on
+// failure.
+simplet_archive_t *simplet_archive_create(const char *path,
+                                          simplet_archive_format_t format) {
+  if (format == SIMPLET_MBTILES)
+    return (simplet_archive_t *)simplet_mbtiles_create(path);
+  return (simplet_archive_t *)simplet_pmtiles_create(path);
+}
+
+// Open the archive at path for reading, telling the formats apart by their
+// first bytes. Returns NULL when it isn't an archive or on failure.
+simplet_archive_t *simplet_archive_open(const char *path) {
+  FILE *file;
+  if (!(file = fopen(path, "rb"))) return NULL;
+  char magic[16] = {0};
+  size_t length = fread(magic, 1, sizeof(magic), file);
+  fclose(file);
+
+  if (length == sizeof(magic) && !memcmp(magic, "SQLite format 3", 16))
+    return (simplet_archive_t *)simplet_mbtiles_open(path);
+  if (length >= 7 && !memcmp(magic, "PMTiles", 7))
+    return (simplet_archive_t *)simplet_pmtiles_open(path);
+  return NULL;
+}
+
+// Check the archive can take or give out tile x, y, z.
+static simplet_status_t check_tile(simplet_archive_t *archive, bool writing,
+                                   unsigned int x, unsigned int y,
+                                   unsigned int z) {
+  if (archive->writing != writing || archive->finished)
+    return set_error(archive, SIMPLET_ERR,
+                     writing ? "archive isn't open for writing"
+                             : "archive isn't open for reading");
+  if (z > SIMPLET_ARCHIVE_MAX_ZOOM || x >> z || y >> z)
+    return set_error(archive, SIMPLET_ERR, "tile is outside the archive");
+  return SIMPLET_OK;
+}
+
+// Append length bytes of an encoded tile at x, y, z. Appending the same
+// position twice keeps the later tile.
+simplet_status_t simplet_archive_append(simplet_archive_t *archive,
+                                        unsigned int x, unsigned int y,
+                                        unsigned int z,
+                                        const unsigned char *data,
+                                        size_t length) {
+  pthread_mutex_lock(&archive->lock);
+  simplet_status_t status = check_tile(archive, true, x, y, z);
+  if (status == SIMPLET_OK) {
+    if (archive->format == SIMPLET_MBTILES)
+      status = simplet_mbtiles_append((simplet_mbtiles_t *)archive, x, y, z,
+                                      data, length);
+    else
+      status = simplet_pmtiles_append((simplet_pmtiles_t *)archive, x, y, z,
+                                      data, length);
+  }
+  pthread_mutex_unlock(&archive->lock);
+  return status;
+}
+
+// Set a metadata value, a row of the metadata table in MBTiles and a key of
+// the metadata object in PMTiles.
+simplet_status_t simplet_archive_set_metadata(simplet_archive_t *archive,
+                                              const char *name,
+                                              const char *value) {
+  pthread_mutex_lock(&archive->lock);
+  simplet_status_t status;
+  if (!archive->writing || archive->finished)
+    status = set_error(archive, SIMPLET_ERR, "archive isn't open for writing");
+  else if (archive->format == SIMPLET_MBTILES)
+    status = simplet_mbtiles_set_metadata((simplet_mbtiles_t *)archive, name,
+                                          value);
+  else
+    status = simplet_pmtiles_set_metadata((simplet_pmtiles_t *)archive, name,
+                                          value);
+  pthread_mutex_unlock(&archive->lock);
+  return status;
+}
+
+// Look up tile x, y, z in an opened archive. Returns a copy of the encoded
+// tile the caller frees and stores its size in length, or NULL when the tile
+// isn't in the archive or on failure.
+unsigned char *simplet_archive_get(simplet_archive_t *archive, unsigned int x,
+                                   unsigned int y, unsigned int z,
+                                   size_t *length) {
+  unsigned char *out = NULL;
+  pthread_mutex_lock(&archive->lock);
+  if (check_tile(archive, false, x, y, z) == SIMPLET_OK) {
+    if (archive->format == SIMPLET_MBTILES)
+      out = simplet_mbtiles_get((simplet_mbtiles_t *)archive, x, y, z, length);
+    else
+      out = simplet_pmtiles_get((simplet_pmtiles_t *)archive, x, y, z, length);
+  }
+  pthread_mutex_unlock(&archive->lock);
+  return out;
+}
+
+// Write out everything appended, after which the archive can be opened.
+simplet_status_t simplet_archive_finish(simplet_archive_t *archive) {
+  pthread_mutex_lock(&archive->lock);
+  simplet_status_t status = SIMPLET_OK;
+  if (!archive->writing) {
+    status = set_error(archive, SIMPLET_ERR, "archive isn't open for writing");
+  } else if (!archive->finished) {
+    archive->finished = true;
+    if (archive->format == SIMPLET_MBTILES)
+      status = simplet_mbtiles_finish((simplet_mbtiles_t *)archive);
+    else
+      status = simplet_pmtiles_finish((simplet_pmtiles_t *)archive);
+  }
+  pthread_mutex_unlock(&archive->lock);
+  return status;
+}
+
+// Free an archive, finishing it first if it was being written.
+void simplet_archive_free(simplet_archive_t *archive) {
+  if (archive->writing && !archive->finished) simplet_archive_finish(archive);
+
+  if (archive->format == SIMPLET_MBTILES)
+    simplet_mbtiles_close((simplet_mbtiles_t *)archive);
+  else
+    simplet_pmtiles_close((simplet_pmtiles_t *)archive);
+
+  if (archive->error_msg) free(archive->error_msg);
+  pthread_mutex_destroy(&archive->lock);
+  free(archive);
+}
+
+// Get the archive's status.
+simplet_status_t simplet_archive_get_status(simplet_archive_t *archive) {
+  return archive->status;
+}
+
+// Get the last error message set on the archive.
+const char *simplet_archive_status_to_string(simplet_archive_t *archive) {
+  return archive->error_msg;
+}
+
@@ -0,0 +1,64 @@
+#ifndef _SIMPLE_TILES_ARCHIVE_H
+#define _SIMPLE_TILES_ARCHIVE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "tile_id.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* single file archives of encoded tiles */
+
+// The deepest zoom an archive holds.
+#define SIMPLET_ARCHIVE_MAX_ZOOM SIMPLET_TILE_ID_MAX_ZOOM
+
+// Common to both formats: whether the archive was created for writing and
+// whether it has been finished, and a lock serializing every call.
+#define SIMPLET_ARCHIVE_FIELDS     \
+  SIMPLET_ERROR_FIELDS             \
+  simplet_archive_format_t format; \
+  bool writing;                    \
+  bool finished;                   \
+  pthread_mutex_t lock;
+
+struct simplet_archive_t {
+  SIMPLET_ARCHIVE_FIELDS
+};
+
+simplet_archive_t *simplet_archive_create(const char *path,
+                                          simplet_archive_format_t format);
+
+simplet_archive_t *simplet_archive_open(const char *path);
+
+simplet_status_t simplet_archive_append(simplet_archive_t *archive,
+                                        unsigned int x, unsigned int y,
+                                        unsigned int z,
+                                        const unsigned char *data,
+                                        size_t length);
+
+simplet_status_t simplet_archive_set_metadata(simplet_archive_t *archive,
+                                              const char *name,
+                                              const char *value);
+
+unsigned char *simplet_archive_get(simplet_archive_t *archive, unsigned int x,
+                                   unsigned int y, unsigned int z,
+                                   size_t *length);
+
+simplet_status_t simplet_archive_finish(simplet_archive_t *archive);
+
+void simplet_archive_free(simplet_archive_t *archive);
+
+simplet_status_t simplet_archive_get_status(simplet_archive_t *archive);
+
+const char *simplet_archive_status_to_string(simplet_archive_t *archive);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,405 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bandmath.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMPLET_X86
+#include <immintrin.h>
+#endif
+
+// State while compiling an expression, top is how many values the ops
+// emitted so far leave on the stack.
+typedef struct {
+  const char *cursor;
+  simplet_op_t *ops;
+  int length;
+  int capacity;
+  int top;
+  int bands;
+  bool failed;
+} parser_t;
+
+static void skip_space(parser_t *parser) {
+  while (isspace((unsigned char)*parser->cursor)) parser->cursor++;
+}
+
+// Consume c if it comes next.
+static bool accept(parser_t *parser, char c) {
+  skip_space(parser);
+  if (*parser->cursor != c) return false;
+  parser->cursor++;
+  return true;
+}
+
+static void expect(parser_t *parser, char c) {
+  if (!accept(parser, c)) parser->failed = true;
+}
+
+// Append an op, keeping track of how deep the stack gets.
+static void emit(parser_t *parser, simplet_op_code_t code, int band,
+                 float value) {
+  if (parser->failed) return;
+  if (parser->length == parser->capacity) {
+    int capacity = parser->capacity ? parser->capacity * 2 : 16;
+    simplet_op_t *ops;
+    if (!(ops = realloc(parser->ops, capacity * sizeof(*ops)))) {
+      parser->failed = true;
+      return;
+    }
+    parser->ops = ops;
+    parser->capacity = capacity;
+  }
+  parser->ops[parser->length++] = (simplet_op_t){code, band, value};
+
+  if (code == SIMPLET_OP_VALUE || code == SIMPLET_OP_BAND)
+    parser->top++;
+  else if (code != SIMPLET_OP_NEG && code != SIMPLET_OP_ABS &&
+           code != SIMPLET_OP_SQRT)
+    parser->top--;
+  if (parser->top > SIMPLET_EXPR_DEPTH) parser->failed = true;
+}
+
+static void parse_sum(parser_t *parser);
+
+// A number, a band, a call or a parenthesized sum.
+static void parse_primary(parser_t *parser) {
+  skip_space(parser);
+  const char *start = parser->cursor;
+  if (isdigit((unsigned char)*start) || *start == '.') {
+    char *end;
+    double value = strtod(start, &end);
+    if (end == start) {
+      parser->failed = true;
+      return;
+    }
+    parser->cursor = end;
+    emit(parser, SIMPLET_OP_VALUE, 0, (float)value);
+    return;
+  }
+
+  if (accept(parser, '(')) {
+    parse_sum(parser);
+    expect(parser, ')');
+    return;
+  }
+
+  const char *end = start;
+  while (isalpha((unsigned char)*end)) end++;
+  size_t length = end - start;
+  if (length == 1 && *start == 'b' && isdigit((unsigned char)*end)) {
+    int band = 0;
+    while (isdigit((unsigned char)*end) && band <= SIMPLET_EXPR_BANDS)
+      band = band * 10 + *end++ - '0';
+    if (band < 1 || band > SIMPLET_EXPR_BANDS) {
+      parser->failed = true;
+      return;
+    }
+    parser->cursor = end;
+    if (band > parser->bands) parser->bands = band;
+    emit(parser, SIMPLET_OP_BAND, band - 1, 0);
+    return;
+  }
+
+  static const struct {
+    const char *name;
+    simplet_op_code_t code;
+    int args;
+  } functions[] = {{"abs", SIMPLET_OP_ABS, 1},
+                   {"sqrt", SIMPLET_OP_SQRT, 1},
+                   {"min", SIMPLET_OP_MIN, 2},
+                   {"max", SIMPLET_OP_MAX, 2}};
+  for (size_t i = 0; i < sizeof(functions) / sizeof(*functions); i++) {
+    if (strlen(functions[i].name) != length ||
+        strncmp(functions[i].name, start, length))
+      continue;
+    parser->cursor = end;
+    expect(parser, '(');
+    for (int arg = 0; arg < functions[i].args && !parser->failed; arg++) {
+      if (arg) expect(parser, ',');
+      parse_sum(parser);
+    }
+    expect(parser, ')');
+    emit(parser, functions[i].code, 0, 0);
+    return;
+  }
+  parser->failed = true;
+}
+
+static void parse_unary(parser_t *parser) {
+  if (accept(parser, '-')) {
+    parse_unary(parser);
+    emit(parser, SIMPLET_OP_NEG, 0, 0);
+    return;
+  }
+  if (accept(parser, '+')) {
+    parse_unary(parser);
+    return;
+  }
+  parse_primary(parser);
+}
+
+static void parse_product(parser_t *parser) {
+  parse_unary(parser);
+  while (!parser->failed) {
+    if (accept(parser, '*')) {
+      parse_unary(parser);
+      emit(parser, SIMPLET_OP_MUL, 0, 0);
+    } else if (accept(parser, '/')) {
+      parse_unary(parser);
+      emit(parser, SIMPLET_OP_DIV, 0, 0);
+    } else {
+      return;
+    }
+  }
+}
+
+static void parse_sum(parser_t *parser) {
+  parse_product(parser);
+  while (!parser->failed) {
+    if (accept(parser, '+')) {
+      parse_product(parser);
+      emit(parser, SIMPLET_OP_ADD, 0, 0);
+    } else if (accept(parser, '-')) {
+      parse_product(parser);
+      emit(parser, SIMPLET_OP_SUB, 0, 0);
+    } else {
+      return;
+    }
+  }
+}
+
+// Compile an expression over bands like (b4 - b3) / (b4 + b3). It may use
+// numbers, bands b1 up to b16, + - * / and parentheses, and the functions
+// abs, sqrt, min and max. Returns NULL if the expression is invalid or
+// memory runs out.
+simplet_expr_t *simplet_expr_new(const char *source) {
+  parser_t parser;
+  memset(&parser, 0, sizeof(parser));
+  parser.cursor = source;
+
+  parse_sum(&parser);
+  skip_space(&parser);
+  if (*parser.cursor || parser.top != 1) parser.failed = true;
+
+  simplet_expr_t *expr = NULL;
+  if (parser.failed || !(expr = malloc(sizeof(*expr)))) {
+    free(parser.ops);
+    return NULL;
+  }
+  expr->ops = parser.ops;
+  expr->length = parser.length;
+  expr->bands = parser.bands;
+  return expr;
+}
+
+void simplet_expr_free(simplet_expr_t *expr) {
+  free(expr->ops);
+  free(expr);
+}
+
+// Evaluate an expression for count pixels, bands holding each band's values
+// it uses. Each op runs over a chunk of pixels at a time so its loop is
+// simple enough for the compiler to vectorize.
+void simplet_expr_eval(const simplet_expr_t *expr, const float *const *bands,
+                       int count, float *out) {
+  float stack[SIMPLET_EXPR_DEPTH][SIMPLET_EXPR_CHUNK];
+  for (int start = 0; start < count; start += SIMPLET_EXPR_CHUNK) {
+    int n = count - start < SIMPLET_EXPR_CHUNK ? count - start
+                                               : SIMPLET_EXPR_CHUNK;
+    int top = -1;
+    for (int k = 0; k < expr->length; k++) {
+      const simplet_op_t *op = &expr->ops[k];
+      float *a = stack[top > 0 ? top - 1 : 0], *b = stack[top > 0 ? top : 0];
+      switch (op->code) {
+        case SIMPLET_OP_VALUE:
+          top++;
+          for (int i = 0; i < n; i++) stack[top][i] = op->value;
+          continue;
+        case SIMPLET_OP_BAND:
+          top++;
+          memcpy(stack[top], bands[op->band] + start, n * sizeof(float));
+          continue;
+        case SIMPLET_OP_ADD:
+          for (int i = 0; i < n; i++) a[i] += b[i];
+          break;
+        case SIMPLET_OP_SUB:
+          for (int i = 0; i < n; i++) a[i] -= b[i];
+          break;
+        case SIMPLET_OP_MUL:
+          for (int i = 0; i < n; i++) a[i] *= b[i];
+          break;
+        case SIMPLET_OP_DIV:
+          for (int i = 0; i < n; i++) a[i] /= b[i];
+          break;
+        case SIMPLET_OP_MIN:
+          for (int i = 0; i < n; i++) a[i] = b[i] < a[i] ? b[i] : a[i];
+          break;
+        case SIMPLET_OP_MAX:
+          for (int i = 0; i < n; i++) a[i] = b[i] > a[i] ? b[i] : a[i];
+          break;
+        case SIMPLET_OP_NEG:
+          for (int i = 0; i < n; i++) b[i] = -b[i];
+          continue;
+        case SIMPLET_OP_ABS:
+          for (int i = 0; i < n; i++) b[i] = fabsf(b[i]);
+          continue;
+        case SIMPLET_OP_SQRT:
+          for (int i = 0; i < n; i++) b[i] = sqrtf(b[i]);
+          continue;
+      }
+      top--;
+    }
+    memcpy(out + start, stack[0], n * sizeof(float));
+  }
+}
+
+// Weights for shading a cell from the sums Horn's method takes across and
+// down its neighbors.
+typedef struct {
+  float up;
+  float across;
+  float down;
+  float x_slope;
+  float y_slope;
+} shade_t;
+
+// Shade one cell from its row and the rows above and below, x being its
+// column and left and right the columns beside it. Neighbors without a
+// value take the cell's own so shading continues up to holes in the data.
+static inline float shade(const shade_t *s, const float *above,
+                          const float *row, const float *below, int left,
+                          int x, int right) {
+  float e = row[x];
+  float a = above[left] == above[left] ? above[left] : e;
+  float b = above[x] == above[x] ? above[x] : e;
+  float c = above[right] == above[right] ? above[right] : e;
+  float d = row[left] == row[left] ? row[left] : e;
+  float f = row[right] == row[right] ? row[right] : e;
+  float g = below[left] == below[left] ? below[left] : e;
+  float h = below[x] == below[x] ? below[x] : e;
+  float i = below[right] == below[right] ? below[right] : e;
+
+  float dx = (c + 2 * f + i) - (a + 2 * d + g);
+  float dy = (g + 2 * h + i) - (a + 2 * b + c);
+  float x_slope = dx * s->x_slope, y_slope = dy * s->y_slope;
+  float lit = (s->up - dx * s->across - dy * s->down) /
+              sqrtf(1 + x_slope * x_slope + y_slope * y_slope);
+  return lit > 0 ? 255 * lit : 0;
+}
+
+#ifdef SIMPLET_X86
+// Take v where it holds a value and e where it doesn't.
+__attribute__((target("sse2"))) static __m128 or_center(__m128 v, __m128 e) {
+  __m128 valid = _mm_cmpord_ps(v, v);
+  return _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, e));
+}
+
+// Shade the cells of a row between its edges four at a time. Returns the
+// column the row is finished from.
+__attribute__((target("sse2"))) static int shade_sse2(
+    const shade_t *s, const float *above, const float *row,
+    const float *below, float *line, int width) {
+  const __m128 two = _mm_set1_ps(2), one = _mm_set1_ps(1);
+  const __m128 up = _mm_set1_ps(s->up), across = _mm_set1_ps(s->across);
+  const __m128 down = _mm_set1_ps(s->down);
+  const __m128 x_step = _mm_set1_ps(s->x_slope);
+  const __m128 y_step = _mm_set1_ps(s->y_slope);
+  const __m128 full = _mm_set1_ps(255);
+
+  int x = 1;
+  for (; x + 4 < width; x += 4) {
+    __m128 e = _mm_loadu_ps(row + x);
+    __m128 a = or_center(_mm_loadu_ps(above + x - 1), e);
+    __m128 b = or_center(_mm_loadu_ps(above + x), e);
+    __m128 c = or_center(_mm_loadu_ps(above + x + 1), e);
+    __m128 d = or_center(_mm_loadu_ps(row + x - 1), e);
+    __m128 f = or_center(_mm_loadu_ps(row + x + 1), e);
+    __m128 g = or_center(_mm_loadu_ps(below + x - 1), e);
+    __m128 h = or_center(_mm_loadu_ps(below + x), e);
+    __m128 i = or_center(_mm_loadu_ps(below + x + 1), e);
+
+    __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_add_ps(c, _mm_mul_ps(two, f)), i),
+                           _mm_add_ps(_mm_add_ps(a, _mm_mul_ps(two, d)), g));
+    __m128 dy = _mm_sub_ps(_mm_add_ps(_mm_add_ps(g, _mm_mul_ps(two, h)), i),
+                           _mm_add_ps(_mm_add_ps(a, _mm_mul_ps(two, b)), c));
+    __m128 x_slope = _mm_mul_ps(dx, x_step), y_slope = _mm_mul_ps(dy, y_step);
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(
+        one, _mm_add_ps(_mm_mul_ps(x_slope, x_slope),
+                        _mm_mul_ps(y_slope, y_slope))));
+    __m128 lit = _mm_sub_ps(
+        up, _mm_add_ps(_mm_mul_ps(dx, across), _mm_mul_ps(dy, down)));
+    lit = _mm_max_ps(_mm_div_ps(lit, length), _mm_setzero_ps());
+    _mm_storeu_ps(line + x, _mm_mul_ps(lit, full));
+  }
+  return x;
+}
+#endif
+
+// Shade the grid, running the middle of each row four cells at a time when
+// vector is set.
+static void hillshade(const float *dem, int width, int height,
+                      const simplet_relief_t *relief, float *out,
+                      bool vector) {
+  double azimuth = relief->azimuth * SIMPLET_PI / 180;
+  double altitude = relief->altitude * SIMPLET_PI / 180;
+  double x_step = relief->z_factor / (8 * relief->x_res);
+  double y_step = relief->z_factor / (8 * relief->y_res);
+
+  // the surface's normal dotted with the direction of the light
+  shade_t s;
+  s.up = (float)sin(altitude);
+  s.across = (float)(cos(altitude) * sin(azimuth) * x_step);
+  s.down = (float)(cos(altitude) * cos(azimuth) * y_step);
+  s.x_slope = (float)x_step;
+  s.y_slope = (float)y_step;
+
+  for (int y = 0; y < height; y++) {
+    const float *row = dem + (size_t)y * width;
+    const float *above = y > 0 ? row - width : row;
+    const float *below = y < height - 1 ? row + width : row;
+    float *line = out + (size_t)y * width;
+
+    line[0] = shade(&s, above, row, below, 0, 0, width > 1 ? 1 : 0);
+    int x = 1;
+#ifdef SIMPLET_X86
+    if (vector) x = shade_sse2(&s, above, row, below, line, width);
+#else
+    (void)vector;
+#endif
+    for (; x < width - 1; x++)
+      line[x] = shade(&s, above, row, below, x - 1, x, x + 1);
+    if (width > 1)
+      line[width - 1] =
+          shade(&s, above, row, below, width - 2, width - 1, width - 1);
+
+    for (x = 0; x < width; x++)
+      if (row[x] != row[x]) line[x] = row[x];
+  }
+}
+
+// Shade a width by height grid of heights with Horn's method, writing
+// brightness from 0 to 255 to out. Cells at the edge of the grid repeat
+// their edge neighbors, so callers read a pixel of halo around the cells
+// they need. Cells without a value stay without one. SSE2 is part of every
+// x86_64 target, so only 32 bit builds ask the processor for it.
+void simplet_hillshade(const float *dem, int width, int height,
+                       const simplet_relief_t *relief, float *out) {
+  bool vector = false;
+#if defined(__SSE2__)
+  vector = true;
+#elif defined(SIMPLET_X86)
+  __builtin_cpu_init();
+  vector = __builtin_cpu_supports("sse2");
+#endif
+  hillshade(dem, width, height, relief, out, vector);
+}
+
+// Shade the grid one cell at a time, the reference for simplet_hillshade.
+void simplet_hillshade_scalar(const float *dem, int width, int height,
+                              const simplet_relief_t *relief, float *out) {
+  hillshade(dem, width, height, relief, out, false);
+}
@@ -0,0 +1,80 @@
+#ifndef _SIMPLE_TILES_BANDMATH_H
+#define _SIMPLE_TILES_BANDMATH_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* arithmetic over raster bands and terrain shading */
+
+// The highest band an expression may use, b1 being the first.
+#define SIMPLET_EXPR_BANDS 16
+
+// How many nested values an expression may hold at once.
+#define SIMPLET_EXPR_DEPTH 16
+
+// How many pixels each step of an expression runs over at a time.
+#define SIMPLET_EXPR_CHUNK 64
+
+typedef enum {
+  SIMPLET_OP_VALUE = 0,
+  SIMPLET_OP_BAND,
+  SIMPLET_OP_ADD,
+  SIMPLET_OP_SUB,
+  SIMPLET_OP_MUL,
+  SIMPLET_OP_DIV,
+  SIMPLET_OP_NEG,
+  SIMPLET_OP_ABS,
+  SIMPLET_OP_SQRT,
+  SIMPLET_OP_MIN,
+  SIMPLET_OP_MAX
+} simplet_op_code_t;
+
+// A step of a compiled expression, pushing a value or a band, or replacing
+// the values on top of the stack with the result of an operator.
+typedef struct {
+  simplet_op_code_t code;
+  int band;
+  float value;
+} simplet_op_t;
+
+// An expression compiled to postfix, bands is the highest band it reads.
+struct simplet_expr_t {
+  simplet_op_t *ops;
+  int length;
+  int bands;
+};
+
+// How to light a surface and the ground size of its cells. Light comes from
+// azimuth degrees clockwise from north and altitude degrees above the
+// horizon. x_res is how far east a column steps and y_res how far north a
+// row steps, negative for north up rasters. z_factor scales heights into
+// ground units.
+typedef struct {
+  double azimuth;
+  double altitude;
+  double z_factor;
+  double x_res;
+  double y_res;
+} simplet_relief_t;
+
+simplet_expr_t *simplet_expr_new(const char *source);
+
+void simplet_expr_free(simplet_expr_t *expr);
+
+void simplet_expr_eval(const simplet_expr_t *expr, const float *const *bands,
+                       int count, float *out);
+
+void simplet_hillshade(const float *dem, int width, int height,
+                       const simplet_relief_t *relief, float *out);
+
+void simplet_hillshade_scalar(const float *dem, int width, int height,
+                              const simplet_relief_t *relief, float *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
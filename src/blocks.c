@@ -0,0 +1,164 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocks.h"
+#include "lru.h"
+#include "memory.h"
+
+// Decoded blocks by source, level, band and position, shared by every thread.
+static simplet_lru_t *blocks = NULL;
+static size_t budget = SIMPLET_BLOCK_CACHE;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Drop a reference to a block, the caller holds blocks_lock.
+static void block_release(simplet_block_t *block) {
+  if (simplet_release((simplet_retainable_t *)block) > 0) return;
+  free(block);
+}
+
+static void block_vrelease(void *block) { block_release(block); }
+
+// Decode block x, y of band. Returns NULL on failure.
+static simplet_block_t *block_new(GDALRasterBandH band, int x, int y,
+                                  int width, int height, size_t bytes) {
+  simplet_block_t *block;
+  if (!(block = malloc(sizeof(*block) + bytes))) return NULL;
+
+  memset(block, 0, sizeof(*block));
+  block->width = width;
+  block->height = height;
+  block->type = GDALGetRasterDataType(band);
+  if (GDALReadBlock(band, x, y, block->data) != CE_None) {
+    free(block);
+    return NULL;
+  }
+
+  simplet_retain((simplet_retainable_t *)block);
+  return block;
+}
+
+// Find block x, y under key in the cache or decode and add it. The caller
+// gets a reference it has to release. Two threads missing the same block
+// both decode it and the later one replaces the earlier in the cache.
+static simplet_block_t *get_block(GDALRasterBandH band, char *key,
+                                  size_t key_length, int x, int y, int width,
+                                  int height, size_t bytes) {
+  memcpy(key + key_length - 2 * sizeof(int), &x, sizeof(int));
+  memcpy(key + key_length - sizeof(int), &y, sizeof(int));
+
+  pthread_mutex_lock(&blocks_lock);
+  if (!blocks) blocks = simplet_lru_new(budget, block_vrelease);
+  simplet_block_t *block =
+      blocks ? simplet_lru_get(blocks, key, key_length) : NULL;
+  if (block) simplet_retain((simplet_retainable_t *)block);
+  pthread_mutex_unlock(&blocks_lock);
+  if (block) return block;
+
+  if (!(block = block_new(band, x, y, width, height, bytes))) return NULL;
+
+  pthread_mutex_lock(&blocks_lock);
+  if (blocks) {
+    simplet_retain((simplet_retainable_t *)block);
+    if (!simplet_lru_set(blocks, key, key_length, block,
+                         bytes + key_length + sizeof(*block)))
+      simplet_release((simplet_retainable_t *)block);
+  }
+  pthread_mutex_unlock(&blocks_lock);
+  return block;
+}
+
+static void release_block(simplet_block_t *block) {
+  pthread_mutex_lock(&blocks_lock);
+  block_release(block);
+  pthread_mutex_unlock(&blocks_lock);
+}
+
+// Read the w by h window at x, y of band into out like GDALRasterIO without
+// resampling, converting to type with pixel_space bytes between pixels and
+// line_space between rows. The band's blocks come from the shared cache
+// when they have been read before, stamp naming the version of the source
+// and level and index which overview and band of it this is. Blocks too big
+// to be worth keeping are read straight from GDAL. Returns false on
+// failure.
+bool simplet_blocks_read(GDALRasterBandH band, const char *stamp, int level,
+                         int index, int x, int y, int w, int h, void *out,
+                         GDALDataType type, int pixel_space, int line_space) {
+  int width, height;
+  GDALGetBlockSize(band, &width, &height);
+  GDALDataType stored = GDALGetRasterDataType(band);
+  int size = GDALGetDataTypeSize(stored) / 8;
+  size_t bytes = (size_t)width * height * size;
+
+  pthread_mutex_lock(&blocks_lock);
+  bool cacheable = width > 0 && height > 0 && size > 0 && bytes <= budget / 8;
+  pthread_mutex_unlock(&blocks_lock);
+  if (!cacheable)
+    return GDALRasterIO(band, GF_Read, x, y, w, h, out, w, h, type,
+                        pixel_space, line_space) == CE_None;
+
+  // The key is the stamp with its terminator, then the level, band and the
+  // block's position filled in for each block.
+  size_t stamp_length = strlen(stamp) + 1;
+  size_t key_length = stamp_length + 4 * sizeof(int);
+  char *key;
+  if (!(key = malloc(key_length))) return false;
+  memcpy(key, stamp, stamp_length);
+  memcpy(key + stamp_length, &level, sizeof(int));
+  memcpy(key + stamp_length + sizeof(int), &index, sizeof(int));
+
+  bool ok = true;
+  for (int by = y / height; ok && by <= (y + h - 1) / height; by++) {
+    for (int bx = x / width; ok && bx <= (x + w - 1) / width; bx++) {
+      simplet_block_t *block;
+      if (!(block = get_block(band, key, key_length, bx, by, width, height,
+                              bytes))) {
+        ok = false;
+        break;
+      }
+
+      // copy the rows of the window inside this block
+      int x0 = bx * width > x ? bx * width : x;
+      int x1 = (bx + 1) * width < x + w ? (bx + 1) * width : x + w;
+      int y0 = by * height > y ? by * height : y;
+      int y1 = (by + 1) * height < y + h ? (by + 1) * height : y + h;
+      for (int row = y0; row < y1; row++) {
+        unsigned char *from =
+            block->data +
+            ((size_t)(row - by * height) * width + x0 - bx * width) * size;
+        unsigned char *to = (unsigned char *)out +
+                            (size_t)(row - y) * line_space +
+                            (size_t)(x0 - x) * pixel_space;
+        GDALCopyWords(from, stored, size, to, type, pixel_space, x1 - x0);
+      }
+      release_block(block);
+    }
+  }
+  free(key);
+  return ok;
+}
+
+// Set how many bytes of decoded blocks are kept, evicting the least recently
+// used ones until they fit. Blocks bigger than an eighth of the budget are
+// never kept.
+void simplet_blocks_set_budget(size_t bytes) {
+  pthread_mutex_lock(&blocks_lock);
+  budget = bytes;
+  if (blocks) simplet_lru_set_budget(blocks, budget);
+  pthread_mutex_unlock(&blocks_lock);
+}
+
+// Drop every cached block.
+void simplet_blocks_clear() {
+  pthread_mutex_lock(&blocks_lock);
+  if (blocks) simplet_lru_clear(blocks);
+  pthread_mutex_unlock(&blocks_lock);
+}
+
+// Return the number of cached blocks.
+unsigned int simplet_blocks_get_length() {
+  pthread_mutex_lock(&blocks_lock);
+  unsigned int length = blocks ? simplet_lru_get_length(blocks) : 0;
+  pthread_mutex_unlock(&blocks_lock);
+  return length;
+}
@@ -0,0 +1,44 @@
+#ifndef _SIMPLE_TILES_BLOCKS_H
+#define _SIMPLE_TILES_BLOCKS_H
+
+#include <gdal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* decoded raster blocks shared between tiles */
+
+// The default byte budget for the process wide block cache.
+#define SIMPLET_BLOCK_CACHE (256 << 20)
+
+// A block of one band as its format stores it, width by height pixels of
+// type. Blocks at the right and bottom edges are only partly filled.
+typedef struct {
+  SIMPLET_ERROR_FIELDS
+  SIMPLET_USER_DATA
+  SIMPLET_RETAIN
+  int width;
+  int height;
+  GDALDataType type;
+  unsigned char data[];
+} simplet_block_t;
+
+bool simplet_blocks_read(GDALRasterBandH band, const char *stamp, int level,
+                         int index, int x, int y, int w, int h, void *out,
+                         GDALDataType type, int pixel_space, int line_space);
+
+void simplet_blocks_set_budget(size_t budget);
+
+void simplet_blocks_clear();
+
+unsigned int simplet_blocks_get_length();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
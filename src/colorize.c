@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "colorize.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMPLET_X86
+#include <immintrin.h>
+#endif
+
+// Pack a straight alpha color as premultiplied ARGB.
+static uint32_t premultiply(double r, double g, double b, double a) {
+  unsigned int alpha = (unsigned int)(a + 0.5);
+  return alpha << 24 | (unsigned int)(r * a / 255 + 0.5) << 16 |
+         (unsigned int)(g * a / 255 + 0.5) << 8 |
+         (unsigned int)(b * a / 255 + 0.5);
+}
+
+// Build a lookup table from length stops sorted by value. A ramp blends
+// between neighbouring stops, classified stops color every value from
+// theirs up to the next stop's. Values past either end take the color of
+// the stop there. Returns NULL on failure.
+simplet_lut_t *simplet_lut_new(const simplet_color_stop_t *stops, int length,
+                               bool classified) {
+  if (length < 1) return NULL;
+
+  size_t size = sizeof(simplet_lut_t);
+  if (classified) size += length * sizeof(simplet_class_t);
+  simplet_lut_t *lut;
+  if (!(lut = malloc(size))) return NULL;
+  memset(lut, 0, size);
+
+  if (classified) {
+    lut->classes_length = length;
+    for (int i = 0; i < length; i++) {
+      lut->classes[i].edge = stops[i].value;
+      lut->classes[i].color =
+          premultiply(stops[i].r, stops[i].g, stops[i].b, stops[i].a);
+    }
+    return lut;
+  }
+
+  double low = stops[0].value, high = stops[length - 1].value;
+  double step = high > low ? (high - low) / (SIMPLET_LUT_BINS - 1) : 0;
+  lut->low = (float)low;
+  lut->scale = step > 0 ? (float)(1 / step) : 0;
+
+  int stop = 0;
+  for (int i = 0; i < SIMPLET_LUT_BINS; i++) {
+    double value = low + i * step;
+    while (stop + 1 < length && stops[stop + 1].value <= value) stop++;
+    const simplet_color_stop_t *from = &stops[stop], *to = from;
+    if (stop + 1 < length) to = &stops[stop + 1];
+
+    double t = to->value > from->value
+                   ? (value - from->value) / (to->value - from->value)
+                   : 0;
+    lut->colors[i] = premultiply(from->r + (to->r - from->r) * t,
+                                 from->g + (to->g - from->g) * t,
+                                 from->b + (to->b - from->b) * t,
+                                 from->a + (to->a - from->a) * t);
+  }
+  return lut;
+}
+
+// Find the last class whose edge is at or below value, values below the
+// first edge taking the first class.
+static uint32_t class_color(const simplet_lut_t *lut, float value) {
+  int low = 0, high = lut->classes_length - 1;
+  while (low < high) {
+    int mid = (low + high + 1) / 2;
+    if (lut->classes[mid].edge <= value)
+      low = mid;
+    else
+      high = mid - 1;
+  }
+  return lut->classes[low].color;
+}
+
+void simplet_colorize_scalar(const simplet_lut_t *lut, const float *values,
+                             int count, uint32_t *out) {
+  for (int i = 0; i < count; i++) {
+    float value = values[i];
+    if (value != value || (lut->has_no_data && value == lut->no_data)) {
+      out[i] = 0;
+      continue;
+    }
+    if (lut->classes_length) {
+      out[i] = class_color(lut, value);
+      continue;
+    }
+    float bin = (value - lut->low) * lut->scale + 0.5f;
+    out[i] = lut->colors[!(bin > 0) ? 0
+                         : bin >= SIMPLET_LUT_BINS - 1 ? SIMPLET_LUT_BINS - 1
+                                                       : (int)bin];
+  }
+}
+
+#ifdef SIMPLET_X86
+// Find eight bins at a time and gather their colors, classes are searched
+// one value at a time.
+__attribute__((target("avx2"))) static void colorize_avx2(
+    const simplet_lut_t *lut, const float *values, int count, uint32_t *out) {
+  if (lut->classes_length) {
+    simplet_colorize_scalar(lut, values, count, out);
+    return;
+  }
+  const __m256 low = _mm256_set1_ps(lut->low);
+  const __m256 scale = _mm256_set1_ps(lut->scale);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 top = _mm256_set1_ps(SIMPLET_LUT_BINS - 1);
+  const __m256 no_data = _mm256_set1_ps(lut->no_data);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 value = _mm256_loadu_ps(values + i);
+    __m256 bin = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_sub_ps(value, low), scale), half);
+    // max picks zero over a NaN bin
+    bin = _mm256_min_ps(_mm256_max_ps(bin, _mm256_setzero_ps()), top);
+    __m256i colors = _mm256_i32gather_epi32(
+        (const int *)lut->colors, _mm256_cvttps_epi32(bin), 4);
+
+    __m256 empty = _mm256_cmp_ps(value, value, _CMP_UNORD_Q);
+    if (lut->has_no_data)
+      empty = _mm256_or_ps(empty, _mm256_cmp_ps(value, no_data, _CMP_EQ_OQ));
+    colors = _mm256_andnot_si256(_mm256_castps_si256(empty), colors);
+    _mm256_storeu_si256((__m256i *)(out + i), colors);
+  }
+  simplet_colorize_scalar(lut, values + i, count - i, out + i);
+}
+#endif
+
+// Pick the fastest lookup this CPU supports.
+simplet_colorize_t simplet_colorize_best() {
+#ifdef SIMPLET_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return colorize_avx2;
+#endif
+  return simplet_colorize_scalar;
+}
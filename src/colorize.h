@@ -0,0 +1,55 @@
+#ifndef _SIMPLE_TILES_COLORIZE_H
+#define _SIMPLE_TILES_COLORIZE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* coloring single band values through lookup tables */
+
+// How many colors a lookup table samples between its first and last stop.
+#define SIMPLET_LUT_BINS 4096
+
+// A class colors every value from its edge up to the next class's edge.
+typedef struct {
+  double edge;
+  uint32_t color;
+} simplet_class_t;
+
+// Premultiplied ARGB colors for evenly spaced values starting at low, scale
+// being bins per unit. Classified tables skip the bins and search their
+// classes instead, so class edges stay exact for any range of values.
+// Values matching no_data come out transparent.
+typedef struct {
+  uint32_t colors[SIMPLET_LUT_BINS];
+  float low;
+  float scale;
+  bool has_no_data;
+  float no_data;
+  int classes_length;
+  simplet_class_t classes[];
+} simplet_lut_t;
+
+// Color count values, writing each as premultiplied ARGB to out, which may
+// be the same memory as values.
+typedef void (*simplet_colorize_t)(const simplet_lut_t *lut,
+                                   const float *values, int count,
+                                   uint32_t *out);
+
+simplet_lut_t *simplet_lut_new(const simplet_color_stop_t *stops, int length,
+                               bool classified);
+
+void simplet_colorize_scalar(const simplet_lut_t *lut, const float *values,
+                             int count, uint32_t *out);
+
+simplet_colorize_t simplet_colorize_best();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
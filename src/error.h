@@ -13,6 +13,14 @@ extern "C" {
     return simplet_error((simplet_errorable_t *)item, status, msg);     \
   }
 
+// Errors met while drawing belong to the map being drawn, the layers and
+// queries drawing it are shared between clones and threads.
+#define SIMPLET_MAP_ERROR_FUNC                                         \
+  static simplet_status_t map_error(                                   \
+      simplet_map_t *map, simplet_status_t status, const char *msg) { \
+    return simplet_error((simplet_errorable_t *)map, status, msg);    \
+  }
+
 simplet_status_t simplet_error(simplet_errorable_t *errr, simplet_status_t err,
                                const char *msg);
 
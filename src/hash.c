@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "hash.h"
+
+// BLAKE2s as in RFC 7693, unkeyed with a 32 byte digest.
+
+static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                               0xa54ff53a, 0x510e527f, 0x9b05688c,
+                               0x1f83d9ab, 0x5be0cd19};
+
+static const uint8_t sigma[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+static uint32_t rotate(uint32_t value, int bits) {
+  return value >> bits | value << (32 - bits);
+}
+
+static uint32_t load(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+         (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+#define MIX(a, b, c, d, x, y)        \
+  do {                               \
+    v[a] = v[a] + v[b] + (x);        \
+    v[d] = rotate(v[d] ^ v[a], 16);  \
+    v[c] = v[c] + v[d];              \
+    v[b] = rotate(v[b] ^ v[c], 12);  \
+    v[a] = v[a] + v[b] + (y);        \
+    v[d] = rotate(v[d] ^ v[a], 8);   \
+    v[c] = v[c] + v[d];              \
+    v[b] = rotate(v[b] ^ v[c], 7);   \
+  } while (0)
+
+// Mix a 64 byte block into the state, last marks the final one.
+static void compress(simplet_hash_t *hash, const uint8_t *block, int last) {
+  uint32_t m[16], v[16];
+  for (int i = 0; i < 16; i++) m[i] = load(block + i * 4);
+  for (int i = 0; i < 8; i++) {
+    v[i] = hash->h[i];
+    v[i + 8] = iv[i];
+  }
+  v[12] ^= hash->t[0];
+  v[13] ^= hash->t[1];
+  if (last) v[14] = ~v[14];
+
+  for (int round = 0; round < 10; round++) {
+    const uint8_t *s = sigma[round];
+    MIX(0, 4, 8, 12, m[s[0]], m[s[1]]);
+    MIX(1, 5, 9, 13, m[s[2]], m[s[3]]);
+    MIX(2, 6, 10, 14, m[s[4]], m[s[5]]);
+    MIX(3, 7, 11, 15, m[s[6]], m[s[7]]);
+    MIX(0, 5, 10, 15, m[s[8]], m[s[9]]);
+    MIX(1, 6, 11, 12, m[s[10]], m[s[11]]);
+    MIX(2, 7, 8, 13, m[s[12]], m[s[13]]);
+    MIX(3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+
+  for (int i = 0; i < 8; i++) hash->h[i] ^= v[i] ^ v[i + 8];
+}
+
+// Count length more bytes hashed.
+static void count(simplet_hash_t *hash, size_t length) {
+  hash->t[0] += (uint32_t)length;
+  if (hash->t[0] < length) hash->t[1]++;
+}
+
+void simplet_hash_init(simplet_hash_t *hash) {
+  memset(hash, 0, sizeof(*hash));
+  memcpy(hash->h, iv, sizeof(iv));
+  hash->h[0] ^= 0x01010000 ^ SIMPLET_HASH_LENGTH;
+}
+
+// Add length bytes of data. The last block is held back until the digest
+// is taken, since it's compressed differently.
+void simplet_hash_update(simplet_hash_t *hash, const void *data,
+                         size_t length) {
+  const uint8_t *bytes = data;
+  while (length > 0) {
+    if (hash->buffered == sizeof(hash->buffer)) {
+      count(hash, sizeof(hash->buffer));
+      compress(hash, hash->buffer, 0);
+      hash->buffered = 0;
+    }
+    size_t take = sizeof(hash->buffer) - hash->buffered;
+    if (take > length) take = length;
+    memcpy(hash->buffer + hash->buffered, bytes, take);
+    hash->buffered += take;
+    bytes += take;
+    length -= take;
+  }
+}
+
+// Store the digest of everything added in out.
+void simplet_hash_final(simplet_hash_t *hash,
+                        uint8_t out[SIMPLET_HASH_LENGTH]) {
+  count(hash, hash->buffered);
+  memset(hash->buffer + hash->buffered, 0,
+         sizeof(hash->buffer) - hash->buffered);
+  compress(hash, hash->buffer, 1);
+  for (int i = 0; i < SIMPLET_HASH_LENGTH; i++)
+    out[i] = hash->h[i / 4] >> (i % 4 * 8);
+}
@@ -0,0 +1,35 @@
+#ifndef _SIMPLE_TILES_HASH_H
+#define _SIMPLE_TILES_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* BLAKE2s digests */
+
+// Bytes in a digest.
+#define SIMPLET_HASH_LENGTH 32
+
+typedef struct {
+  uint32_t h[8];
+  uint32_t t[2];
+  uint8_t buffer[64];
+  size_t buffered;
+} simplet_hash_t;
+
+void simplet_hash_init(simplet_hash_t *hash);
+
+void simplet_hash_update(simplet_hash_t *hash, const void *data,
+                         size_t length);
+
+void simplet_hash_final(simplet_hash_t *hash,
+                        uint8_t out[SIMPLET_HASH_LENGTH]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
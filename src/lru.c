@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lru.h"
+
+// Number of hash buckets a new cache starts with.
+#define SIMPLET_LRU_BUCKETS 64
+
+// FNV-1a over the key bytes.
+static unsigned int hash_key(const void *key, size_t key_length) {
+  const unsigned char *bytes = key;
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < key_length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Create a new cache that evicts its least recently used values once the
+// total cost of its values passes budget. Returns NULL on failure.
+simplet_lru_t *simplet_lru_new(size_t budget, simplet_user_data_free free) {
+  simplet_lru_t *lru;
+  if (!(lru = malloc(sizeof(*lru)))) return NULL;
+
+  memset(lru, 0, sizeof(*lru));
+
+  if (!(lru->buckets = calloc(SIMPLET_LRU_BUCKETS, sizeof(*lru->buckets)))) {
+    free(lru);
+    return NULL;
+  }
+
+  lru->buckets_length = SIMPLET_LRU_BUCKETS;
+  lru->budget = budget;
+  lru->free = free;
+  return lru;
+}
+
+// Unlink an entry from the recency list.
+static void unlink_entry(simplet_lru_t *lru, simplet_lru_entry_t *entry) {
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    lru->newest = entry->older;
+
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    lru->oldest = entry->newer;
+
+  entry->newer = entry->older = NULL;
+}
+
+// Link an entry in as the most recently used.
+static void link_entry(simplet_lru_t *lru, simplet_lru_entry_t *entry) {
+  entry->older = lru->newest;
+  entry->newer = NULL;
+  if (lru->newest) lru->newest->newer = entry;
+  lru->newest = entry;
+  if (!lru->oldest) lru->oldest = entry;
+}
+
+// Remove an entry from the cache entirely and free its value.
+static void remove_entry(simplet_lru_t *lru, simplet_lru_entry_t *entry) {
+  simplet_lru_entry_t **slot =
+      &lru->buckets[entry->hash % lru->buckets_length];
+  while (*slot != entry) slot = &(*slot)->chain;
+  *slot = entry->chain;
+
+  unlink_entry(lru, entry);
+  lru->cost -= entry->cost;
+  lru->length--;
+  if (lru->free) lru->free(entry->value);
+  free(entry);
+}
+
+// Find the entry stored under key, or NULL.
+static simplet_lru_entry_t *find(simplet_lru_t *lru, const void *key,
+                                 size_t key_length, unsigned int hash) {
+  simplet_lru_entry_t *entry = lru->buckets[hash % lru->buckets_length];
+  for (; entry; entry = entry->chain)
+    if (entry->hash == hash && entry->key_length == key_length &&
+        !memcmp(entry->key, key, key_length))
+      return entry;
+  return NULL;
+}
+
+// Double the bucket count once chains start getting long.
+static void grow(simplet_lru_t *lru) {
+  unsigned int length = lru->buckets_length * 2;
+  simplet_lru_entry_t **buckets;
+  if (!(buckets = calloc(length, sizeof(*buckets)))) return;
+
+  for (unsigned int i = 0; i < lru->buckets_length; i++) {
+    simplet_lru_entry_t *entry = lru->buckets[i];
+    while (entry) {
+      simplet_lru_entry_t *chain = entry->chain;
+      entry->chain = buckets[entry->hash % length];
+      buckets[entry->hash % length] = entry;
+      entry = chain;
+    }
+  }
+
+  free(lru->buckets);
+  lru->buckets = buckets;
+  lru->buckets_length = length;
+}
+
+// Return the value stored under key and mark it as recently used, or NULL if
+// there isn't one.
+void *simplet_lru_get(simplet_lru_t *lru, const void *key, size_t key_length) {
+  simplet_lru_entry_t *entry =
+      find(lru, key, key_length, hash_key(key, key_length));
+  if (!entry) return NULL;
+
+  unlink_entry(lru, entry);
+  link_entry(lru, entry);
+  return entry->value;
+}
+
+// Store value under key, replacing and freeing any previous value, then
+// evict the least recently used values until the cache is back under budget.
+// The new value is never evicted by its own insertion. Returns value, or NULL
+// if the entry couldn't be allocated, in which case value is not owned by the
+// cache.
+void *simplet_lru_set(simplet_lru_t *lru, const void *key, size_t key_length,
+                      void *value, size_t cost) {
+  unsigned int hash = hash_key(key, key_length);
+  simplet_lru_entry_t *entry;
+  if ((entry = find(lru, key, key_length, hash))) remove_entry(lru, entry);
+
+  if (!(entry = malloc(sizeof(*entry) + key_length))) return NULL;
+
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->key, key, key_length);
+  entry->key_length = key_length;
+  entry->hash = hash;
+  entry->value = value;
+  entry->cost = cost;
+
+  if (lru->length >= lru->buckets_length * 2) grow(lru);
+
+  simplet_lru_entry_t **slot = &lru->buckets[hash % lru->buckets_length];
+  entry->chain = *slot;
+  *slot = entry;
+  link_entry(lru, entry);
+  lru->cost += cost;
+  lru->length++;
+
+  while (lru->cost > lru->budget && lru->oldest != entry)
+    remove_entry(lru, lru->oldest);
+
+  return value;
+}
+
+// Remove and free the value stored under key, if there is one.
+void simplet_lru_remove(simplet_lru_t *lru, const void *key,
+                        size_t key_length) {
+  simplet_lru_entry_t *entry;
+  if ((entry = find(lru, key, key_length, hash_key(key, key_length))))
+    remove_entry(lru, entry);
+}
+
+// Change the cache's budget, evicting the least recently used values until
+// it fits.
+void simplet_lru_set_budget(simplet_lru_t *lru, size_t budget) {
+  lru->budget = budget;
+  while (lru->cost > lru->budget && lru->oldest)
+    remove_entry(lru, lru->oldest);
+}
+
+// Remove and free every value in the cache.
+void simplet_lru_clear(simplet_lru_t *lru) {
+  while (lru->oldest) remove_entry(lru, lru->oldest);
+}
+
+// Return the number of values in the cache.
+unsigned int simplet_lru_get_length(simplet_lru_t *lru) { return lru->length; }
+
+// Free the cache and every value in it.
+void simplet_lru_free(simplet_lru_t *lru) {
+  simplet_lru_clear(lru);
+  free(lru->buckets);
+  free(lru);
+}
@@ -0,0 +1,56 @@
+#ifndef _SIMPLE_TILES_LRU_H
+#define _SIMPLE_TILES_LRU_H
+
+#include <stddef.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* least recently used caches */
+typedef struct simplet_lru_entry_t {
+  struct simplet_lru_entry_t *chain;  // next entry in the hash bucket
+  struct simplet_lru_entry_t *newer;
+  struct simplet_lru_entry_t *older;
+  unsigned int hash;
+  size_t key_length;
+  size_t cost;
+  void *value;
+  unsigned char key[];
+} simplet_lru_entry_t;
+
+typedef struct {
+  simplet_lru_entry_t **buckets;
+  simplet_lru_entry_t *newest;
+  simplet_lru_entry_t *oldest;
+  SIMPLET_FREEFUNC
+  unsigned int buckets_length;
+  unsigned int length;
+  size_t cost;
+  size_t budget;
+} simplet_lru_t;
+
+simplet_lru_t *simplet_lru_new(size_t budget, simplet_user_data_free free);
+
+void simplet_lru_free(simplet_lru_t *lru);
+
+void *simplet_lru_get(simplet_lru_t *lru, const void *key, size_t key_length);
+
+void *simplet_lru_set(simplet_lru_t *lru, const void *key, size_t key_length,
+                      void *value, size_t cost);
+
+void simplet_lru_remove(simplet_lru_t *lru, const void *key,
+                        size_t key_length);
+
+void simplet_lru_set_budget(simplet_lru_t *lru, size_t budget);
+
+void simplet_lru_clear(simplet_lru_t *lru);
+
+unsigned int simplet_lru_get_length(simplet_lru_t *lru);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "init.h"
 #include "error.h"
@@ -13,6 +14,13 @@
 #include "bounds.h"
 #include "text.h"
 #include "memory.h"
+#include "pyramid.h"
+#include "tile_cache.h"
+#include "bandmath.h"
+#include "mosaic.h"
+#include "hash.h"
+#include "tile_id.h"
+#include "pool.h"
 
 // Output size of a slippy tile.
 #define SIMPLET_SLIPPY_SIZE 256
@@ -68,6 +76,49 @@ void simplet_map_free(simplet_map_t *map) {
   free(map);
 }
 
+// Create a map drawing the same layers as map with its own bounds, size,
+// projection, background, buffer and error, ready to be set to other views
+// on another thread. The layers, and their queries and styles, are retained
+// rather than copied, so changes to them show up in every clone. Returns
+// NULL on failure.
+simplet_map_t *simplet_map_clone(simplet_map_t *map) {
+  simplet_map_t *clone;
+  if (!(clone = simplet_map_new())) return NULL;
+
+  clone->bounds->nw = map->bounds->nw;
+  clone->bounds->se = map->bounds->se;
+  clone->bounds->width = map->bounds->width;
+  clone->bounds->height = map->bounds->height;
+  clone->width = map->width;
+  clone->height = map->height;
+  clone->buffer = map->buffer;
+  clone->status = map->status;
+
+  simplet_listiter_t *iter;
+  bool ok = (!map->proj || (clone->proj = OSRClone(map->proj))) &&
+            (!map->bgcolor ||
+             (clone->bgcolor = simplet_copy_string(map->bgcolor))) &&
+            (!map->error_msg ||
+             (clone->error_msg = simplet_copy_string(map->error_msg))) &&
+            (iter = simplet_get_list_iter(map->layers));
+
+  simplet_layer_t *layer;
+  while (ok && (layer = simplet_list_next(iter))) {
+    simplet_retain((simplet_retainable_t *)layer);
+    if (!simplet_list_push(clone->layers, layer)) {
+      simplet_list_iter_free(iter);
+      simplet_release((simplet_retainable_t *)layer);
+      ok = false;
+    }
+  }
+
+  if (!ok) {
+    simplet_map_free(clone);
+    return NULL;
+  }
+  return clone;
+}
+
 // Add error reporting to simplet_map_t. Macro defined in <b>error.h</b>
 SIMPLET_ERROR_FUNC(map_t)
 
@@ -172,16 +223,9 @@ simplet_status_t simplet_map_set_bounds(simplet_map_t *map, double maxx,
   return SIMPLET_OK;
 }
 
-// Sets the bounds and correct size for a map tile, uses
-// [tile
-// coordinates](http://code.google.com/apis/maps/documentation/javascript/maptypes.html#CustomMapTypes)
-simplet_status_t simplet_map_set_slippy(simplet_map_t *map, unsigned int x,
+// Set the bounds of a map already in mercator to tile x, y, z.
+static simplet_status_t set_tile_bounds(simplet_map_t *map, unsigned int x,
                                         unsigned int y, unsigned int z) {
-  simplet_map_set_size(map, SIMPLET_SLIPPY_SIZE, SIMPLET_SLIPPY_SIZE);
-
-  if (!(simplet_map_set_srs(map, SIMPLET_MERCATOR) == SIMPLET_OK))
-    return set_error(map, SIMPLET_OGR_ERR, "couldn't set slippy projection");
-
   double zfactor, length, origin;
   zfactor = pow(2.0, z);
   length = SIMPLET_MERC_LENGTH / zfactor;
@@ -196,6 +240,19 @@ simplet_status_t simplet_map_set_slippy(simplet_map_t *map, unsigned int x,
   return SIMPLET_OK;
 }
 
+// Sets the bounds and correct size for a map tile, uses
+// [tile
+// coordinates](http://code.google.com/apis/maps/documentation/javascript/maptypes.html#CustomMapTypes)
+simplet_status_t simplet_map_set_slippy(simplet_map_t *map, unsigned int x,
+                                        unsigned int y, unsigned int z) {
+  simplet_map_set_size(map, SIMPLET_SLIPPY_SIZE, SIMPLET_SLIPPY_SIZE);
+
+  if (!(simplet_map_set_srs(map, SIMPLET_MERCATOR) == SIMPLET_OK))
+    return set_error(map, SIMPLET_OGR_ERR, "couldn't set slippy projection");
+
+  return set_tile_bounds(map, x, y, z);
+}
+
 static void *add_layer(simplet_map_t *map, simplet_layer_t *layer) {
   if (!simplet_list_push(map->layers, layer)) {
     simplet_layer_vfree((void *)layer);
@@ -229,6 +286,18 @@ simplet_raster_layer_t *simplet_map_add_raster_layer(simplet_map_t *map,
   return add_layer(map, (simplet_layer_t *)layer);
 }
 
+// Add a raster layer drawing a mosaic of the rasters in a directory or list.
+simplet_raster_layer_t *simplet_map_add_mosaic_layer(simplet_map_t *map,
+                                                     const char *datastring) {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new_mosaic(datastring))) {
+    set_error(map, SIMPLET_OOM, "couldn't create a mosaic layer");
+    return NULL;
+  }
+
+  return add_layer(map, (simplet_layer_t *)layer);
+}
+
 // Add a previously initialized layer to the map.
 simplet_layer_t *simplet_map_add_layer_directly(simplet_map_t *map,
                                                 simplet_layer_t *layer) {
@@ -270,17 +339,9 @@ simplet_status_t simplet_map_is_valid(simplet_map_t *map) {
   return SIMPLET_OK;
 }
 
-// Build a rendering context to draw the map on.
-cairo_surface_t *simplet_map_build_surface(simplet_map_t *map) {
-  // Check if the map is valid.
-  if (simplet_map_is_valid(map) == SIMPLET_ERR) return NULL;
-
-  // Create a cairo surface to draw on.
-  cairo_surface_t *surface =
-      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, map->width, map->height);
-
-  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) return NULL;
-
+// Draw the map's background and layers on surface, setting the map's error
+// when a layer fails.
+static void draw_layers(simplet_map_t *map, cairo_surface_t *surface) {
   cairo_t *ctx = cairo_create(surface);
 
   // Paint the background color.
@@ -308,9 +369,9 @@ cairo_surface_t *simplet_map_build_surface(simplet_map_t *map) {
                                          ctx);
     }
 
+    // the layer left its error on the map, layers are shared by clones
     if (err != SIMPLET_OK) {
       simplet_list_iter_free(iter);
-      set_error(map, layer->status, layer->error_msg);
       break;
     }
   }
@@ -318,6 +379,49 @@ cairo_surface_t *simplet_map_build_surface(simplet_map_t *map) {
   simplet_lithograph_free(litho);
   cairo_destroy(ctx);
   cairo_destroy(litho_ctx);
+}
+
+// Count what drawing the map would read within its bounds and buffer into
+// count: the features of every query and the rasters under it. A map that
+// counts none draws just its background. Sets the map's error on failure.
+simplet_status_t simplet_map_count_features(simplet_map_t *map,
+                                            uint64_t *count) {
+  *count = 0;
+  if (simplet_map_is_valid(map) == SIMPLET_ERR) return SIMPLET_ERR;
+
+  simplet_listiter_t *iter;
+  if (!(iter = simplet_get_list_iter(map->layers)))
+    return set_error(map, SIMPLET_OOM, "out of memory getting list iterator");
+
+  simplet_status_t status = SIMPLET_OK;
+  simplet_layer_t *layer;
+  while ((layer = simplet_list_next(iter))) {
+    if (layer->type == SIMPLET_VECTOR)
+      status = simplet_vector_layer_count((simplet_vector_layer_t *)layer,
+                                          map, count);
+    else if (layer->type == SIMPLET_RASTER)
+      status = simplet_raster_layer_count((simplet_raster_layer_t *)layer,
+                                          map, count);
+    if (status != SIMPLET_OK) {
+      simplet_list_iter_free(iter);
+      break;
+    }
+  }
+  return status;
+}
+
+// Build a rendering context to draw the map on.
+cairo_surface_t *simplet_map_build_surface(simplet_map_t *map) {
+  // Check if the map is valid.
+  if (simplet_map_is_valid(map) == SIMPLET_ERR) return NULL;
+
+  // Create a cairo surface to draw on.
+  cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, map->width, map->height);
+
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) return NULL;
+
+  draw_layers(map, surface);
   return surface;
 }
 
@@ -353,3 +457,551 @@ void simplet_map_render_to_png(simplet_map_t *map, const char *path) {
 
   close_surface(surface);
 }
+
+// Write a string with its length so no value can run into the next.
+static void describe_string(FILE *stream, const char *name, const char *str) {
+  if (str)
+    fprintf(stream, "%s %zu:%s\n", name, strlen(str), str);
+  else
+    fprintf(stream, "%s -\n", name);
+}
+
+// Returns false on failure.
+static bool describe_raster(FILE *stream, simplet_raster_layer_t *layer) {
+  fprintf(stream, "resample %d max_error %.17g classified %d\n",
+          layer->resample, layer->max_error, layer->classified);
+  for (int i = 0; i < layer->stops_length; i++) {
+    simplet_color_stop_t *stop = &layer->stops[i];
+    fprintf(stream, "stop %.17g %u %u %u %u\n", stop->value, stop->r,
+            stop->g, stop->b, stop->a);
+  }
+  if (layer->expr)
+    for (int i = 0; i < layer->expr->length; i++) {
+      simplet_op_t *op = &layer->expr->ops[i];
+      fprintf(stream, "op %d %d %.9g\n", op->code, op->band, op->value);
+    }
+  fprintf(stream, "hillshade %.17g %.17g %.17g\n", layer->azimuth,
+          layer->altitude, layer->z_factor);
+
+  // A mosaic draws the scenes it listed when it was loaded, so load it now
+  // rather than have the fingerprint change after the first render. Those
+  // scenes are stamped afresh since they're reopened on every render.
+  if (!layer->mosaic) return true;
+  if (!simplet_mosaic_load(layer->mosaic)) {
+    fprintf(stream, "mosaic -\n");
+    return true;
+  }
+  bool ok = true;
+  pthread_mutex_lock(&layer->mosaic->lock);
+  for (int i = 0; ok && i < layer->mosaic->length; i++) {
+    char *stamp;
+    if (!(stamp = simplet_source_stamp(layer->mosaic->scenes[i].path))) {
+      ok = false;
+      break;
+    }
+    describe_string(stream, "scene", stamp);
+    free(stamp);
+  }
+  pthread_mutex_unlock(&layer->mosaic->lock);
+  return ok;
+}
+
+static void describe_vector(FILE *stream, simplet_vector_layer_t *layer) {
+  simplet_listiter_t *queries = simplet_get_list_iter(layer->queries);
+  simplet_query_t *query;
+  while ((query = simplet_list_next(queries))) {
+    describe_string(stream, "query", query->ogrsql);
+    simplet_listiter_t *styles = simplet_get_list_iter(query->styles);
+    simplet_style_t *style;
+    while ((style = simplet_list_next(styles))) {
+      describe_string(stream, "style", style->key);
+      describe_string(stream, "arg", style->arg);
+    }
+  }
+}
+
+// Hash everything that changes how the map draws, so maps with the same
+// fingerprint draw the same images. Sources are stamped with their size and
+// modification time. Slippy tiles set their own projection, size and
+// bounds, so those are left out unless view is set. Returns false on
+// failure.
+static bool fingerprint(simplet_map_t *map, bool view,
+                        uint8_t out[SIMPLET_HASH_LENGTH]) {
+  char *description = NULL;
+  size_t length;
+  FILE *stream;
+  if (!(stream = open_memstream(&description, &length))) return false;
+
+  if (view) {
+    char *wkt = NULL;
+    if (map->proj) OSRExportToWkt(map->proj, &wkt);
+    describe_string(stream, "srs", wkt);
+    free(wkt);
+    if (map->bounds)
+      fprintf(stream, "bounds %.17g %.17g %.17g %.17g\n", map->bounds->nw.x,
+              map->bounds->nw.y, map->bounds->se.x, map->bounds->se.y);
+    fprintf(stream, "size %u %u\n", map->width, map->height);
+  }
+  fprintf(stream, "buffer %.17g\n", map->buffer);
+  describe_string(stream, "bgcolor", map->bgcolor);
+
+  bool ok = true;
+  simplet_listiter_t *iter = simplet_get_list_iter(map->layers);
+  simplet_layer_t *layer;
+  while ((layer = simplet_list_next(iter))) {
+    char *stamp;
+    if (!(stamp = simplet_source_stamp(layer->source))) {
+      simplet_list_iter_free(iter);
+      ok = false;
+      break;
+    }
+    fprintf(stream, "layer %d\n", layer->type);
+    describe_string(stream, "source", stamp);
+    free(stamp);
+
+    if (layer->type == SIMPLET_VECTOR)
+      describe_vector(stream, (simplet_vector_layer_t *)layer);
+    else if (layer->type == SIMPLET_RASTER &&
+             !describe_raster(stream, (simplet_raster_layer_t *)layer)) {
+      simplet_list_iter_free(iter);
+      ok = false;
+      break;
+    }
+  }
+
+  ok = !ferror(stream) && ok;
+  if (fclose(stream) || !ok) {
+    free(description);
+    return false;
+  }
+
+  simplet_hash_t hash;
+  simplet_hash_init(&hash);
+  simplet_hash_update(&hash, description, length);
+  simplet_hash_final(&hash, out);
+  free(description);
+  return true;
+}
+
+// Store a 256 bit hash of everything that changes the map's output in out:
+// its projection, bounds, size, buffer and background, and each layer's
+// source, queries, styles and raster settings, in order. Sources are
+// stamped with their size and modification time, so the fingerprint
+// changes when they're edited. Mosaics are loaded to stamp their scenes.
+simplet_status_t simplet_map_fingerprint(simplet_map_t *map,
+                                         uint8_t out[SIMPLET_HASH_LENGTH]) {
+  if (!fingerprint(map, true, out))
+    return set_error(map, SIMPLET_OOM, "couldn't fingerprint map");
+  return SIMPLET_OK;
+}
+
+// Grows as cairo writes a png to it.
+typedef struct {
+  unsigned char *data;
+  size_t length;
+  size_t capacity;
+} png_buffer_t;
+
+static cairo_status_t write_png_buffer(void *closure,
+                                       const unsigned char *data,
+                                       unsigned int length) {
+  png_buffer_t *buffer = closure;
+  if (buffer->length + length > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 16384;
+    while (capacity < buffer->length + length) capacity *= 2;
+    unsigned char *grown;
+    if (!(grown = realloc(buffer->data, capacity)))
+      return CAIRO_STATUS_NO_MEMORY;
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+// Digest the pixels of an image surface along with its size.
+static void hash_pixels(cairo_surface_t *surface,
+                        uint8_t out[SIMPLET_HASH_LENGTH]) {
+  cairo_surface_flush(surface);
+  int size[2] = {cairo_image_surface_get_width(surface),
+                 cairo_image_surface_get_height(surface)};
+  int stride = cairo_image_surface_get_stride(surface);
+  const unsigned char *data = cairo_image_surface_get_data(surface);
+
+  simplet_hash_t hash;
+  simplet_hash_init(&hash);
+  simplet_hash_update(&hash, size, sizeof(size));
+  for (int y = 0; data && y < size[1]; y++)
+    simplet_hash_update(&hash, data + y * stride, size[0] * 4);
+  simplet_hash_final(&hash, out);
+}
+
+// Emit slippy tile x, y, z as a png stream to closure like
+// simplet_map_render_to_stream, taking it from cache when the cache holds it
+// for a map with the same fingerprint, less its view. Tiles that have to be
+// drawn set the map to the tile and are added to the cache, skipping the
+// encode when the same pixels were drawn before.
+void simplet_map_render_cached(
+    simplet_map_t *map, simplet_tile_cache_t *cache, unsigned int x,
+    unsigned int y, unsigned int z, void *stream,
+    cairo_status_t (*cb)(void *closure, const unsigned char *data,
+                         unsigned int length)) {
+  uint8_t key[SIMPLET_HASH_LENGTH];
+  if (!fingerprint(map, false, key)) {
+    set_error(map, SIMPLET_OOM, "couldn't fingerprint map");
+    return;
+  }
+
+  png_buffer_t png = {NULL, 0, 0};
+  if ((png.data = simplet_tile_cache_get(cache, key, sizeof(key), x, y, z,
+                                         &png.length))) {
+    if (cb(stream, png.data, png.length) != CAIRO_STATUS_SUCCESS)
+      set_error(map, SIMPLET_CAIRO_ERR, "couldn't write cached tile");
+    free(png.data);
+    return;
+  }
+
+  cairo_surface_t *surface;
+  if (simplet_map_set_slippy(map, x, y, z) != SIMPLET_OK ||
+      !(surface = simplet_map_build_surface(map)))
+    return;
+
+  // Tiles missing a layer aren't cached.
+  if (map->status != SIMPLET_OK) {
+    close_surface(surface);
+    return;
+  }
+
+  // Pixels that have been drawn before, solid water or empty land, reuse
+  // their earlier encoding.
+  uint8_t pixels[SIMPLET_HASH_LENGTH];
+  hash_pixels(surface, pixels);
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  if (!(png.data = simplet_tile_cache_get_duplicate(cache, pixels,
+                                                    &png.length))) {
+    status =
+        cairo_surface_write_to_png_stream(surface, write_png_buffer, &png);
+    if (status == CAIRO_STATUS_SUCCESS)
+      simplet_tile_cache_set_duplicate(cache, pixels, png.data, png.length);
+  }
+  close_surface(surface);
+  if (status != CAIRO_STATUS_SUCCESS) {
+    set_error(map, SIMPLET_CAIRO_ERR, cairo_status_to_string(status));
+  } else {
+    simplet_tile_cache_set(cache, key, sizeof(key), x, y, z, png.data,
+                           png.length);
+    if (cb(stream, png.data, png.length) != CAIRO_STATUS_SUCCESS)
+      set_error(map, SIMPLET_CAIRO_ERR, "couldn't write tile");
+  }
+  free(png.data);
+}
+
+// How to build a pyramid, handed down the traversal.
+typedef struct {
+  simplet_map_t *map;
+  unsigned int max_zoom;
+  simplet_kern_t kern;
+  simplet_downsample_t box;
+  void *closure;
+  simplet_tile_func cb;
+} pyramid_t;
+
+static cairo_surface_t *build_pyramid(pyramid_t *pyramid, unsigned int x,
+                                      unsigned int y, unsigned int z);
+
+// Shrink the four children of tile x, y, z into it. Only the children of the
+// tiles on the path down are alive at once.
+static cairo_surface_t *shrink_children(pyramid_t *pyramid, unsigned int x,
+                                        unsigned int y, unsigned int z) {
+  cairo_surface_t *children[4] = {NULL, NULL, NULL, NULL}, *tile = NULL;
+  for (int i = 0; i < 4; i++)
+    if (!(children[i] =
+              build_pyramid(pyramid, x * 2 + i % 2, y * 2 + i / 2, z + 1)))
+      goto cleanup;
+
+  int size = cairo_image_surface_get_width(children[0]);
+  tile = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+  if (cairo_surface_status(tile) != CAIRO_STATUS_SUCCESS) {
+    set_error(pyramid->map, SIMPLET_CAIRO_ERR,
+              cairo_status_to_string(cairo_surface_status(tile)));
+    cairo_surface_destroy(tile);
+    tile = NULL;
+    goto cleanup;
+  }
+
+  int stride = cairo_image_surface_get_stride(tile) / 4, half = size / 2;
+  uint32_t *out = (uint32_t *)cairo_image_surface_get_data(tile);
+  for (int i = 0; i < 4; i++) cairo_surface_flush(children[i]);
+
+  if (pyramid->kern == SIMPLET_LANCZOS) {
+    // The filter reaches across the seams, so it runs over the children
+    // laid out side by side.
+    uint32_t *mosaic;
+    if (!(mosaic = malloc((size_t)size * size * 4 * sizeof(*mosaic)))) {
+      set_error(pyramid->map, SIMPLET_OOM, "out of memory shrinking tiles");
+      cairo_surface_destroy(tile);
+      tile = NULL;
+      goto cleanup;
+    }
+    for (int i = 0; i < 4; i++) {
+      unsigned char *data = cairo_image_surface_get_data(children[i]);
+      int child_stride = cairo_image_surface_get_stride(children[i]);
+      for (int row = 0; row < size; row++)
+        memcpy(mosaic + ((size_t)(i / 2 * size + row) * 2 + i % 2) * size,
+               data + (size_t)row * child_stride, size * sizeof(*mosaic));
+    }
+    bool ok = simplet_downsample_lanczos(mosaic, size * 2, out, stride, size,
+                                         size);
+    free(mosaic);
+    if (!ok) {
+      set_error(pyramid->map, SIMPLET_OOM, "out of memory shrinking tiles");
+      cairo_surface_destroy(tile);
+      tile = NULL;
+      goto cleanup;
+    }
+  } else {
+    for (int i = 0; i < 4; i++)
+      pyramid->box(
+          (const uint32_t *)cairo_image_surface_get_data(children[i]),
+          cairo_image_surface_get_stride(children[i]) / 4,
+          out + (size_t)(i / 2) * half * stride + (i % 2) * half, stride,
+          half, half);
+  }
+  cairo_surface_mark_dirty(tile);
+
+cleanup:
+  for (int i = 0; i < 4; i++)
+    if (children[i]) cairo_surface_destroy(children[i]);
+  return tile;
+}
+
+// Build tile x, y, z, rendering it from the layers at the max zoom and from
+// its children above, and hand it to the callback. Returns the tile for its
+// parent or NULL on failure.
+static cairo_surface_t *build_pyramid(pyramid_t *pyramid, unsigned int x,
+                                      unsigned int y, unsigned int z) {
+  simplet_map_t *map = pyramid->map;
+  cairo_surface_t *tile;
+  if (z < pyramid->max_zoom) {
+    if (!(tile = shrink_children(pyramid, x, y, z))) return NULL;
+  } else {
+    if (simplet_map_set_slippy(map, x, y, z) != SIMPLET_OK) return NULL;
+    if (!(tile = simplet_map_build_surface(map))) {
+      if (map->status == SIMPLET_OK)
+        set_error(map, SIMPLET_ERR, "map isn't valid for rendering");
+      return NULL;
+    }
+    if (map->status != SIMPLET_OK) {
+      cairo_surface_destroy(tile);
+      return NULL;
+    }
+  }
+
+  if (pyramid->cb(pyramid->closure, x, y, z, tile) != SIMPLET_OK) {
+    if (map->status == SIMPLET_OK)
+      set_error(map, SIMPLET_ERR, "pyramid stopped by callback");
+    cairo_surface_destroy(tile);
+    return NULL;
+  }
+  return tile;
+}
+
+// Render slippy tile x, y, z and every tile under it down to max_zoom,
+// calling cb with closure for each, children before their parents. Only the
+// max zoom is drawn from the layers, each tile above it is shrunk from its
+// four children, with lanczos when kern is SIMPLET_LANCZOS and by averaging
+// each 2x2 block otherwise. Leaves the map set to the last tile drawn.
+simplet_status_t simplet_map_render_pyramid(simplet_map_t *map, unsigned int x,
+                                            unsigned int y, unsigned int z,
+                                            unsigned int max_zoom,
+                                            simplet_kern_t kern, void *closure,
+                                            simplet_tile_func cb) {
+  if (max_zoom < z)
+    return set_error(map, SIMPLET_ERR, "max zoom is above the tile");
+
+  pyramid_t pyramid = {map, max_zoom, kern, simplet_downsample_best(),
+                       closure, cb};
+  cairo_surface_t *tile;
+  if (!(tile = build_pyramid(&pyramid, x, y, z))) return map->status;
+
+  cairo_surface_destroy(tile);
+  return SIMPLET_OK;
+}
+
+// A tile of a batch by its place along the Hilbert curve.
+typedef struct {
+  uint64_t hilbert;
+  size_t index;
+} batch_tile_t;
+
+// A batch of tiles shared between workers, each drawing on its own clone of
+// the map.
+typedef struct {
+  simplet_map_t *map;
+  simplet_map_t **clones;
+  const simplet_tile_id_t *ids;
+  batch_tile_t *order;
+  simplet_pool_ranges_t *ranges;
+  void *closure;
+  simplet_png_func cb;
+  bool stopped;
+  pthread_mutex_t lock;
+} batch_t;
+
+static int by_hilbert(const void *a, const void *b) {
+  const batch_tile_t *left = a, *right = b;
+  return (left->hilbert > right->hilbert) - (left->hilbert < right->hilbert);
+}
+
+static bool batch_stopped(batch_t *batch) {
+  pthread_mutex_lock(&batch->lock);
+  bool stopped = batch->stopped;
+  pthread_mutex_unlock(&batch->lock);
+  return stopped;
+}
+
+// Stop the batch, moving the clone's error, or the one given when the clone
+// has none, to the map the batch was started from.
+static void stop_batch(batch_t *batch, simplet_map_t *clone,
+                       simplet_status_t status, const char *msg) {
+  pthread_mutex_lock(&batch->lock);
+  if (!batch->stopped) {
+    batch->stopped = true;
+    if (clone->status != SIMPLET_OK) {
+      if (batch->map->error_msg) free(batch->map->error_msg);
+      batch->map->status = clone->status;
+      batch->map->error_msg = clone->error_msg;
+      clone->error_msg = NULL;
+    } else {
+      set_error(batch->map, status, msg);
+    }
+  }
+  pthread_mutex_unlock(&batch->lock);
+}
+
+// Draw tiles until the batch runs out or stops on one surface and png buffer
+// for the whole run. Vector sources are held open so drawing each tile finds
+// them already open.
+static void render_batch(void *data, int worker) {
+  batch_t *batch = data;
+  simplet_map_t *clone = batch->clones[worker];
+  unsigned int length = simplet_list_get_length(clone->layers), held = 0;
+  OGRDataSourceH sources[length ? length : 1];
+  simplet_listiter_t *iter;
+  simplet_layer_t *layer;
+  if ((iter = simplet_get_list_iter(clone->layers)))
+    while ((layer = simplet_list_next(iter)))
+      if (layer->type == SIMPLET_VECTOR &&
+          (sources[held] = OGROpenShared(layer->source, 0, NULL)))
+        held++;
+
+  cairo_surface_t *surface = cairo_image_surface_create(
+      CAIRO_FORMAT_ARGB32, SIMPLET_SLIPPY_SIZE, SIMPLET_SLIPPY_SIZE);
+  cairo_t *clear = cairo_create(surface);
+  cairo_set_operator(clear, CAIRO_OPERATOR_CLEAR);
+  png_buffer_t png = {NULL, 0, 0};
+
+  size_t index;
+  while (!batch_stopped(batch) &&
+         simplet_pool_ranges_next(batch->ranges, worker, &index)) {
+    if (cairo_status(clear) != CAIRO_STATUS_SUCCESS) {
+      stop_batch(batch, clone, SIMPLET_CAIRO_ERR,
+                 cairo_status_to_string(cairo_status(clear)));
+      break;
+    }
+
+    simplet_tile_id_t id = batch->ids[batch->order[index].index];
+    if (set_tile_bounds(clone, id.x, id.y, id.z) != SIMPLET_OK) {
+      stop_batch(batch, clone, clone->status, clone->error_msg);
+      break;
+    }
+    cairo_paint(clear);
+    draw_layers(clone, surface);
+    if (clone->status != SIMPLET_OK) {
+      stop_batch(batch, clone, clone->status, clone->error_msg);
+      break;
+    }
+
+    png.length = 0;
+    cairo_status_t status =
+        cairo_surface_write_to_png_stream(surface, write_png_buffer, &png);
+    if (status != CAIRO_STATUS_SUCCESS) {
+      stop_batch(batch, clone, SIMPLET_CAIRO_ERR,
+                 cairo_status_to_string(status));
+      break;
+    }
+
+    // Tiles are handed over one at a time.
+    pthread_mutex_lock(&batch->lock);
+    simplet_status_t handed = SIMPLET_OK;
+    if (!batch->stopped)
+      handed = batch->cb(batch->closure, id, png.data, png.length);
+    pthread_mutex_unlock(&batch->lock);
+    if (handed != SIMPLET_OK) {
+      stop_batch(batch, clone, SIMPLET_ERR, "batch stopped by callback");
+      break;
+    }
+  }
+
+  free(png.data);
+  cairo_destroy(clear);
+  cairo_surface_destroy(surface);
+  for (unsigned int i = 0; i < held; i++) OGRReleaseDataSource(sources[i]);
+}
+
+// Render length slippy tiles, calling cb with closure and each tile encoded
+// as a png. Tiles are drawn along a Hilbert curve rather than in the order
+// given, on threads workers, one per processor when 0, each with its own
+// clone of the map, and handed to cb one at a time. The projection, the
+// sources and the buffers are set up once for the whole batch rather than
+// per tile, and the map itself is left as it was.
+simplet_status_t simplet_map_render_tiles(simplet_map_t *map,
+                                          const simplet_tile_id_t *ids,
+                                          size_t length, int threads,
+                                          void *closure, simplet_png_func cb) {
+  if (map->status != SIMPLET_OK) return map->status;
+  if (!simplet_list_head(map->layers))
+    return set_error(map, SIMPLET_ERR, "map has no layers");
+  for (size_t i = 0; i < length; i++)
+    if (ids[i].z > SIMPLET_TILE_ID_MAX_ZOOM || ids[i].x >> ids[i].z ||
+        ids[i].y >> ids[i].z)
+      return set_error(map, SIMPLET_ERR, "tile is outside the world");
+  if (!length) return SIMPLET_OK;
+
+  int workers = threads > 0 ? threads : simplet_pool_size();
+  if ((size_t)workers > length) workers = length;
+
+  batch_t batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.map = map;
+  batch.ids = ids;
+  batch.closure = closure;
+  batch.cb = cb;
+  pthread_mutex_init(&batch.lock, NULL);
+
+  bool ok = (batch.order = malloc(sizeof(*batch.order) * length)) &&
+            (batch.clones = calloc(workers, sizeof(*batch.clones))) &&
+            (batch.ranges = simplet_pool_ranges_new(length, workers));
+  for (int i = 0; ok && i < workers; i++)
+    ok = (batch.clones[i] = simplet_map_clone(map)) &&
+         simplet_map_set_slippy(batch.clones[i], 0, 0, 0) == SIMPLET_OK;
+
+  if (ok) {
+    for (size_t i = 0; i < length; i++)
+      batch.order[i] = (batch_tile_t){
+          simplet_tile_id(ids[i].x, ids[i].y, ids[i].z), i};
+    qsort(batch.order, length, sizeof(*batch.order), by_hilbert);
+    simplet_pool_run(render_batch, &batch, workers);
+  } else {
+    set_error(map, SIMPLET_OOM, "couldn't set up tile batch");
+  }
+
+  for (int i = 0; batch.clones && i < workers; i++)
+    if (batch.clones[i]) simplet_map_free(batch.clones[i]);
+  if (batch.ranges) simplet_pool_ranges_free(batch.ranges);
+  free(batch.clones);
+  free(batch.order);
+  pthread_mutex_destroy(&batch.lock);
+  return map->status;
+}
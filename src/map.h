@@ -1,7 +1,9 @@
 #ifndef _SIMPLE_TILES_MAP_H
 #define _SIMPLE_TILES_MAP_H
 
+#include <stdint.h>
 #include "types.h"
+#include "hash.h"
 #include "user_data.h"
 
 #ifdef __cplusplus
@@ -12,6 +14,8 @@ simplet_map_t *simplet_map_new();
 
 void simplet_map_free(simplet_map_t *map);
 
+simplet_map_t *simplet_map_clone(simplet_map_t *map);
+
 simplet_status_t simplet_map_set_srs(simplet_map_t *map, const char *proj);
 
 simplet_status_t simplet_map_set_size(simplet_map_t *map, unsigned int width,
@@ -30,6 +34,9 @@ simplet_vector_layer_t *simplet_map_add_vector_layer(simplet_map_t *map,
 simplet_raster_layer_t *simplet_map_add_raster_layer(simplet_map_t *map,
                                                      const char *datastring);
 
+simplet_raster_layer_t *simplet_map_add_mosaic_layer(simplet_map_t *map,
+                                                     const char *datastring);
+
 simplet_layer_t *simplet_map_add_layer_directly(simplet_map_t *map,
                                                 simplet_layer_t *layer);
 
@@ -46,6 +53,29 @@ void simplet_map_render_to_stream(
     cairo_status_t (*cb)(void *closure, const unsigned char *data,
                          unsigned int length));
 
+simplet_status_t simplet_map_fingerprint(simplet_map_t *map,
+                                         uint8_t out[SIMPLET_HASH_LENGTH]);
+
+simplet_status_t simplet_map_count_features(simplet_map_t *map,
+                                            uint64_t *count);
+
+void simplet_map_render_cached(
+    simplet_map_t *map, simplet_tile_cache_t *cache, unsigned int x,
+    unsigned int y, unsigned int z, void *stream,
+    cairo_status_t (*cb)(void *closure, const unsigned char *data,
+                         unsigned int length));
+
+simplet_status_t simplet_map_render_pyramid(simplet_map_t *map, unsigned int x,
+                                            unsigned int y, unsigned int z,
+                                            unsigned int max_zoom,
+                                            simplet_kern_t kern, void *closure,
+                                            simplet_tile_func cb);
+
+simplet_status_t simplet_map_render_tiles(simplet_map_t *map,
+                                          const simplet_tile_id_t *ids,
+                                          size_t length, int threads,
+                                          void *closure, simplet_png_func cb);
+
 void simplet_map_get_srs(simplet_map_t *map, char **srs);
 
 simplet_status_t simplet_map_set_slippy(simplet_map_t *map, unsigned int x,
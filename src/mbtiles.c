@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "hash.h"
+#include "mbtiles.h"
+
+// Add in an error function.
+SIMPLET_ERROR_FUNC(mbtiles_t)
+
+// Each distinct tile is stored once in images, named by its digest, and map
+// points every position at one of them. The tiles view is what readers of
+// the format look at, rows counted from the south as in TMS.
+static const char schema[] =
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "CREATE TABLE metadata (name TEXT, value TEXT);"
+    "CREATE UNIQUE INDEX metadata_name ON metadata (name);"
+    "CREATE TABLE map (zoom_level INTEGER, tile_column INTEGER,"
+    " tile_row INTEGER, tile_id TEXT);"
+    "CREATE UNIQUE INDEX map_index ON map (zoom_level, tile_column, tile_row);"
+    "CREATE TABLE images (tile_data BLOB, tile_id TEXT);"
+    "CREATE UNIQUE INDEX images_id ON images (tile_id);"
+    "CREATE VIEW tiles AS SELECT map.zoom_level AS zoom_level,"
+    " map.tile_column AS tile_column, map.tile_row AS tile_row,"
+    " images.tile_data AS tile_data"
+    " FROM map JOIN images ON images.tile_id = map.tile_id;"
+    "INSERT INTO metadata VALUES ('format', 'png');";
+
+// Drop images replaced at every position and fill in the zooms from the
+// tiles unless they were given.
+static const char finish[] =
+    "DELETE FROM images WHERE tile_id NOT IN (SELECT tile_id FROM map);"
+    "INSERT OR IGNORE INTO metadata SELECT 'minzoom', MIN(zoom_level)"
+    " FROM map HAVING COUNT(*) > 0;"
+    "INSERT OR IGNORE INTO metadata SELECT 'maxzoom', MAX(zoom_level)"
+    " FROM map HAVING COUNT(*) > 0;";
+
+// Allocate an archive around a database, NULL on failure.
+static simplet_mbtiles_t *mbtiles_new(bool writing) {
+  simplet_mbtiles_t *mbtiles;
+  if (!(mbtiles = malloc(sizeof(*mbtiles)))) return NULL;
+
+  memset(mbtiles, 0, sizeof(*mbtiles));
+  mbtiles->status = SIMPLET_OK;
+  mbtiles->format = SIMPLET_MBTILES;
+  mbtiles->writing = writing;
+  pthread_mutex_init(&mbtiles->lock, NULL);
+  return mbtiles;
+}
+
+// Tear down a half built archive.
+static simplet_mbtiles_t *mbtiles_abort(simplet_mbtiles_t *mbtiles) {
+  simplet_mbtiles_close(mbtiles);
+  pthread_mutex_destroy(&mbtiles->lock);
+  free(mbtiles);
+  return NULL;
+}
+
+// Remove path and anything SQLite left beside it.
+static void remove_database(const char *path) {
+  unlink(path);
+  const char *suffixes[] = {"-wal", "-shm", "-journal"};
+  for (int i = 0; i < 3; i++) {
+    char *side;
+    if (asprintf(&side, "%s%s", path, suffixes[i]) < 0) continue;
+    unlink(side);
+    free(side);
+  }
+}
+
+// Create a new MBTiles database at path, replacing whatever is there.
+// Returns NULL on failure.
+simplet_mbtiles_t *simplet_mbtiles_create(const char *path) {
+  simplet_mbtiles_t *mbtiles;
+  if (!(mbtiles = mbtiles_new(true))) return NULL;
+
+  remove_database(path);
+  if (sqlite3_open_v2(path, &mbtiles->db,
+                      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                      NULL) != SQLITE_OK ||
+      sqlite3_exec(mbtiles->db, schema, NULL, NULL, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(mbtiles->db,
+                         "INSERT OR IGNORE INTO images VALUES (?, ?)", -1,
+                         &mbtiles->insert_image, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(mbtiles->db,
+                         "INSERT OR REPLACE INTO map VALUES (?, ?, ?, ?)", -1,
+                         &mbtiles->insert, NULL) != SQLITE_OK)
+    return mbtiles_abort(mbtiles);
+
+  return mbtiles;
+}
+
+// Open the MBTiles database at path for reading. The database is mapped
+// into memory rather than read through SQLite's page cache. Returns NULL on
+// failure.
+simplet_mbtiles_t *simplet_mbtiles_open(const char *path) {
+  simplet_mbtiles_t *mbtiles;
+  if (!(mbtiles = mbtiles_new(false))) return NULL;
+
+  if (sqlite3_open_v2(path, &mbtiles->db, SQLITE_OPEN_READONLY, NULL) !=
+          SQLITE_OK ||
+      sqlite3_exec(mbtiles->db, "PRAGMA mmap_size = 1073741824", NULL, NULL,
+                   NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(mbtiles->db,
+                         "SELECT tile_data FROM tiles WHERE zoom_level = ?"
+                         " AND tile_column = ? AND tile_row = ?",
+                         -1, &mbtiles->select, NULL) != SQLITE_OK)
+    return mbtiles_abort(mbtiles);
+
+  return mbtiles;
+}
+
+// Record the database's last error on the archive.
+static simplet_status_t database_error(simplet_mbtiles_t *mbtiles) {
+  return set_error(mbtiles, SIMPLET_ERR, sqlite3_errmsg(mbtiles->db));
+}
+
+// Record a failed insert. It only undoes itself and the transaction carries
+// on, unless SQLite had to roll all of it back, taking the pending tiles
+// with it.
+static simplet_status_t append_error(simplet_mbtiles_t *mbtiles) {
+  if (sqlite3_get_autocommit(mbtiles->db)) mbtiles->pending = 0;
+  return database_error(mbtiles);
+}
+
+// Add a tile, grouping SIMPLET_MBTILES_BATCH of them into each transaction
+// so SQLite syncs rarely. Contents already in the database are only
+// referenced again.
+simplet_status_t simplet_mbtiles_append(simplet_mbtiles_t *mbtiles,
+                                        unsigned int x, unsigned int y,
+                                        unsigned int z,
+                                        const unsigned char *data,
+                                        size_t length) {
+  if (sqlite3_get_autocommit(mbtiles->db) &&
+      sqlite3_exec(mbtiles->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+    return database_error(mbtiles);
+
+  uint8_t digest[SIMPLET_HASH_LENGTH];
+  simplet_hash_t hash;
+  simplet_hash_init(&hash);
+  simplet_hash_update(&hash, data, length);
+  simplet_hash_final(&hash, digest);
+  char id[SIMPLET_HASH_LENGTH * 2 + 1];
+  for (int i = 0; i < SIMPLET_HASH_LENGTH; i++)
+    sprintf(id + i * 2, "%02x", digest[i]);
+
+  sqlite3_stmt *image = mbtiles->insert_image;
+  sqlite3_bind_blob64(image, 1, data, length, SQLITE_STATIC);
+  sqlite3_bind_text(image, 2, id, -1, SQLITE_STATIC);
+  int ret = sqlite3_step(image);
+  sqlite3_reset(image);
+  sqlite3_clear_bindings(image);
+  if (ret != SQLITE_DONE) return append_error(mbtiles);
+
+  sqlite3_stmt *insert = mbtiles->insert;
+  sqlite3_bind_int(insert, 1, z);
+  sqlite3_bind_int64(insert, 2, x);
+  sqlite3_bind_int64(insert, 3, ((1ll << z) - 1) - y);
+  sqlite3_bind_text(insert, 4, id, -1, SQLITE_STATIC);
+  ret = sqlite3_step(insert);
+  sqlite3_reset(insert);
+  sqlite3_clear_bindings(insert);
+  if (ret != SQLITE_DONE) return append_error(mbtiles);
+
+  if (++mbtiles->pending == SIMPLET_MBTILES_BATCH) {
+    mbtiles->pending = 0;
+    if (sqlite3_exec(mbtiles->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+      return database_error(mbtiles);
+  }
+  return SIMPLET_OK;
+}
+
+// Set a row of the metadata table.
+simplet_status_t simplet_mbtiles_set_metadata(simplet_mbtiles_t *mbtiles,
+                                              const char *name,
+                                              const char *value) {
+  sqlite3_stmt *insert;
+  if (sqlite3_prepare_v2(mbtiles->db,
+                         "INSERT OR REPLACE INTO metadata VALUES (?, ?)", -1,
+                         &insert, NULL) != SQLITE_OK)
+    return database_error(mbtiles);
+
+  sqlite3_bind_text(insert, 1, name, -1, SQLITE_STATIC);
+  sqlite3_bind_text(insert, 2, value, -1, SQLITE_STATIC);
+  int ret = sqlite3_step(insert);
+  sqlite3_finalize(insert);
+  if (ret != SQLITE_DONE) return database_error(mbtiles);
+  return SIMPLET_OK;
+}
+
+// Look up a tile. Returns a copy the caller frees, or NULL when it isn't
+// in the database or on failure.
+unsigned char *simplet_mbtiles_get(simplet_mbtiles_t *mbtiles, unsigned int x,
+                                   unsigned int y, unsigned int z,
+                                   size_t *length) {
+  sqlite3_stmt *select = mbtiles->select;
+  sqlite3_bind_int(select, 1, z);
+  sqlite3_bind_int64(select, 2, x);
+  sqlite3_bind_int64(select, 3, ((1ll << z) - 1) - y);
+
+  unsigned char *out = NULL;
+  int ret = sqlite3_step(select);
+  if (ret == SQLITE_ROW) {
+    const void *blob = sqlite3_column_blob(select, 0);
+    *length = sqlite3_column_bytes(select, 0);
+    if ((out = malloc(*length ? *length : 1)))
+      memcpy(out, blob, *length);
+    else
+      set_error(mbtiles, SIMPLET_OOM, "out of memory reading tile");
+  } else if (ret != SQLITE_DONE) {
+    database_error(mbtiles);
+  }
+  sqlite3_reset(select);
+  return out;
+}
+
+// Commit the last batch, tidy up the images and fold the write ahead log
+// back in so the archive is a single file again.
+simplet_status_t simplet_mbtiles_finish(simplet_mbtiles_t *mbtiles) {
+  if (!sqlite3_get_autocommit(mbtiles->db)) {
+    mbtiles->pending = 0;
+    if (sqlite3_exec(mbtiles->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+      return database_error(mbtiles);
+  }
+  sqlite3_finalize(mbtiles->insert);
+  sqlite3_finalize(mbtiles->insert_image);
+  mbtiles->insert = mbtiles->insert_image = NULL;
+
+  if (sqlite3_exec(mbtiles->db, finish, NULL, NULL, NULL) != SQLITE_OK ||
+      sqlite3_exec(mbtiles->db, "PRAGMA journal_mode = DELETE", NULL, NULL,
+                   NULL) != SQLITE_OK)
+    return database_error(mbtiles);
+  return SIMPLET_OK;
+}
+
+// Release the database, leaving the archive itself to the caller.
+void simplet_mbtiles_close(simplet_mbtiles_t *mbtiles) {
+  sqlite3_finalize(mbtiles->insert);
+  sqlite3_finalize(mbtiles->insert_image);
+  sqlite3_finalize(mbtiles->select);
+  sqlite3_close(mbtiles->db);
+}
@@ -0,0 +1,51 @@
+#ifndef _SIMPLE_TILES_MBTILES_H
+#define _SIMPLE_TILES_MBTILES_H
+
+#include <sqlite3.h>
+#include "archive.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* MBTiles archives, tiles in an SQLite database */
+
+// Appends grouped into each transaction while writing.
+#define SIMPLET_MBTILES_BATCH 512
+
+typedef struct {
+  SIMPLET_ARCHIVE_FIELDS
+  sqlite3 *db;
+  sqlite3_stmt *insert;
+  sqlite3_stmt *insert_image;
+  sqlite3_stmt *select;
+  unsigned int pending;  // appends in the open transaction
+} simplet_mbtiles_t;
+
+simplet_mbtiles_t *simplet_mbtiles_create(const char *path);
+
+simplet_mbtiles_t *simplet_mbtiles_open(const char *path);
+
+simplet_status_t simplet_mbtiles_append(simplet_mbtiles_t *mbtiles,
+                                        unsigned int x, unsigned int y,
+                                        unsigned int z,
+                                        const unsigned char *data,
+                                        size_t length);
+
+simplet_status_t simplet_mbtiles_set_metadata(simplet_mbtiles_t *mbtiles,
+                                              const char *name,
+                                              const char *value);
+
+unsigned char *simplet_mbtiles_get(simplet_mbtiles_t *mbtiles, unsigned int x,
+                                   unsigned int y, unsigned int z,
+                                   size_t *length);
+
+simplet_status_t simplet_mbtiles_finish(simplet_mbtiles_t *mbtiles);
+
+void simplet_mbtiles_close(simplet_mbtiles_t *mbtiles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,11 +1,11 @@
 #include "memory.h"
 
+// Counts are changed atomically so objects shared between cloned maps can be
+// retained and released from any thread.
 int simplet_retain(simplet_retainable_t *obj) {
-  obj->refcount++;
-  return obj->refcount;
+  return __atomic_add_fetch(&obj->refcount, 1, __ATOMIC_ACQ_REL);
 }
 
 int simplet_release(simplet_retainable_t *obj) {
-  obj->refcount--;
-  return obj->refcount;
+  return __atomic_sub_fetch(&obj->refcount, 1, __ATOMIC_ACQ_REL);
 }
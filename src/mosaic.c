@@ -0,0 +1,375 @@
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <gdal.h>
+#include <ogr_api.h>
+#include <ogr_srs_api.h>
+
+#include "mosaic.h"
+#include "util.h"
+
+// Points placed along each edge of an outline before it's reprojected.
+#define SIMPLET_OUTLINE_STEPS 16
+
+// The first line of a saved index.
+#define SIMPLET_INDEX_HEADER "simplet-mosaic 1\n"
+
+// The index is saved inside a directory of scenes, or next to a list of
+// them, unless told otherwise.
+#define SIMPLET_INDEX_NAME ".simplet-mosaic"
+
+// Create a mosaic of the scenes in source, either a directory of rasters or
+// a file listing one raster path per line. Returns NULL on failure.
+simplet_mosaic_t *simplet_mosaic_new(const char *source) {
+  simplet_mosaic_t *mosaic;
+  if (!(mosaic = malloc(sizeof(*mosaic)))) return NULL;
+
+  memset(mosaic, 0, sizeof(*mosaic));
+  struct stat st;
+  const char *format = !stat(source, &st) && S_ISDIR(st.st_mode)
+                           ? "%s/" SIMPLET_INDEX_NAME
+                           : "%s" SIMPLET_INDEX_NAME;
+  if (asprintf(&mosaic->index, format, source) < 0) mosaic->index = NULL;
+  if (!mosaic->index || !(mosaic->source = simplet_copy_string(source))) {
+    free(mosaic->index);
+    free(mosaic);
+    return NULL;
+  }
+
+  pthread_mutex_init(&mosaic->lock, NULL);
+  return mosaic;
+}
+
+static void scenes_free(simplet_scene_t *scenes, int length) {
+  for (int i = 0; i < length; i++) {
+    free(scenes[i].path);
+    free(scenes[i].stamp);
+  }
+  free(scenes);
+}
+
+void simplet_mosaic_free(simplet_mosaic_t *mosaic) {
+  scenes_free(mosaic->scenes, mosaic->length);
+  if (mosaic->tree) simplet_rtree_free(mosaic->tree);
+  pthread_mutex_destroy(&mosaic->lock);
+  free(mosaic->source);
+  free(mosaic->index);
+  free(mosaic);
+}
+
+// Set where the footprint index is saved, NULL keeps it in memory only. Has
+// no effect once the mosaic has been drawn.
+simplet_status_t simplet_mosaic_set_index(simplet_mosaic_t *mosaic,
+                                          const char *index) {
+  char *copy = NULL;
+  if (index && !(copy = simplet_copy_string(index))) return SIMPLET_OOM;
+  free(mosaic->index);
+  mosaic->index = copy;
+  return SIMPLET_OK;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(((const simplet_scene_t *)a)->path,
+                ((const simplet_scene_t *)b)->path);
+}
+
+static int compare_stamps(const void *a, const void *b) {
+  return strcmp(((const simplet_scene_t *)a)->stamp,
+                ((const simplet_scene_t *)b)->stamp);
+}
+
+// Skip hidden files and the sidecars GDAL keeps next to rasters, some of
+// which it would happily open as scenes of their own.
+static bool skip_name(const char *name) {
+  static const char *sidecars[] = {".ovr", ".aux.xml", ".msk"};
+  if (name[0] == '.') return true;
+  size_t length = strlen(name);
+  for (size_t i = 0; i < sizeof(sidecars) / sizeof(*sidecars); i++) {
+    size_t suffix = strlen(sidecars[i]);
+    if (length > suffix && !strcmp(name + length - suffix, sidecars[i]))
+      return true;
+  }
+  return false;
+}
+
+// Add path to the list of scenes if it's a file, returns false when out of
+// memory.
+static bool add_scene(simplet_scene_t **scenes, int *length, int *size,
+                      const char *path) {
+  struct stat st;
+  if (stat(path, &st) || !S_ISREG(st.st_mode)) return true;
+
+  if (*length == *size) {
+    int grown = *size ? *size * 2 : 64;
+    simplet_scene_t *resized = realloc(*scenes, sizeof(**scenes) * grown);
+    if (!resized) return false;
+    *scenes = resized;
+    *size = grown;
+  }
+
+  simplet_scene_t *scene = &(*scenes)[*length];
+  memset(scene, 0, sizeof(*scene));
+  if (!(scene->path = simplet_copy_string(path)) ||
+      !(scene->stamp = simplet_source_stamp(path))) {
+    free(scene->path);
+    return false;
+  }
+  (*length)++;
+  return true;
+}
+
+// List the scenes in the mosaic's source. A directory's scenes come in name
+// order, a list's in the order given. Returns false on failure.
+static bool list_scenes(simplet_mosaic_t *mosaic, simplet_scene_t **scenes,
+                        int *length) {
+  int size = 0;
+  bool ok = true;
+  struct stat st;
+  if (stat(mosaic->source, &st)) return false;
+
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir;
+    if (!(dir = opendir(mosaic->source))) return false;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir))) {
+      if (skip_name(entry->d_name)) continue;
+      char *path;
+      if (asprintf(&path, "%s/%s", mosaic->source, entry->d_name) < 0) {
+        ok = false;
+        break;
+      }
+      ok = add_scene(scenes, length, &size, path);
+      free(path);
+    }
+    closedir(dir);
+    if (ok) qsort(*scenes, *length, sizeof(**scenes), compare_paths);
+    return ok;
+  }
+
+  FILE *file;
+  if (!(file = fopen(mosaic->source, "r"))) return false;
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t read;
+  while (ok && (read = getline(&line, &capacity, file)) != -1) {
+    while (read > 0 && strchr(" \t\r\n", line[read - 1])) line[--read] = '\0';
+    if (read == 0 || line[0] == '#') continue;
+    ok = add_scene(scenes, length, &size, line);
+  }
+  free(line);
+  fclose(file);
+  return ok;
+}
+
+// Read the footprints saved at path, sorted by stamp. Returns how many were
+// read, a missing or unreadable index reads as empty.
+static int read_index(const char *path, simplet_scene_t **saved) {
+  FILE *file;
+  if (!path || !(file = fopen(path, "r"))) return 0;
+
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t read;
+  int length = 0, size = 0;
+  if (getline(&line, &capacity, file) == -1 ||
+      strcmp(line, SIMPLET_INDEX_HEADER)) {
+    free(line);
+    fclose(file);
+    return 0;
+  }
+
+  while ((read = getline(&line, &capacity, file)) != -1) {
+    if (read > 0 && line[read - 1] == '\n') line[read - 1] = '\0';
+    simplet_scene_t scene;
+    memset(&scene, 0, sizeof(scene));
+    int valid, offset = 0;
+    if (sscanf(line, "%d %lf %lf %lf %lf %n", &valid, &scene.box.min_x,
+               &scene.box.min_y, &scene.box.max_x, &scene.box.max_y,
+               &offset) < 5 ||
+        !offset)
+      continue;
+
+    if (length == size) {
+      int grown = size ? size * 2 : 64;
+      simplet_scene_t *resized = realloc(*saved, sizeof(**saved) * grown);
+      if (!resized) break;
+      *saved = resized;
+      size = grown;
+    }
+    if (!(scene.stamp = simplet_copy_string(line + offset))) break;
+    scene.valid = valid;
+    (*saved)[length++] = scene;
+  }
+  free(line);
+  fclose(file);
+
+  if (length) qsort(*saved, length, sizeof(**saved), compare_stamps);
+  return length;
+}
+
+// Save the footprints to path, through a temporary file so other processes
+// never read half an index.
+static void write_index(const char *path, simplet_scene_t *scenes,
+                        int length) {
+  char *temp;
+  if (asprintf(&temp, "%s.%d", path, (int)getpid()) < 0) return;
+
+  FILE *file;
+  if (!(file = fopen(temp, "w"))) {
+    free(temp);
+    return;
+  }
+  fputs(SIMPLET_INDEX_HEADER, file);
+  for (int i = 0; i < length; i++)
+    fprintf(file, "%d %.17g %.17g %.17g %.17g %s\n", scenes[i].valid,
+            scenes[i].box.min_x, scenes[i].box.min_y, scenes[i].box.max_x,
+            scenes[i].box.max_y, scenes[i].stamp);
+  if (fclose(file) || rename(temp, path)) remove(temp);
+  free(temp);
+}
+
+// Find the box around the width by height rectangle placed by the
+// geotransform t once reprojected from one srs to another. Each edge is
+// outlined with several points so curved edges keep their extent. Returns
+// false if it can't be reprojected.
+static bool outline(const double *t, double width, double height,
+                    OGRSpatialReferenceH from, OGRSpatialReferenceH to,
+                    simplet_box_t *box) {
+  OGRGeometryH line;
+  if (!(line = OGR_G_CreateGeometry(wkbLineString))) return false;
+
+  for (int i = 0; i < 4 * SIMPLET_OUTLINE_STEPS; i++) {
+    int edge = i / SIMPLET_OUTLINE_STEPS;
+    double along = (double)(i % SIMPLET_OUTLINE_STEPS) / SIMPLET_OUTLINE_STEPS;
+    double x = edge == 0 ? along : edge == 1 ? 1 : edge == 2 ? 1 - along : 0;
+    double y = edge == 0 ? 0 : edge == 1 ? along : edge == 2 ? 1 : 1 - along;
+    x *= width;
+    y *= height;
+    OGR_G_AddPoint_2D(line, t[0] + x * t[1] + y * t[2],
+                      t[3] + x * t[4] + y * t[5]);
+  }
+
+  OGR_G_AssignSpatialReference(line, from);
+  bool placed = OGR_G_TransformTo(line, to) == OGRERR_NONE &&
+                OGR_G_GetPointCount(line) > 0;
+  if (placed) {
+    OGREnvelope envelope;
+    OGR_G_GetEnvelope(line, &envelope);
+    box->min_x = envelope.MinX;
+    box->min_y = envelope.MinY;
+    box->max_x = envelope.MaxX;
+    box->max_y = envelope.MaxY;
+  }
+  OGR_G_DestroyGeometry(line);
+  return placed;
+}
+
+// Open a scene to find its footprint in wgs84.
+static void place_scene(simplet_scene_t *scene, OGRSpatialReferenceH wgs84) {
+  scene->valid = false;
+  GDALDatasetH source;
+  if (!(source = GDALOpen(scene->path, GA_ReadOnly))) return;
+
+  double t[6];
+  const char *wkt = GDALGetProjectionRef(source);
+  OGRSpatialReferenceH srs = NULL;
+  if (GDALGetGeoTransform(source, t) == CE_None && wkt && *wkt &&
+      (srs = OSRNewSpatialReference(wkt)))
+    scene->valid = outline(t, GDALGetRasterXSize(source),
+                           GDALGetRasterYSize(source), srs, wgs84,
+                           &scene->box);
+  if (srs) OSRDestroySpatialReference(srs);
+  GDALClose(source);
+}
+
+static OGRSpatialReferenceH wgs84_new() {
+  OGRSpatialReferenceH wgs84;
+  if (!(wgs84 = OSRNewSpatialReference(NULL))) return NULL;
+  if (OSRSetFromUserInput(wgs84, SIMPLET_WGS84) != OGRERR_NONE) {
+    OSRDestroySpatialReference(wgs84);
+    return NULL;
+  }
+  return wgs84;
+}
+
+// List the scenes and find their footprints, reusing the saved index for
+// scenes that haven't changed since and saving it again if any had. Only the
+// first caller does the work, so it's safe to call from several threads.
+// Returns false if the scenes can't be listed.
+bool simplet_mosaic_load(simplet_mosaic_t *mosaic) {
+  pthread_mutex_lock(&mosaic->lock);
+  if (mosaic->loaded) {
+    pthread_mutex_unlock(&mosaic->lock);
+    return true;
+  }
+
+  simplet_scene_t *scenes = NULL, *saved = NULL;
+  int length = 0, saved_length = 0;
+  OGRSpatialReferenceH wgs84 = NULL;
+  bool ok = list_scenes(mosaic, &scenes, &length) && (wgs84 = wgs84_new());
+  if (ok) saved_length = read_index(mosaic->index, &saved);
+
+  bool changed = length != saved_length;
+  for (int i = 0; ok && i < length; i++) {
+    simplet_scene_t *match = NULL;
+    if (saved_length)
+      match = bsearch(&scenes[i], saved, saved_length, sizeof(*saved),
+                      compare_stamps);
+    if (match) {
+      scenes[i].valid = match->valid;
+      scenes[i].box = match->box;
+    } else {
+      place_scene(&scenes[i], wgs84);
+      changed = true;
+    }
+    // scenes without a footprint get an empty box the tree leaves out
+    if (!scenes[i].valid)
+      scenes[i].box = (simplet_box_t){INFINITY, INFINITY, -INFINITY,
+                                      -INFINITY};
+  }
+  if (ok && changed && mosaic->index)
+    write_index(mosaic->index, scenes, length);
+
+  simplet_box_t *boxes = NULL;
+  if (ok && length && !(boxes = malloc(sizeof(*boxes) * length))) ok = false;
+  for (int i = 0; ok && i < length; i++) boxes[i] = scenes[i].box;
+  if (ok && !(mosaic->tree = simplet_rtree_new(boxes, length))) ok = false;
+  free(boxes);
+
+  if (ok) {
+    mosaic->scenes = scenes;
+    mosaic->length = length;
+    mosaic->loaded = true;
+  } else {
+    scenes_free(scenes, length);
+  }
+  scenes_free(saved, saved_length);
+  if (wgs84) OSRDestroySpatialReference(wgs84);
+  pthread_mutex_unlock(&mosaic->lock);
+  return ok;
+}
+
+// Find the scenes under the map, storing their indexes in hits in priority
+// order, the scene drawn on top first. hits needs room for every scene.
+// Every scene is a hit when the map can't be placed in wgs84. Returns the
+// number of hits.
+int simplet_mosaic_search(simplet_mosaic_t *mosaic, simplet_map_t *map,
+                          int *hits) {
+  simplet_bounds_t *bounds = map->bounds;
+  double t[6] = {bounds->nw.x, bounds->width, 0, bounds->nw.y, 0,
+                 -bounds->height};
+  simplet_box_t box;
+  OGRSpatialReferenceH wgs84 = wgs84_new();
+  bool placed = wgs84 && outline(t, 1, 1, map->proj, wgs84, &box);
+  if (wgs84) OSRDestroySpatialReference(wgs84);
+  if (placed) return simplet_rtree_search(mosaic->tree, &box, hits);
+
+  int count = 0;
+  for (int i = 0; i < mosaic->length; i++)
+    if (mosaic->scenes[i].valid) hits[count++] = i;
+  return count;
+}
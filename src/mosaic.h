@@ -0,0 +1,50 @@
+#ifndef _SIMPLE_TILES_MOSAIC_H
+#define _SIMPLE_TILES_MOSAIC_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "types.h"
+#include "rtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* collections of raster scenes indexed by footprint */
+
+// A raster file in a mosaic, stamp names this version of it and box is its
+// footprint in WGS84. Scenes GDAL can't place aren't valid and never drawn.
+typedef struct {
+  char *path;
+  char *stamp;
+  bool valid;
+  simplet_box_t box;
+} simplet_scene_t;
+
+struct simplet_mosaic_t {
+  char *source;
+  char *index;
+  simplet_scene_t *scenes;
+  int length;
+  simplet_rtree_t *tree;
+  pthread_mutex_t lock;
+  bool loaded;
+};
+
+simplet_mosaic_t *simplet_mosaic_new(const char *source);
+
+void simplet_mosaic_free(simplet_mosaic_t *mosaic);
+
+simplet_status_t simplet_mosaic_set_index(simplet_mosaic_t *mosaic,
+                                          const char *index);
+
+bool simplet_mosaic_load(simplet_mosaic_t *mosaic);
+
+int simplet_mosaic_search(simplet_mosaic_t *mosaic, simplet_map_t *map,
+                          int *hits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
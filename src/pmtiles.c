@@ -0,0 +1,710 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "hash.h"
+#include "pmtiles.h"
+#include "util.h"
+
+// Add in an error function.
+SIMPLET_ERROR_FUNC(pmtiles_t)
+
+// Byte budget for decoded leaf directories while reading.
+#define SIMPLET_PMTILES_LEAVES (16 << 20)
+
+// A decoded leaf directory.
+typedef struct {
+  size_t length;
+  simplet_pmtiles_entry_t entries[];
+} leaf_t;
+
+// Allocate an empty archive, NULL on failure.
+static simplet_pmtiles_t *pmtiles_new(const char *path, bool writing) {
+  simplet_pmtiles_t *pmtiles;
+  if (!(pmtiles = malloc(sizeof(*pmtiles)))) return NULL;
+
+  memset(pmtiles, 0, sizeof(*pmtiles));
+  pmtiles->status = SIMPLET_OK;
+  pmtiles->format = SIMPLET_PMTILES;
+  pmtiles->writing = writing;
+  pmtiles->scratch = -1;
+  pthread_mutex_init(&pmtiles->lock, NULL);
+
+  if (!(pmtiles->path = simplet_copy_string(path))) {
+    pthread_mutex_destroy(&pmtiles->lock);
+    free(pmtiles);
+    return NULL;
+  }
+  return pmtiles;
+}
+
+// Tear down a half built archive.
+static simplet_pmtiles_t *pmtiles_abort(simplet_pmtiles_t *pmtiles) {
+  simplet_pmtiles_close(pmtiles);
+  pthread_mutex_destroy(&pmtiles->lock);
+  free(pmtiles);
+  return NULL;
+}
+
+// Create a new PMTiles archive at path. Nothing appears at path until the
+// archive is finished, tiles wait in a scratch file beside it. Returns NULL
+// on failure.
+simplet_pmtiles_t *simplet_pmtiles_create(const char *path) {
+  simplet_pmtiles_t *pmtiles;
+  if (!(pmtiles = pmtiles_new(path, true))) return NULL;
+
+  pmtiles->min_zoom = SIMPLET_ARCHIVE_MAX_ZOOM;
+  pmtiles->west = pmtiles->south = INFINITY;
+  pmtiles->east = pmtiles->north = -INFINITY;
+
+  char *scratch;
+  if (asprintf(&scratch, "%s.XXXXXX", path) < 0) return pmtiles_abort(pmtiles);
+  pmtiles->scratch = mkstemp(scratch);
+  if (pmtiles->scratch >= 0) unlink(scratch);
+  free(scratch);
+
+  // Indexes into blobs are stored one up, so none of them are NULL.
+  if (pmtiles->scratch < 0 ||
+      !(pmtiles->contents = simplet_lru_new(SIZE_MAX, NULL)))
+    return pmtiles_abort(pmtiles);
+
+  return pmtiles;
+}
+
+// Make room for one more item in an array of size items.
+static bool grow(void **items, size_t *size, size_t length, size_t item) {
+  if (length < *size) return true;
+  size_t grown = *size ? *size * 2 : 1024;
+  void *resized;
+  if (!(resized = realloc(*items, grown * item))) return false;
+  *items = resized;
+  *size = grown;
+  return true;
+}
+
+// Write all of data to fd at offset.
+static bool write_at(int fd, const unsigned char *data, size_t length,
+                     uint64_t offset) {
+  while (length > 0) {
+    ssize_t ret = pwrite(fd, data, length, offset);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    data += ret;
+    length -= ret;
+    offset += ret;
+  }
+  return true;
+}
+
+// Read all of length bytes from fd at offset.
+static bool read_at(int fd, unsigned char *data, size_t length,
+                    uint64_t offset) {
+  while (length > 0) {
+    ssize_t ret = pread(fd, data, length, offset);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    data += ret;
+    length -= ret;
+    offset += ret;
+  }
+  return true;
+}
+
+// Widen the archive's bounds to take in tile x, y, z.
+static void extend_bounds(simplet_pmtiles_t *pmtiles, unsigned int x,
+                          unsigned int y, unsigned int z) {
+  double tiles = ldexp(1, z);
+  double west = x / tiles * 360 - 180, east = (x + 1) / tiles * 360 - 180;
+  double north = atan(sinh(M_PI * (1 - 2 * y / tiles))) * 180 / M_PI;
+  double south = atan(sinh(M_PI * (1 - 2 * (y + 1) / tiles))) * 180 / M_PI;
+  if (west < pmtiles->west) pmtiles->west = west;
+  if (east > pmtiles->east) pmtiles->east = east;
+  if (south < pmtiles->south) pmtiles->south = south;
+  if (north > pmtiles->north) pmtiles->north = north;
+  if (z < pmtiles->min_zoom) pmtiles->min_zoom = z;
+  if (z > pmtiles->max_zoom) pmtiles->max_zoom = z;
+}
+
+// Add a tile. Contents already in the archive aren't written again, the
+// tile just points at the earlier copy.
+simplet_status_t simplet_pmtiles_append(simplet_pmtiles_t *pmtiles,
+                                        unsigned int x, unsigned int y,
+                                        unsigned int z,
+                                        const unsigned char *data,
+                                        size_t length) {
+  if (length > UINT32_MAX)
+    return set_error(pmtiles, SIMPLET_ERR, "tile is too large to archive");
+
+  uint8_t digest[SIMPLET_HASH_LENGTH];
+  simplet_hash_t hash;
+  simplet_hash_init(&hash);
+  simplet_hash_update(&hash, data, length);
+  simplet_hash_final(&hash, digest);
+
+  uintptr_t blob =
+      (uintptr_t)simplet_lru_get(pmtiles->contents, digest, sizeof(digest));
+  if (!blob) {
+    if (!grow((void **)&pmtiles->blobs, &pmtiles->blobs_size,
+              pmtiles->blobs_length, sizeof(*pmtiles->blobs)))
+      return set_error(pmtiles, SIMPLET_OOM, "out of memory adding tile");
+    if (!write_at(pmtiles->scratch, data, length, pmtiles->scratch_length))
+      return set_error(pmtiles, SIMPLET_ERR, "failed writing tile");
+
+    pmtiles->blobs[pmtiles->blobs_length] = (simplet_pmtiles_blob_t){
+        .offset = pmtiles->scratch_length,
+        .clustered = UINT64_MAX,
+        .length = length};
+    blob = ++pmtiles->blobs_length;
+    pmtiles->scratch_length += length;
+    if (!simplet_lru_set(pmtiles->contents, digest, sizeof(digest),
+                         (void *)blob, 1))
+      return set_error(pmtiles, SIMPLET_OOM, "out of memory adding tile");
+  }
+
+  if (!grow((void **)&pmtiles->tiles, &pmtiles->tiles_size,
+            pmtiles->tiles_length, sizeof(*pmtiles->tiles)))
+    return set_error(pmtiles, SIMPLET_OOM, "out of memory adding tile");
+  pmtiles->tiles[pmtiles->tiles_length] = (simplet_pmtiles_tile_t){
+      .tile_id = simplet_tile_id(x, y, z),
+      .blob = blob - 1,
+      .order = pmtiles->tiles_length};
+  pmtiles->tiles_length++;
+  extend_bounds(pmtiles, x, y, z);
+  return SIMPLET_OK;
+}
+
+// Set a key of the metadata object, replacing any earlier value.
+simplet_status_t simplet_pmtiles_set_metadata(simplet_pmtiles_t *pmtiles,
+                                              const char *name,
+                                              const char *value) {
+  char *copy;
+  if (!(copy = simplet_copy_string(value)))
+    return set_error(pmtiles, SIMPLET_OOM, "out of memory setting metadata");
+
+  for (size_t i = 0; i < pmtiles->metadata_length; i += 2) {
+    if (strcmp(pmtiles->metadata[i], name)) continue;
+    free(pmtiles->metadata[i + 1]);
+    pmtiles->metadata[i + 1] = copy;
+    return SIMPLET_OK;
+  }
+
+  char **metadata;
+  size_t grown = pmtiles->metadata_length + 2;
+  if (!(metadata = realloc(pmtiles->metadata, sizeof(*metadata) * grown))) {
+    free(copy);
+    return set_error(pmtiles, SIMPLET_OOM, "out of memory setting metadata");
+  }
+  pmtiles->metadata = metadata;
+  if (!(metadata[pmtiles->metadata_length] = simplet_copy_string(name))) {
+    free(copy);
+    return set_error(pmtiles, SIMPLET_OOM, "out of memory setting metadata");
+  }
+  metadata[pmtiles->metadata_length + 1] = copy;
+  pmtiles->metadata_length += 2;
+  return SIMPLET_OK;
+}
+
+// Order tiles along the curve, repeats in the order they came.
+static int compare_tiles(const void *a, const void *b) {
+  const simplet_pmtiles_tile_t *ta = a, *tb = b;
+  if (ta->tile_id != tb->tile_id) return ta->tile_id < tb->tile_id ? -1 : 1;
+  return ta->order < tb->order ? -1 : ta->order > tb->order;
+}
+
+static void write_varint(FILE *stream, uint64_t value) {
+  while (value >= 0x80) {
+    fputc((int)(value & 0x7f) | 0x80, stream);
+    value >>= 7;
+  }
+  fputc((int)value, stream);
+}
+
+// Serialize a directory: the entry count, then each column of the entries
+// in turn. Tile ids are stored as deltas and offsets as zero when an entry
+// follows straight on from the one before it.
+static void write_directory(FILE *stream,
+                            const simplet_pmtiles_entry_t *entries,
+                            size_t length) {
+  write_varint(stream, length);
+  uint64_t last = 0;
+  for (size_t i = 0; i < length; i++) {
+    write_varint(stream, entries[i].tile_id - last);
+    last = entries[i].tile_id;
+  }
+  for (size_t i = 0; i < length; i++)
+    write_varint(stream, entries[i].run_length);
+  for (size_t i = 0; i < length; i++)
+    write_varint(stream, entries[i].length);
+  for (size_t i = 0; i < length; i++) {
+    if (i > 0 &&
+        entries[i].offset == entries[i - 1].offset + entries[i - 1].length)
+      write_varint(stream, 0);
+    else
+      write_varint(stream, entries[i].offset + 1);
+  }
+}
+
+// Serialize the directories, into the root alone when it fits and otherwise
+// into leaves of leaf entries each behind a root pointing at them.
+static bool write_directories(const simplet_pmtiles_entry_t *entries,
+                              size_t length, size_t leaf, char **root,
+                              size_t *root_length, char **leaves,
+                              size_t *leaves_length) {
+  FILE *stream;
+  *leaves = NULL;
+  *leaves_length = 0;
+  if (!leaf) {
+    if (!(stream = open_memstream(root, root_length))) return false;
+    write_directory(stream, entries, length);
+    return !fclose(stream);
+  }
+
+  size_t count = (length + leaf - 1) / leaf;
+  simplet_pmtiles_entry_t *pointers;
+  if (!(pointers = malloc(sizeof(*pointers) * (count ? count : 1))))
+    return false;
+  if (!(stream = open_memstream(leaves, leaves_length))) {
+    free(pointers);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t start = i * leaf;
+    size_t end = start + leaf < length ? start + leaf : length;
+    long offset = ftell(stream);
+    write_directory(stream, entries + start, end - start);
+    pointers[i] = (simplet_pmtiles_entry_t){
+        .tile_id = entries[start].tile_id,
+        .offset = offset,
+        .length = ftell(stream) - offset,
+        .run_length = 0};
+  }
+  bool ok = !fclose(stream);
+  if (ok && (stream = open_memstream(root, root_length))) {
+    write_directory(stream, pointers, count);
+    ok = !fclose(stream);
+  } else {
+    ok = false;
+  }
+  free(pointers);
+  return ok;
+}
+
+// Write value as a JSON string.
+static void write_json_string(FILE *stream, const char *value) {
+  fputc('"', stream);
+  for (const unsigned char *c = (const unsigned char *)value; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(stream, "\\%c", *c);
+    else if (*c < 0x20)
+      fprintf(stream, "\\u%04x", *c);
+    else
+      fputc(*c, stream);
+  }
+  fputc('"', stream);
+}
+
+// The metadata pairs as a JSON object.
+static bool write_metadata(simplet_pmtiles_t *pmtiles, char **json,
+                           size_t *length) {
+  FILE *stream;
+  if (!(stream = open_memstream(json, length))) return false;
+  fputc('{', stream);
+  for (size_t i = 0; i < pmtiles->metadata_length; i += 2) {
+    if (i) fputc(',', stream);
+    write_json_string(stream, pmtiles->metadata[i]);
+    fputc(':', stream);
+    write_json_string(stream, pmtiles->metadata[i + 1]);
+  }
+  fputc('}', stream);
+  return !fclose(stream);
+}
+
+// The header's tile type from the format in the metadata, png by default.
+static uint8_t tile_type(simplet_pmtiles_t *pmtiles) {
+  const char *format = "png";
+  for (size_t i = 0; i < pmtiles->metadata_length; i += 2)
+    if (!strcmp(pmtiles->metadata[i], "format"))
+      format = pmtiles->metadata[i + 1];
+
+  const char *types[] = {"pbf", "png", "jpg", "webp", "avif"};
+  for (int i = 0; i < 5; i++)
+    if (!strcmp(format, types[i])) return i + 1;
+  return !strcmp(format, "jpeg") ? 3 : 0;
+}
+
+static void put64(unsigned char *at, uint64_t value) {
+  for (int i = 0; i < 8; i++) at[i] = value >> (i * 8);
+}
+
+static void put32(unsigned char *at, int32_t value) {
+  for (int i = 0; i < 4; i++) at[i] = (uint32_t)value >> (i * 8);
+}
+
+// Where everything landed, for the header.
+typedef struct {
+  uint64_t root_length;
+  uint64_t metadata_length;
+  uint64_t leaves_length;
+  uint64_t data_length;
+  uint64_t addressed;
+  uint64_t entries;
+  uint64_t contents;
+} layout_t;
+
+static void write_header(simplet_pmtiles_t *pmtiles, layout_t *layout,
+                         unsigned char header[SIMPLET_PMTILES_HEADER]) {
+  memset(header, 0, SIMPLET_PMTILES_HEADER);
+  memcpy(header, "PMTiles", 7);
+  header[7] = 3;
+  uint64_t offset = SIMPLET_PMTILES_HEADER;
+  put64(header + 8, offset);
+  put64(header + 16, layout->root_length);
+  offset += layout->root_length;
+  put64(header + 24, offset);
+  put64(header + 32, layout->metadata_length);
+  offset += layout->metadata_length;
+  put64(header + 40, offset);
+  put64(header + 48, layout->leaves_length);
+  offset += layout->leaves_length;
+  put64(header + 56, offset);
+  put64(header + 64, layout->data_length);
+  put64(header + 72, layout->addressed);
+  put64(header + 80, layout->entries);
+  put64(header + 88, layout->contents);
+  header[96] = 1;  // clustered
+  header[97] = 1;  // directories aren't compressed
+  header[98] = 1;  // neither are tiles, beyond their own encoding
+  header[99] = tile_type(pmtiles);
+
+  if (!layout->addressed) return;
+  header[100] = pmtiles->min_zoom;
+  header[101] = pmtiles->max_zoom;
+  put32(header + 102, lround(pmtiles->west * 1e7));
+  put32(header + 106, lround(pmtiles->south * 1e7));
+  put32(header + 110, lround(pmtiles->east * 1e7));
+  put32(header + 114, lround(pmtiles->north * 1e7));
+  header[118] = pmtiles->min_zoom;
+  put32(header + 119, lround((pmtiles->west + pmtiles->east) / 2 * 1e7));
+  put32(header + 123, lround((pmtiles->south + pmtiles->north) / 2 * 1e7));
+}
+
+// Copy the tile contents out of scratch in the order they were placed.
+static bool copy_contents(simplet_pmtiles_t *pmtiles, FILE *out,
+                          const size_t *placed, size_t length) {
+  size_t largest = 1;
+  for (size_t i = 0; i < length; i++)
+    if (pmtiles->blobs[placed[i]].length > largest)
+      largest = pmtiles->blobs[placed[i]].length;
+
+  unsigned char *buffer;
+  if (!(buffer = malloc(largest))) return false;
+  bool ok = true;
+  for (size_t i = 0; ok && i < length; i++) {
+    simplet_pmtiles_blob_t *blob = &pmtiles->blobs[placed[i]];
+    ok = read_at(pmtiles->scratch, buffer, blob->length, blob->offset) &&
+         fwrite(buffer, 1, blob->length, out) == blob->length;
+  }
+  free(buffer);
+  return ok;
+}
+
+// Lay the tiles out along the curve and write the archive. The last tile
+// appended at a position wins, runs of a repeated tile share one entry and
+// the directory spills into leaves once the root outgrows its space.
+simplet_status_t simplet_pmtiles_finish(simplet_pmtiles_t *pmtiles) {
+  simplet_pmtiles_tile_t *tiles = pmtiles->tiles;
+  size_t length = 0;
+  if (pmtiles->tiles_length)
+    qsort(tiles, pmtiles->tiles_length, sizeof(*tiles), compare_tiles);
+  for (size_t i = 0; i < pmtiles->tiles_length; i++) {
+    if (length && tiles[length - 1].tile_id == tiles[i].tile_id) length--;
+    tiles[length++] = tiles[i];
+  }
+
+  simplet_pmtiles_entry_t *entries = NULL;
+  size_t *placed = NULL;
+  if (!(entries = malloc(sizeof(*entries) * (length ? length : 1))) ||
+      !(placed = malloc(sizeof(*placed) *
+                        (pmtiles->blobs_length ? pmtiles->blobs_length : 1)))) {
+    free(entries);
+    return set_error(pmtiles, SIMPLET_OOM, "out of memory finishing archive");
+  }
+
+  layout_t layout = {.addressed = length};
+  for (size_t i = 0; i < length; i++) {
+    simplet_pmtiles_blob_t *blob = &pmtiles->blobs[tiles[i].blob];
+    if (blob->clustered == UINT64_MAX) {
+      blob->clustered = layout.data_length;
+      layout.data_length += blob->length;
+      placed[layout.contents++] = tiles[i].blob;
+    }
+
+    simplet_pmtiles_entry_t *last =
+        layout.entries ? &entries[layout.entries - 1] : NULL;
+    if (last && last->offset == blob->clustered &&
+        last->tile_id + last->run_length == tiles[i].tile_id &&
+        last->run_length < UINT32_MAX) {
+      last->run_length++;
+      continue;
+    }
+    entries[layout.entries++] = (simplet_pmtiles_entry_t){
+        .tile_id = tiles[i].tile_id,
+        .offset = blob->clustered,
+        .length = blob->length,
+        .run_length = 1};
+  }
+
+  char *root = NULL, *leaves = NULL, *metadata = NULL;
+  size_t root_length = 0, leaves_length = 0, metadata_length = 0;
+  bool ok = true;
+  for (size_t leaf = 0; ok; leaf = leaf ? leaf * 2 : SIMPLET_PMTILES_LEAF) {
+    free(root);
+    free(leaves);
+    root = leaves = NULL;
+    ok = write_directories(entries, layout.entries, leaf, &root, &root_length,
+                           &leaves, &leaves_length);
+    if (root_length <= SIMPLET_PMTILES_ROOT) break;
+  }
+  free(entries);
+  ok = ok && write_metadata(pmtiles, &metadata, &metadata_length);
+  layout.root_length = root_length;
+  layout.leaves_length = leaves_length;
+  layout.metadata_length = metadata_length;
+
+  // Written beside path and moved into place, readers never see half of it.
+  char *temp = NULL;
+  FILE *out = NULL;
+  int fd = -1;
+  if (ok && asprintf(&temp, "%s.XXXXXX", pmtiles->path) < 0) temp = NULL;
+  if (temp && (fd = mkstemp(temp)) >= 0 && !fchmod(fd, 0644))
+    out = fdopen(fd, "wb");
+
+  if (out) {
+    unsigned char header[SIMPLET_PMTILES_HEADER];
+    write_header(pmtiles, &layout, header);
+    ok = fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+         fwrite(root, 1, root_length, out) == root_length &&
+         fwrite(metadata, 1, metadata_length, out) == metadata_length &&
+         (!leaves || fwrite(leaves, 1, leaves_length, out) == leaves_length) &&
+         copy_contents(pmtiles, out, placed, layout.contents);
+    ok = !fclose(out) && ok && !rename(temp, pmtiles->path);
+  } else {
+    if (fd >= 0) close(fd);
+    ok = false;
+  }
+  if (!ok && temp) unlink(temp);
+
+  free(temp);
+  free(root);
+  free(leaves);
+  free(metadata);
+  free(placed);
+  if (!ok) return set_error(pmtiles, SIMPLET_ERR, "failed writing archive");
+  return SIMPLET_OK;
+}
+
+static uint64_t get64(const unsigned char *at) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) value = value << 8 | at[i];
+  return value;
+}
+
+// Read a varint between *at and end, false when it runs off the end.
+static bool read_varint(const unsigned char **at, const unsigned char *end,
+                        uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; *at < end && shift < 64; shift += 7) {
+    unsigned char byte = *(*at)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+// Decode the directory in length bytes at data into entries, storing their
+// number in count. Returns NULL when it's malformed or on failure.
+static simplet_pmtiles_entry_t *read_directory(const unsigned char *data,
+                                               size_t length, size_t *count) {
+  const unsigned char *at = data, *end = data + length;
+  uint64_t value;
+  // every entry takes at least four bytes
+  if (!read_varint(&at, end, &value) || value > length / 4) return NULL;
+  *count = value;
+
+  simplet_pmtiles_entry_t *entries;
+  if (!(entries = malloc(sizeof(*entries) * (*count ? *count : 1))))
+    return NULL;
+
+  bool ok = true;
+  uint64_t id = 0;
+  for (size_t i = 0; ok && i < *count; i++) {
+    ok = read_varint(&at, end, &value);
+    entries[i].tile_id = id += value;
+  }
+  for (size_t i = 0; ok && i < *count; i++) {
+    ok = read_varint(&at, end, &value) && value <= UINT32_MAX;
+    entries[i].run_length = value;
+  }
+  for (size_t i = 0; ok && i < *count; i++) {
+    ok = read_varint(&at, end, &value) && value <= UINT32_MAX;
+    entries[i].length = value;
+  }
+  for (size_t i = 0; ok && i < *count; i++) {
+    ok = read_varint(&at, end, &value) && (value || i > 0);
+    entries[i].offset = value ? value - 1
+                              : entries[i - 1].offset + entries[i - 1].length;
+  }
+  if (!ok) {
+    free(entries);
+    return NULL;
+  }
+  return entries;
+}
+
+// Open the PMTiles archive at path for reading, mapping it into memory.
+// Only archives with uncompressed directories can be read. Returns NULL on
+// failure.
+simplet_pmtiles_t *simplet_pmtiles_open(const char *path) {
+  simplet_pmtiles_t *pmtiles;
+  if (!(pmtiles = pmtiles_new(path, false))) return NULL;
+
+  int fd;
+  struct stat st;
+  if ((fd = open(path, O_RDONLY)) < 0) return pmtiles_abort(pmtiles);
+  if (!fstat(fd, &st) && st.st_size >= SIMPLET_PMTILES_HEADER) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+      pmtiles->map = map;
+      pmtiles->map_length = st.st_size;
+    }
+  }
+  close(fd);
+
+  const unsigned char *header = pmtiles->map;
+  if (!header || memcmp(header, "PMTiles", 7) || header[7] != 3 ||
+      header[97] > 1)
+    return pmtiles_abort(pmtiles);
+
+  uint64_t root_offset = get64(header + 8), root_length = get64(header + 16);
+  pmtiles->leaf_offset = get64(header + 40);
+  pmtiles->data_offset = get64(header + 56);
+  if (root_offset > pmtiles->map_length ||
+      root_length > pmtiles->map_length - root_offset ||
+      !(pmtiles->root = read_directory(header + root_offset, root_length,
+                                       &pmtiles->root_length)) ||
+      !(pmtiles->leaves = simplet_lru_new(SIMPLET_PMTILES_LEAVES, free)))
+    return pmtiles_abort(pmtiles);
+
+  return pmtiles;
+}
+
+// Find the entry covering tile_id, the last one starting at or before it.
+static simplet_pmtiles_entry_t *find_entry(simplet_pmtiles_entry_t *entries,
+                                           size_t length, uint64_t tile_id) {
+  size_t low = 0, high = length;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (entries[middle].tile_id <= tile_id)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low ? &entries[low - 1] : NULL;
+}
+
+// The leaf directory entry points at, decoded once and then kept.
+static leaf_t *get_leaf(simplet_pmtiles_t *pmtiles,
+                        simplet_pmtiles_entry_t *entry) {
+  uint64_t offset = pmtiles->leaf_offset + entry->offset;
+  leaf_t *leaf = simplet_lru_get(pmtiles->leaves, &offset, sizeof(offset));
+  if (leaf) return leaf;
+
+  if (offset < pmtiles->leaf_offset || offset > pmtiles->map_length ||
+      entry->length > pmtiles->map_length - offset)
+    return NULL;
+
+  size_t length;
+  simplet_pmtiles_entry_t *entries;
+  if (!(entries =
+            read_directory(pmtiles->map + offset, entry->length, &length)))
+    return NULL;
+  if ((leaf = malloc(sizeof(*leaf) + sizeof(*entries) * length))) {
+    leaf->length = length;
+    memcpy(leaf->entries, entries, sizeof(*entries) * length);
+    if (!simplet_lru_set(pmtiles->leaves, &offset, sizeof(offset), leaf,
+                         sizeof(*leaf) + sizeof(*entries) * length)) {
+      free(leaf);
+      leaf = NULL;
+    }
+  }
+  free(entries);
+  return leaf;
+}
+
+// Look up a tile, following leaf directories down from the root. Returns a
+// copy the caller frees, or NULL when it isn't in the archive or on failure.
+unsigned char *simplet_pmtiles_get(simplet_pmtiles_t *pmtiles, unsigned int x,
+                                   unsigned int y, unsigned int z,
+                                   size_t *length) {
+  uint64_t tile_id = simplet_tile_id(x, y, z);
+  simplet_pmtiles_entry_t *entries = pmtiles->root;
+  size_t entries_length = pmtiles->root_length;
+
+  // The spec allows leaves to point at further leaves, a few levels deep.
+  for (int depth = 0; depth < 4; depth++) {
+    simplet_pmtiles_entry_t *entry;
+    if (!(entry = find_entry(entries, entries_length, tile_id))) return NULL;
+
+    if (entry->run_length) {
+      if (tile_id >= entry->tile_id + entry->run_length) return NULL;
+      uint64_t offset = pmtiles->data_offset + entry->offset;
+      if (offset < pmtiles->data_offset || offset > pmtiles->map_length ||
+          entry->length > pmtiles->map_length - offset) {
+        set_error(pmtiles, SIMPLET_ERR, "tile runs past the archive");
+        return NULL;
+      }
+
+      unsigned char *out;
+      if (!(out = malloc(entry->length ? entry->length : 1))) {
+        set_error(pmtiles, SIMPLET_OOM, "out of memory reading tile");
+        return NULL;
+      }
+      memcpy(out, pmtiles->map + offset, entry->length);
+      *length = entry->length;
+      return out;
+    }
+
+    leaf_t *leaf;
+    if (!(leaf = get_leaf(pmtiles, entry))) {
+      set_error(pmtiles, SIMPLET_ERR, "malformed leaf directory");
+      return NULL;
+    }
+    entries = leaf->entries;
+    entries_length = leaf->length;
+  }
+  return NULL;
+}
+
+// Release whatever the archive holds, leaving the archive itself to the
+// caller.
+void simplet_pmtiles_close(simplet_pmtiles_t *pmtiles) {
+  if (pmtiles->scratch >= 0) close(pmtiles->scratch);
+  if (pmtiles->contents) simplet_lru_free(pmtiles->contents);
+  free(pmtiles->blobs);
+  free(pmtiles->tiles);
+  for (size_t i = 0; i < pmtiles->metadata_length; i++)
+    free(pmtiles->metadata[i]);
+  free(pmtiles->metadata);
+
+  if (pmtiles->map) munmap((void *)pmtiles->map, pmtiles->map_length);
+  if (pmtiles->leaves) simplet_lru_free(pmtiles->leaves);
+  free(pmtiles->root);
+  free(pmtiles->path);
+}
@@ -0,0 +1,99 @@
+#ifndef _SIMPLE_TILES_PMTILES_H
+#define _SIMPLE_TILES_PMTILES_H
+
+#include <stdint.h>
+#include "archive.h"
+#include "lru.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* PMTiles version 3 archives, tiles in one file behind a directory */
+
+// Bytes in the fixed header.
+#define SIMPLET_PMTILES_HEADER 127
+
+// The header and root directory must fit in the first 16k of the file.
+#define SIMPLET_PMTILES_ROOT (16384 - SIMPLET_PMTILES_HEADER)
+
+// Entries in each leaf directory, doubled until the root fits.
+#define SIMPLET_PMTILES_LEAF 4096
+
+// A run of tiles with the same contents, or a leaf directory when
+// run_length is zero.
+typedef struct {
+  uint64_t tile_id;
+  uint64_t offset;
+  uint32_t length;
+  uint32_t run_length;
+} simplet_pmtiles_entry_t;
+
+// A tile appended while writing, order breaks ties between repeats.
+typedef struct {
+  uint64_t tile_id;
+  size_t blob;
+  size_t order;
+} simplet_pmtiles_tile_t;
+
+// Distinct tile contents while writing.
+typedef struct {
+  uint64_t offset;     // in the scratch file
+  uint64_t clustered;  // in the archive, UINT64_MAX until placed
+  uint32_t length;
+} simplet_pmtiles_blob_t;
+
+typedef struct {
+  SIMPLET_ARCHIVE_FIELDS
+  char *path;
+
+  // writing: tile data goes to an unlinked scratch file until finished
+  int scratch;
+  uint64_t scratch_length;
+  simplet_lru_t *contents;  // digest to index in blobs
+  simplet_pmtiles_blob_t *blobs;
+  size_t blobs_length, blobs_size;
+  simplet_pmtiles_tile_t *tiles;
+  size_t tiles_length, tiles_size;
+  char **metadata;  // name and value pairs
+  size_t metadata_length;
+  unsigned int min_zoom, max_zoom;
+  double west, south, east, north;
+
+  // reading: the whole file is mapped
+  const unsigned char *map;
+  size_t map_length;
+  simplet_pmtiles_entry_t *root;
+  size_t root_length;
+  simplet_lru_t *leaves;
+  uint64_t leaf_offset;
+  uint64_t data_offset;
+} simplet_pmtiles_t;
+
+simplet_pmtiles_t *simplet_pmtiles_create(const char *path);
+
+simplet_pmtiles_t *simplet_pmtiles_open(const char *path);
+
+simplet_status_t simplet_pmtiles_append(simplet_pmtiles_t *pmtiles,
+                                        unsigned int x, unsigned int y,
+                                        unsigned int z,
+                                        const unsigned char *data,
+                                        size_t length);
+
+simplet_status_t simplet_pmtiles_set_metadata(simplet_pmtiles_t *pmtiles,
+                                              const char *name,
+                                              const char *value);
+
+unsigned char *simplet_pmtiles_get(simplet_pmtiles_t *pmtiles, unsigned int x,
+                                   unsigned int y, unsigned int z,
+                                   size_t *length);
+
+simplet_status_t simplet_pmtiles_finish(simplet_pmtiles_t *pmtiles);
+
+void simplet_pmtiles_close(simplet_pmtiles_t *pmtiles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// The most threads a pool starts.
+#define SIMPLET_POOL_MAX 256
+
+typedef struct {
+  simplet_pool_work_t work;
+  void *data;
+  int worker;
+} pool_thread_t;
+
+static void *pool_thread(void *arg) {
+  pool_thread_t *thread = arg;
+  thread->work(thread->data, thread->worker);
+  return NULL;
+}
+
+// The number of processors online, at least one.
+int simplet_pool_size() {
+  long size = sysconf(_SC_NPROCESSORS_ONLN);
+  if (size < 1) return 1;
+  return size > SIMPLET_POOL_MAX ? SIMPLET_POOL_MAX : (int)size;
+}
+
+// Run work on up to workers threads, the calling thread included, and wait
+// for all of them to finish. Threads that can't be started are skipped, so
+// work must be shared out as it's pulled rather than split up front.
+// Returns the number of workers that ran.
+int simplet_pool_run(simplet_pool_work_t work, void *data, int workers) {
+  if (workers > SIMPLET_POOL_MAX) workers = SIMPLET_POOL_MAX;
+
+  pool_thread_t *threads = NULL;
+  pthread_t *ids = NULL;
+  if (workers > 1 && (threads = malloc(sizeof(*threads) * workers)) &&
+      !(ids = malloc(sizeof(*ids) * workers))) {
+    free(threads);
+    threads = NULL;
+  }
+
+  int started = 1;
+  for (int i = 1; threads && i < workers; i++) {
+    threads[started].work = work;
+    threads[started].data = data;
+    threads[started].worker = started;
+    if (pthread_create(&ids[started], NULL, pool_thread, &threads[started]))
+      break;
+    started++;
+  }
+
+  work(data, 0);
+
+  for (int i = 1; i < started; i++) pthread_join(ids[i], NULL);
+  free(threads);
+  free(ids);
+  return started;
+}
+
+// Split length indices between workers. Returns NULL on failure.
+simplet_pool_ranges_t *simplet_pool_ranges_new(size_t length, int workers) {
+  if (workers < 1) workers = 1;
+  simplet_pool_ranges_t *ranges;
+  if (!(ranges = malloc(sizeof(*ranges)))) return NULL;
+  memset(ranges, 0, sizeof(*ranges));
+
+  if (!(ranges->next = malloc(sizeof(*ranges->next) * workers)) ||
+      !(ranges->end = malloc(sizeof(*ranges->end) * workers))) {
+    free(ranges->next);
+    free(ranges);
+    return NULL;
+  }
+  pthread_mutex_init(&ranges->lock, NULL);
+  ranges->workers = workers;
+  size_t share = length / workers, extra = length % workers, start = 0;
+  for (int i = 0; i < workers; i++) {
+    ranges->next[i] = start;
+    start += share + ((size_t)i < extra);
+    ranges->end[i] = start;
+  }
+  return ranges;
+}
+
+// Take the next index for worker, stealing when its own range is used up.
+// Returns false once every index has been handed out.
+bool simplet_pool_ranges_next(simplet_pool_ranges_t *ranges, int worker,
+                              size_t *index) {
+  pthread_mutex_lock(&ranges->lock);
+  size_t *next = ranges->next, *end = ranges->end;
+  if (next[worker] == end[worker]) {
+    int victim = worker;
+    for (int i = 0; i < ranges->workers; i++)
+      if (end[i] - next[i] > end[victim] - next[victim]) victim = i;
+    size_t middle = next[victim] + (end[victim] - next[victim]) / 2;
+    next[worker] = middle;
+    end[worker] = end[victim];
+    end[victim] = middle;
+  }
+  bool found = next[worker] < end[worker];
+  if (found) *index = next[worker]++;
+  pthread_mutex_unlock(&ranges->lock);
+  return found;
+}
+
+// Free the ranges.
+void simplet_pool_ranges_free(simplet_pool_ranges_t *ranges) {
+  pthread_mutex_destroy(&ranges->lock);
+  free(ranges->next);
+  free(ranges->end);
+  free(ranges);
+}
@@ -0,0 +1,44 @@
+#ifndef _SIMPLE_TILES_POOL_H
+#define _SIMPLE_TILES_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* running work across a pool of threads */
+
+// Called once on each thread with the shared data and the worker's index,
+// zero being the calling thread. Workers pull their own work from data.
+typedef void (*simplet_pool_work_t)(void *data, int worker);
+
+int simplet_pool_size();
+
+int simplet_pool_run(simplet_pool_work_t work, void *data, int workers);
+
+// The indices below a length split into a contiguous range per worker, each
+// taken from the front by its worker. A worker whose range runs out steals
+// the back half of the largest one left, so neighbouring indices mostly stay
+// on one thread.
+typedef struct {
+  pthread_mutex_t lock;
+  int workers;
+  size_t *next;
+  size_t *end;
+} simplet_pool_ranges_t;
+
+simplet_pool_ranges_t *simplet_pool_ranges_new(size_t length, int workers);
+
+bool simplet_pool_ranges_next(simplet_pool_ranges_t *ranges, int worker,
+                              size_t *index);
+
+void simplet_pool_ranges_free(simplet_pool_ranges_t *ranges);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
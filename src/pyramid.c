@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pyramid.h"
+#include "raster_layer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMPLET_X86
+#include <immintrin.h>
+#endif
+
+// Taps along an axis for a lanczos halving, three lobes of the kernel
+// stretched over twice as many source pixels.
+#define LANCZOS_TAPS 12
+
+// Average each 2x2 block, rounding to nearest. Premultiplied channels can be
+// averaged independently and stay no greater than alpha.
+void simplet_downsample_box(const uint32_t *src, int src_stride,
+                            uint32_t *dst, int dst_stride, int width,
+                            int height) {
+  for (int y = 0; y < height; y++) {
+    const uint8_t *top = (const uint8_t *)(src + (size_t)y * 2 * src_stride);
+    const uint8_t *bottom = top + (size_t)src_stride * 4;
+    uint8_t *out = (uint8_t *)(dst + (size_t)y * dst_stride);
+    for (int x = 0; x < width * 4; x++) {
+      int i = x / 4 * 8 + x % 4;
+      out[x] = (top[i] + top[i + 4] + bottom[i] + bottom[i + 4] + 2) >> 2;
+    }
+  }
+}
+
+#ifdef SIMPLET_X86
+// Sum both rows, then neighbouring pixels, in 16 bit lanes, four parents at
+// a time.
+__attribute__((target("sse2"))) static void downsample_sse2(
+    const uint32_t *src, int src_stride, uint32_t *dst, int dst_stride,
+    int width, int height) {
+  const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+  for (int y = 0; y < height; y++) {
+    const uint32_t *top = src + (size_t)y * 2 * src_stride;
+    const uint32_t *bottom = top + src_stride;
+    uint32_t *out = dst + (size_t)y * dst_stride;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(top + x * 2));
+      __m128i b = _mm_loadu_si128((const __m128i *)(top + x * 2 + 4));
+      __m128i c = _mm_loadu_si128((const __m128i *)(bottom + x * 2));
+      __m128i d = _mm_loadu_si128((const __m128i *)(bottom + x * 2 + 4));
+
+      // each register holds two source pixels summed down
+      __m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                  _mm_unpacklo_epi8(c, zero));
+      __m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                  _mm_unpackhi_epi8(c, zero));
+      __m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero),
+                                  _mm_unpacklo_epi8(d, zero));
+      __m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero),
+                                  _mm_unpackhi_epi8(d, zero));
+
+      // and the pair summed across in the low half
+      p01 = _mm_add_epi16(p01, _mm_srli_si128(p01, 8));
+      p23 = _mm_add_epi16(p23, _mm_srli_si128(p23, 8));
+      p45 = _mm_add_epi16(p45, _mm_srli_si128(p45, 8));
+      p67 = _mm_add_epi16(p67, _mm_srli_si128(p67, 8));
+
+      __m128i low = _mm_srli_epi16(
+          _mm_add_epi16(_mm_unpacklo_epi64(p01, p23), two), 2);
+      __m128i high = _mm_srli_epi16(
+          _mm_add_epi16(_mm_unpacklo_epi64(p45, p67), two), 2);
+      _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(low, high));
+    }
+    if (x < width)
+      simplet_downsample_box(top + x * 2, src_stride, out + x, dst_stride,
+                             width - x, 1);
+  }
+}
+#endif
+
+// Pick the fastest box reduction this CPU supports.
+simplet_downsample_t simplet_downsample_best() {
+#ifdef SIMPLET_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) return downsample_sse2;
+#endif
+  return simplet_downsample_box;
+}
+
+static int clamp(int value, int min, int max) {
+  return value < min ? min : value > max ? max : value;
+}
+
+// Colors are clamped to alpha as well as to a byte since lanczos rings.
+static uint32_t pack(const float *sum) {
+  float alpha = sum[3] < 0 ? 0 : sum[3] > 255 ? 255 : sum[3];
+  uint32_t pixel = (uint32_t)(alpha + 0.5f) << 24;
+  for (int c = 0; c < 3; c++) {
+    float value = sum[c] < 0 ? 0 : sum[c] > alpha ? alpha : sum[c];
+    pixel |= (uint32_t)(value + 0.5f) << (c * 8);
+  }
+  return pixel;
+}
+
+// Halve with a lanczos filter, across then down, repeating the edge pixels
+// where the taps run off the image. Returns false on failure.
+bool simplet_downsample_lanczos(const uint32_t *src, int src_stride,
+                                uint32_t *dst, int dst_stride, int width,
+                                int height) {
+  // Every parent is centered between the same two source pixels, so a
+  // single row of weights serves for every one of them.
+  float weights[LANCZOS_TAPS];
+  double total = 0;
+  for (int i = 0; i < LANCZOS_TAPS; i++) {
+    weights[i] = simplet_lanczos((i - (LANCZOS_TAPS - 1) / 2.0) / 2);
+    total += weights[i];
+  }
+  for (int i = 0; i < LANCZOS_TAPS; i++) weights[i] /= total;
+
+  // Each source row widened to floats with the edge pixels repeated into
+  // the padding, so the taps never need clamping.
+  int rows = height * 2, pad = LANCZOS_TAPS / 2 - 1;
+  size_t line_length = (size_t)(width * 2 + pad * 2) * 4;
+  float *across, *line;
+  if (!(across = malloc((size_t)width * rows * 4 * sizeof(*across))))
+    return false;
+  if (!(line = malloc(line_length * sizeof(*line)))) {
+    free(across);
+    return false;
+  }
+
+  for (int y = 0; y < rows; y++) {
+    const uint8_t *row = (const uint8_t *)(src + (size_t)y * src_stride);
+    for (int x = -pad; x < width * 2 + pad; x++)
+      for (int c = 0; c < 4; c++)
+        line[(x + pad) * 4 + c] = row[clamp(x, 0, width * 2 - 1) * 4 + c];
+
+    float *out = across + (size_t)y * width * 4;
+    for (int x = 0; x < width; x++) {
+      const float *taps = line + x * 8;
+      float sum[4] = {0, 0, 0, 0};
+      for (int i = 0; i < LANCZOS_TAPS; i++)
+        for (int c = 0; c < 4; c++) sum[c] += taps[i * 4 + c] * weights[i];
+      memcpy(out + x * 4, sum, sizeof(sum));
+    }
+  }
+  free(line);
+
+  float *sums;
+  if (!(sums = malloc((size_t)width * 4 * sizeof(*sums)))) {
+    free(across);
+    return false;
+  }
+  for (int y = 0; y < height; y++) {
+    memset(sums, 0, (size_t)width * 4 * sizeof(*sums));
+    for (int j = 0; j < LANCZOS_TAPS; j++) {
+      const float *row =
+          across + (size_t)clamp(y * 2 - pad + j, 0, rows - 1) * width * 4;
+      for (int i = 0; i < width * 4; i++) sums[i] += row[i] * weights[j];
+    }
+    for (int x = 0; x < width; x++)
+      dst[(size_t)y * dst_stride + x] = pack(sums + x * 4);
+  }
+  free(sums);
+
+  free(across);
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef _SIMPLE_TILES_PYRAMID_H
+#define _SIMPLE_TILES_PYRAMID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* halving tiles of premultiplied ARGB pixels */
+
+// Shrink a width * 2 by height * 2 image with src_stride pixels per row to
+// width by height, writing rows of dst_stride pixels.
+typedef void (*simplet_downsample_t)(const uint32_t *src, int src_stride,
+                                     uint32_t *dst, int dst_stride, int width,
+                                     int height);
+
+void simplet_downsample_box(const uint32_t *src, int src_stride,
+                            uint32_t *dst, int dst_stride, int width,
+                            int height);
+
+simplet_downsample_t simplet_downsample_best();
+
+bool simplet_downsample_lanczos(const uint32_t *src, int src_stride,
+                                uint32_t *dst, int dst_stride, int width,
+                                int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -50,6 +50,7 @@ void simplet_query_free(simplet_query_t *query) {
 
 // Add an error function.
 SIMPLET_ERROR_FUNC(query_t)
+SIMPLET_MAP_ERROR_FUNC
 
 // Set the OGR SQL on this query.
 simplet_status_t simplet_query_set(simplet_query_t *query, const char *sql) {
@@ -203,14 +204,126 @@ static void set_seamless(simplet_list_t *styles, cairo_t *ctx) {
     cairo_set_operator(ctx, CAIRO_OPERATOR_SATURATE);
 }
 
+// Per-query drawing state for a feature scan shared by several queries.
+typedef struct {
+  cairo_surface_t *surface;
+  cairo_t *ctx;
+} pass_t;
+
+// Tear down the drawing state for the first count passes.
+static void passes_free(pass_t *passes, unsigned int count) {
+  for (unsigned int i = 0; i < count; i++) {
+    if (passes[i].ctx) cairo_destroy(passes[i].ctx);
+    if (passes[i].surface) cairo_surface_destroy(passes[i].surface);
+  }
+}
+
+// Check if a query's labels are placed once across the whole layer.
+static bool global_placement(simplet_list_t *styles) {
+  simplet_style_t *placement = simplet_lookup_style(styles, "text-placement");
+  return placement && !strcmp(placement->arg, "global");
+}
+
+// Drop the references to the first count label indexes.
+static void indexes_free(simplet_label_index_t **indexes, unsigned int count) {
+  for (unsigned int i = 0; i < count; i++)
+    if (indexes[i]) simplet_label_index_free(indexes[i]);
+}
+
+// Find, or build and cache, the label index for query at the map's current
+// srs and resolution. Labels are placed once against every feature in the
+// layer in global pixels, the map's pixels without the translation to its
+// bounds, so every tile at a zoom level draws the same labels and they line
+// up across tile edges. The index is keyed to the source's stamp, so it is
+// rebuilt when the source changes.
+static simplet_label_index_t *label_index(
+    simplet_query_t *query, simplet_map_t *map, OGRDataSourceH source,
+    OGRCoordinateTransformationH transform, const char *stamp,
+    cairo_matrix_t *mat) {
+  simplet_style_t *field = simplet_lookup_style(query->styles, "text-field");
+  simplet_style_t *font = simplet_lookup_style(query->styles, "font");
+  simplet_style_t *spacing =
+      simplet_lookup_style(query->styles, "letter-spacing");
+
+  // Tiles at the same zoom level only agree on their scale to a handful of
+  // digits, so round it off for the key.
+  char *srs = NULL, *key;
+  simplet_map_get_srs(map, &srs);
+  int ret = asprintf(&key, "%s\n%s\n%s\n%s\n%s\n%s\n%.9g\n%.9g",
+                     stamp ? stamp : "", query->ogrsql, field->arg,
+                     font ? font->arg : "", spacing ? spacing->arg : "",
+                     srs ? srs : "", mat->xx, mat->yy);
+  free(srs);
+  if (ret < 0) return NULL;
+
+  // only one thread scans the layer, the others wait for its index
+  simplet_label_index_t *index;
+  bool build;
+  if ((index = simplet_label_index_lookup(key, &build)) || !build) {
+    free(key);
+    return index;
+  }
+
+  OGRLayerH olayer;
+  if (!(olayer = OGR_DS_ExecuteSQL(source, query->ogrsql, NULL, NULL)) ||
+      !(index = simplet_label_index_new())) {
+    if (olayer) OGR_DS_ReleaseResultSet(source, olayer);
+    simplet_label_index_store(key, NULL);
+    free(key);
+    return NULL;
+  }
+
+  // Place the features in source order, earlier features win collisions.
+  OGRFeatureH feature;
+  while ((feature = OGR_L_GetNextFeature(olayer))) {
+    double x, y;
+    if (simplet_lithograph_anchor(stamp, query->ogrsql, feature, &x, &y) &&
+        (!transform || OCTTransform(transform, 1, &x, &y, NULL)))
+      simplet_label_index_add_placement(index, feature, query->styles,
+                                        x * mat->xx + y * mat->xy,
+                                        x * mat->yx + y * mat->yy);
+    OGR_F_Destroy(feature);
+  }
+
+  OGR_DS_ReleaseResultSet(source, olayer);
+  simplet_label_index_store(key, index);
+  free(key);
+  return index;
+}
+
+// The area features are read from, the map's bounds grown by its buffer so
+// strokes and labels of features just outside still reach the edge. Returns
+// NULL when out of memory.
+static OGRGeometryH read_bounds(simplet_map_t *map) {
+  if (simplet_map_get_buffer(map) <= 0)
+    return simplet_bounds_to_ogr(map->bounds, map->proj);
+
+  cairo_matrix_t mat;
+  simplet_map_init_matrix(map, &mat);
+  cairo_matrix_invert(&mat);
+  double dx, dy;
+  dx = dy = simplet_map_get_buffer(map);
+  cairo_matrix_transform_distance(&mat, &dx, &dy);
+
+  simplet_bounds_t *bbounds;
+  if (!(bbounds = simplet_bounds_buffer(map->bounds, dx))) return NULL;
+  OGRGeometryH bounds = simplet_bounds_to_ogr(bbounds, map->proj);
+  free(bbounds);
+  return bounds;
+}
+
 // This is the meat of rendering. In this function, we hit the actual data
 // sources, perform transformation, add labels to the lithograph,
-// and plot the individual geometries.
-simplet_status_t simplet_query_process(simplet_query_t *query,
-                                       simplet_map_t *map,
-                                       OGRDataSourceH source,
-                                       simplet_lithograph_t *litho,
-                                       cairo_t *ctx) {
+// and plot the individual geometries. Every query passed in must share the
+// same SQL: the features are read and transformed once, then handed to each
+// query in turn, each drawing onto its own surface. The surfaces are
+// composited in order so each query blends exactly as if run on its own.
+static simplet_status_t process(simplet_query_t **queries, unsigned int count,
+                                simplet_map_t *map, OGRDataSourceH source,
+                                simplet_lithograph_t *litho, cairo_t *ctx,
+                                bool apply_labels) {
+  simplet_query_t *query = queries[0];
+
   // Grab a layer in order to suss out the srs
   OGRLayerH olayer;
   if (!(olayer = OGR_DS_ExecuteSQL(source, query->ogrsql, NULL, NULL))) {
@@ -219,94 +332,196 @@ simplet_status_t simplet_query_process(simplet_query_t *query,
       // FIXME: This should be a problem, but it is ignored right now.
       return SIMPLET_OK;
     } else {
-      return set_error(query, SIMPLET_OGR_ERR, CPLGetLastErrorMsg());
+      return map_error(map, SIMPLET_OGR_ERR, CPLGetLastErrorMsg());
     }
   }
 
   // Grab an srs.
   OGRSpatialReferenceH srs = OGR_L_GetSpatialRef(olayer);
 
-  // If the map has a buffer we need to grow the bounds a bit to grab more
-  // data from the data source.
   OGRGeometryH bounds;
-  if (simplet_map_get_buffer(map) > 0) {
-    cairo_matrix_t mat;
-    simplet_map_init_matrix(map, &mat);
-    cairo_matrix_invert(&mat);
-    double dx, dy;
-    dx = dy = simplet_map_get_buffer(map);
-    cairo_matrix_transform_distance(&mat, &dx, &dy);
-
-    simplet_bounds_t *bbounds = simplet_bounds_buffer(map->bounds, dx);
-    if (!bbounds) {
-      OGR_DS_ReleaseResultSet(source, olayer);
-      return SIMPLET_OGR_ERR;
-    }
-    bounds = simplet_bounds_to_ogr(bbounds, map->proj);
-    free(bbounds);
-  } else {
-    bounds = simplet_bounds_to_ogr(map->bounds, map->proj);
+  if (!(bounds = read_bounds(map))) {
+    OGR_DS_ReleaseResultSet(source, olayer);
+    return map_error(map, SIMPLET_OOM, "out of memory buffering bounds");
   }
   // Transform the OGR bounds to the source's srs.
   OGR_G_TransformTo(bounds, srs);
-  OGR_DS_ReleaseResultSet(source, olayer);
-
-  // Execute the SQL and limit it to returning only the bounds set on the map.
-  olayer = OGR_DS_ExecuteSQL(source, query->ogrsql, bounds, NULL);
-  if (!olayer) return set_error(query, SIMPLET_OGR_ERR, CPLGetLastErrorMsg());
 
   // Create a transorm to use in rendering later.
   OGRCoordinateTransformationH transform =
       OCTNewCoordinateTransformation(srs, map->proj);
-
-  // Copy the original surface so we don't muss about with defaults.
-  cairo_surface_t *surface = cairo_surface_create_similar(
-      cairo_get_target(ctx), CAIRO_CONTENT_COLOR_ALPHA, map->width,
-      map->height);
-  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-    return set_error(
-        query, SIMPLET_CAIRO_ERR,
-        (const char *)cairo_status_to_string(cairo_surface_status(surface)));
-
-  // Setup seamless rendering.
-  cairo_t *sub_ctx = cairo_create(surface);
-  set_seamless(query->styles, sub_ctx);
+  OGR_DS_ReleaseResultSet(source, olayer);
 
   // Initialize the transformation matrix.
   cairo_matrix_t mat;
   simplet_map_init_matrix(map, &mat);
-  cairo_set_matrix(sub_ctx, &mat);
+
+  // Only look for label anchors if one of the queries places labels, and
+  // look up the layer wide placements for queries that use them. Those are
+  // built from a scan of their own, so it has to happen before the main one.
+  bool labeled = false;
+  char *stamp = NULL;
+  simplet_label_index_t *indexes[count];
+  for (unsigned int i = 0; i < count; i++) {
+    indexes[i] = NULL;
+    if (!simplet_lookup_style(queries[i]->styles, "text-field")) continue;
+    if (!stamp) stamp = simplet_source_stamp(OGR_DS_GetName(source));
+    if (global_placement(queries[i]->styles))
+      indexes[i] =
+          label_index(queries[i], map, source, transform, stamp, &mat);
+    else
+      labeled = true;
+  }
+
+  // Execute the SQL and limit it to returning only the bounds set on the map.
+  olayer = OGR_DS_ExecuteSQL(source, query->ogrsql, bounds, NULL);
+  if (!olayer) {
+    indexes_free(indexes, count);
+    free(stamp);
+    OGR_G_DestroyGeometry(bounds);
+    OCTDestroyCoordinateTransformation(transform);
+    return map_error(map, SIMPLET_OGR_ERR, CPLGetLastErrorMsg());
+  }
+
+  pass_t passes[count];
+  memset(passes, 0, sizeof(passes));
+  for (unsigned int i = 0; i < count; i++) {
+    // Copy the original surface so we don't muss about with defaults.
+    passes[i].surface = cairo_surface_create_similar(
+        cairo_get_target(ctx), CAIRO_CONTENT_COLOR_ALPHA, map->width,
+        map->height);
+    if (cairo_surface_status(passes[i].surface) != CAIRO_STATUS_SUCCESS) {
+      simplet_status_t status = map_error(
+          map, SIMPLET_CAIRO_ERR,
+          (const char *)cairo_status_to_string(
+              cairo_surface_status(passes[i].surface)));
+      passes_free(passes, i + 1);
+      indexes_free(indexes, count);
+      free(stamp);
+      OGR_G_DestroyGeometry(bounds);
+      OGR_DS_ReleaseResultSet(source, olayer);
+      OCTDestroyCoordinateTransformation(transform);
+      return status;
+    }
+
+    // Setup seamless rendering.
+    passes[i].ctx = cairo_create(passes[i].surface);
+    set_seamless(queries[i]->styles, passes[i].ctx);
+    cairo_set_matrix(passes[i].ctx, &mat);
+  }
 
   // Loop through and place the features.
   OGRFeatureH feature;
   while ((feature = OGR_L_GetNextFeature(olayer))) {
     OGRGeometryH geom = OGR_F_GetGeometryRef(feature);
 
-    if (transform) OGR_G_Transform(geom, transform);
-
     if (geom == NULL) {
       OGR_F_Destroy(feature);
       continue;
     }
 
-    dispatch(geom, query, sub_ctx);
-    // Add feature labels, this is another loop, but it should be fast enough/
-    simplet_lithograph_add_placement(litho, feature, query->styles, sub_ctx);
+    // Label anchors are found, and cached, in the source's coordinates, so
+    // look them up before the geometry is transformed and then transform
+    // just the one point.
+    double x, y;
+    bool anchored =
+        labeled &&
+        simplet_lithograph_anchor(stamp, query->ogrsql, feature, &x, &y) &&
+        (!transform || OCTTransform(transform, 1, &x, &y, NULL));
+    if (anchored) cairo_matrix_transform_point(&mat, &x, &y);
+
+    if (transform) OGR_G_Transform(geom, transform);
+
+    for (unsigned int i = 0; i < count; i++) {
+      dispatch(geom, queries[i], passes[i].ctx);
+      // Add feature labels, this is another loop, but it should be fast
+      // enough.
+      if (anchored && !indexes[i])
+        simplet_lithograph_add_placement(litho, feature, queries[i]->styles,
+                                         x, y);
+    }
     OGR_F_Destroy(feature);
   }
+  free(stamp);
+
+  // Add the layer wide placements that land on this map.
+  for (unsigned int i = 0; i < count; i++)
+    if (indexes[i])
+      simplet_lithograph_add_index(litho, indexes[i], queries[i]->styles,
+                                   mat.x0, mat.y0, map->width, map->height);
+  indexes_free(indexes, count);
+
+  // Composite each query in order, placing labels as we go.
+  for (unsigned int i = 0; i < count; i++) {
+    cairo_set_source_surface(ctx, passes[i].surface, 0, 0);
+    simplet_apply_styles(ctx, queries[i]->styles, "blend", NULL);
+    cairo_paint(ctx);
+
+    if (apply_labels &&
+        simplet_lookup_style(queries[i]->styles, "text-field"))
+      simplet_lithograph_apply(litho, queries[i]->styles);
+  }
 
   // Cleanup.
-  cairo_set_source_surface(ctx, surface, 0, 0);
-  simplet_apply_styles(ctx, query->styles, "blend", NULL);
-  cairo_paint(ctx);
-  cairo_destroy(sub_ctx);
-  cairo_surface_destroy(surface);
+  passes_free(passes, count);
   OGR_G_DestroyGeometry(bounds);
   OGR_DS_ReleaseResultSet(source, olayer);
   OCTDestroyCoordinateTransformation(transform);
   return SIMPLET_OK;
 }
 
+// Render a single query onto ctx. Labels are collected on the lithograph but
+// left for the caller to apply.
+simplet_status_t simplet_query_process(simplet_query_t *query,
+                                       simplet_map_t *map,
+                                       OGRDataSourceH source,
+                                       simplet_lithograph_t *litho,
+                                       cairo_t *ctx) {
+  return process(&query, 1, map, source, litho, ctx, false);
+}
+
+// Render count queries that share the same SQL from a single feature scan,
+// compositing and labeling each in order. If more than one of the queries
+// places labels their candidates are interleaved feature by feature, so
+// callers that care about label priority should keep those apart.
+simplet_status_t simplet_query_process_shared(simplet_query_t **queries,
+                                              unsigned int count,
+                                              simplet_map_t *map,
+                                              OGRDataSourceH source,
+                                              simplet_lithograph_t *litho,
+                                              cairo_t *ctx) {
+  return process(queries, count, map, source, litho, ctx, true);
+}
+
+// Count the features drawing query on map would read, adding them to count.
+// A query that finds no layer counts none, just as it draws none.
+simplet_status_t simplet_query_count(simplet_query_t *query,
+                                     simplet_map_t *map,
+                                     OGRDataSourceH source, uint64_t *count) {
+  OGRLayerH olayer;
+  if (!(olayer = OGR_DS_ExecuteSQL(source, query->ogrsql, NULL, NULL))) {
+    if (!CPLGetLastErrorNo()) return SIMPLET_OK;
+    return map_error(map, SIMPLET_OGR_ERR, CPLGetLastErrorMsg());
+  }
+
+  OGRGeometryH bounds;
+  if ((bounds = read_bounds(map)))
+    OGR_G_TransformTo(bounds, OGR_L_GetSpatialRef(olayer));
+  OGR_DS_ReleaseResultSet(source, olayer);
+  if (!bounds)
+    return map_error(map, SIMPLET_OOM, "out of memory buffering bounds");
+
+  if (!(olayer = OGR_DS_ExecuteSQL(source, query->ogrsql, bounds, NULL))) {
+    OGR_G_DestroyGeometry(bounds);
+    return map_error(map, SIMPLET_OGR_ERR, CPLGetLastErrorMsg());
+  }
+  long long found = OGR_L_GetFeatureCount(olayer, 1);
+  OGR_DS_ReleaseResultSet(source, olayer);
+  OGR_G_DestroyGeometry(bounds);
+  if (found > 0) *count += found;
+  return SIMPLET_OK;
+}
+
 // Initialize and add a new style to this query.
 simplet_style_t *simplet_query_add_style(simplet_query_t *query,
                                          const char *key, const char *arg) {
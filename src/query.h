@@ -34,6 +34,17 @@ simplet_status_t simplet_query_process(simplet_query_t *query,
                                        simplet_lithograph_t *litho,
                                        cairo_t *ctx);
 
+simplet_status_t simplet_query_process_shared(simplet_query_t **queries,
+                                              unsigned int count,
+                                              simplet_map_t *map,
+                                              OGRDataSourceH source,
+                                              simplet_lithograph_t *litho,
+                                              cairo_t *ctx);
+
+simplet_status_t simplet_query_count(simplet_query_t *query,
+                                     simplet_map_t *map,
+                                     OGRDataSourceH source, uint64_t *count);
+
 SIMPLET_HAS_USER_DATA_PROTOS(query)
 
 #ifdef __cplusplus
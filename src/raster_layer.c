@@ -3,18 +3,29 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "raster_layer.h"
 #include "util.h"
 #include "error.h"
 #include "memory.h"
 #include "map.h"
+#include "resample.h"
+#include "pool.h"
+#include "mosaic.h"
+#include "colorize.h"
+#include "bandmath.h"
+#include "blocks.h"
 
 // Add in an error function.
 SIMPLET_ERROR_FUNC(raster_layer_t)
+SIMPLET_MAP_ERROR_FUNC
 
 SIMPLET_HAS_USER_DATA(raster_layer)
 
+// The default error in pixels allowed when approximating the reprojection.
+#define SIMPLET_MAX_ERROR 0.125
+
 simplet_raster_layer_t *simplet_raster_layer_new(const char *datastring) {
   simplet_raster_layer_t *layer;
   if (!(layer = malloc(sizeof(*layer)))) return NULL;
@@ -23,12 +34,41 @@ simplet_raster_layer_t *simplet_raster_layer_new(const char *datastring) {
   layer->source = simplet_copy_string(datastring);
   layer->type = SIMPLET_RASTER;
   layer->status = SIMPLET_OK;
+  layer->max_error = SIMPLET_MAX_ERROR;
 
   simplet_retain((simplet_retainable_t *)layer);
 
   return layer;
 }
 
+// Create a raster layer drawing a mosaic of many rasters, datastring names
+// either a directory of them or a file listing one per line. Scenes listed
+// earlier are drawn over later ones, and only those under the map are
+// opened. Returns NULL on failure.
+simplet_raster_layer_t *simplet_raster_layer_new_mosaic(
+    const char *datastring) {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new(datastring))) return NULL;
+
+  if (!(layer->mosaic = simplet_mosaic_new(datastring))) {
+    simplet_raster_layer_free(layer);
+    return NULL;
+  }
+  return layer;
+}
+
+// Set where a mosaic layer saves the footprints of its scenes so later
+// processes don't have to open every scene again, NULL keeps them in memory.
+// Defaults to .simplet-mosaic inside the directory or next to the list.
+simplet_status_t simplet_raster_layer_set_mosaic_index(
+    simplet_raster_layer_t *layer, const char *index) {
+  if (!layer->mosaic)
+    return set_error(layer, SIMPLET_ERR, "layer isn't a mosaic");
+  if (simplet_mosaic_set_index(layer->mosaic, index) != SIMPLET_OK)
+    return set_error(layer, SIMPLET_OOM, "out of memory setting index");
+  return SIMPLET_OK;
+}
+
 void simplet_raster_layer_set_resample(simplet_raster_layer_t *layer,
                                        simplet_kern_t resample) {
   layer->resample = resample;
@@ -39,37 +79,806 @@ simplet_kern_t simplet_raster_layer_get_resample(
   return layer->resample;
 }
 
+// Set how many pixels a reprojected source pixel may be off by. Larger errors
+// let more of each scanline be interpolated rather than transformed, zero
+// transforms every pixel exactly.
+void simplet_raster_layer_set_max_error(simplet_raster_layer_t *layer,
+                                        double max_error) {
+  layer->max_error = max_error < 0 ? 0 : max_error;
+}
+
+double simplet_raster_layer_get_max_error(simplet_raster_layer_t *layer) {
+  return layer->max_error;
+}
+
+// Set how many threads may warp the raster, zero uses one per processor.
+// Only outputs larger than a single band of rows are split up.
+void simplet_raster_layer_set_threads(simplet_raster_layer_t *layer,
+                                      int threads) {
+  layer->threads = threads < 0 ? 0 : threads;
+}
+
+int simplet_raster_layer_get_threads(simplet_raster_layer_t *layer) {
+  return layer->threads;
+}
+
+// Color the layer's first band through a ramp or palette of stops instead of
+// drawing its bands as colors. color is in #rrggbb or #rrggbbaa form. Stops
+// are kept sorted by value, stops sharing a value keep the order added.
+simplet_status_t simplet_raster_layer_add_color_stop(
+    simplet_raster_layer_t *layer, double value, const char *color) {
+  unsigned int r, g, b, a = 255;
+  if (!color || simplet_parse_color(color, &r, &g, &b, &a) < 3)
+    return set_error(layer, SIMPLET_ERR, "invalid color stop");
+
+  simplet_color_stop_t *stops;
+  if (!(stops = realloc(layer->stops,
+                        sizeof(*stops) * (layer->stops_length + 1))))
+    return set_error(layer, SIMPLET_OOM, "out of memory adding color stop");
+  layer->stops = stops;
+
+  int i = layer->stops_length++;
+  for (; i > 0 && stops[i - 1].value > value; i--) stops[i] = stops[i - 1];
+  stops[i].value = value;
+  stops[i].r = r;
+  stops[i].g = g;
+  stops[i].b = b;
+  stops[i].a = a;
+  return SIMPLET_OK;
+}
+
+// Color each value with the stop at or below it rather than blending
+// between stops, for classified data like land cover.
+void simplet_raster_layer_set_classified(simplet_raster_layer_t *layer,
+                                         bool classified) {
+  layer->classified = classified;
+}
+
+bool simplet_raster_layer_get_classified(simplet_raster_layer_t *layer) {
+  return layer->classified;
+}
+
+// Color the value of an expression over the layer's bands, like
+// (b4 - b3) / (b4 + b3), rather than its first band. Pixels where any band
+// the expression uses holds nodata are left out. NULL goes back to the first
+// band.
+simplet_status_t simplet_raster_layer_set_expression(
+    simplet_raster_layer_t *layer, const char *expression) {
+  simplet_expr_t *expr = NULL;
+  if (expression && !(expr = simplet_expr_new(expression)))
+    return set_error(layer, SIMPLET_ERR, "invalid band expression");
+  if (layer->expr) simplet_expr_free(layer->expr);
+  layer->expr = expr;
+  return SIMPLET_OK;
+}
+
+// Shade the layer's values as terrain lit from azimuth degrees clockwise
+// from north and altitude degrees above the horizon. z_factor converts
+// heights to the raster's ground units, for example about 1/111120 for
+// heights in meters over a raster in degrees, and zero turns shading off.
+// Shade runs from 0 to 255 and is drawn through the color stops.
+void simplet_raster_layer_set_hillshade(simplet_raster_layer_t *layer,
+                                        double azimuth, double altitude,
+                                        double z_factor) {
+  layer->azimuth = azimuth;
+  layer->altitude = altitude;
+  layer->z_factor = z_factor;
+}
+
+bool simplet_raster_layer_get_hillshade(simplet_raster_layer_t *layer) {
+  return layer->z_factor != 0;
+}
+
 void simplet_raster_layer_free(simplet_raster_layer_t *layer) {
   if (simplet_release((simplet_retainable_t *)layer) > 0) return;
   if (layer->error_msg) free(layer->error_msg);
+  if (layer->mosaic) simplet_mosaic_free(layer->mosaic);
+  if (layer->expr) simplet_expr_free(layer->expr);
+  free(layer->stops);
   free(layer->source);
   free(layer);
 }
 
-static double sinc(double x) {
-  if (x == 0.0) return 1.0;
-  return sin(M_PI * x) / (M_PI * x);
+// The most output pixels warped from a single windowed read.
+#define SIMPLET_WARP_PIXELS (256 * 256)
+
+// Everything a warp needs that doesn't change from pixel to pixel.
+typedef struct {
+  GDALDatasetH source;
+  char *stamp;
+  int x_size;
+  int y_size;
+  double x_scale;
+  double y_scale;
+  int overview;
+  int bands;
+  int band_map[4];
+  int band_offset;
+  GDALRasterBandH band_handles[SIMPLET_EXPR_BANDS];
+  int has_no_data[SIMPLET_EXPR_BANDS];
+  double no_data[SIMPLET_EXPR_BANDS];
+  GDALTransformerFunc transform;
+  void *transform_args;
+  bool affine;
+  double to_source[6];
+  float *weights;
+  int taps;
+  simplet_convolve_t convolve;
+  simplet_lut_t *lut;
+  simplet_colorize_t colorize;
+  const simplet_expr_t *expr;
+  bool used[SIMPLET_EXPR_BANDS];
+  bool hillshade;
+  simplet_relief_t relief;
+  int width;
+  int height;
+  uint32_t *data;
+  int stride;
+} warp_t;
+
+// Windows hold pixels as four bytes in cairo's ARGB32 order on little endian
+// machines: blue, green, red and alpha. Bands one through four land in red,
+// green, blue and alpha.
+static const int channels[4] = {2, 1, 0, 3};
+
+static int clamp(int value, int min, int max) {
+  return value < min ? min : value > max ? max : value;
 }
 
-simplet_status_t simplet_raster_layer_process(simplet_raster_layer_t *layer,
-                                              simplet_map_t *map,
-                                              cairo_t *ctx) {
-  // process the map
-  int width = map->width;
-  int height = map->height;
+// Check if any band of a window pixel holds its nodata value.
+static bool is_no_data(warp_t *warp, const GByte *pixel) {
+  for (int band = 0; band < warp->bands; band++)
+    if (warp->has_no_data[band] &&
+        warp->no_data[band] == pixel[channels[band]])
+      return true;
+  return false;
+}
+
+// Get a freshly read window ready to sample: pixels holding nodata become
+// fully transparent and colors are premultiplied by alpha, as cairo expects,
+// so kernels blend across transparent edges without bleeding color.
+static void prepare_window(warp_t *warp, GByte *window, size_t length) {
+  bool no_data = false;
+  for (int band = 0; band < warp->bands; band++)
+    if (warp->has_no_data[band]) no_data = true;
+  if (!no_data && warp->bands < 4) return;
 
-  GDALDatasetH source = GDALOpen(layer->source, GA_ReadOnly);
-  if (source == NULL)
-    return set_error(layer, SIMPLET_GDAL_ERR, "error opening raster source");
+  for (size_t i = 0; i < length; i += 4) {
+    GByte *pixel = window + i;
+    if (no_data && is_no_data(warp, pixel)) {
+      memset(pixel, 0, 4);
+      continue;
+    }
+    unsigned int alpha = pixel[3];
+    if (alpha == 0xff) continue;
+    for (int c = 0; c < 3; c++) pixel[c] = (pixel[c] * alpha + 127) / 255;
+  }
+}
+
+// Pack a window pixel into ARGB as is.
+static uint32_t pack(const GByte *pixel) {
+  return (uint32_t)pixel[3] << 24 | pixel[2] << 16 | pixel[1] << 8 | pixel[0];
+}
 
-  int bands = GDALGetRasterCount(source);
-  if (bands > 4) bands = 4;
+// Copy nearest neighbor pixels for a warp that only scales and translates.
+// Every row samples the same columns, so they are looked up once from the
+// first row and each row is a gather from one source row. Returns false if
+// the column table can't be allocated.
+static bool copy_aligned(warp_t *warp, const GByte *window, int buf_w,
+                         int buf_h, double min_x, double min_y,
+                         double x_scale, double y_scale,
+                         const double *x_lookup, const double *y_lookup,
+                         const int *test, int y0, int y1) {
+  int width = warp->width;
+  int *cols;
+  if (!(cols = malloc(width * sizeof(*cols)))) return false;
+  for (int x = 0; x < width; x++)
+    cols[x] = clamp((int)((x_lookup[x] - min_x) * x_scale), 0, buf_w - 1) * 4;
+
+  for (int y = y0, i = 0; y < y1; y++, i += width) {
+    uint32_t *scanline = warp->data + (size_t)y * warp->stride;
+    int cy = clamp((int)((y_lookup[i] - min_y) * y_scale), 0, buf_h - 1);
+    const GByte *row = window + (size_t)cy * buf_w * 4;
+    for (int x = 0; x < width; x++) {
+      const GByte *pixel = row + cols[x];
+      if (test[i + x] && pixel[3]) scanline[x] = pack(pixel);
+    }
+  }
+  free(cols);
+  return true;
+}
+
+// Resample rows y0 up to y1 from the window with the layer's kernel. Taps
+// that hang off the window are clamped a pixel at a time, the rest of each
+// row goes to the convolution in one call. Returns false if the row buffers
+// can't be allocated.
+static bool resample_rows(warp_t *warp, const GByte *window, int buf_w,
+                          int buf_h, double min_x, double min_y,
+                          double x_scale, double y_scale,
+                          const double *x_lookup, const double *y_lookup,
+                          const int *test, int y0, int y1) {
+  int width = warp->width, taps = warp->taps;
+  simplet_tap_t *pixels = malloc(width * sizeof(*pixels));
+  int *targets = malloc(width * sizeof(*targets));
+  uint32_t *out = malloc(width * sizeof(*out));
+  if (!pixels || !targets || !out) {
+    free(pixels);
+    free(targets);
+    free(out);
+    return false;
+  }
+
+  for (int y = y0, i = 0; y < y1; y++) {
+    uint32_t *scanline = warp->data + (size_t)y * warp->stride;
+    int count = 0;
+    for (int x = 0; x < width; x++, i++) {
+      if (!test[i]) continue;
+      double u = (x_lookup[i] - min_x) * x_scale;
+      double v = (y_lookup[i] - min_y) * y_scale;
+
+      // leave the pixel fully transparent if we don't have a pixel value
+      const GByte *center =
+          window + ((size_t)clamp((int)v, 0, buf_h - 1) * buf_w +
+                    clamp((int)u, 0, buf_w - 1)) * 4;
+      if (!center[3]) continue;
+
+      int first_x, first_y, x_phase, y_phase;
+      simplet_resample_locate(u, taps, &first_x, &x_phase);
+      simplet_resample_locate(v, taps, &first_y, &y_phase);
+      if (first_x < 0 || first_y < 0 || first_x + taps > buf_w ||
+          first_y + taps > buf_h) {
+        scanline[x] =
+            simplet_resample_clamped(window, buf_w, buf_h, taps, warp->weights,
+                                     first_x, first_y, x_phase, y_phase);
+        continue;
+      }
+
+      pixels[count].offset = ((uint32_t)first_y * buf_w + first_x) * 4;
+      pixels[count].x_phase = x_phase;
+      pixels[count].y_phase = y_phase;
+      targets[count++] = x;
+    }
+
+    warp->convolve(window, (size_t)buf_w * 4, taps, warp->weights, pixels,
+                   count, out);
+    for (int k = 0; k < count; k++) scanline[targets[k]] = out[k];
+  }
+
+  free(pixels);
+  free(targets);
+  free(out);
+  return true;
+}
+
+// Read a window of a band at the chosen level, converted to type. Reads at
+// the level's own resolution go through the shared block cache so later
+// tiles over the same blocks don't decode them again, decimated reads go
+// straight to GDAL.
+static bool read_band_window(warp_t *warp, int band, int x, int y, int w,
+                             int h, void *out, int buf_w, int buf_h,
+                             GDALDataType type, int pixel_space,
+                             int line_space) {
+  if (!warp->stamp || buf_w != w || buf_h != h)
+    return GDALRasterIO(warp->band_handles[band], GF_Read, x, y, w, h, out,
+                        buf_w, buf_h, type, pixel_space,
+                        line_space) == CE_None;
+  return simplet_blocks_read(warp->band_handles[band], warp->stamp,
+                             warp->overview, band + 1, x, y, w, h, out, type,
+                             pixel_space, line_space);
+}
+
+// Read a band's values into a buffer, nodata becoming NaN.
+static bool read_band(warp_t *warp, int band, int x, int y, int w, int h,
+                      float *values, int buf_w, int buf_h) {
+  if (!read_band_window(warp, band, x, y, w, h, values, buf_w, buf_h,
+                        GDT_Float32, sizeof(float), buf_w * sizeof(float)))
+    return false;
+  if (!warp->has_no_data[band]) return true;
+
+  float no_data = (float)warp->no_data[band];
+  for (size_t i = 0; i < (size_t)buf_w * buf_h; i++)
+    if (values[i] == no_data) values[i] = NAN;
+  return true;
+}
+
+// Compute the values a window colors: the layer's expression or its first
+// band, shaded when it's terrain. Returns false if the source couldn't be
+// read or the buffers allocated.
+static bool read_values(warp_t *warp, int x, int y, int w, int h,
+                        float *values, int buf_w, int buf_h) {
+  size_t count = (size_t)buf_w * buf_h;
+  int reads = warp->expr ? warp->bands : 0;
+  float *buffer, *bands[SIMPLET_EXPR_BANDS];
+  if (!(buffer = malloc(count * (reads + warp->hillshade) * sizeof(float))))
+    return false;
+
+  // shading needs the values apart from where it writes
+  float *surface = warp->hillshade ? buffer + count * reads : values;
+  bool ok = true;
+  if (warp->expr) {
+    for (int band = 0; band < reads && ok; band++) {
+      bands[band] = buffer + count * band;
+      if (warp->used[band])
+        ok = read_band(warp, band, x, y, w, h, bands[band], buf_w, buf_h);
+    }
+    if (ok)
+      simplet_expr_eval(warp->expr, (const float *const *)bands, (int)count,
+                        surface);
+  } else {
+    ok = read_band(warp, 0, x, y, w, h, surface, buf_w, buf_h);
+  }
+
+  // cells of a decimated read cover more ground
+  if (ok && warp->hillshade) {
+    simplet_relief_t relief = warp->relief;
+    relief.x_res *= (double)w / buf_w;
+    relief.y_res *= (double)h / buf_h;
+    simplet_hillshade(surface, buf_w, buf_h, &relief, values);
+  }
+  free(buffer);
+  return ok;
+}
+
+// Read the window at x, y, w by h from the chosen level into a buf_w by
+// buf_h window of four byte pixels, sources without an alpha band come out
+// opaque. Colorized sources are read as values and colored in place.
+// Returns false on failure.
+static bool read_window(warp_t *warp, int x, int y, int w, int h,
+                        GByte *window, int buf_w, int buf_h) {
+  if (warp->expr || warp->hillshade) {
+    if (!read_values(warp, x, y, w, h, (float *)window, buf_w, buf_h))
+      return false;
+    warp->colorize(warp->lut, (const float *)window, buf_w * buf_h,
+                   (uint32_t *)window);
+    return true;
+  }
+
+  if (warp->lut) {
+    if (!read_band_window(warp, 0, x, y, w, h, window, buf_w, buf_h,
+                          GDT_Float32, sizeof(float), buf_w * sizeof(float)))
+      return false;
+    warp->colorize(warp->lut, (const float *)window, buf_w * buf_h,
+                   (uint32_t *)window);
+    return true;
+  }
+
+  size_t length = (size_t)buf_w * buf_h * 4;
+  memset(window, 0, length);
+  if (warp->bands < 4)
+    for (size_t i = 3; i < length; i += 4) window[i] = 0xff;
+
+  // decimated full resolution reads take every band in one call
+  bool cached = warp->stamp && buf_w == w && buf_h == h;
+  if (warp->overview < 0 && !cached)
+    return GDALDatasetRasterIO(warp->source, GF_Read, x, y, w, h,
+                               window + warp->band_offset, buf_w, buf_h,
+                               GDT_Byte, warp->bands, warp->band_map, 4,
+                               buf_w * 4, 1) == CE_None;
+
+  for (int band = 0; band < warp->bands; band++)
+    if (!read_band_window(warp, band, x, y, w, h, window + channels[band],
+                          buf_w, buf_h, GDT_Byte, 4, buf_w * 4))
+      return false;
+  return true;
+}
+
+// Transform output pixels to source pixels with the affine in args, used when
+// the source and map share a spatial reference.
+static int affine_transform(void *args, int dst_to_src, int count, double *x,
+                            double *y, double *z, int *test) {
+  (void)dst_to_src, (void)z;
+  const double *t = args;
+  for (int i = 0; i < count; i++) {
+    double px = x[i], py = y[i];
+    x[i] = t[0] + px * t[1] + py * t[2];
+    y[i] = t[3] + px * t[4] + py * t[5];
+    test[i] = TRUE;
+  }
+  return TRUE;
+}
+
+// Create a transformer reprojecting output pixels to source pixels, returns
+// false on failure.
+static bool create_transformer(warp_t *warp, const char *src_wkt,
+                               double *src_t, simplet_map_t *map,
+                               double *dst_t, double max_error) {
+  char *dest_wkt;
+  OSRExportToWkt(map->proj, &dest_wkt);
+
+  // get a transformer
+  warp->transform = GDALGenImgProjTransform;
+  warp->transform_args =
+      GDALCreateGenImgProjTransformer3(src_wkt, src_t, dest_wkt, dst_t);
+  free(dest_wkt);
+  if (warp->transform_args == NULL) return false;
+
+  // Transform a few points per scanline exactly and interpolate the rest
+  // when they stay within max_error pixels, like gdalwarp does.
+  if (max_error > 0) {
+    void *approx_args = GDALCreateApproxTransformer(
+        GDALGenImgProjTransform, warp->transform_args, max_error);
+    if (approx_args == NULL) {
+      GDALDestroyGenImgProjTransformer(warp->transform_args);
+      return false;
+    }
+    GDALApproxTransformerOwnsSubtransformer(approx_args, TRUE);
+    warp->transform = GDALApproxTransform;
+    warp->transform_args = approx_args;
+  }
+  return true;
+}
+
+static void destroy_transformer(warp_t *warp) {
+  if (!warp->affine) GDALDestroyTransformer(warp->transform_args);
+}
+
+// Find how many source pixels an output pixel covers around the center of
+// the map, returns 0 if that can't be worked out.
+static double source_ratio(warp_t *warp) {
+  double cx = warp->width / 2.0, cy = warp->height / 2.0;
+  double x[3] = {cx, cx + 1, cx}, y[3] = {cy, cy, cy + 1}, z[3] = {0, 0, 0};
+  int test[3];
+  warp->transform(warp->transform_args, TRUE, 3, x, y, z, test);
+  if (!test[0] || !test[1] || !test[2]) return 0;
+  return fmin(hypot(x[1] - x[0], y[1] - y[0]), hypot(x[2] - x[0], y[2] - y[0]));
+}
+
+// Point the warp's band handles at the chosen level of its source.
+static void get_bands(warp_t *warp) {
+  for (int band = 0; band < warp->bands; band++) {
+    warp->band_handles[band] = GDALGetRasterBand(warp->source, band + 1);
+    if (warp->overview >= 0)
+      warp->band_handles[band] =
+          GDALGetOverview(warp->band_handles[band], warp->overview);
+  }
+}
+
+// Switch the warp to the smallest overview that still has at least one
+// source pixel for each output pixel, so low zoom renders read about as
+// much as high zoom ones. Stays on the full resolution bands when no
+// overview fits or the bands' overviews don't line up.
+static void pick_overview(warp_t *warp) {
+  warp->overview = -1;
+  warp->x_scale = warp->y_scale = 1;
+  get_bands(warp);
+
+  double ratio = source_ratio(warp);
+  if (ratio < 2) return;
+
+  double best = 1;
+  GDALRasterBandH first = warp->band_handles[0];
+  for (int i = 0; i < GDALGetOverviewCount(first); i++) {
+    GDALRasterBandH overview = GDALGetOverview(first, i);
+    if (!overview) continue;
+    int x_size = GDALGetRasterBandXSize(overview);
+    int y_size = GDALGetRasterBandYSize(overview);
+    if (x_size < 1 || y_size < 1) continue;
+    double factor = (double)warp->x_size / x_size;
+    if (factor > ratio || factor <= best) continue;
+
+    bool matched = true;
+    for (int band = 1; band < warp->bands && matched; band++) {
+      overview = GDALGetOverview(warp->band_handles[band], i);
+      matched = overview && GDALGetRasterBandXSize(overview) == x_size &&
+                GDALGetRasterBandYSize(overview) == y_size;
+    }
+    if (!matched) continue;
+
+    best = factor;
+    warp->overview = i;
+  }
+  if (warp->overview < 0) return;
+
+  get_bands(warp);
+  int x_size = GDALGetRasterBandXSize(warp->band_handles[0]);
+  int y_size = GDALGetRasterBandYSize(warp->band_handles[0]);
+  warp->x_scale = (double)x_size / warp->x_size;
+  warp->y_scale = (double)y_size / warp->y_size;
+  warp->x_size = x_size;
+  warp->y_size = y_size;
+}
+
+// Warp output rows y0 up to y1. The source pixels under every output pixel
+// are found first, then the window covering them and the kernel is read in
+// one interleaved call and resampled from memory. Returns false if the
+// source couldn't be read.
+static bool warp_rows(warp_t *warp, int y0, int y1) {
+  int width = warp->width;
+  int length = width * (y1 - y0);
+  int half = warp->taps / 2;
+  bool ok = false;
+  GByte *window = NULL;
+
+  double *x_lookup = malloc(length * sizeof(double));
+  double *y_lookup = malloc(length * sizeof(double));
+  double *z_lookup = malloc(length * sizeof(double));
+  int *test = malloc(length * sizeof(int));
+  if (!x_lookup || !y_lookup || !z_lookup || !test) goto cleanup;
+
+  if (warp->affine) {
+    // step along each scanline in source pixels from its first center
+    const double *t = warp->to_source;
+    for (int y = y0, i = 0; y < y1; y++) {
+      double x_source = t[0] + 0.5 * t[1] + (y + 0.5) * t[2];
+      double y_source = t[3] + 0.5 * t[4] + (y + 0.5) * t[5];
+      for (int x = 0; x < width; x++, i++) {
+        x_lookup[i] = x_source;
+        y_lookup[i] = y_source;
+        test[i] = TRUE;
+        x_source += t[1];
+        y_source += t[4];
+      }
+    }
+  } else {
+    // write center of our pixel positions to the destination rows
+    for (int y = y0, i = 0; y < y1; y++)
+      for (int x = 0; x < width; x++, i++) {
+        x_lookup[i] = x + 0.5;
+        y_lookup[i] = y + 0.5;
+        z_lookup[i] = 0.0;
+      }
+
+    // transform a scanline at a time, the approximate transformer
+    // interpolates along a line of points
+    for (int i = 0; i < length; i += width)
+      warp->transform(warp->transform_args, TRUE, width, x_lookup + i,
+                      y_lookup + i, z_lookup + i, test + i);
+  }
+
+  int min_x = warp->x_size, min_y = warp->y_size, max_x = -1, max_y = -1;
+  for (int i = 0; i < length; i++) {
+    // move full resolution coordinates onto the overview
+    x_lookup[i] *= warp->x_scale;
+    y_lookup[i] *= warp->y_scale;
+
+    // skip pixels we could not transform or that are outside of the raster,
+    // the sanity check is from gdalsimplewarp
+    if (!test[i] || x_lookup[i] < 0.0 || y_lookup[i] < 0.0 ||
+        x_lookup[i] > warp->x_size || y_lookup[i] > warp->y_size) {
+      test[i] = FALSE;
+      continue;
+    }
+    int x = (int)x_lookup[i], y = (int)y_lookup[i];
+    if (x < min_x) min_x = x;
+    if (x > max_x) max_x = x;
+    if (y < min_y) min_y = y;
+    if (y > max_y) max_y = y;
+  }
+
+  // none of these rows touch the raster
+  if (max_x < 0) {
+    ok = true;
+    goto cleanup;
+  }
+
+  // When the window has many more pixels than the output, let GDAL decimate
+  // it while reading rather than holding all of it.
+  // Windows smaller than the kernel are stretched to fit it.
+  int limit = 4 * (width > y1 - y0 ? width : y1 - y0) + warp->taps;
+
+  // Grow the window to cover the kernel. Shading looks at each cell's
+  // neighbors, so it gets a halo of one more read pixel, however many
+  // source pixels that covers.
+  int x_pad = half, y_pad = half;
+  if (warp->hillshade) {
+    x_pad += (max_x - min_x + 2 * half + limit) / limit;
+    y_pad += (max_y - min_y + 2 * half + limit) / limit;
+    limit += 2;
+  }
+  min_x = clamp(min_x - x_pad, 0, warp->x_size - 1);
+  min_y = clamp(min_y - y_pad, 0, warp->y_size - 1);
+  max_x = clamp(max_x + x_pad, 0, warp->x_size - 1);
+  max_y = clamp(max_y + y_pad, 0, warp->y_size - 1);
+  int win_w = max_x - min_x + 1, win_h = max_y - min_y + 1;
+
+  int buf_w = win_w < limit ? win_w : limit;
+  int buf_h = win_h < limit ? win_h : limit;
+  if (buf_w < warp->taps) buf_w = warp->taps;
+  if (buf_h < warp->taps) buf_h = warp->taps;
+  if (!(window = malloc((size_t)buf_w * buf_h * 4))) goto cleanup;
+  if (!read_window(warp, min_x, min_y, win_w, win_h, window, buf_w, buf_h))
+    goto cleanup;
+  if (!warp->lut) prepare_window(warp, window, (size_t)buf_w * buf_h * 4);
+
+  double x_scale = (double)buf_w / win_w, y_scale = (double)buf_h / win_h;
+  if (warp->taps > 1) {
+    ok = resample_rows(warp, window, buf_w, buf_h, min_x, min_y, x_scale,
+                       y_scale, x_lookup, y_lookup, test, y0, y1);
+    goto cleanup;
+  }
+
+  if (warp->affine && warp->to_source[2] == 0 && warp->to_source[4] == 0 &&
+      copy_aligned(warp, window, buf_w, buf_h, min_x, min_y, x_scale, y_scale,
+                   x_lookup, y_lookup, test, y0, y1)) {
+    ok = true;
+    goto cleanup;
+  }
+
+  for (int y = y0, i = 0; y < y1; y++) {
+    uint32_t *scanline = warp->data + (size_t)y * warp->stride;
+    for (int x = 0; x < width; x++, i++) {
+      if (!test[i]) continue;
+      int cx = clamp((int)((x_lookup[i] - min_x) * x_scale), 0, buf_w - 1);
+      int cy = clamp((int)((y_lookup[i] - min_y) * y_scale), 0, buf_h - 1);
+      const GByte *pixel = window + ((size_t)cy * buf_w + cx) * 4;
+      if (pixel[3]) scanline[x] = pack(pixel);
+    }
+  }
+  ok = true;
+
+cleanup:
+  free(x_lookup);
+  free(y_lookup);
+  free(z_lookup);
+  free(test);
+  free(window);
+  return ok;
+}
+
+// Bands of rows shared out to the threads warping a raster.
+typedef struct {
+  warp_t *warp;
+  const char *source;
+  pthread_mutex_t lock;
+  int next;
+  int rows;
+  bool failed;
+} bands_t;
+
+// Take the next band of rows to warp, returns false once there are none left
+// or a thread has failed.
+static bool next_band(bands_t *bands, int *y0, int *y1) {
+  int height = bands->warp->height;
+  pthread_mutex_lock(&bands->lock);
+  *y0 = bands->next;
+  bands->next += bands->rows;
+  bool more = !bands->failed && *y0 < height;
+  pthread_mutex_unlock(&bands->lock);
+  *y1 = *y0 + bands->rows < height ? *y0 + bands->rows : height;
+  return more;
+}
+
+// Warp bands of rows until they run out. GDAL handles and transformers
+// can't be shared between threads, so each worker past the first opens its
+// own handle on the source and clones the transformer.
+static void warp_bands(void *data, int worker) {
+  bands_t *bands = data;
+  warp_t warp = *bands->warp;
+  bool ok = true;
+
+  if (worker > 0) {
+    if (!(warp.source = GDALOpen(bands->source, GA_ReadOnly))) {
+      ok = false;
+    } else {
+      get_bands(&warp);
+      if (warp.affine)
+        warp.transform_args = warp.to_source;
+      else if (!(warp.transform_args =
+                     GDALCloneTransformer(bands->warp->transform_args)))
+        ok = false;
+    }
+  }
+
+  int y0, y1;
+  while (ok && next_band(bands, &y0, &y1)) ok = warp_rows(&warp, y0, y1);
+
+  if (!ok) {
+    pthread_mutex_lock(&bands->lock);
+    bands->failed = true;
+    pthread_mutex_unlock(&bands->lock);
+  }
+
+  if (worker > 0 && warp.source) {
+    if (warp.transform_args) destroy_transformer(&warp);
+    GDALClose(warp.source);
+  }
+}
+
+// Check that surface is an ARGB image we can write width by height pixels to.
+static bool is_image(cairo_surface_t *surface, int width, int height) {
+  return cairo_surface_get_type(surface) == CAIRO_SURFACE_TYPE_IMAGE &&
+         cairo_image_surface_get_format(surface) == CAIRO_FORMAT_ARGB32 &&
+         cairo_image_surface_get_width(surface) == width &&
+         cairo_image_surface_get_height(surface) == height;
+}
+
+// Scratch surfaces to warp into, one per thread and kept while the maps it
+// renders stay the same size.
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_vfree(void *surface) { cairo_surface_destroy(surface); }
+
+static void scratch_key_init() {
+  pthread_key_create(&scratch_key, scratch_vfree);
+}
+
+// Get this thread's cleared scratch surface, returns NULL on failure.
+static cairo_surface_t *get_scratch(int width, int height) {
+  pthread_once(&scratch_once, scratch_key_init);
+
+  cairo_surface_t *surface = pthread_getspecific(scratch_key);
+  if (surface && is_image(surface, width, height)) {
+    cairo_surface_flush(surface);
+    memset(cairo_image_surface_get_data(surface), 0,
+           (size_t)cairo_image_surface_get_stride(surface) * height);
+    return surface;
+  }
+
+  if (surface) cairo_surface_destroy(surface);
+  surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(surface);
+    surface = NULL;
+  }
+  pthread_setspecific(scratch_key, surface);
+  return surface;
+}
+
+// Warp the raster at path into surface, an image the size of the map.
+static simplet_status_t warp_source(simplet_raster_layer_t *layer,
+                                    const char *path, simplet_map_t *map,
+                                    cairo_surface_t *surface) {
+  warp_t warp;
+  memset(&warp, 0, sizeof(warp));
+  warp.width = map->width;
+  warp.height = map->height;
+
+  if (!(warp.weights = simplet_resample_weights(layer->resample, &warp.taps)))
+    return map_error(map, SIMPLET_ERR, "unknown resample kernel");
+  warp.convolve = simplet_convolve_best();
+
+  GDALDatasetH source = GDALOpen(path, GA_ReadOnly);
+  if (source == NULL) {
+    free(warp.weights);
+    return map_error(map, SIMPLET_GDAL_ERR, "error opening raster source");
+  }
+  warp.source = source;
+  warp.x_size = GDALGetRasterXSize(source);
+  warp.y_size = GDALGetRasterYSize(source);
+
+  // values are colored from the bands an expression uses or the first
+  warp.bands = GDALGetRasterCount(source);
+  warp.expr = layer->expr;
+  warp.hillshade = layer->z_factor != 0;
+  if (warp.expr) {
+    if (warp.expr->bands > warp.bands) {
+      free(warp.weights);
+      GDALClose(source);
+      return map_error(map, SIMPLET_ERR,
+                       "expression uses bands the raster doesn't have");
+    }
+    warp.bands = warp.expr->bands > 0 ? warp.expr->bands : 1;
+    for (int k = 0; k < warp.expr->length; k++)
+      if (warp.expr->ops[k].code == SIMPLET_OP_BAND)
+        warp.used[warp.expr->ops[k].band] = true;
+  } else if (layer->stops_length || warp.hillshade) {
+    if (warp.bands > 1) warp.bands = 1;
+  } else if (warp.bands > 4) {
+    warp.bands = 4;
+  }
+
+  // look up the bands and their nodata values once
+  for (int band = 0; band < warp.bands; band++)
+    warp.no_data[band] = GDALGetRasterNoDataValue(
+        GDALGetRasterBand(source, band + 1), &warp.has_no_data[band]);
+
+  // Order the bands so an interleaved read lands them on their channels,
+  // red, green and blue run backwards ahead of alpha.
+  int colors = warp.bands < 3 ? warp.bands : 3;
+  for (int band = 0; band < colors; band++)
+    warp.band_map[band] = colors - band;
+  if (warp.bands == 4) warp.band_map[3] = 4;
+  warp.band_offset = 3 - colors;
 
   // create geotransform
   double src_t[6];
-  if (GDALGetGeoTransform(source, src_t) != CE_None)
-    return set_error(layer, SIMPLET_GDAL_ERR,
+  if (GDALGetGeoTransform(source, src_t) != CE_None) {
+    free(warp.weights);
+    GDALClose(source);
+    return map_error(map, SIMPLET_GDAL_ERR,
                      "can't get geotransform on dataset");
+  }
 
   double dst_t[6];
   cairo_matrix_t mat;
@@ -84,149 +893,231 @@ simplet_status_t simplet_raster_layer_process(simplet_raster_layer_t *layer,
 
   // grab WKTs from source and dest
   const char *src_wkt = GDALGetProjectionRef(source);
-  char *dest_wkt;
-  OSRExportToWkt(map->proj, &dest_wkt);
 
-  // get a transformer
-  void *transform_args =
-      GDALCreateGenImgProjTransformer3(src_wkt, src_t, dest_wkt, dst_t);
-  free(dest_wkt);
-  if (transform_args == NULL)
-    return set_error(layer, SIMPLET_GDAL_ERR, "transform failed");
-
-  double *x_lookup = malloc(width * sizeof(double));
-  double *y_lookup = malloc(width * sizeof(double));
-  double *z_lookup = malloc(width * sizeof(double));
-  int *test = malloc(width * sizeof(int));
-  uint32_t *data = malloc(sizeof(uint32_t) * width * height);
-  memset(data, 0, sizeof(uint32_t) * width * height);
-
-  int kernel_size;
-  double *kernel;
-
-  switch (layer->resample) {
-    case SIMPLET_NEAREST:
-      kernel_size = 1;
-      kernel = calloc(kernel_size, sizeof(*kernel));
-      kernel[0] = 1;
-      break;
-    case SIMPLET_BILINEAR:
-      kernel_size = 3;
-      kernel = calloc(kernel_size, sizeof(*kernel));
-      kernel[0] = 0.25;
-      kernel[1] = 0.5;
-      kernel[2] = 0.25;
-      break;
-    case SIMPLET_LANCZOS:
-      kernel_size = 9;
-      double tot = 0;
-      kernel = calloc(kernel_size, sizeof(double));
-      for (int i = 0; i < kernel_size; i++) {
-        double x = (double)i - kernel_size / 2.0 + 0.5;
-        // the divided by three is this one weird trick from here:
-        // http://cbloomrants.blogspot.com/2011/03/03-24-11-image-filters-and-gradients.html
-        kernel[i] = sinc(x / 3) * sinc(x / (kernel_size / 2));
-        tot += kernel[i];
-      }
-      for (int i = 0; i < kernel_size; i++) kernel[i] /= tot;
-      break;
-    default:
-      return set_error(layer, SIMPLET_ERR, "unknown resample kernel");
+  // When the source is already in the map's srs, output pixels map to source
+  // pixels through the destination transform and the inverse of the source's
+  // geotransform, so there is nothing to reproject.
+  double inv_t[6];
+  OGRSpatialReferenceH src_srs = NULL;
+  if (src_wkt && *src_wkt && (src_srs = OSRNewSpatialReference(src_wkt)) &&
+      OSRIsSame(src_srs, map->proj) && GDALInvGeoTransform(src_t, inv_t)) {
+    double *t = warp.to_source;
+    t[0] = inv_t[0] + inv_t[1] * dst_t[0] + inv_t[2] * dst_t[3];
+    t[1] = inv_t[1] * dst_t[1] + inv_t[2] * dst_t[4];
+    t[2] = inv_t[1] * dst_t[2] + inv_t[2] * dst_t[5];
+    t[3] = inv_t[3] + inv_t[4] * dst_t[0] + inv_t[5] * dst_t[3];
+    t[4] = inv_t[4] * dst_t[1] + inv_t[5] * dst_t[4];
+    t[5] = inv_t[4] * dst_t[2] + inv_t[5] * dst_t[5];
+    warp.affine = true;
+    warp.transform = affine_transform;
+    warp.transform_args = warp.to_source;
   }
+  if (src_srs) OSRDestroySpatialReference(src_srs);
 
-  // draw to cairo
-  for (int y = 0; y < height; y++) {
-    // write center of our pixel positions to the destination scanline
-    for (int k = 0; k < width; k++) {
-      x_lookup[k] = k + 0.5;
-      y_lookup[k] = y + 0.5;
-      z_lookup[k] = 0.0;
+  if (!warp.affine &&
+      !create_transformer(&warp, src_wkt, src_t, map, dst_t,
+                          layer->max_error)) {
+    free(warp.weights);
+    GDALClose(source);
+    return map_error(map, SIMPLET_GDAL_ERR, "transform failed");
+  }
+
+  pick_overview(&warp);
+
+  // Color values through the stops instead of reading the bands as colors,
+  // computed values without stops are drawn as grays from 0 to 255.
+  static const simplet_color_stop_t grays[] = {{0, 0, 0, 0, 255},
+                                               {255, 255, 255, 255, 255}};
+  if (layer->stops_length || warp.expr || warp.hillshade) {
+    const simplet_color_stop_t *stops = grays;
+    int length = 2;
+    if (layer->stops_length) {
+      stops = layer->stops;
+      length = layer->stops_length;
+    }
+    if (!(warp.lut = simplet_lut_new(stops, length, layer->classified))) {
+      free(warp.weights);
+      destroy_transformer(&warp);
+      GDALClose(source);
+      return map_error(map, SIMPLET_OOM, "out of memory coloring raster");
     }
-    uint32_t *scanline = data + y * width;
+    warp.lut->has_no_data = warp.has_no_data[0];
+    warp.lut->no_data = (float)warp.no_data[0];
+    warp.colorize = simplet_colorize_best();
+  }
 
-    // set an opaque alpha value for RGB images
-    if (bands < 4)
-      for (int i = 0; i < width; i++) scanline[i] = 0xff << 24;
+  // Computed values mark nodata as NaN themselves, a result that happens to
+  // equal the first band's nodata is still drawn.
+  if (warp.expr || warp.hillshade) warp.lut->has_no_data = false;
 
-    GDALGenImgProjTransform(transform_args, TRUE, width, x_lookup, y_lookup,
-                            z_lookup, test);
+  // the ground size of a cell of the chosen level, for shading
+  warp.relief.azimuth = layer->azimuth;
+  warp.relief.altitude = layer->altitude;
+  warp.relief.z_factor = layer->z_factor;
+  warp.relief.x_res = src_t[1] / warp.x_scale;
+  warp.relief.y_res = src_t[5] / warp.y_scale;
 
-    for (int x = 0; x < width; x++) {
-      // could not transform the point, skip this pixel
-      if (!test[x]) {
-        scanline[x] = 0x00 << 24;
-        continue;
-      }
+  // blocks are shared under the version of the file they came from
+  warp.stamp = simplet_source_stamp(path);
 
-      // sanity check? From gdalsimplewarp
-      if (x_lookup[x] < 0.0 || y_lookup[x] < 0.0) {
-        scanline[x] = 0x00 << 24;
-        continue;
-      }
+  cairo_surface_flush(surface);
+  warp.data = (uint32_t *)cairo_image_surface_get_data(surface);
+  warp.stride = cairo_image_surface_get_stride(surface) / 4;
 
-      // check to see if we are outside of the raster
-      if (x_lookup[x] > GDALGetRasterXSize(source) ||
-          y_lookup[x] > GDALGetRasterYSize(source)) {
-        scanline[x] = 0x00 << 24;
-        continue;
-      }
+  // Warp a band of rows at a time to bound the lookups and window, spread
+  // over threads when there are several bands.
+  bands_t bands;
+  memset(&bands, 0, sizeof(bands));
+  bands.warp = &warp;
+  bands.source = path;
+  bands.rows = SIMPLET_WARP_PIXELS / (warp.width > 0 ? warp.width : 1);
+  if (bands.rows < 1) bands.rows = 1;
+  pthread_mutex_init(&bands.lock, NULL);
+
+  int workers = layer->threads ? layer->threads : simplet_pool_size();
+  int count = (warp.height + bands.rows - 1) / bands.rows;
+  if (workers > count) workers = count;
+  simplet_pool_run(warp_bands, &bands, workers);
+  pthread_mutex_destroy(&bands.lock);
+  simplet_status_t status = SIMPLET_OK;
+  if (bands.failed)
+    status = map_error(map, SIMPLET_GDAL_ERR, "error reading raster source");
+  cairo_surface_mark_dirty(surface);
+
+  free(warp.stamp);
+  free(warp.lut);
+  free(warp.weights);
+  destroy_transformer(&warp);
+  GDALClose(source);
+  return status;
+}
 
-      // clean up needed here
-      for (int band = 1; band <= bands; band++) {
-        double pixel = 0;
-        GByte window[kernel_size * kernel_size];
-        memset(window, 0, kernel_size * kernel_size);
-        GDALRasterBandH b = GDALGetRasterBand(source, band);
-
-        GDALRasterIO(b, GF_Read, (int)x_lookup[x] - kernel_size / 2,
-                     (int)y_lookup[x] - kernel_size / 2,
-                     kernel_size, kernel_size,
-                     window,
-                     kernel_size, kernel_size,
-                     GDT_Byte, 0, 0);
-
-        for (int kx = 0; kx < kernel_size; kx++) {
-          for (int ky = 0; ky < kernel_size; ky++) {
-            GByte px = window[kx * kernel_size + ky];
-            pixel += px * kernel[kx] * kernel[ky];
-          }
-        }
-
-        // set the pixel to fully transparent if we don't have a pixel value
-        int has_no_data = 0;
-        double no_data = GDALGetRasterNoDataValue(b, &has_no_data);
-        if (has_no_data && no_data == window[(kernel_size * kernel_size) / 2]) {
-          scanline[x] = 0x00 << 24;
-          continue;
-        }
-
-        int band_remap[5] = {0, 2, 1, 0, 3};
-        scanline[x] |= ((int)fmax(0, fmin(255, pixel)))
-                       << ((band_remap[band]) * 8);
+// The first layer of a map without a background lands on a blank surface,
+// so it can be written straight into the map's.
+static bool is_blank(simplet_raster_layer_t *layer, simplet_map_t *map,
+                     cairo_surface_t *target) {
+  return !map->bgcolor && simplet_list_head(map->layers) == layer &&
+         is_image(target, map->width, map->height);
+}
+
+// Check if every pixel of surface is opaque.
+static bool is_opaque(cairo_surface_t *surface) {
+  cairo_surface_flush(surface);
+  const unsigned char *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  int width = cairo_image_surface_get_width(surface);
+  int height = cairo_image_surface_get_height(surface);
+  for (int y = 0; y < height; y++) {
+    const uint32_t *row = (const uint32_t *)(data + (size_t)y * stride);
+    for (int x = 0; x < width; x++)
+      if (row[x] >> 24 != 0xff) return false;
+  }
+  return true;
+}
+
+// Draw the scenes of a mosaic under the map. Scenes are warped in priority
+// order, each composited beneath the ones before it, until the map is
+// covered.
+static simplet_status_t process_mosaic(simplet_raster_layer_t *layer,
+                                       simplet_map_t *map, cairo_t *ctx) {
+  simplet_mosaic_t *mosaic = layer->mosaic;
+  if (!simplet_mosaic_load(mosaic))
+    return map_error(map, SIMPLET_GDAL_ERR, "error listing mosaic scenes");
+
+  int *hits;
+  if (!(hits = malloc(sizeof(*hits) * (mosaic->length ? mosaic->length : 1))))
+    return map_error(map, SIMPLET_OOM, "out of memory searching mosaic");
+  int count = simplet_mosaic_search(mosaic, map, hits);
+  if (!count) {
+    free(hits);
+    return SIMPLET_OK;
+  }
+
+  // gather the scenes on the map's surface if it's blank, or on a new one
+  cairo_surface_t *target = cairo_get_target(ctx), *mosaic_surface = target;
+  if (!is_blank(layer, map, target))
+    mosaic_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                map->width, map->height);
+  if (cairo_surface_status(mosaic_surface) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(mosaic_surface);
+    free(hits);
+    return map_error(map, SIMPLET_CAIRO_ERR, "couldn't create surface");
+  }
+  cairo_t *mosaic_ctx = cairo_create(mosaic_surface);
+  cairo_set_operator(mosaic_ctx, CAIRO_OPERATOR_DEST_OVER);
+
+  simplet_status_t status = SIMPLET_OK;
+  for (int i = 0; i < count; i++) {
+    const char *path = mosaic->scenes[hits[i]].path;
+
+    // the first scene lands on a blank surface, the rest go under it
+    if (i == 0) {
+      status = warp_source(layer, path, map, mosaic_surface);
+      if (status != SIMPLET_OK) break;
+    } else {
+      cairo_surface_t *scratch = get_scratch(map->width, map->height);
+      if (!scratch) {
+        status = map_error(map, SIMPLET_CAIRO_ERR, "couldn't create surface");
+        break;
       }
+      status = warp_source(layer, path, map, scratch);
+      if (status != SIMPLET_OK) break;
+      cairo_set_source_surface(mosaic_ctx, scratch, 0, 0);
+      cairo_paint(mosaic_ctx);
     }
+
+    if (is_opaque(mosaic_surface)) break;
+  }
+
+  cairo_destroy(mosaic_ctx);
+  if (mosaic_surface != target) {
+    cairo_set_source_surface(ctx, mosaic_surface, 0, 0);
+    cairo_paint(ctx);
+    cairo_surface_destroy(mosaic_surface);
   }
+  free(hits);
+  return status;
+}
 
-  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, map->width);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data(
-      (unsigned char *)data, CAIRO_FORMAT_ARGB32, map->width, map->height,
-      stride);
+// Count the sources under map the layer would draw from, adding them to
+// count: the scenes of a mosaic whose footprints the map's bounds touch, or
+// its one raster, which always counts.
+simplet_status_t simplet_raster_layer_count(simplet_raster_layer_t *layer,
+                                            simplet_map_t *map,
+                                            uint64_t *count) {
+  simplet_mosaic_t *mosaic = layer->mosaic;
+  if (!mosaic) {
+    *count += 1;
+    return SIMPLET_OK;
+  }
+  if (!simplet_mosaic_load(mosaic))
+    return map_error(map, SIMPLET_GDAL_ERR, "error listing mosaic scenes");
 
-  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-    set_error(layer, SIMPLET_CAIRO_ERR, (const char *)cairo_status_to_string(
-                                            cairo_surface_status(surface)));
+  int *hits;
+  if (!(hits = malloc(sizeof(*hits) * (mosaic->length ? mosaic->length : 1))))
+    return map_error(map, SIMPLET_OOM, "out of memory searching mosaic");
+  *count += simplet_mosaic_search(mosaic, map, hits);
+  free(hits);
+  return SIMPLET_OK;
+}
+
+simplet_status_t simplet_raster_layer_process(simplet_raster_layer_t *layer,
+                                              simplet_map_t *map,
+                                              cairo_t *ctx) {
+  if (layer->mosaic) return process_mosaic(layer, map, ctx);
 
-  cairo_set_source_surface(ctx, surface, 0, 0);
-  cairo_paint(ctx);
-  cairo_surface_destroy(surface);
+  // Warp straight into the map's surface when it's blank, otherwise into a
+  // scratch surface that's painted on.
+  cairo_surface_t *target = cairo_get_target(ctx), *surface = target;
+  if (!is_blank(layer, map, target))
+    surface = get_scratch(map->width, map->height);
+  if (!surface)
+    return map_error(map, SIMPLET_CAIRO_ERR, "couldn't create surface");
 
-  free(x_lookup);
-  free(y_lookup);
-  free(z_lookup);
-  free(test);
-  free(data);
-  free(kernel);
-  GDALDestroyGenImgProjTransformer(transform_args);
-  GDALClose(source);
-  return layer->status;
+  simplet_status_t status = warp_source(layer, layer->source, map, surface);
+  if (surface != target) {
+    cairo_set_source_surface(ctx, surface, 0, 0);
+    cairo_paint(ctx);
+  }
+  return status;
 }
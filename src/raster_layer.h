@@ -5,6 +5,7 @@
 #include "text.h"
 #include "user_data.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,16 +13,53 @@ extern "C" {
 
 simplet_raster_layer_t *simplet_raster_layer_new(const char *datastring);
 
+simplet_raster_layer_t *simplet_raster_layer_new_mosaic(
+    const char *datastring);
+
+simplet_status_t simplet_raster_layer_set_mosaic_index(
+    simplet_raster_layer_t *layer, const char *index);
+
 void simplet_raster_layer_free(simplet_raster_layer_t *layer);
 
 simplet_status_t simplet_raster_layer_process(simplet_raster_layer_t *layer,
                                               simplet_map_t *map, cairo_t *ctx);
 
+simplet_status_t simplet_raster_layer_count(simplet_raster_layer_t *layer,
+                                            simplet_map_t *map,
+                                            uint64_t *count);
+
 void simplet_raster_layer_set_resample(simplet_raster_layer_t *layer,
                                        simplet_kern_t resample);
 
 simplet_kern_t simplet_raster_layer_get_resample(simplet_raster_layer_t *layer);
 
+void simplet_raster_layer_set_max_error(simplet_raster_layer_t *layer,
+                                        double max_error);
+
+double simplet_raster_layer_get_max_error(simplet_raster_layer_t *layer);
+
+void simplet_raster_layer_set_threads(simplet_raster_layer_t *layer,
+                                      int threads);
+
+int simplet_raster_layer_get_threads(simplet_raster_layer_t *layer);
+
+simplet_status_t simplet_raster_layer_add_color_stop(
+    simplet_raster_layer_t *layer, double value, const char *color);
+
+void simplet_raster_layer_set_classified(simplet_raster_layer_t *layer,
+                                         bool classified);
+
+bool simplet_raster_layer_get_classified(simplet_raster_layer_t *layer);
+
+simplet_status_t simplet_raster_layer_set_expression(
+    simplet_raster_layer_t *layer, const char *expression);
+
+void simplet_raster_layer_set_hillshade(simplet_raster_layer_t *layer,
+                                        double azimuth, double altitude,
+                                        double z_factor);
+
+bool simplet_raster_layer_get_hillshade(simplet_raster_layer_t *layer);
+
 double simplet_bilinear(const double value);
 
 double simplet_bicubic(const double value);
@@ -0,0 +1,250 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resample.h"
+#include "raster_layer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMPLET_X86
+#include <immintrin.h>
+#endif
+
+static double sinc(double x) {
+  if (x == 0.0) return 1.0;
+  return sin(SIMPLET_PI * x) / (SIMPLET_PI * x);
+}
+
+// Kernel weight for a tap value pixels away from the sample.
+double simplet_bilinear(const double value) {
+  double x = fabs(value);
+  return x < 1 ? 1 - x : 0;
+}
+
+// Catmull-Rom, the cubic most image tools mean by bicubic.
+double simplet_bicubic(const double value) {
+  double x = fabs(value), a = -0.5;
+  if (x < 1) return ((a + 2) * x - (a + 3)) * x * x + 1;
+  if (x < 2) return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+  return 0;
+}
+
+double simplet_average(const double value) {
+  return fabs(value) <= 0.5 ? 1 : 0;
+}
+
+// Three lobed lanczos.
+double simplet_lanczos(const double value) {
+  double x = fabs(value);
+  return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+}
+
+// Tabulate a kernel's weights at every phase, each row normalized to sum to
+// one. Stores the number of taps the kernel uses along an axis in taps and
+// returns NULL on failure.
+float *simplet_resample_weights(simplet_kern_t kern, int *taps) {
+  double (*kernel)(const double);
+  switch (kern) {
+    case SIMPLET_NEAREST:
+      *taps = 1;
+      kernel = simplet_average;
+      break;
+    case SIMPLET_BILINEAR:
+      *taps = 2;
+      kernel = simplet_bilinear;
+      break;
+    case SIMPLET_BICUBIC:
+      *taps = 4;
+      kernel = simplet_bicubic;
+      break;
+    case SIMPLET_LANCZOS:
+      *taps = 6;
+      kernel = simplet_lanczos;
+      break;
+    default:
+      return NULL;
+  }
+
+  float *weights;
+  if (!(weights = malloc((SIMPLET_PHASES + 1) * *taps * sizeof(*weights))))
+    return NULL;
+
+  for (int phase = 0; phase <= SIMPLET_PHASES; phase++) {
+    float *row = weights + phase * *taps;
+    if (*taps == 1) {
+      row[0] = 1;
+      continue;
+    }
+
+    double total = 0;
+    for (int i = 0; i < *taps; i++) {
+      row[i] = kernel((double)phase / SIMPLET_PHASES + *taps / 2 - 1 - i);
+      total += row[i];
+    }
+    for (int i = 0; i < *taps; i++) row[i] /= total;
+  }
+  return weights;
+}
+
+// Find the first tap and the phase of a kernel sampling at position, in
+// pixels where pixel centers sit on the halves.
+void simplet_resample_locate(double position, int taps, int *first,
+                             int *phase) {
+  double center = position - 0.5, base = floor(center);
+  *phase = (int)((center - base) * SIMPLET_PHASES + 0.5);
+  *first = (int)base - (taps / 2 - 1);
+}
+
+// Colors are premultiplied, so they're clamped to alpha as well as to a byte
+// to keep kernels that ring from producing invalid pixels. Halves round to
+// even like the vector kernels' conversions.
+static uint32_t pack(const float *sum) {
+  float alpha = sum[3] < 0 ? 0 : sum[3] > 255 ? 255 : sum[3];
+  uint32_t pixel = (uint32_t)lrintf(alpha) << 24;
+  for (int c = 0; c < 3; c++) {
+    float value = sum[c] < 0 ? 0 : sum[c] > alpha ? alpha : sum[c];
+    pixel |= (uint32_t)lrintf(value) << (c * 8);
+  }
+  return pixel;
+}
+
+static int clamp(int value, int min, int max) {
+  return value < min ? min : value > max ? max : value;
+}
+
+// Every kernel sums a row of taps in two runs, the even taps and the odd
+// ones, adds the runs and then weights the row, so all of them round alike
+// and draw the same bytes on any CPU.
+
+// Resample one pixel whose taps may fall off a width by height window, the
+// taps off the edge repeat the edge pixels.
+uint32_t simplet_resample_clamped(const uint8_t *window, int width,
+                                  int height, int taps, const float *weights,
+                                  int x, int y, int x_phase, int y_phase) {
+  const float *wx = weights + x_phase * taps, *wy = weights + y_phase * taps;
+  float sum[4] = {0, 0, 0, 0};
+  for (int j = 0; j < taps; j++) {
+    const uint8_t *row =
+        window + (size_t)clamp(y + j, 0, height - 1) * width * 4;
+    float across[2][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+    for (int i = 0; i < taps; i++) {
+      const uint8_t *pixel = row + clamp(x + i, 0, width - 1) * 4;
+      for (int c = 0; c < 4; c++) across[i % 2][c] += pixel[c] * wx[i];
+    }
+    for (int c = 0; c < 4; c++)
+      sum[c] += (across[0][c] + across[1][c]) * wy[j];
+  }
+  return pack(sum);
+}
+
+// Filter each row of taps across, then the row sums down.
+void simplet_convolve_scalar(const uint8_t *window, size_t stride, int taps,
+                             const float *weights, const simplet_tap_t *pixels,
+                             int count, uint32_t *out) {
+  for (int k = 0; k < count; k++) {
+    const float *wx = weights + pixels[k].x_phase * taps;
+    const float *wy = weights + pixels[k].y_phase * taps;
+    const uint8_t *origin = window + pixels[k].offset;
+    float sum[4] = {0, 0, 0, 0};
+    for (int j = 0; j < taps; j++) {
+      const uint8_t *row = origin + j * stride;
+      float across[2][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+      for (int i = 0; i < taps; i++)
+        for (int c = 0; c < 4; c++)
+          across[i % 2][c] += row[i * 4 + c] * wx[i];
+      for (int c = 0; c < 4; c++)
+        sum[c] += (across[0][c] + across[1][c]) * wy[j];
+    }
+    out[k] = pack(sum);
+  }
+}
+
+#ifdef SIMPLET_X86
+// Clamp colors to alpha, then round, saturate and pack the four channels in
+// sum to bytes.
+__attribute__((target("sse2"))) static uint32_t pack_sse2(__m128 sum) {
+  sum = _mm_min_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(3, 3, 3, 3)));
+  __m128i pixel = _mm_cvtps_epi32(sum);
+  pixel = _mm_packs_epi32(pixel, pixel);
+  pixel = _mm_packus_epi16(pixel, pixel);
+  return (uint32_t)_mm_cvtsi128_si32(pixel);
+}
+
+// Filter with all four channels of a pixel in one register.
+__attribute__((target("sse2"))) static void convolve_sse2(
+    const uint8_t *window, size_t stride, int taps, const float *weights,
+    const simplet_tap_t *pixels, int count, uint32_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  for (int k = 0; k < count; k++) {
+    const float *wx = weights + pixels[k].x_phase * taps;
+    const float *wy = weights + pixels[k].y_phase * taps;
+    const uint8_t *origin = window + pixels[k].offset;
+    __m128 sum = _mm_setzero_ps();
+    for (int j = 0; j < taps; j++) {
+      const uint8_t *row = origin + j * stride;
+      __m128 across[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+      for (int i = 0; i < taps; i++) {
+        int32_t bytes;
+        memcpy(&bytes, row + i * 4, sizeof(bytes));
+        __m128i pixel = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        pixel = _mm_unpacklo_epi16(pixel, zero);
+        across[i % 2] = _mm_add_ps(
+            across[i % 2],
+            _mm_mul_ps(_mm_cvtepi32_ps(pixel), _mm_set1_ps(wx[i])));
+      }
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(across[0], across[1]),
+                                       _mm_set1_ps(wy[j])));
+    }
+    out[k] = pack_sse2(sum);
+  }
+}
+
+// Filter two taps at a time, eight channels to a register, the even tap in
+// the low half and the odd one in the high half.
+__attribute__((target("avx2"))) static void convolve_avx2(
+    const uint8_t *window, size_t stride, int taps, const float *weights,
+    const simplet_tap_t *pixels, int count, uint32_t *out) {
+  for (int k = 0; k < count; k++) {
+    const float *wx = weights + pixels[k].x_phase * taps;
+    const float *wy = weights + pixels[k].y_phase * taps;
+    const uint8_t *origin = window + pixels[k].offset;
+    __m128 sum = _mm_setzero_ps();
+    for (int j = 0; j < taps; j++) {
+      const uint8_t *row = origin + j * stride;
+      __m256 across = _mm256_setzero_ps();
+      int i = 0;
+      for (; i + 1 < taps; i += 2) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(row + i * 4));
+        __m256 pair = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        __m256 weight = _mm256_insertf128_ps(
+            _mm256_castps128_ps256(_mm_set1_ps(wx[i])), _mm_set1_ps(wx[i + 1]),
+            1);
+        across = _mm256_add_ps(across, _mm256_mul_ps(pair, weight));
+      }
+      if (i < taps) {
+        // the odd half gains zero, which leaves it as it was
+        int32_t bytes;
+        memcpy(&bytes, row + i * 4, sizeof(bytes));
+        __m256 single =
+            _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+        across = _mm256_add_ps(across,
+                               _mm256_mul_ps(single, _mm256_set1_ps(wx[i])));
+      }
+      __m128 row_sum = _mm_add_ps(_mm256_castps256_ps128(across),
+                                  _mm256_extractf128_ps(across, 1));
+      sum = _mm_add_ps(sum, _mm_mul_ps(row_sum, _mm_set1_ps(wy[j])));
+    }
+    out[k] = pack_sse2(sum);
+  }
+}
+#endif
+
+// Pick the fastest convolution this CPU supports.
+simplet_convolve_t simplet_convolve_best() {
+#ifdef SIMPLET_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return convolve_avx2;
+  if (__builtin_cpu_supports("sse2")) return convolve_sse2;
+#endif
+  return simplet_convolve_scalar;
+}
@@ -0,0 +1,52 @@
+#ifndef _SIMPLE_TILES_RESAMPLE_H
+#define _SIMPLE_TILES_RESAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* resampling kernels over windows of 8 bit BGRA pixels */
+
+// How many sub-pixel positions the kernel weights are tabulated for.
+#define SIMPLET_PHASES 64
+
+// A pixel to resample: the byte offset of its first tap in the window, and
+// the rows of the weight table to use across and down.
+typedef struct {
+  uint32_t offset;
+  uint16_t x_phase;
+  uint16_t y_phase;
+} simplet_tap_t;
+
+// Resample count pixels from a window with stride bytes per row, writing
+// each as premultiplied ARGB to out. weights holds SIMPLET_PHASES + 1 rows
+// of taps weights.
+typedef void (*simplet_convolve_t)(const uint8_t *window, size_t stride,
+                                   int taps, const float *weights,
+                                   const simplet_tap_t *pixels, int count,
+                                   uint32_t *out);
+
+float *simplet_resample_weights(simplet_kern_t kern, int *taps);
+
+void simplet_resample_locate(double position, int taps, int *first,
+                             int *phase);
+
+uint32_t simplet_resample_clamped(const uint8_t *window, int width,
+                                  int height, int taps, const float *weights,
+                                  int x, int y, int x_phase, int y_phase);
+
+void simplet_convolve_scalar(const uint8_t *window, size_t stride, int taps,
+                             const float *weights, const simplet_tap_t *pixels,
+                             int count, uint32_t *out);
+
+simplet_convolve_t simplet_convolve_best();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
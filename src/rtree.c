@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtree.h"
+
+typedef struct {
+  simplet_box_t box;
+  int id;
+} entry_t;
+
+static int compare_x(const void *a, const void *b) {
+  const simplet_box_t *x = &((const entry_t *)a)->box;
+  const simplet_box_t *y = &((const entry_t *)b)->box;
+  double cx = x->min_x + x->max_x, cy = y->min_x + y->max_x;
+  return (cx > cy) - (cx < cy);
+}
+
+static int compare_y(const void *a, const void *b) {
+  const simplet_box_t *x = &((const entry_t *)a)->box;
+  const simplet_box_t *y = &((const entry_t *)b)->box;
+  double cx = x->min_y + x->max_y, cy = y->min_y + y->max_y;
+  return (cx > cy) - (cx < cy);
+}
+
+static int compare_id(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static void extend(simplet_box_t *box, const simplet_box_t *other) {
+  if (other->min_x < box->min_x) box->min_x = other->min_x;
+  if (other->min_y < box->min_y) box->min_y = other->min_y;
+  if (other->max_x > box->max_x) box->max_x = other->max_x;
+  if (other->max_y > box->max_y) box->max_y = other->max_y;
+}
+
+static int overlaps(const simplet_box_t *a, const simplet_box_t *b) {
+  return a->min_x <= b->max_x && b->min_x <= a->max_x &&
+         a->min_y <= b->max_y && b->min_y <= a->max_y;
+}
+
+// Whether box covers anything. Empty boxes and those with NaN corners can't
+// overlap a search, and their centers would break the ordering of the sorts.
+static bool is_box(const simplet_box_t *box) {
+  return box->min_x <= box->max_x && box->min_y <= box->max_y;
+}
+
+// Number of entries on the level above one with length entries.
+static int parents(int length) {
+  return (length + SIMPLET_RTREE_FANOUT - 1) / SIMPLET_RTREE_FANOUT;
+}
+
+// Bulk load a tree over length boxes with sort-tile-recursive packing: the
+// boxes are cut into vertical slices by x, each slice is sorted by y and
+// runs of neighbours become leaves. Search results are indexes into boxes.
+// Empty boxes are left out of the tree and never found. Returns NULL on
+// failure.
+simplet_rtree_t *simplet_rtree_new(const simplet_box_t *boxes,
+                                   int boxes_length) {
+  simplet_rtree_t *tree;
+  if (!(tree = malloc(sizeof(*tree)))) return NULL;
+  memset(tree, 0, sizeof(*tree));
+  int length = 0;
+  for (int i = 0; i < boxes_length; i++) length += is_box(&boxes[i]);
+  tree->length = length;
+  if (length <= 0) return tree;
+
+  int total = length, levels = 1;
+  for (int size = length; size > 1; levels++) {
+    size = parents(size);
+    total += size;
+  }
+
+  entry_t *entries = malloc(sizeof(*entries) * length);
+  tree->boxes = malloc(sizeof(*tree->boxes) * total);
+  tree->ids = malloc(sizeof(*tree->ids) * length);
+  tree->levels = malloc(sizeof(*tree->levels) * (levels + 1));
+  if (!entries || !tree->boxes || !tree->ids || !tree->levels) {
+    free(entries);
+    simplet_rtree_free(tree);
+    return NULL;
+  }
+
+  for (int i = 0, j = 0; i < boxes_length; i++) {
+    if (!is_box(&boxes[i])) continue;
+    entries[j].box = boxes[i];
+    entries[j++].id = i;
+  }
+  qsort(entries, length, sizeof(*entries), compare_x);
+  int slice = (int)ceil(sqrt(parents(length))) * SIMPLET_RTREE_FANOUT;
+  for (int i = 0; i < length; i += slice)
+    qsort(entries + i, length - i < slice ? length - i : slice,
+          sizeof(*entries), compare_y);
+
+  for (int i = 0; i < length; i++) {
+    tree->boxes[i] = entries[i].box;
+    tree->ids[i] = entries[i].id;
+  }
+  free(entries);
+
+  // each node's box covers the run of entries below it
+  tree->levels_length = levels;
+  tree->levels[0] = 0;
+  tree->levels[1] = length;
+  for (int level = 1; level < levels; level++) {
+    const simplet_box_t *below = tree->boxes + tree->levels[level - 1];
+    int below_length = tree->levels[level] - tree->levels[level - 1];
+    simplet_box_t *nodes = tree->boxes + tree->levels[level];
+    int nodes_length = parents(below_length);
+    for (int i = 0; i < below_length; i++) {
+      if (i % SIMPLET_RTREE_FANOUT == 0)
+        nodes[i / SIMPLET_RTREE_FANOUT] = below[i];
+      else
+        extend(&nodes[i / SIMPLET_RTREE_FANOUT], &below[i]);
+    }
+    tree->levels[level + 1] = tree->levels[level] + nodes_length;
+  }
+  return tree;
+}
+
+void simplet_rtree_free(simplet_rtree_t *tree) {
+  free(tree->boxes);
+  free(tree->ids);
+  free(tree->levels);
+  free(tree);
+}
+
+// Find every box overlapping box, storing their indexes in hits in
+// ascending order. hits needs room for all of the tree's boxes. Returns the
+// number of hits.
+int simplet_rtree_search(simplet_rtree_t *tree, const simplet_box_t *box,
+                         int *hits) {
+  if (tree->length <= 0) return 0;
+
+  // a depth first walk holds at most one node's children per level
+  struct {
+    int level;
+    int index;
+  } stack[SIMPLET_RTREE_FANOUT * 32];
+  int depth = 0, count = 0;
+  stack[depth].level = tree->levels_length - 1;
+  stack[depth++].index = 0;
+
+  while (depth > 0) {
+    depth--;
+    int level = stack[depth].level, index = stack[depth].index;
+    if (!overlaps(&tree->boxes[tree->levels[level] + index], box)) continue;
+    if (level == 0) {
+      hits[count++] = tree->ids[index];
+      continue;
+    }
+
+    int first = index * SIMPLET_RTREE_FANOUT;
+    int last = first + SIMPLET_RTREE_FANOUT;
+    int below = tree->levels[level] - tree->levels[level - 1];
+    if (last > below) last = below;
+    for (int i = last - 1; i >= first; i--) {
+      stack[depth].level = level - 1;
+      stack[depth++].index = i;
+    }
+  }
+
+  qsort(hits, count, sizeof(*hits), compare_id);
+  return count;
+}
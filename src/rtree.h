@@ -0,0 +1,41 @@
+#ifndef _SIMPLE_TILES_RTREE_H
+#define _SIMPLE_TILES_RTREE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* packed r-trees over boxes that don't change once built */
+
+// How many entries each node of the tree covers.
+#define SIMPLET_RTREE_FANOUT 16
+
+typedef struct {
+  double min_x;
+  double min_y;
+  double max_x;
+  double max_y;
+} simplet_box_t;
+
+// Every level of the tree stored bottom up in one array, node i of a level
+// covers entries i * SIMPLET_RTREE_FANOUT onwards of the level below it.
+typedef struct {
+  simplet_box_t *boxes;
+  int *ids;
+  int *levels;
+  int levels_length;
+  int length;
+} simplet_rtree_t;
+
+simplet_rtree_t *simplet_rtree_new(const simplet_box_t *boxes, int length);
+
+void simplet_rtree_free(simplet_rtree_t *tree);
+
+int simplet_rtree_search(simplet_rtree_t *tree, const simplet_box_t *box,
+                         int *hits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
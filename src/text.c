@@ -3,19 +3,247 @@
 #include "util.h"
 #include "bounds.h"
 #include "memory.h"
+#include "lru.h"
 #include <math.h>
+#include <pthread.h>
 
 #define GTimer GTimer_GTK
 #include <glib.h>
 #include <glib-object.h>
 #undef GTimer
 
-// A storage structure that holds the current state of the layout.
+// An entry in a label grid, linking stored bounds to one of the cells they
+// cover. Entries that hash to the same bucket are chained by index.
+struct simplet_label_cell_t {
+  int x;
+  int y;
+  unsigned int placement;
+  int next;
+};
+
+// How many shaped layouts each thread keeps around.
+#define SIMPLET_LAYOUT_CACHE 4096
+
+// A shaped layout and its size in pixels, cached by text, font and tracking.
 typedef struct {
   PangoLayout *layout;
-  int placed;
+  int width;
+  int height;
+} shaped_t;
+
+// Text state kept for the life of a rendering thread, so fonts are only
+// loaded and labels only shaped once no matter how many tiles draw them.
+// Pango objects can't be shared between threads, so every thread gets its
+// own.
+typedef struct {
+  PangoFontMap *font_map;
+  PangoContext *pango_ctx;
+  simplet_lru_t *shaped;
+} engine_t;
+
+static pthread_key_t engine_key;
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+
+// Free a shaped layout.
+static void shaped_vfree(void *val) {
+  shaped_t *shaped = val;
+  g_object_unref(shaped->layout);
+  free(shaped);
+}
+
+// Free a thread's text engine on thread exit.
+static void engine_vfree(void *val) {
+  engine_t *engine = val;
+  if (engine->shaped) simplet_lru_free(engine->shaped);
+  if (engine->pango_ctx) g_object_unref(engine->pango_ctx);
+  if (engine->font_map) g_object_unref(engine->font_map);
+  free(engine);
+}
+
+static void engine_key_init() {
+  pthread_key_create(&engine_key, engine_vfree);
+}
+
+// Return the calling thread's text engine, creating it on first use.
+static engine_t *get_engine() {
+  pthread_once(&engine_once, engine_key_init);
+
+  engine_t *engine;
+  if ((engine = pthread_getspecific(engine_key))) return engine;
+
+  if (!(engine = malloc(sizeof(*engine)))) return NULL;
+  memset(engine, 0, sizeof(*engine));
+
+  if (!(engine->shaped = simplet_lru_new(SIMPLET_LAYOUT_CACHE, shaped_vfree)) ||
+      !(engine->font_map = pango_cairo_font_map_new()) ||
+      !(engine->pango_ctx = pango_font_map_create_context(engine->font_map))) {
+    engine_vfree(engine);
+    return NULL;
+  }
+
+  // Turn font hinting off
+  cairo_font_options_t *opts;
+  if (!(opts = cairo_font_options_create())) {
+    engine_vfree(engine);
+    return NULL;
+  }
+  cairo_font_options_set_hint_style(opts, CAIRO_HINT_STYLE_NONE);
+  cairo_font_options_set_hint_metrics(opts, CAIRO_HINT_METRICS_OFF);
+  pango_cairo_context_set_font_options(engine->pango_ctx, opts);
+  cairo_font_options_destroy(opts);
+
+  pthread_setspecific(engine_key, engine);
+  return engine;
+}
+
+// Set up an empty grid.
+static void grid_init(simplet_label_grid_t *grid) {
+  memset(grid, 0, sizeof(*grid));
+  for (int i = 0; i < SIMPLET_LABEL_BUCKETS; i++) grid->buckets[i] = -1;
+}
+
+// Free the storage held by a grid.
+static void grid_free(simplet_label_grid_t *grid) {
+  free(grid->bounds);
+  free(grid->cells);
+}
+
+// Find the bucket for a grid cell.
+static unsigned int bucket(int x, int y) {
+  return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u) %
+         SIMPLET_LABEL_BUCKETS;
+}
+
+// Find the range of grid cells covered by bounds.
+static void cell_range(simplet_bounds_t *bounds, int *x0, int *y0, int *x1,
+                       int *y1) {
+  *x0 = (int)floor(bounds->nw.x / SIMPLET_LABEL_CELL);
+  *x1 = (int)floor(bounds->se.x / SIMPLET_LABEL_CELL);
+  *y0 = (int)floor(bounds->se.y / SIMPLET_LABEL_CELL);
+  *y1 = (int)floor(bounds->nw.y / SIMPLET_LABEL_CELL);
+}
+
+// Test bounds against the bounds stored in the grid cells it covers.
+static int grid_collides(simplet_label_grid_t *grid,
+                         simplet_bounds_t *bounds) {
+  int x0, y0, x1, y1;
+  cell_range(bounds, &x0, &y0, &x1, &y1);
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      for (int i = grid->buckets[bucket(x, y)]; i >= 0;
+           i = grid->cells[i].next) {
+        simplet_label_cell_t *cell = &grid->cells[i];
+        if (cell->x != x || cell->y != y) continue;
+        if (simplet_bounds_intersects(&grid->bounds[cell->placement], bounds))
+          return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Sort placement indexes ascending.
+static int compare_placements(const void *a, const void *b) {
+  unsigned int l = *(const unsigned int *)a, r = *(const unsigned int *)b;
+  return (l > r) - (l < r);
+}
+
+// Find every placement intersecting bounds. Returns their indexes in
+// placement order, and the count in length, or NULL if there are none.
+static unsigned int *grid_search(simplet_label_grid_t *grid,
+                                 simplet_bounds_t *bounds,
+                                 unsigned int *length) {
+  unsigned int *found = NULL, size = 0;
+  *length = 0;
+
+  int x0, y0, x1, y1;
+  cell_range(bounds, &x0, &y0, &x1, &y1);
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      for (int i = grid->buckets[bucket(x, y)]; i >= 0;
+           i = grid->cells[i].next) {
+        simplet_label_cell_t *cell = &grid->cells[i];
+        if (cell->x != x || cell->y != y) continue;
+        if (!simplet_bounds_intersects(&grid->bounds[cell->placement], bounds))
+          continue;
+        if (*length == size) {
+          size = size ? size * 2 : 32;
+          unsigned int *tmp;
+          if (!(tmp = realloc(found, size * sizeof(*found)))) {
+            free(found);
+            *length = 0;
+            return NULL;
+          }
+          found = tmp;
+        }
+        found[(*length)++] = cell->placement;
+      }
+    }
+  }
+  if (!found) return NULL;
+
+  // A placement turns up once for every cell it covers.
+  qsort(found, *length, sizeof(*found), compare_placements);
+  unsigned int unique = 0;
+  for (unsigned int i = 0; i < *length; i++)
+    if (!unique || found[unique - 1] != found[i]) found[unique++] = found[i];
+  *length = unique;
+  return found;
+}
+
+// Make room for one more set of bounds in the grid.
+static int grid_reserve(simplet_label_grid_t *grid) {
+  if (grid->length < grid->size) return 1;
+  unsigned int size = grid->size ? grid->size * 2 : 32;
   simplet_bounds_t *bounds;
-} placement_t;
+  if (!(bounds = realloc(grid->bounds, size * sizeof(*bounds)))) return 0;
+  grid->bounds = bounds;
+  grid->size = size;
+  return 1;
+}
+
+// Store bounds in the grid and link them into every cell they cover, the
+// grid must have room for them. Returns 0 on failure.
+static int grid_insert(simplet_label_grid_t *grid, simplet_bounds_t *bounds) {
+  int x0, y0, x1, y1;
+  cell_range(bounds, &x0, &y0, &x1, &y1);
+  unsigned int needed =
+      grid->cells_length + (unsigned int)((x1 - x0 + 1) * (y1 - y0 + 1));
+  if (needed > grid->cells_size) {
+    unsigned int size = grid->cells_size ? grid->cells_size : 64;
+    while (size < needed) size *= 2;
+    simplet_label_cell_t *cells;
+    if (!(cells = realloc(grid->cells, size * sizeof(*cells)))) return 0;
+    grid->cells = cells;
+    grid->cells_size = size;
+  }
+
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      unsigned int b = bucket(x, y);
+      simplet_label_cell_t *cell = &grid->cells[grid->cells_length];
+      cell->x = x;
+      cell->y = y;
+      cell->placement = grid->length;
+      cell->next = grid->buckets[b];
+      grid->buckets[b] = grid->cells_length++;
+    }
+  }
+  grid->bounds[grid->length++] = *bounds;
+  return 1;
+}
+
+// Build the pixel bounds of a width by height label centered on x, y.
+static void label_bounds(simplet_bounds_t *bounds, int width, int height,
+                         double x, double y) {
+  memset(bounds, 0, sizeof(*bounds));
+  bounds->nw.x = floor(x - width / 2);
+  bounds->nw.y = floor(y + height / 2);
+  bounds->se.x = floor(x + width / 2);
+  bounds->se.y = floor(y - height / 2);
+  bounds->width = bounds->se.x - bounds->nw.x;
+  bounds->height = bounds->nw.y - bounds->se.y;
+}
 
 // Create and return a new lithograph, returns NULL on failure.
 simplet_lithograph_t *simplet_lithograph_new(cairo_t *ctx) {
@@ -23,104 +251,89 @@ simplet_lithograph_t *simplet_lithograph_new(cairo_t *ctx) {
   if (!(litho = malloc(sizeof(*litho)))) return NULL;
 
   memset(litho, 0, sizeof(*litho));
+  grid_init(&litho->grid);
 
-  if (!(litho->placements = simplet_list_new(litho))) {
+  engine_t *engine;
+  if (!(engine = get_engine())) {
     free(litho);
     return NULL;
   }
 
   litho->ctx = ctx;
-  litho->pango_ctx = pango_cairo_create_context(ctx);
+  litho->pango_ctx = engine->pango_ctx;
 
   cairo_reference(ctx);
   simplet_retain((simplet_retainable_t *)litho);
   return litho;
 }
 
-// Free a placement.
-void placement_vfree(void *placement) {
-  placement_t *plc = placement;
-  simplet_bounds_free(plc->bounds);
-  g_object_unref(plc->layout);
-  free(plc);
-}
-
 // Free a lithograph and unref the stored ctx.
 void simplet_lithograph_free(simplet_lithograph_t *litho) {
   if (simplet_release((simplet_retainable_t *)litho) > 0) return;
 
   cairo_destroy(litho->ctx);
-  simplet_list_set_item_free(litho->placements, placement_vfree);
-  g_object_unref(litho->pango_ctx);
-  simplet_list_free(litho->placements);
+  for (unsigned int i = 0; i < litho->grid.length; i++)
+    g_object_unref(litho->layouts[i]);
+  free(litho->layouts);
+  grid_free(&litho->grid);
   free(litho);
 }
 
-// Create and return a new placement.
-placement_t *placement_new(PangoLayout *layout, simplet_bounds_t *bounds) {
-  placement_t *placement;
-  if (!(placement = malloc(sizeof(*placement)))) return NULL;
-
-  memset(placement, 0, sizeof(*placement));
+// Store a placement, taking ownership of layout.
+static void insert_placement(simplet_lithograph_t *litho, PangoLayout *layout,
+                             simplet_bounds_t *bounds) {
+  unsigned int size = litho->grid.size;
+  if (!grid_reserve(&litho->grid)) {
+    g_object_unref(layout);
+    return;
+  }
 
-  placement->layout = layout;
-  placement->bounds = bounds;
-  placement->placed = FALSE;
+  // Keep the layouts as big as the grid's bounds.
+  if (litho->grid.size != size) {
+    PangoLayout **layouts;
+    if (!(layouts = realloc(litho->layouts,
+                            litho->grid.size * sizeof(*layouts)))) {
+      litho->grid.size = size;
+      g_object_unref(layout);
+      return;
+    }
+    litho->layouts = layouts;
+  }
 
-  return placement;
+  litho->layouts[litho->grid.length] = layout;
+  if (!grid_insert(&litho->grid, bounds)) g_object_unref(layout);
 }
 
 // Before placing a new label we need to see if the label overlaps over
 // previously placed labels. This algorithm will be refactored a bit to try
 // NE SE SW NW placements in the future.
-void try_and_insert_placement(simplet_lithograph_t *litho, PangoLayout *layout,
-                              double x, double y) {
-  int width, height;
-  // Find the computed width and height of a layout in image pixels
-  pango_layout_get_pixel_size(layout, &width, &height);
-  simplet_bounds_t *bounds = simplet_bounds_new();
-  if (!bounds) return;
+static void try_and_insert_placement(simplet_lithograph_t *litho,
+                                     PangoLayout *layout, int width,
+                                     int height, double x, double y) {
   // Create a bounds to test for intersection
-  simplet_bounds_extend(bounds, floor(x - width / 2), floor(y - height / 2));
-  simplet_bounds_extend(bounds, floor(x + width / 2), floor(y + height / 2));
-
-  // Iterate through the list of already placed labels and check for overlaps.
-  simplet_listiter_t *iter = simplet_get_list_iter(litho->placements);
-  placement_t *placement;
-  while ((placement = (placement_t *)simplet_list_next(iter))) {
-    if (simplet_bounds_intersects(placement->bounds, bounds)) {
-      simplet_bounds_free(bounds);
-      g_object_unref(layout);
-      simplet_list_iter_free(iter);
-      return;
-    }
-  }
+  simplet_bounds_t bounds;
+  label_bounds(&bounds, width, height, x, y);
 
-  // If we get here we can create and insert a new placement.
-  placement_t *plc = placement_new(layout, bounds);
-  if (!plc) {
-    simplet_bounds_free(bounds);
+  // Only look at the labels that share a grid cell with this one.
+  if (grid_collides(&litho->grid, &bounds)) {
     g_object_unref(layout);
     return;
   }
 
-  simplet_list_push(litho->placements, (void *)plc);
+  // If we get here we can store and index a new placement.
+  insert_placement(litho, layout, &bounds);
 }
 
 // Apply the labels to the map.
 void simplet_lithograph_apply(simplet_lithograph_t *litho,
                               simplet_list_t *styles) {
-  simplet_listiter_t *iter = simplet_get_list_iter(litho->placements);
-  placement_t *placement;
   cairo_save(litho->ctx);
-  while ((placement = (placement_t *)simplet_list_next(iter))) {
-    if (placement->placed == TRUE) continue;
-    cairo_move_to(litho->ctx, placement->bounds->nw.x, placement->bounds->se.y);
+  for (; litho->applied < litho->grid.length; litho->applied++) {
+    simplet_bounds_t *bounds = &litho->grid.bounds[litho->applied];
+    cairo_move_to(litho->ctx, bounds->nw.x, bounds->se.y);
 
     // Draw the placement
-    pango_cairo_layout_path(litho->ctx, placement->layout);
-
-    placement->placed = TRUE;
+    pango_cairo_layout_path(litho->ctx, litho->layouts[litho->applied]);
   }
   simplet_apply_styles(litho->ctx, styles, "text-stroke-weight",
                        "text-stroke-color", "color", NULL);
@@ -129,23 +342,71 @@ void simplet_lithograph_apply(simplet_lithograph_t *litho,
   cairo_restore(litho->ctx);
 }
 
-// Create and add a placement to the current lithograph if it doesn't overlap
-// with current labels.
-void simplet_lithograph_add_placement(simplet_lithograph_t *litho,
-                                      OGRFeatureH feature,
-                                      simplet_list_t *styles,
-                                      cairo_t *proj_ctx) {
-  simplet_style_t *field = simplet_lookup_style(styles, "text-field");
-  if (!field) return;
+// Return a layout for txt set in font with the tracking from styles, shaping
+// it only if this thread hasn't seen the same combination recently. The
+// layout stays owned by the cache.
+static shaped_t *shape(const char *txt, const char *font,
+                       simplet_list_t *styles) {
+  engine_t *engine;
+  if (!(engine = get_engine())) return NULL;
+
+  simplet_style_t *spacing = simplet_lookup_style(styles, "letter-spacing");
+  const char *tracking = spacing ? spacing->arg : "";
+
+  // The key is the three strings with their terminators.
+  size_t txt_length = strlen(txt) + 1, font_length = strlen(font) + 1,
+         tracking_length = strlen(tracking) + 1;
+  size_t key_length = txt_length + font_length + tracking_length;
+  char *key;
+  if (!(key = malloc(key_length))) return NULL;
+  memcpy(key, txt, txt_length);
+  memcpy(key + txt_length, font, font_length);
+  memcpy(key + txt_length + font_length, tracking, tracking_length);
+
+  shaped_t *shaped;
+  if ((shaped = simplet_lru_get(engine->shaped, key, key_length))) {
+    free(key);
+    return shaped;
+  }
 
-  OGRFeatureDefnH defn;
-  if (!(defn = OGR_F_GetDefnRef(feature))) return;
+  if (!(shaped = malloc(sizeof(*shaped)))) {
+    free(key);
+    return NULL;
+  }
 
-  int idx = OGR_FD_GetFieldIndex(defn, (const char *)field->arg);
-  if (idx < 0) return;
+  PangoLayout *layout = pango_layout_new(engine->pango_ctx);
+  pango_layout_set_text(layout, txt, -1);
+  simplet_apply_styles(layout, styles, "letter-spacing", NULL);
 
+  PangoFontDescription *desc = pango_font_description_from_string(font);
+  pango_layout_set_font_description(layout, desc);
+  pango_font_description_free(desc);
+
+  // Find the computed width and height of a layout in image pixels, this is
+  // what forces pango to shape the text.
+  shaped->layout = layout;
+  pango_layout_get_pixel_size(layout, &shaped->width, &shaped->height);
+
+  if (!simplet_lru_set(engine->shaped, key, key_length, shaped, 1)) {
+    free(key);
+    shaped_vfree(shaped);
+    return NULL;
+  }
+  free(key);
+  return shaped;
+}
+
+// Byte budget for the process wide label anchor cache.
+#define SIMPLET_ANCHOR_CACHE (16 << 20)
+
+// Label anchors in source coordinates, shared by every thread.
+static simplet_lru_t *anchors = NULL;
+static pthread_mutex_t anchors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Find the anchor for a label on geom: the centroid of the largest part of a
+// multi-geometry, or of the geometry itself.
+static int find_anchor(OGRGeometryH super, double *x, double *y) {
   // Find the largest sub geometry of a particular multi-geometry.
-  OGRGeometryH super = OGR_F_GetGeometryRef(feature);
   OGRGeometryH geom = super;
   double area = 0.0;
   switch (wkbFlatten(OGR_G_GetGeometryType(super))) {
@@ -167,49 +428,333 @@ void simplet_lithograph_add_placement(simplet_lithograph_t *litho,
   // Find the center of our geometry. This sometimes throws an invalid geometry
   // error, so there is a slight bug here somehow.
   OGRGeometryH center;
-  if (!(center = OGR_G_CreateGeometry(wkbPoint))) return;
+  if (!(center = OGR_G_CreateGeometry(wkbPoint))) return 0;
   if (OGR_G_Centroid(geom, center) == OGRERR_FAILURE) {
     OGR_G_DestroyGeometry(center);
-    return;
+    return 0;
   }
 
-  // Turn font hinting off
-  cairo_font_options_t *opts;
-  if (!(opts = cairo_font_options_create())) {
-    OGR_G_DestroyGeometry(center);
-    return;
+  *x = OGR_G_GetX(center, 0);
+  *y = OGR_G_GetY(center, 0);
+  OGR_G_DestroyGeometry(center);
+  return 1;
+}
+
+// Find the label anchor for feature in the coordinates of its source, which
+// must not have been transformed yet. Anchors are cached under stamp, a
+// simplet_source_stamp of the data source, along with the sql that read the
+// feature and the feature's layer and id, so later tiles showing the same
+// feature skip the area and centroid math. The sql is part of the key since
+// queries on one layer can give the same id different geometries. Returns 0
+// if there is no anchor.
+int simplet_lithograph_anchor(const char *stamp, const char *sql,
+                              OGRFeatureH feature, double *x, double *y) {
+  OGRGeometryH geom;
+  if (!(geom = OGR_F_GetGeometryRef(feature))) return 0;
+
+  GIntBig fid = OGR_F_GetFID(feature);
+  OGRFeatureDefnH defn = OGR_F_GetDefnRef(feature);
+  if (fid == OGRNullFID || !defn || !stamp || !sql)
+    return find_anchor(geom, x, y);
+
+  // The key is the stamp, sql and layer name with their terminators, then
+  // the id.
+  const char *name = OGR_FD_GetName(defn);
+  size_t stamp_length = strlen(stamp) + 1, sql_length = strlen(sql) + 1;
+  size_t name_length = strlen(name) + 1;
+  size_t key_length = stamp_length + sql_length + name_length + sizeof(fid);
+  char *key;
+  if (!(key = malloc(key_length))) return find_anchor(geom, x, y);
+  memcpy(key, stamp, stamp_length);
+  memcpy(key + stamp_length, sql, sql_length);
+  memcpy(key + stamp_length + sql_length, name, name_length);
+  memcpy(key + stamp_length + sql_length + name_length, &fid, sizeof(fid));
+
+  pthread_mutex_lock(&anchors_lock);
+  if (!anchors) anchors = simplet_lru_new(SIMPLET_ANCHOR_CACHE, free);
+  simplet_point_t *cached = anchors ? simplet_lru_get(anchors, key, key_length)
+                                    : NULL;
+  if (cached) {
+    *x = cached->x;
+    *y = cached->y;
   }
+  pthread_mutex_unlock(&anchors_lock);
 
-  cairo_font_options_set_hint_style(opts, CAIRO_HINT_STYLE_NONE);
-  cairo_font_options_set_hint_metrics(opts, CAIRO_HINT_METRICS_OFF);
-  pango_cairo_context_set_font_options(litho->pango_ctx, opts);
-  cairo_font_options_destroy(opts);
+  if (cached) {
+    free(key);
+    return 1;
+  }
 
-  // Get the field containing the text for the label.
-  char *txt = simplet_copy_string(OGR_F_GetFieldAsString(feature, idx));
-  PangoLayout *layout = pango_layout_new(litho->pango_ctx);
-  pango_layout_set_text(layout, txt, -1);
-  free(txt);
+  if (!find_anchor(geom, x, y)) {
+    free(key);
+    return 0;
+  }
 
-  // Grab the font to use and apply tracking.
-  simplet_style_t *font = simplet_lookup_style(styles, "font");
-  simplet_apply_styles(layout, styles, "letter-spacing", NULL);
+  simplet_point_t *point;
+  if ((point = malloc(sizeof(*point)))) {
+    point->x = *x;
+    point->y = *y;
+    pthread_mutex_lock(&anchors_lock);
+    if (!anchors ||
+        !simplet_lru_set(anchors, key, key_length, point,
+                         key_length + sizeof(*point)))
+      free(point);
+    pthread_mutex_unlock(&anchors_lock);
+  }
+  free(key);
+  return 1;
+}
+
+// Find the label text for feature, or NULL if it has none.
+static const char *label_text(OGRFeatureH feature, simplet_list_t *styles) {
+  simplet_style_t *field = simplet_lookup_style(styles, "text-field");
+  if (!field) return NULL;
 
-  const char *font_family;
+  OGRFeatureDefnH defn;
+  if (!(defn = OGR_F_GetDefnRef(feature))) return NULL;
 
-  if (!font)
-    font_family = "helvetica 12px";
-  else
-    font_family = font->arg;
+  int idx = OGR_FD_GetFieldIndex(defn, (const char *)field->arg);
+  if (idx < 0) return NULL;
 
-  PangoFontDescription *desc = pango_font_description_from_string(font_family);
-  pango_layout_set_font_description(layout, desc);
-  pango_font_description_free(desc);
+  return OGR_F_GetFieldAsString(feature, idx);
+}
+
+// Shape txt with the font and tracking set in styles.
+static shaped_t *shape_styled(const char *txt, simplet_list_t *styles) {
+  simplet_style_t *font = simplet_lookup_style(styles, "font");
+  return shape(txt, font ? font->arg : "helvetica 12px", styles);
+}
+
+// Create and add a placement for feature at x, y in device pixels to the
+// current lithograph if it doesn't overlap with current labels.
+void simplet_lithograph_add_placement(simplet_lithograph_t *litho,
+                                      OGRFeatureH feature,
+                                      simplet_list_t *styles, double x,
+                                      double y) {
+  // Grab the text for the label, the font to use and the tracking.
+  const char *txt;
+  if (!(txt = label_text(feature, styles))) return;
 
-  double x = OGR_G_GetX(center, 0), y = OGR_G_GetY(center, 0);
-  cairo_user_to_device(proj_ctx, &x, &y);
+  shaped_t *shaped;
+  if (!(shaped = shape_styled(txt, styles))) return;
 
   // Finally try the placement and test for overlaps.
-  try_and_insert_placement(litho, layout, x, y);
-  OGR_G_DestroyGeometry(center);
+  try_and_insert_placement(litho, g_object_ref(shaped->layout), shaped->width,
+                           shaped->height, x, y);
+}
+
+// Add the labels from a label index that land on a width by height map,
+// where dx, dy moves the index's global pixels into the map's pixels. These
+// labels were already placed against the whole layer, so they are added
+// without collision tests to draw the same on every tile; labels placed on
+// the lithograph later still avoid them.
+void simplet_lithograph_add_index(simplet_lithograph_t *litho,
+                                  simplet_label_index_t *index,
+                                  simplet_list_t *styles, double dx, double dy,
+                                  double width, double height) {
+  simplet_bounds_t view;
+  memset(&view, 0, sizeof(view));
+  view.nw.x = -dx;
+  view.nw.y = height - dy;
+  view.se.x = width - dx;
+  view.se.y = -dy;
+
+  unsigned int length;
+  unsigned int *found = grid_search(&index->grid, &view, &length);
+  for (unsigned int i = 0; i < length; i++) {
+    shaped_t *shaped;
+    if (!(shaped = shape_styled(index->texts[found[i]], styles))) continue;
+
+    simplet_bounds_t bounds = index->grid.bounds[found[i]];
+    bounds.nw.x += dx;
+    bounds.se.x += dx;
+    bounds.nw.y += dy;
+    bounds.se.y += dy;
+    insert_placement(litho, g_object_ref(shaped->layout), &bounds);
+  }
+  free(found);
+}
+
+// Byte budget for the process wide cache of label indexes.
+#define SIMPLET_LABEL_INDEX_CACHE (64 << 20)
+
+// A label index one thread is building while others wait for it.
+typedef struct building_t {
+  struct building_t *next;
+  char *key;
+  simplet_label_index_t *index;  // once built, NULL if that failed
+  bool built;
+  int waiters;
+} building_t;
+
+// Label indexes by layer, query and resolution, shared by every thread, and
+// those being built.
+static simplet_lru_t *indexes = NULL;
+static building_t *building = NULL;
+static pthread_mutex_t indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t indexes_built = PTHREAD_COND_INITIALIZER;
+
+// Create and return a new, empty label index, returns NULL on failure.
+simplet_label_index_t *simplet_label_index_new() {
+  simplet_label_index_t *index;
+  if (!(index = malloc(sizeof(*index)))) return NULL;
+
+  memset(index, 0, sizeof(*index));
+  grid_init(&index->grid);
+
+  simplet_retain((simplet_retainable_t *)index);
+  return index;
+}
+
+// Drop a reference to an index, the caller holds indexes_lock.
+static void index_release(simplet_label_index_t *index) {
+  if (simplet_release((simplet_retainable_t *)index) > 0) return;
+
+  for (unsigned int i = 0; i < index->grid.length; i++) free(index->texts[i]);
+  free(index->texts);
+  grid_free(&index->grid);
+  free(index);
+}
+
+static void index_vrelease(void *index) { index_release(index); }
+
+// Free a label index, or drop a reference to one returned by lookup.
+void simplet_label_index_free(simplet_label_index_t *index) {
+  pthread_mutex_lock(&indexes_lock);
+  index_release(index);
+  pthread_mutex_unlock(&indexes_lock);
+}
+
+// Place a label for feature at x, y in global pixels if it doesn't overlap
+// with labels already in the index.
+void simplet_label_index_add_placement(simplet_label_index_t *index,
+                                       OGRFeatureH feature,
+                                       simplet_list_t *styles, double x,
+                                       double y) {
+  const char *txt;
+  if (!(txt = label_text(feature, styles))) return;
+
+  shaped_t *shaped;
+  if (!(shaped = shape_styled(txt, styles))) return;
+
+  simplet_bounds_t bounds;
+  label_bounds(&bounds, shaped->width, shaped->height, x, y);
+  if (grid_collides(&index->grid, &bounds)) return;
+
+  // Keep the texts as big as the grid's bounds.
+  unsigned int size = index->grid.size;
+  if (!grid_reserve(&index->grid)) return;
+  if (index->grid.size != size) {
+    char **texts;
+    if (!(texts = realloc(index->texts, index->grid.size * sizeof(*texts)))) {
+      index->grid.size = size;
+      return;
+    }
+    index->texts = texts;
+  }
+
+  char *copy;
+  if (!(copy = simplet_copy_string(txt))) return;
+  index->texts[index->grid.length] = copy;
+  if (!grid_insert(&index->grid, &bounds)) free(copy);
+}
+
+// Free a finished build, the caller holds indexes_lock.
+static void building_free(building_t *pending) {
+  if (pending->index) index_release(pending->index);
+  free(pending->key);
+  free(pending);
+}
+
+// Find a cached label index by key. The index returned holds a reference
+// that must be dropped with simplet_label_index_free. When another thread
+// is building the index this waits for it. Otherwise a miss sets build, the
+// caller builds the index and must hand it, or NULL if that fails, to
+// simplet_label_index_store so every layer is only scanned once.
+simplet_label_index_t *simplet_label_index_lookup(const char *key,
+                                                  bool *build) {
+  simplet_label_index_t *index = NULL;
+  *build = false;
+  pthread_mutex_lock(&indexes_lock);
+  if (indexes && (index = simplet_lru_get(indexes, key, strlen(key)))) {
+    simplet_retain((simplet_retainable_t *)index);
+    pthread_mutex_unlock(&indexes_lock);
+    return index;
+  }
+
+  building_t *pending = building;
+  while (pending && strcmp(pending->key, key)) pending = pending->next;
+  if (!pending) {
+    // the others wait for this thread, unless it can't say it's building
+    if ((pending = malloc(sizeof(*pending)))) {
+      memset(pending, 0, sizeof(*pending));
+      if ((pending->key = simplet_copy_string(key))) {
+        pending->next = building;
+        building = pending;
+      } else {
+        free(pending);
+      }
+    }
+    *build = true;
+    pthread_mutex_unlock(&indexes_lock);
+    return NULL;
+  }
+
+  pending->waiters++;
+  while (!pending->built) pthread_cond_wait(&indexes_built, &indexes_lock);
+  if ((index = pending->index)) simplet_retain((simplet_retainable_t *)index);
+  if (!--pending->waiters) building_free(pending);
+  pthread_mutex_unlock(&indexes_lock);
+  return index;
+}
+
+// Cache a label index under key and hand it to the threads waiting for it,
+// NULL when building it failed. The cache takes its own reference, unless
+// the index is larger than the whole cache, which then drops any older
+// index under key instead.
+void simplet_label_index_store(const char *key, simplet_label_index_t *index) {
+  size_t cost = 0;
+  if (index) {
+    cost = sizeof(*index) + strlen(key);
+    for (unsigned int i = 0; i < index->grid.length; i++)
+      cost += sizeof(simplet_bounds_t) + sizeof(char *) +
+              strlen(index->texts[i]) + 1;
+    cost += index->grid.cells_length * sizeof(simplet_label_cell_t);
+  }
+
+  pthread_mutex_lock(&indexes_lock);
+  if (!indexes)
+    indexes = simplet_lru_new(SIMPLET_LABEL_INDEX_CACHE, index_vrelease);
+  if (!index) {
+    // nothing to keep, the waiting threads go without
+  } else if (indexes && cost > SIMPLET_LABEL_INDEX_CACHE) {
+    simplet_lru_remove(indexes, key, strlen(key));
+  } else {
+    simplet_retain((simplet_retainable_t *)index);
+    if (!indexes || !simplet_lru_set(indexes, key, strlen(key), index, cost))
+      index_release(index);
+  }
+
+  building_t **slot = &building;
+  while (*slot && strcmp((*slot)->key, key)) slot = &(*slot)->next;
+  if (*slot) {
+    building_t *pending = *slot;
+    *slot = pending->next;
+    pending->built = true;
+    if ((pending->index = index))
+      simplet_retain((simplet_retainable_t *)index);
+    if (pending->waiters)
+      pthread_cond_broadcast(&indexes_built);
+    else
+      building_free(pending);
+  }
+  pthread_mutex_unlock(&indexes_lock);
+}
+
+// Return the number of label indexes cached.
+unsigned int simplet_label_index_get_length() {
+  pthread_mutex_lock(&indexes_lock);
+  unsigned int length = indexes ? simplet_lru_get_length(indexes) : 0;
+  pthread_mutex_unlock(&indexes_lock);
+  return length;
 }
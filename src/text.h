@@ -8,27 +8,85 @@
 extern "C" {
 #endif
 
+// Labels are bucketed into square cells of this many pixels for collision
+// tests, and the cells are hashed into a fixed number of buckets.
+#define SIMPLET_LABEL_CELL 64
+#define SIMPLET_LABEL_BUCKETS 512
+
+typedef struct simplet_label_cell_t simplet_label_cell_t;
+
+// A uniform grid over label bounds in pixel space.
+typedef struct {
+  simplet_bounds_t *bounds;
+  unsigned int length;
+  unsigned int size;
+  simplet_label_cell_t *cells;
+  unsigned int cells_length;
+  unsigned int cells_size;
+  int buckets[SIMPLET_LABEL_BUCKETS];
+} simplet_label_grid_t;
+
 typedef struct {
   SIMPLET_ERROR_FIELDS
   SIMPLET_USER_DATA
   SIMPLET_RETAIN
   cairo_t *ctx;
   PangoContext *pango_ctx;
-  simplet_list_t *placements;
+  // Layouts of the placed labels, in placement order, parallel to the bounds
+  // stored in the grid.
+  PangoLayout **layouts;
+  simplet_label_grid_t grid;
+  // Number of placements already drawn to ctx.
+  unsigned int applied;
 } simplet_lithograph_t;
 
+// Labels placed once for a whole layer at a single resolution in global
+// pixel space, so every tile at that resolution draws the same ones.
+typedef struct {
+  SIMPLET_ERROR_FIELDS
+  SIMPLET_USER_DATA
+  SIMPLET_RETAIN
+  // Text of the placed labels, parallel to the bounds stored in the grid.
+  char **texts;
+  simplet_label_grid_t grid;
+} simplet_label_index_t;
+
 simplet_lithograph_t *simplet_lithograph_new(cairo_t *ctx);
 
 void simplet_lithograph_free(simplet_lithograph_t *litho);
 
+int simplet_lithograph_anchor(const char *stamp, const char *sql,
+                              OGRFeatureH feature, double *x, double *y);
+
 void simplet_lithograph_add_placement(simplet_lithograph_t *litho,
                                       OGRFeatureH feature,
-                                      simplet_list_t *styles,
-                                      cairo_t *proj_ctx);
+                                      simplet_list_t *styles, double x,
+                                      double y);
+
+void simplet_lithograph_add_index(simplet_lithograph_t *litho,
+                                  simplet_label_index_t *index,
+                                  simplet_list_t *styles, double dx, double dy,
+                                  double width, double height);
 
 void simplet_lithograph_apply(simplet_lithograph_t *litho,
                               simplet_list_t *styles);
 
+simplet_label_index_t *simplet_label_index_new();
+
+void simplet_label_index_free(simplet_label_index_t *index);
+
+void simplet_label_index_add_placement(simplet_label_index_t *index,
+                                       OGRFeatureH feature,
+                                       simplet_list_t *styles, double x,
+                                       double y);
+
+simplet_label_index_t *simplet_label_index_lookup(const char *key,
+                                                  bool *build);
+
+void simplet_label_index_store(const char *key, simplet_label_index_t *index);
+
+unsigned int simplet_label_index_get_length();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,389 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "tile_cache.h"
+#include "util.h"
+
+// An encoded tile held in memory.
+typedef struct {
+  size_t length;
+  unsigned char data[];
+} tile_t;
+
+// What's known about some pixels: how often they've been drawn and, once
+// they've repeated, their encoding.
+typedef struct {
+  int seen;
+  bool encoded;
+  size_t length;
+  unsigned char data[];
+} duplicate_t;
+
+// Create a cache keeping up to budget bytes of tiles in memory and, when
+// path isn't NULL, every tile it's given in a directory under path. Returns
+// NULL on failure.
+simplet_tile_cache_t *simplet_tile_cache_new(size_t budget, const char *path) {
+  simplet_tile_cache_t *cache;
+  if (!(cache = malloc(sizeof(*cache)))) return NULL;
+
+  memset(cache, 0, sizeof(*cache));
+  if (!(cache->tiles = simplet_lru_new(budget, free)) ||
+      !(cache->duplicates = simplet_lru_new(SIMPLET_TILE_DUPLICATES, free)) ||
+      (path && !(cache->path = simplet_copy_string(path)))) {
+    if (cache->tiles) simplet_lru_free(cache->tiles);
+    if (cache->duplicates) simplet_lru_free(cache->duplicates);
+    free(cache);
+    return NULL;
+  }
+
+  pthread_mutex_init(&cache->lock, NULL);
+  return cache;
+}
+
+void simplet_tile_cache_free(simplet_tile_cache_t *cache) {
+  simplet_lru_free(cache->tiles);
+  simplet_lru_free(cache->duplicates);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->path);
+  free(cache);
+}
+
+// Append the tile's position to key. Returns NULL on failure.
+static unsigned char *tile_key(const void *key, size_t key_length,
+                               unsigned int x, unsigned int y, unsigned int z,
+                               size_t *length) {
+  unsigned int position[3] = {z, x, y};
+  unsigned char *out;
+  *length = key_length + sizeof(position);
+  if (!(out = malloc(*length))) return NULL;
+  memcpy(out, key, key_length);
+  memcpy(out + key_length, position, sizeof(position));
+  return out;
+}
+
+// FNV-1a over the key, naming the directory of tiles sharing it.
+static uint64_t hash_key(const void *key, size_t key_length) {
+  const unsigned char *bytes = key;
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < key_length; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+// Where a tile lives on disk. x and y are split into groups of three digits
+// so no directory holds more than a thousand entries. Returns NULL on
+// failure.
+static char *tile_path(simplet_tile_cache_t *cache, const void *key,
+                       size_t key_length, unsigned int x, unsigned int y,
+                       unsigned int z) {
+  char *path;
+  if (asprintf(&path, "%s/%016llx/%02u/%03u/%03u/%03u/%03u/%03u/%03u.png",
+               cache->path,
+               (unsigned long long)hash_key(key, key_length), z,
+               x / 1000000, x / 1000 % 1000, x % 1000, y / 1000000,
+               y / 1000 % 1000, y % 1000) < 0)
+    return NULL;
+  return path;
+}
+
+// Where the single copy of some contents lives on disk, named by their
+// digest. Returns NULL on failure.
+static char *blob_path(simplet_tile_cache_t *cache, const unsigned char *data,
+                       size_t length) {
+  uint8_t digest[SIMPLET_HASH_LENGTH];
+  simplet_hash_t hash;
+  simplet_hash_init(&hash);
+  simplet_hash_update(&hash, data, length);
+  simplet_hash_final(&hash, digest);
+
+  char hex[SIMPLET_HASH_LENGTH * 2 + 1];
+  for (int i = 0; i < SIMPLET_HASH_LENGTH; i++)
+    sprintf(hex + i * 2, "%02x", digest[i]);
+
+  char *path;
+  if (asprintf(&path, "%s/blobs/%.2s/%s.png", cache->path, hex, hex + 2) < 0)
+    return NULL;
+  return path;
+}
+
+// Read a whole file. Returns NULL when it isn't there or on failure.
+static tile_t *read_tile(const char *path) {
+  FILE *file;
+  if (!(file = fopen(path, "rb"))) return NULL;
+
+  struct stat st;
+  tile_t *tile = NULL;
+  if (!fstat(fileno(file), &st) &&
+      (tile = malloc(sizeof(*tile) + st.st_size))) {
+    tile->length = st.st_size;
+    if (fread(tile->data, 1, tile->length, file) != tile->length) {
+      free(tile);
+      tile = NULL;
+    }
+  }
+  fclose(file);
+  return tile;
+}
+
+// Make every directory leading up to path.
+static bool make_parents(char *path) {
+  for (char *slash = strchr(path + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    int failed = mkdir(path, 0755) && errno != EEXIST;
+    *slash = '/';
+    if (failed) return false;
+  }
+  return true;
+}
+
+// Write a tile next to path and move it into place, so readers never see a
+// partly written one.
+static bool write_tile(char *path, const unsigned char *data, size_t length) {
+  char *temp;
+  if (!make_parents(path) || asprintf(&temp, "%s.XXXXXX", path) < 0)
+    return false;
+
+  int fd = mkstemp(temp);
+  if (fd < 0) {
+    free(temp);
+    return false;
+  }
+
+  // mkstemp only lets the owner read, tiles are for serving
+  bool ok = !fchmod(fd, 0644);
+  for (size_t written = 0; ok && written < length;) {
+    ssize_t ret = write(fd, data + written, length - written);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0)
+      ok = false;
+    else
+      written += ret;
+  }
+  ok = !close(fd) && ok && !rename(temp, path);
+  if (!ok) unlink(temp);
+  free(temp);
+  return ok;
+}
+
+// Store a tile on disk as a link to the single copy of its contents, writing
+// that first when it's new. Filesystems that can't link, or blobs with as
+// many links as they can take, get a copy of the tile instead.
+static bool link_tile(simplet_tile_cache_t *cache, char *path,
+                      const unsigned char *data, size_t length) {
+  char *blob, *temp = NULL;
+  if (!(blob = blob_path(cache, data, length))) return false;
+
+  bool ok = !access(blob, F_OK) || write_tile(blob, data, length);
+  if (ok && make_parents(path) && asprintf(&temp, "%s.XXXXXX", path) >= 0) {
+    // mkstemp only picks the name, the link takes it
+    int fd = mkstemp(temp);
+    if (fd >= 0) {
+      close(fd);
+      unlink(temp);
+    }
+    ok = fd >= 0 && !link(blob, temp);
+    if (ok && rename(temp, path)) {
+      unlink(temp);
+      ok = false;
+    }
+  } else {
+    ok = false;
+  }
+  free(temp);
+  free(blob);
+  return ok || write_tile(path, data, length);
+}
+
+// Hold a tile in memory under full when it fits in the budget, taking
+// ownership of it. Tiles that don't fit, which is all of them when the budget
+// is zero, are freed instead along with any older copy. Call with the lock
+// held. Returns false on failure.
+static bool keep_tile(simplet_tile_cache_t *cache, const unsigned char *full,
+                      size_t full_length, tile_t *tile) {
+  size_t cost = tile->length + full_length;
+  if (cost > cache->tiles->budget) {
+    simplet_lru_remove(cache->tiles, full, full_length);
+    free(tile);
+    return true;
+  }
+  if (simplet_lru_set(cache->tiles, full, full_length, tile, cost))
+    return true;
+  free(tile);
+  return false;
+}
+
+// Look up tile x, y, z under key, first in memory, then in the archive and
+// then on disk. Returns a copy of the encoded tile the caller frees and
+// stores its size in length, or NULL when the tile isn't cached or on
+// failure.
+unsigned char *simplet_tile_cache_get(simplet_tile_cache_t *cache,
+                                      const void *key, size_t key_length,
+                                      unsigned int x, unsigned int y,
+                                      unsigned int z, size_t *length) {
+  size_t full_length;
+  unsigned char *full, *out = NULL;
+  if (!(full = tile_key(key, key_length, x, y, z, &full_length)))
+    return NULL;
+
+  pthread_mutex_lock(&cache->lock);
+  tile_t *tile = simplet_lru_get(cache->tiles, full, full_length);
+  if (tile && (out = malloc(tile->length ? tile->length : 1))) {
+    memcpy(out, tile->data, tile->length);
+    *length = tile->length;
+  }
+  simplet_archive_t *archive = cache->archive;
+  pthread_mutex_unlock(&cache->lock);
+  if (tile || (!archive && !cache->path)) {
+    free(full);
+    return out;
+  }
+
+  // Found in the archive or on disk, the tile is kept in memory for next
+  // time.
+  unsigned char *data;
+  size_t data_length;
+  if (archive &&
+      (data = simplet_archive_get(archive, x, y, z, &data_length))) {
+    if ((tile = malloc(sizeof(*tile) + data_length))) {
+      tile->length = data_length;
+      memcpy(tile->data, data, data_length);
+    }
+    free(data);
+  }
+  char *path;
+  if (!tile && cache->path &&
+      (path = tile_path(cache, key, key_length, x, y, z))) {
+    tile = read_tile(path);
+    free(path);
+  }
+  if (tile && (out = malloc(tile->length ? tile->length : 1))) {
+    memcpy(out, tile->data, tile->length);
+    *length = tile->length;
+    pthread_mutex_lock(&cache->lock);
+    keep_tile(cache, full, full_length, tile);
+    pthread_mutex_unlock(&cache->lock);
+  } else {
+    free(tile);
+  }
+  free(full);
+  return out;
+}
+
+// Keep length bytes of data as tile x, y, z under key, in memory when it
+// fits the budget and on disk when the cache has a directory. On disk
+// identical tiles share one file. Returns false on failure.
+bool simplet_tile_cache_set(simplet_tile_cache_t *cache, const void *key,
+                            size_t key_length, unsigned int x, unsigned int y,
+                            unsigned int z, const unsigned char *data,
+                            size_t length) {
+  size_t full_length;
+  unsigned char *full;
+  if (!(full = tile_key(key, key_length, x, y, z, &full_length)))
+    return false;
+
+  tile_t *tile;
+  if (!(tile = malloc(sizeof(*tile) + length))) {
+    free(full);
+    return false;
+  }
+  tile->length = length;
+  memcpy(tile->data, data, length);
+
+  pthread_mutex_lock(&cache->lock);
+  bool ok = keep_tile(cache, full, full_length, tile);
+  pthread_mutex_unlock(&cache->lock);
+  free(full);
+
+  if (cache->path) {
+    char *path;
+    if (!(path = tile_path(cache, key, key_length, x, y, z))) return false;
+    ok = link_tile(cache, path, data, length) && ok;
+    free(path);
+  }
+  return ok;
+}
+
+// Look up the encoding of a tile by the digest of its pixels. Returns a copy
+// the caller frees and stores its size in length, or NULL when these pixels
+// haven't repeated yet or on failure. Pixels seen a second time are marked
+// so their encoding is kept by simplet_tile_cache_set_duplicate, tiles
+// that are only drawn once never take up room.
+unsigned char *simplet_tile_cache_get_duplicate(
+    simplet_tile_cache_t *cache, const uint8_t pixels[SIMPLET_HASH_LENGTH],
+    size_t *length) {
+  unsigned char *out = NULL;
+  pthread_mutex_lock(&cache->lock);
+  duplicate_t *duplicate =
+      simplet_lru_get(cache->duplicates, pixels, SIMPLET_HASH_LENGTH);
+  if (duplicate && duplicate->encoded) {
+    if ((out = malloc(duplicate->length ? duplicate->length : 1))) {
+      memcpy(out, duplicate->data, duplicate->length);
+      *length = duplicate->length;
+    }
+  } else if (duplicate) {
+    duplicate->seen++;
+  } else if ((duplicate = malloc(sizeof(*duplicate)))) {
+    memset(duplicate, 0, sizeof(*duplicate));
+    duplicate->seen = 1;
+    if (!simplet_lru_set(cache->duplicates, pixels, SIMPLET_HASH_LENGTH,
+                         duplicate, sizeof(*duplicate) + SIMPLET_HASH_LENGTH))
+      free(duplicate);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return out;
+}
+
+// Keep the encoding of pixels when they have repeated.
+void simplet_tile_cache_set_duplicate(
+    simplet_tile_cache_t *cache, const uint8_t pixels[SIMPLET_HASH_LENGTH],
+    const unsigned char *data, size_t length) {
+  pthread_mutex_lock(&cache->lock);
+  duplicate_t *duplicate =
+      simplet_lru_get(cache->duplicates, pixels, SIMPLET_HASH_LENGTH);
+  if (duplicate && !duplicate->encoded && duplicate->seen > 1 &&
+      (duplicate = malloc(sizeof(*duplicate) + length))) {
+    duplicate->seen = 2;
+    duplicate->encoded = true;
+    duplicate->length = length;
+    memcpy(duplicate->data, data, length);
+    if (!simplet_lru_set(cache->duplicates, pixels, SIMPLET_HASH_LENGTH,
+                         duplicate,
+                         sizeof(*duplicate) + length + SIMPLET_HASH_LENGTH))
+      free(duplicate);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Serve tiles from an opened archive as well, whatever their key. The cache
+// doesn't take ownership, the archive must outlive it or be unset with NULL.
+void simplet_tile_cache_set_archive(simplet_tile_cache_t *cache,
+                                    simplet_archive_t *archive) {
+  pthread_mutex_lock(&cache->lock);
+  cache->archive = archive;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Drop every tile held in memory, the ones on disk stay.
+void simplet_tile_cache_clear(simplet_tile_cache_t *cache) {
+  pthread_mutex_lock(&cache->lock);
+  simplet_lru_clear(cache->tiles);
+  simplet_lru_clear(cache->duplicates);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Return the number of tiles held in memory.
+unsigned int simplet_tile_cache_get_length(simplet_tile_cache_t *cache) {
+  pthread_mutex_lock(&cache->lock);
+  unsigned int length = simplet_lru_get_length(cache->tiles);
+  pthread_mutex_unlock(&cache->lock);
+  return length;
+}
@@ -0,0 +1,65 @@
+#ifndef _SIMPLE_TILES_TILE_CACHE_H
+#define _SIMPLE_TILES_TILE_CACHE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "hash.h"
+#include "lru.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* rendered tiles kept in memory and on disk */
+
+// The default byte budget for a cache's memory tier.
+#define SIMPLET_TILE_CACHE (64 << 20)
+
+// Byte budget for the tiles kept by pixel digest so repeats skip encoding.
+#define SIMPLET_TILE_DUPLICATES (4 << 20)
+
+struct simplet_tile_cache_t {
+  simplet_lru_t *tiles;
+  simplet_lru_t *duplicates;
+  char *path;
+  simplet_archive_t *archive;
+  pthread_mutex_t lock;
+};
+
+simplet_tile_cache_t *simplet_tile_cache_new(size_t budget, const char *path);
+
+void simplet_tile_cache_free(simplet_tile_cache_t *cache);
+
+unsigned char *simplet_tile_cache_get(simplet_tile_cache_t *cache,
+                                      const void *key, size_t key_length,
+                                      unsigned int x, unsigned int y,
+                                      unsigned int z, size_t *length);
+
+bool simplet_tile_cache_set(simplet_tile_cache_t *cache, const void *key,
+                            size_t key_length, unsigned int x, unsigned int y,
+                            unsigned int z, const unsigned char *data,
+                            size_t length);
+
+unsigned char *simplet_tile_cache_get_duplicate(
+    simplet_tile_cache_t *cache, const uint8_t pixels[SIMPLET_HASH_LENGTH],
+    size_t *length);
+
+void simplet_tile_cache_set_duplicate(
+    simplet_tile_cache_t *cache, const uint8_t pixels[SIMPLET_HASH_LENGTH],
+    const unsigned char *data, size_t length);
+
+void simplet_tile_cache_set_archive(simplet_tile_cache_t *cache,
+                                    simplet_archive_t *archive);
+
+void simplet_tile_cache_clear(simplet_tile_cache_t *cache);
+
+unsigned int simplet_tile_cache_get_length(simplet_tile_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#include "tile_id.h"
+
+// The position of tile x, y, z along the PMTiles Hilbert curve. Every tile
+// of a zoom comes after all those of the zooms above it, and within a zoom
+// neighbouring ids are neighbouring tiles.
+uint64_t simplet_tile_id(unsigned int x, unsigned int y, unsigned int z) {
+  uint64_t id = ((1ull << (2 * z)) - 1) / 3;
+  for (uint64_t s = z ? 1ull << (z - 1) : 0; s > 0; s >>= 1) {
+    uint64_t rx = (x & s) > 0, ry = (y & s) > 0;
+    id += s * s * ((3 * rx) ^ ry);
+    if (!ry) {
+      if (rx) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      unsigned int swap = x;
+      x = y;
+      y = swap;
+    }
+  }
+  return id;
+}
@@ -0,0 +1,21 @@
+#ifndef _SIMPLE_TILES_TILE_ID_H
+#define _SIMPLE_TILES_TILE_ID_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* numbering tiles along a Hilbert curve */
+
+// The deepest zoom a tile id can number.
+#define SIMPLET_TILE_ID_MAX_ZOOM 26
+
+uint64_t simplet_tile_id(unsigned int x, unsigned int y, unsigned int z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,7 @@
 #include <cairo.h>
 #include <pango/pangocairo.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -110,12 +111,62 @@ typedef struct {
 typedef enum {
   SIMPLET_NEAREST = 0,
   SIMPLET_BILINEAR,
-  SIMPLET_LANCZOS
+  SIMPLET_LANCZOS,
+  SIMPLET_BICUBIC
 } simplet_kern_t;
 
+// Handed each tile of a pyramid as it's finished, which stays owned by the
+// map. Returning anything but SIMPLET_OK stops the pyramid.
+typedef simplet_status_t (*simplet_tile_func)(void *closure, unsigned int x,
+                                              unsigned int y, unsigned int z,
+                                              cairo_surface_t *tile);
+
+// A slippy tile.
+typedef struct {
+  unsigned int x;
+  unsigned int y;
+  unsigned int z;
+} simplet_tile_id_t;
+
+// Handed each tile of a batch as a png once it's encoded, which stays owned
+// by the map. Returning anything but SIMPLET_OK stops the batch.
+typedef simplet_status_t (*simplet_png_func)(void *closure,
+                                             simplet_tile_id_t id,
+                                             const unsigned char *data,
+                                             size_t length);
+
+typedef struct simplet_mosaic_t simplet_mosaic_t;
+
+typedef struct simplet_tile_cache_t simplet_tile_cache_t;
+
+typedef enum { SIMPLET_MBTILES, SIMPLET_PMTILES } simplet_archive_format_t;
+
+typedef struct simplet_archive_t simplet_archive_t;
+
+typedef struct simplet_expr_t simplet_expr_t;
+
+// A color for single band rasters at value.
+typedef struct {
+  double value;
+  unsigned char r;
+  unsigned char g;
+  unsigned char b;
+  unsigned char a;
+} simplet_color_stop_t;
+
 typedef struct {
   SIMPLET_LAYER_FIELDS
   simplet_kern_t resample;
+  double max_error;
+  int threads;
+  simplet_mosaic_t *mosaic;
+  simplet_color_stop_t *stops;
+  int stops_length;
+  bool classified;
+  simplet_expr_t *expr;
+  double azimuth;
+  double altitude;
+  double z_factor;
 } simplet_raster_layer_t;
 
 typedef struct {
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "memory.h"
@@ -16,3 +17,20 @@ int simplet_parse_color(const char *src, unsigned int *r, unsigned int *g,
                         unsigned int *b, unsigned int *a) {
   return sscanf(src, "#%2x%2x%2x%2x", r, g, b, a);
 }
+
+// Return a new string naming source along with its modification time and
+// size, so anything cached from the source is keyed to this version of it.
+// Sources that aren't files, like database connection strings, are stamped
+// by name alone.
+char *simplet_source_stamp(const char *source) {
+  struct stat st;
+  char *stamp;
+  int ret;
+  if (source && !stat(source, &st))
+    ret = asprintf(&stamp, "%s@%lld:%lld", source, (long long)st.st_mtime,
+                   (long long)st.st_size);
+  else
+    ret = asprintf(&stamp, "%s", source ? source : "");
+  if (ret < 0) return NULL;
+  return stamp;
+}
@@ -10,6 +10,8 @@ char *simplet_copy_string(const char *src);
 int simplet_parse_color(const char *src, unsigned int *r, unsigned int *g,
                         unsigned int *b, unsigned int *a);
 
+char *simplet_source_stamp(const char *source);
+
 #define SIMPLET_CCEIL 256.0
 
 #ifdef __cplusplus
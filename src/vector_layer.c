@@ -3,6 +3,7 @@
 
 #include "vector_layer.h"
 #include "query.h"
+#include "style.h"
 #include "util.h"
 #include "error.h"
 #include "memory.h"
@@ -32,6 +33,7 @@ simplet_vector_layer_t *simplet_vector_layer_new(const char *datastring) {
 
 // Add in an error function.
 SIMPLET_ERROR_FUNC(vector_layer_t)
+SIMPLET_MAP_ERROR_FUNC
 
 // Free a void pointer pointing to a layer instance.
 void simplet_vector_layer_vfree(void *layer) {
@@ -70,35 +72,93 @@ simplet_query_t *simplet_vector_layer_add_query_directly(
   return query;
 }
 
+// Count how many queries at the front of queries can share one feature scan.
+// They must run the same SQL, and at most one of them may place labels so
+// collisions resolve exactly as they would running the queries one by one.
+// The SQL is a query's whole filter: the only other one is the spatial
+// filter from the map's bounds, which is the same for every query of a
+// render.
+static unsigned int shared_run(simplet_query_t **queries,
+                               unsigned int length) {
+  bool labeled = false;
+  unsigned int count;
+  for (count = 0; count < length; count++) {
+    simplet_query_t *query = queries[count];
+    if (count > 0 && strcmp(query->ogrsql, queries[0]->ogrsql)) break;
+    if (simplet_lookup_style(query->styles, "text-field")) {
+      if (labeled) break;
+      labeled = true;
+    }
+  }
+  return count;
+}
+
 // Process a layer and add labels.
 simplet_status_t simplet_vector_layer_process(simplet_vector_layer_t *layer,
                                               simplet_map_t *map,
                                               simplet_lithograph_t *litho,
                                               cairo_t *ctx) {
+  unsigned int length = simplet_list_get_length(layer->queries);
+  if (!length) return SIMPLET_OK;
+
   simplet_listiter_t *iter;
   OGRDataSourceH source;
   if (!(source = OGROpenShared(layer->source, 0, NULL)))
-    return set_error(layer, SIMPLET_OGR_ERR, "error opening layer source");
+    return map_error(map, SIMPLET_OGR_ERR, "error opening layer source");
 
   if (!(iter = simplet_get_list_iter(layer->queries))) {
     OGRReleaseDataSource(source);
-    return set_error(layer, SIMPLET_OOM, "out of memory getting list iterator");
+    return map_error(map, SIMPLET_OOM, "out of memory getting list iterator");
   }
 
-  // Loop through the layer's queries and process them.
+  simplet_query_t *queries[length];
   simplet_query_t *query;
-  simplet_status_t status = SIMPLET_OK;
-  while ((query = simplet_list_next(iter))) {
-    status = simplet_query_process(query, map, source, litho, ctx);
+  unsigned int n = 0;
+  while ((query = simplet_list_next(iter))) queries[n++] = query;
+
+  // Loop through the layer's queries and process them, queries that repeat
+  // the same SQL back to back are read from the source only once.
+  unsigned int count;
+  for (unsigned int i = 0; i < length; i += count) {
+    count = shared_run(queries + i, length - i);
+    simplet_status_t status = simplet_query_process_shared(
+        queries + i, count, map, source, litho, ctx);
 
     if (status != SIMPLET_OK) {
-      simplet_list_iter_free(iter);
       OGRReleaseDataSource(source);
-      return set_error(layer, query->status, query->error_msg);
+      return status;
     }
-
-    simplet_lithograph_apply(litho, query->styles);
   }
   OGRReleaseDataSource(source);
   return SIMPLET_OK;
 }
+
+// Count the features the layer's queries would read drawing map, adding them
+// to count. A feature read by two queries counts twice.
+simplet_status_t simplet_vector_layer_count(simplet_vector_layer_t *layer,
+                                            simplet_map_t *map,
+                                            uint64_t *count) {
+  if (!simplet_list_get_length(layer->queries)) return SIMPLET_OK;
+
+  OGRDataSourceH source;
+  if (!(source = OGROpenShared(layer->source, 0, NULL)))
+    return map_error(map, SIMPLET_OGR_ERR, "error opening layer source");
+
+  simplet_listiter_t *iter;
+  if (!(iter = simplet_get_list_iter(layer->queries))) {
+    OGRReleaseDataSource(source);
+    return map_error(map, SIMPLET_OOM, "out of memory getting list iterator");
+  }
+
+  simplet_status_t status = SIMPLET_OK;
+  simplet_query_t *query;
+  while ((query = simplet_list_next(iter))) {
+    if ((status = simplet_query_count(query, map, source, count)) !=
+        SIMPLET_OK) {
+      simplet_list_iter_free(iter);
+      break;
+    }
+  }
+  OGRReleaseDataSource(source);
+  return status;
+}
@@ -1,6 +1,7 @@
 #ifndef _SIMPLET_VECTOR_LAYER_H
 #define _SIMPLET_VECTOR_LAYER_H
 
+#include <stdint.h>
 #include "types.h"
 #include "text.h"
 #include "user_data.h"
@@ -26,6 +27,10 @@ simplet_status_t simplet_vector_layer_process(simplet_vector_layer_t *layer,
                                               simplet_lithograph_t *litho,
                                               cairo_t *ctx);
 
+simplet_status_t simplet_vector_layer_count(simplet_vector_layer_t *layer,
+                                            simplet_map_t *map,
+                                            uint64_t *count);
+
 void simplet_vector_layer_get_source(simplet_vector_layer_t *layer,
                                      char **source);
 
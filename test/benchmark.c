@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <time.h>
@@ -7,6 +8,13 @@
 #include "query.h"
 #include "vector_layer.h"
 #include "raster_layer.h"
+#include "resample.h"
+#include "colorize.h"
+#include "bandmath.h"
+#include "blocks.h"
+#include "pyramid.h"
+#include "tile_cache.h"
+#include "archive.h"
 #include "error.h"
 
 static void *setup_map() {
@@ -25,6 +33,74 @@ static void *setup_list() {
 
 static void teardown_list(void *ctx) { (void)ctx; }
 
+// A tile's worth of lanczos taps over a window of noise.
+#define WINDOW_SIZE 300
+#define WINDOW_PIXELS (256 * 256)
+
+typedef struct {
+  uint8_t *window;
+  float *weights;
+  int taps;
+  simplet_tap_t *pixels;
+  uint32_t *out;
+} window_bench_t;
+
+static void *setup_window() {
+  window_bench_t *bench = malloc(sizeof(*bench));
+  assert(bench);
+  assert((bench->window = malloc(WINDOW_SIZE * WINDOW_SIZE * 4)));
+  for (int i = 0; i < WINDOW_SIZE * WINDOW_SIZE * 4; i++)
+    bench->window[i] = rand();
+  assert((bench->weights =
+              simplet_resample_weights(SIMPLET_LANCZOS, &bench->taps)));
+  assert((bench->pixels = malloc(WINDOW_PIXELS * sizeof(simplet_tap_t))));
+  assert((bench->out = malloc(WINDOW_PIXELS * sizeof(uint32_t))));
+  for (int k = 0; k < WINDOW_PIXELS; k++) {
+    bench->pixels[k].offset = ((k / 256) * WINDOW_SIZE + k % 256) * 4;
+    bench->pixels[k].x_phase = k % (SIMPLET_PHASES + 1);
+    bench->pixels[k].y_phase = (k / 7) % (SIMPLET_PHASES + 1);
+  }
+  return bench;
+}
+
+static void teardown_window(void *ctx) {
+  window_bench_t *bench = ctx;
+  free(bench->window);
+  free(bench->weights);
+  free(bench->pixels);
+  free(bench->out);
+  free(bench);
+}
+
+// A tile's worth of float values and a ramp to color them with.
+typedef struct {
+  simplet_lut_t *lut;
+  float *values;
+  uint32_t *out;
+} values_bench_t;
+
+static void *setup_values() {
+  values_bench_t *bench = malloc(sizeof(*bench));
+  assert(bench);
+  simplet_color_stop_t stops[] = {{-100, 0, 0, 255, 255},
+                                  {0, 255, 255, 255, 255},
+                                  {3000, 255, 0, 0, 255}};
+  assert((bench->lut = simplet_lut_new(stops, 3, false)));
+  assert((bench->values = malloc(WINDOW_PIXELS * sizeof(float))));
+  assert((bench->out = malloc(WINDOW_PIXELS * sizeof(uint32_t))));
+  for (int i = 0; i < WINDOW_PIXELS; i++)
+    bench->values[i] = rand() % 3200 - 150;
+  return bench;
+}
+
+static void teardown_values(void *ctx) {
+  values_bench_t *bench = ctx;
+  free(bench->lut);
+  free(bench->values);
+  free(bench->out);
+  free(bench);
+}
+
 static void initialize_map(simplet_map_t *map) {
   simplet_map_set_size(map, 256, 256);
   simplet_map_set_slippy(map, 0, 1, 2);
@@ -95,6 +171,27 @@ static void bench_render(void *ctx) {
   assert(SIMPLET_OK == simplet_map_get_status(map));
 }
 
+// The render above through a cache, drawn on the first run and served from
+// memory on every one after.
+static void bench_render_cached(void *ctx) {
+  static simplet_tile_cache_t *cache = NULL;
+  if (!cache)
+    assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, NULL)));
+  simplet_map_t *map = ctx;
+  initialize_map(map);
+  char *data = NULL;
+  simplet_map_render_cached(map, cache, 0, 1, 2, data, stream);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+}
+
+static void bench_fingerprint(void *ctx) {
+  simplet_map_t *map = ctx;
+  initialize_map(map);
+  uint8_t out[SIMPLET_HASH_LENGTH];
+  for (int i = 0; i < 1000; i++)
+    assert(SIMPLET_OK == simplet_map_fingerprint(map, out));
+}
+
 static void bench_text(void *ctx) {
   simplet_map_t *map = ctx;
   initialize_map(map);
@@ -130,6 +227,13 @@ static void bench_raster(void *ctx) {
   assert(SIMPLET_OK == simplet_map_get_status(map));
 }
 
+// The same tile decoding its blocks again, raster above finds them cached
+// after its first run.
+static void bench_raster_cold(void *ctx) {
+  simplet_blocks_clear();
+  bench_raster(ctx);
+}
+
 static void bench_raster_resample(void *ctx) {
   simplet_map_t *map = ctx;
   simplet_map_set_slippy(map, 602, 769, 11);
@@ -141,6 +245,102 @@ static void bench_raster_resample(void *ctx) {
   assert(SIMPLET_OK == simplet_map_get_status(map));
 }
 
+static void bench_raster_bilinear(void *ctx) {
+  simplet_map_t *map = ctx;
+  simplet_map_set_slippy(map, 602, 769, 11);
+  simplet_raster_layer_t *layer = simplet_map_add_raster_layer(
+      map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  simplet_raster_layer_set_resample(layer, SIMPLET_BILINEAR);
+  char *data = NULL;
+  simplet_map_render_to_stream(map, data, stream);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+}
+
+static void bench_raster_bicubic(void *ctx) {
+  simplet_map_t *map = ctx;
+  simplet_map_set_slippy(map, 602, 769, 11);
+  simplet_raster_layer_t *layer = simplet_map_add_raster_layer(
+      map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  simplet_raster_layer_set_resample(layer, SIMPLET_BICUBIC);
+  char *data = NULL;
+  simplet_map_render_to_stream(map, data, stream);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+}
+
+// A 2048 pixel export over the same area, warped on one thread and then on
+// one per processor.
+static void render_large(simplet_map_t *map, int threads) {
+  simplet_map_set_slippy(map, 602, 769, 11);
+  simplet_map_set_size(map, 2048, 2048);
+  simplet_raster_layer_t *layer = simplet_map_add_raster_layer(
+      map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  simplet_raster_layer_set_threads(layer, threads);
+  char *data = NULL;
+  simplet_map_render_to_stream(map, data, stream);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+}
+
+static void bench_raster_large_single(void *ctx) { render_large(ctx, 1); }
+
+static void bench_raster_large(void *ctx) { render_large(ctx, 0); }
+
+static void bench_convolve_scalar(void *ctx) {
+  window_bench_t *bench = ctx;
+  simplet_convolve_scalar(bench->window, WINDOW_SIZE * 4, bench->taps,
+                          bench->weights, bench->pixels, WINDOW_PIXELS,
+                          bench->out);
+}
+
+static void bench_convolve_best(void *ctx) {
+  window_bench_t *bench = ctx;
+  simplet_convolve_best()(bench->window, WINDOW_SIZE * 4, bench->taps,
+                          bench->weights, bench->pixels, WINDOW_PIXELS,
+                          bench->out);
+}
+
+// Halve the window into a quarter of the tile.
+static void bench_downsample_box(void *ctx) {
+  window_bench_t *bench = ctx;
+  simplet_downsample_box((uint32_t *)bench->window, WINDOW_SIZE, bench->out,
+                         WINDOW_SIZE / 2, WINDOW_SIZE / 2, WINDOW_SIZE / 2);
+}
+
+static void bench_downsample_best(void *ctx) {
+  window_bench_t *bench = ctx;
+  simplet_downsample_best()((uint32_t *)bench->window, WINDOW_SIZE,
+                            bench->out, WINDOW_SIZE / 2, WINDOW_SIZE / 2,
+                            WINDOW_SIZE / 2);
+}
+
+static void bench_colorize_scalar(void *ctx) {
+  values_bench_t *bench = ctx;
+  simplet_colorize_scalar(bench->lut, bench->values, WINDOW_PIXELS,
+                          bench->out);
+}
+
+static void bench_colorize_best(void *ctx) {
+  values_bench_t *bench = ctx;
+  simplet_colorize_best()(bench->lut, bench->values, WINDOW_PIXELS,
+                          bench->out);
+}
+
+// Horn's method over a window of heights, and a normalized difference of
+// two bands over the same number of pixels.
+static void bench_hillshade(void *ctx) {
+  values_bench_t *bench = ctx;
+  simplet_relief_t relief = {315, 45, 1, 30, -30};
+  simplet_hillshade(bench->values, 256, 256, &relief, (float *)bench->out);
+}
+
+static void bench_expression(void *ctx) {
+  values_bench_t *bench = ctx;
+  simplet_expr_t *expr = simplet_expr_new("(b2 - b1) / (b2 + b1)");
+  assert(expr);
+  const float *bands[] = {bench->values, bench->values + 1};
+  simplet_expr_eval(expr, bands, WINDOW_PIXELS - 1, (float *)bench->out);
+  simplet_expr_free(expr);
+}
+
 static void bench_many_raster(void *ctx) {
   simplet_map_t *map = ctx;
   simplet_map_set_slippy(map, 602, 769, 11);
@@ -152,7 +352,121 @@ static void bench_many_raster(void *ctx) {
   assert(SIMPLET_OK == simplet_map_get_status(map));
 }
 
+// The same ten rasters as a mosaic, only drawn until the tile is covered.
+static void bench_mosaic(void *ctx) {
+  simplet_map_t *map = ctx;
+  FILE *list = fopen("./many.txt", "w");
+  assert(list);
+  for (int i = 0; i < 10; i++)
+    fputs("./data/nyc2-rgb-pansharpened-8bit-nodata.tif\n", list);
+  fclose(list);
+
+  simplet_map_set_slippy(map, 602, 769, 11);
+  simplet_raster_layer_t *layer =
+      simplet_map_add_mosaic_layer(map, "./many.txt");
+  simplet_raster_layer_set_mosaic_index(layer, NULL);
+  char *data = NULL;
+  simplet_map_render_to_stream(map, data, stream);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+}
+
 #define ITEMS 100000
+static simplet_status_t discard(void *closure, unsigned int x,
+                                unsigned int y, unsigned int z,
+                                cairo_surface_t *tile) {
+  (void)closure, (void)x, (void)y, (void)z, (void)tile;
+  return SIMPLET_OK;
+}
+
+// Three zooms over the raster, first shrinking each level from the one below
+// and then warping every tile of every level from the source.
+static void bench_pyramid(void *ctx) {
+  simplet_map_t *map = ctx;
+  simplet_map_add_raster_layer(map,
+                               "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  assert(SIMPLET_OK == simplet_map_render_pyramid(map, 301, 384, 10, 12,
+                                                  SIMPLET_NEAREST, NULL,
+                                                  discard));
+}
+
+static void bench_pyramid_unshared(void *ctx) {
+  simplet_map_t *map = ctx;
+  simplet_map_add_raster_layer(map,
+                               "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  for (unsigned int z = 10; z <= 12; z++) {
+    unsigned int n = 1 << (z - 10);
+    for (unsigned int y = 384 * n; y < 385 * n; y++)
+      for (unsigned int x = 301 * n; x < 302 * n; x++) {
+        simplet_map_set_slippy(map, x, y, z);
+        cairo_surface_t *tile = simplet_map_build_surface(map);
+        assert(tile && SIMPLET_OK == simplet_map_get_status(map));
+        cairo_surface_destroy(tile);
+      }
+  }
+}
+
+static simplet_status_t discard_png(void *closure, simplet_tile_id_t id,
+                                    const unsigned char *data,
+                                    size_t length) {
+  (void)closure, (void)id, (void)data, (void)length;
+  return SIMPLET_OK;
+}
+
+// A viewport of sixteen tiles as one batch on a single thread, and then the
+// same tiles one call at a time.
+static void bench_tiles(void *ctx) {
+  simplet_map_t *map = ctx;
+  initialize_map(map);
+  simplet_tile_id_t ids[16];
+  for (unsigned int i = 0; i < 16; i++)
+    ids[i] = (simplet_tile_id_t){4 + i % 4, 5 + i / 4, 4};
+  assert(SIMPLET_OK ==
+         simplet_map_render_tiles(map, ids, 16, 1, NULL, discard_png));
+}
+
+static void bench_tiles_unbatched(void *ctx) {
+  simplet_map_t *map = ctx;
+  initialize_map(map);
+  for (unsigned int i = 0; i < 16; i++) {
+    simplet_map_set_slippy(map, 4 + i % 4, 5 + i / 4, 4);
+    char *data = NULL;
+    simplet_map_render_to_stream(map, data, stream);
+    assert(SIMPLET_OK == simplet_map_get_status(map));
+  }
+}
+
+static void *setup_archive() {
+  char *path;
+  assert(asprintf(&path, "/tmp/simplet-bench-%d", getpid()) > 0);
+  return path;
+}
+
+static void teardown_archive(void *ctx) {
+  unlink(ctx);
+  free(ctx);
+}
+
+// A zoom of small tiles, a quarter of them the same.
+static void append_tiles(const char *path, simplet_archive_format_t format) {
+  simplet_archive_t *archive = simplet_archive_create(path, format);
+  assert(archive);
+  unsigned char tile[1024];
+  for (unsigned int x = 0; x < 128; x++)
+    for (unsigned int y = 0; y < 128; y++) {
+      int value = x % 2 && y % 2 ? 0 : x * 128 + y;
+      memset(tile, value, sizeof(tile));
+      memcpy(tile, &value, sizeof(value));
+      assert(simplet_archive_append(archive, x, y, 7, tile, sizeof(tile)) ==
+             SIMPLET_OK);
+    }
+  assert(simplet_archive_finish(archive) == SIMPLET_OK);
+  simplet_archive_free(archive);
+}
+
+static void bench_mbtiles(void *ctx) { append_tiles(ctx, SIMPLET_MBTILES); }
+
+static void bench_pmtiles(void *ctx) { append_tiles(ctx, SIMPLET_PMTILES); }
+
 static void bench_list(void *ctx) {
   simplet_list_t *list = ctx;
   int t = 1;
@@ -173,14 +487,36 @@ typedef struct {
 
 bench_wrap_t benchmarks[] = {
   BENCH(map, render)
+  BENCH(map, render_cached)
+  BENCH(map, fingerprint)
   BENCH(map, unprojected)
   BENCH(map, text)
   BENCH(map, seamless)
   BENCH(map, empty)
   BENCH(map, many_queries)
   BENCH(map, raster)
+  BENCH(map, raster_cold)
   BENCH(map, raster_resample)
+  BENCH(map, raster_bilinear)
+  BENCH(map, raster_bicubic)
+  BENCH(map, raster_large_single)
+  BENCH(map, raster_large)
+  BENCH(window, convolve_scalar)
+  BENCH(window, convolve_best)
+  BENCH(window, downsample_box)
+  BENCH(window, downsample_best)
+  BENCH(values, colorize_scalar)
+  BENCH(values, colorize_best)
+  BENCH(values, hillshade)
+  BENCH(values, expression)
   BENCH(map, many_raster)
+  BENCH(map, mosaic)
+  BENCH(map, pyramid)
+  BENCH(map, pyramid_unshared)
+  BENCH(map, tiles)
+  BENCH(map, tiles_unbatched)
+  BENCH(archive, mbtiles)
+  BENCH(archive, pmtiles)
   BENCH(list, list)
   {NULL, NULL, NULL, NULL, 0}
 };
@@ -13,8 +13,12 @@ typedef struct {
   const char *name;
 } task_wrap_t;
 
-task_wrap_t tasks[] = {TASK_ENTRY(list) TASK_ENTRY(bounds) TASK_ENTRY(
-    vector_layer) TASK_ENTRY(raster_layer) TASK_ENTRY(query) TASK_ENTRY(style)
-                           TASK_ENTRY(map) TASK_ENTRY(integration){NULL, NULL}};
+task_wrap_t tasks[] = {
+    TASK_ENTRY(list) TASK_ENTRY(lru) TASK_ENTRY(bounds) TASK_ENTRY(vector_layer)
+    TASK_ENTRY(raster_layer) TASK_ENTRY(resample) TASK_ENTRY(rtree)
+    TASK_ENTRY(colorize) TASK_ENTRY(bandmath) TASK_ENTRY(pyramid)
+    TASK_ENTRY(tile_cache) TASK_ENTRY(hash) TASK_ENTRY(archive) TASK_ENTRY(pool)
+    TASK_ENTRY(query) TASK_ENTRY(style) TASK_ENTRY(map)
+    TASK_ENTRY(integration){NULL, NULL}};
 
 #endif
@@ -0,0 +1,762 @@
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "simple_tiles.h"
+#include "archive.h"
+#include "pool.h"
+#include "query.h"
+#include "raster_layer.h"
+#include "tile_cache.h"
+#include "vector_layer.h"
+
+// Seed a pyramid of slippy tiles for a map described in a file into a tile
+// cache directory, an MBTiles or a PMTiles archive. See usage below.
+
+// The side of the square blocks of tiles handed to a worker at once, and
+// recorded as done together. Blocks are taken in Hilbert order and so are
+// the tiles within them, keeping each worker on neighbouring source data.
+#define BLOCK 8
+
+// The most tiles a zoom can have for its solid ones to be remembered, a
+// byte each, and the most colors they're remembered in. Children of larger
+// zooms, and of tiles in other colors, are drawn.
+#define SOLID_TILES ((uint64_t)1 << 27)
+#define SOLID_COLORS 255
+
+// Seconds between progress reports.
+#define REPORT 2
+
+// The furthest north and south slippy tiles reach.
+#define MAX_LATITUDE 85.0511287798066
+
+static const char usage[] =
+    "usage: simplet-seed [-b west,south,east,north] [-z min-max] [-t threads]"
+    " [-s]\n"
+    "                    description output\n"
+    "\n"
+    "Renders every tile of the zooms min to max, 0-5 unless given, over the\n"
+    "bounds in degrees, the whole world unless given, on threads threads.\n"
+    "Output ending in .mbtiles or .pmtiles is written as that archive and\n"
+    "anything else as a tile cache directory. With -s, children of tiles\n"
+    "drawn in a single color are given the same tile without drawing them\n"
+    "when no feature or raster lies under them. Progress is kept in\n"
+    "output.progress, rerunning the same command carries on from where an\n"
+    "interrupted run stopped unless the map or its sources changed.\n"
+    "\n"
+    "The description has one setting per line, # starts a comment:\n"
+    "  bgcolor #rrggbb[aa]      buffer pixels\n"
+    "  vector source            query sql           style name value\n"
+    "  raster source            mosaic source\n"
+    "  resample nearest|bilinear|lanczos|bicubic\n"
+    "  color-stop value color   classified          expression expr\n"
+    "  hillshade azimuth altitude z-factor\n"
+    "Queries follow their vector layer, styles their query and the settings\n"
+    "below raster their raster or mosaic layer.\n";
+
+// Encoded tiles, growing as cairo hands over data.
+typedef struct {
+  unsigned char *data;
+  size_t length;
+  size_t capacity;
+} png_t;
+
+// The encoding of a tile drawn all in one color.
+typedef struct {
+  uint32_t color;
+  size_t length;
+  unsigned char data[];
+} solid_t;
+
+// A tile or block and its place along the Hilbert curve.
+typedef struct {
+  uint64_t id;
+  unsigned int x, y;
+} hilbert_t;
+
+// Everything the workers share.
+typedef struct {
+  simplet_map_t *map;    // as described, never drawn
+  simplet_map_t **maps;  // a clone of it per worker
+  bool inherit;          // copy solid tiles to empty children
+
+  // output, one of the two
+  simplet_tile_cache_t *cache;
+  simplet_archive_t *archive;
+  uint8_t key[SIMPLET_HASH_LENGTH];  // the map's fingerprint
+
+  // the tiles to seed, by zoom
+  unsigned int min_zoom, max_zoom;
+  unsigned int x0[SIMPLET_ARCHIVE_MAX_ZOOM + 1];
+  unsigned int y0[SIMPLET_ARCHIVE_MAX_ZOOM + 1];
+  unsigned int width[SIMPLET_ARCHIVE_MAX_ZOOM + 1];
+  unsigned int height[SIMPLET_ARCHIVE_MAX_ZOOM + 1];
+  uint8_t *done[SIMPLET_ARCHIVE_MAX_ZOOM + 1];  // a bit per chunk
+
+  // the zoom being seeded
+  unsigned int z;
+  hilbert_t *blocks;
+  simplet_pool_ranges_t *ranges;
+  uint8_t *solid;    // a byte per tile of this zoom, 1 + its solid or 0
+  uint8_t *parents;  // and the last zoom's
+  solid_t *solids[SOLID_COLORS];
+  int solids_length;
+
+  FILE *progress;  // chunks are appended as they finish in directories
+  uint64_t total, skipped, drawn, inherited, failed;
+  double started, reported;
+  pthread_mutex_t lock;
+} seed_t;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal) {
+  (void)signal;
+  stopping = 1;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t tiles_in(seed_t *seed, unsigned int z) {
+  return (uint64_t)seed->width[z] * seed->height[z];
+}
+
+// The zoom blocks of zoom z are tiles of.
+static unsigned int block_zoom(unsigned int z) {
+  return z < 3 ? 0 : z - 3;
+}
+
+static uint64_t chunks_in(seed_t *seed, unsigned int z) {
+  unsigned int shift = z - block_zoom(z);
+  uint64_t x0 = seed->x0[z] >> shift, y0 = seed->y0[z] >> shift;
+  uint64_t x1 = (seed->x0[z] + seed->width[z] - 1) >> shift;
+  uint64_t y1 = (seed->y0[z] + seed->height[z] - 1) >> shift;
+  return (x1 - x0 + 1) * (y1 - y0 + 1);
+}
+
+static int by_id(const void *a, const void *b) {
+  const hilbert_t *left = a, *right = b;
+  return (left->id > right->id) - (left->id < right->id);
+}
+
+// The blocks covering zoom z in Hilbert order, chunks_in of them. Returns
+// NULL on failure.
+static hilbert_t *blocks_in(seed_t *seed, unsigned int z) {
+  unsigned int shift = z - block_zoom(z);
+  unsigned int x0 = seed->x0[z] >> shift, y0 = seed->y0[z] >> shift;
+  unsigned int x1 = (seed->x0[z] + seed->width[z] - 1) >> shift;
+  unsigned int y1 = (seed->y0[z] + seed->height[z] - 1) >> shift;
+  hilbert_t *blocks;
+  if (!(blocks = malloc(sizeof(*blocks) * chunks_in(seed, z)))) return NULL;
+
+  size_t length = 0;
+  for (unsigned int y = y0; y <= y1; y++)
+    for (unsigned int x = x0; x <= x1; x++)
+      blocks[length++] =
+          (hilbert_t){simplet_tile_id(x, y, block_zoom(z)), x, y};
+  qsort(blocks, length, sizeof(*blocks), by_id);
+  return blocks;
+}
+
+// The tiles of block being seeded at zoom z in Hilbert order. Returns how
+// many there are.
+static int tiles_of(seed_t *seed, unsigned int z, const hilbert_t *block,
+                    hilbert_t tiles[BLOCK * BLOCK]) {
+  unsigned int shift = z - block_zoom(z), side = 1u << shift;
+  unsigned int left = block->x << shift, top = block->y << shift;
+  int length = 0;
+  for (unsigned int y = top; y < top + side; y++)
+    for (unsigned int x = left; x < left + side; x++)
+      if (x - seed->x0[z] < seed->width[z] && y - seed->y0[z] < seed->height[z])
+        tiles[length++] = (hilbert_t){simplet_tile_id(x, y, z), x, y};
+  qsort(tiles, length, sizeof(*tiles), by_id);
+  return length;
+}
+
+static bool is_done(seed_t *seed, unsigned int z, uint64_t chunk) {
+  return seed->done[z][chunk / 8] >> (chunk % 8) & 1;
+}
+
+static void mark_done(seed_t *seed, unsigned int z, uint64_t chunk) {
+  seed->done[z][chunk / 8] |= 1 << (chunk % 8);
+}
+
+// The range of tiles covering west to east and north to south at each zoom.
+static void set_bounds(seed_t *seed, double west, double south, double east,
+                       double north) {
+  north = fmin(fmax(north, -MAX_LATITUDE), MAX_LATITUDE);
+  south = fmin(fmax(south, -MAX_LATITUDE), MAX_LATITUDE);
+  for (unsigned int z = seed->min_zoom; z <= seed->max_zoom; z++) {
+    double n = ldexp(1, z);
+    double x[2] = {(west + 180) / 360 * n, (east + 180) / 360 * n};
+    double y[2] = {north, south};
+    for (int i = 0; i < 2; i++) {
+      double lat = y[i] * M_PI / 180;
+      y[i] = (1 - log(tan(lat) + 1 / cos(lat)) / M_PI) / 2 * n;
+      x[i] = fmin(fmax(floor(x[i]), 0), n - 1);
+      y[i] = fmin(fmax(floor(y[i]), 0), n - 1);
+    }
+    seed->x0[z] = x[0];
+    seed->y0[z] = y[0];
+    seed->width[z] = x[1] - x[0] + 1;
+    seed->height[z] = y[1] - y[0] + 1;
+  }
+}
+
+static simplet_kern_t parse_kern(const char *name, bool *ok) {
+  const char *names[] = {"nearest", "bilinear", "lanczos", "bicubic"};
+  simplet_kern_t kerns[] = {SIMPLET_NEAREST, SIMPLET_BILINEAR,
+                            SIMPLET_LANCZOS, SIMPLET_BICUBIC};
+  for (int i = 0; i < 4; i++)
+    if (!strcmp(name, names[i])) return kerns[i];
+  *ok = false;
+  return SIMPLET_NEAREST;
+}
+
+// Apply one line of a description to map. Returns false when the line
+// doesn't make sense.
+static bool apply(simplet_map_t *map, char *setting, char *value,
+                  simplet_vector_layer_t **vector, simplet_query_t **query,
+                  simplet_raster_layer_t **raster) {
+  bool ok = true;
+  if (!strcmp(setting, "bgcolor")) {
+    ok = simplet_map_set_bgcolor(map, value) == SIMPLET_OK;
+  } else if (!strcmp(setting, "buffer")) {
+    simplet_map_set_buffer(map, atof(value));
+  } else if (!strcmp(setting, "vector")) {
+    ok = (*vector = simplet_map_add_vector_layer(map, value)) != NULL;
+    *query = NULL;
+  } else if (!strcmp(setting, "query")) {
+    ok = *vector && (*query = simplet_vector_layer_add_query(*vector, value));
+  } else if (!strcmp(setting, "style")) {
+    char *rest = value + strcspn(value, " \t");
+    if (*rest) *rest++ = '\0';
+    rest += strspn(rest, " \t");
+    ok = *query && *rest && simplet_query_add_style(*query, value, rest);
+  } else if (!strcmp(setting, "raster")) {
+    ok = (*raster = simplet_map_add_raster_layer(map, value)) != NULL;
+  } else if (!strcmp(setting, "mosaic")) {
+    ok = (*raster = simplet_map_add_mosaic_layer(map, value)) != NULL;
+  } else if (!*raster) {
+    ok = false;
+  } else if (!strcmp(setting, "resample")) {
+    simplet_raster_layer_set_resample(*raster, parse_kern(value, &ok));
+  } else if (!strcmp(setting, "color-stop")) {
+    char *color;
+    double stop = strtod(value, &color);
+    ok = color != value &&
+         simplet_raster_layer_add_color_stop(
+             *raster, stop, color + strspn(color, " \t")) == SIMPLET_OK;
+  } else if (!strcmp(setting, "classified")) {
+    simplet_raster_layer_set_classified(*raster, true);
+  } else if (!strcmp(setting, "expression")) {
+    ok = simplet_raster_layer_set_expression(*raster, value) == SIMPLET_OK;
+  } else if (!strcmp(setting, "hillshade")) {
+    double azimuth, altitude, z_factor;
+    ok = sscanf(value, "%lf %lf %lf", &azimuth, &altitude, &z_factor) == 3;
+    if (ok)
+      simplet_raster_layer_set_hillshade(*raster, azimuth, altitude,
+                                         z_factor);
+  } else {
+    ok = false;
+  }
+  return ok;
+}
+
+// Build a map from the description at path. Returns NULL after saying why
+// on failure.
+static simplet_map_t *load_map(const char *path) {
+  FILE *file;
+  if (!(file = fopen(path, "r"))) {
+    perror(path);
+    return NULL;
+  }
+
+  simplet_map_t *map;
+  if (!(map = simplet_map_new())) {
+    fclose(file);
+    return NULL;
+  }
+
+  simplet_vector_layer_t *vector = NULL;
+  simplet_query_t *query = NULL;
+  simplet_raster_layer_t *raster = NULL;
+  char *line = NULL;
+  size_t size = 0;
+  bool ok = true;
+  for (int number = 1; ok && getline(&line, &size, file) >= 0; number++) {
+    char *setting = line + strspn(line, " \t");
+    size_t length = strlen(setting);
+    while (length && strchr(" \t\r\n", setting[length - 1]))
+      setting[--length] = '\0';
+    if (!*setting || *setting == '#') continue;
+
+    char *value = setting + strcspn(setting, " \t");
+    if (*value) *value++ = '\0';
+    value += strspn(value, " \t");
+    if (!(ok = apply(map, setting, value, &vector, &query, &raster)))
+      fprintf(stderr, "%s:%d: can't use %s %s\n", path, number, setting,
+              value);
+  }
+  free(line);
+  fclose(file);
+
+  if (ok && (simplet_map_set_slippy(map, 0, 0, 0) != SIMPLET_OK ||
+             simplet_map_is_valid(map) != SIMPLET_OK)) {
+    const char *error = simplet_map_status_to_string(map);
+    fprintf(stderr, "%s: %s\n", path,
+            error ? error : "the map needs at least one layer");
+    ok = false;
+  }
+  if (!ok) {
+    simplet_map_free(map);
+    return NULL;
+  }
+  return map;
+}
+
+static cairo_status_t collect(void *closure, const unsigned char *data,
+                              unsigned int length) {
+  png_t *png = closure;
+  if (png->length + length > png->capacity) {
+    size_t capacity = png->capacity ? png->capacity * 2 : 16384;
+    while (capacity < png->length + length) capacity *= 2;
+    unsigned char *grown;
+    if (!(grown = realloc(png->data, capacity)))
+      return CAIRO_STATUS_NO_MEMORY;
+    png->data = grown;
+    png->capacity = capacity;
+  }
+  memcpy(png->data + png->length, data, length);
+  png->length += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+// Whether every pixel of surface is the same, which is stored in color.
+static bool is_solid(cairo_surface_t *surface, uint32_t *color) {
+  cairo_surface_flush(surface);
+  const unsigned char *data = cairo_image_surface_get_data(surface);
+  int width = cairo_image_surface_get_width(surface);
+  int height = cairo_image_surface_get_height(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  if (!data || !width || !height) return false;
+
+  *color = *(const uint32_t *)data;
+  for (int y = 0; y < height; y++) {
+    const uint32_t *row = (const uint32_t *)(data + y * stride);
+    for (int x = 0; x < width; x++)
+      if (row[x] != *color) return false;
+  }
+  return true;
+}
+
+static bool write_tile(seed_t *seed, unsigned int x, unsigned int y,
+                       const unsigned char *data, size_t length) {
+  if (seed->archive)
+    return simplet_archive_append(seed->archive, x, y, seed->z, data,
+                                  length) == SIMPLET_OK;
+  return simplet_tile_cache_set(seed->cache, seed->key, sizeof(seed->key), x,
+                                y, seed->z, data, length);
+}
+
+// Where tile x, y is in the solid set of zoom z.
+static uint64_t solid_index(seed_t *seed, unsigned int z, unsigned int x,
+                            unsigned int y) {
+  return (uint64_t)(y - seed->y0[z]) * seed->width[z] + (x - seed->x0[z]);
+}
+
+// A solid set for zoom z, or NULL when its tiles aren't remembered.
+static uint8_t *solid_new(seed_t *seed, unsigned int z) {
+  if (!seed->inherit || tiles_in(seed, z) > SOLID_TILES) return NULL;
+  return calloc(tiles_in(seed, z), 1);
+}
+
+// Note tile x, y is drawn in one color, returning its encoding, or NULL when
+// the color is new and png isn't given or there's no room for it. The caller
+// holds the lock.
+static solid_t *note_solid(seed_t *seed, unsigned int x, unsigned int y,
+                           uint32_t color, png_t *png) {
+  int i = 0;
+  while (i < seed->solids_length && seed->solids[i]->color != color) i++;
+  if (i == seed->solids_length) {
+    solid_t *solid;
+    if (!png || i == SOLID_COLORS ||
+        !(solid = malloc(sizeof(*solid) + png->length)))
+      return NULL;
+    solid->color = color;
+    solid->length = png->length;
+    memcpy(solid->data, png->data, png->length);
+    seed->solids[seed->solids_length++] = solid;
+  }
+  if (seed->solid) seed->solid[solid_index(seed, seed->z, x, y)] = i + 1;
+  return seed->solids[i];
+}
+
+// Draw tile x, y of the current zoom on map and write it out, or copy its
+// parent when that was drawn in one color and nothing lies under the tile.
+// A feature too small to show in the parent still has the tile drawn.
+// Returns false on failure.
+static bool seed_tile(seed_t *seed, int worker, unsigned int x,
+                      unsigned int y) {
+  simplet_map_t *map = seed->maps[worker];
+  bool placed = simplet_map_set_slippy(map, x, y, seed->z) == SIMPLET_OK;
+
+  solid_t *solid = NULL;
+  uint8_t parent = 0;
+  pthread_mutex_lock(&seed->lock);
+  if (seed->parents)
+    parent = seed->parents[solid_index(seed, seed->z - 1, x / 2, y / 2)];
+  pthread_mutex_unlock(&seed->lock);
+
+  uint64_t count;
+  if (parent && placed &&
+      simplet_map_count_features(map, &count) == SIMPLET_OK && !count) {
+    pthread_mutex_lock(&seed->lock);
+    solid = seed->solids[parent - 1];
+    if (seed->solid) seed->solid[solid_index(seed, seed->z, x, y)] = parent;
+    seed->inherited++;
+    pthread_mutex_unlock(&seed->lock);
+    return write_tile(seed, x, y, solid->data, solid->length);
+  }
+
+  // a failed count leaves its error on the map, which fails the tile
+  cairo_surface_t *surface = NULL;
+  if (placed) surface = simplet_map_build_surface(map);
+
+  png_t png = {NULL, 0, 0};
+  bool ok = surface && simplet_map_get_status(map) == SIMPLET_OK;
+  uint32_t color;
+  if (ok && is_solid(surface, &color)) {
+    pthread_mutex_lock(&seed->lock);
+    solid = note_solid(seed, x, y, color, NULL);
+    pthread_mutex_unlock(&seed->lock);
+    if (!solid) {
+      ok = cairo_surface_write_to_png_stream(surface, collect, &png) ==
+           CAIRO_STATUS_SUCCESS;
+      pthread_mutex_lock(&seed->lock);
+      if (ok) solid = note_solid(seed, x, y, color, &png);
+      pthread_mutex_unlock(&seed->lock);
+    }
+  } else if (ok) {
+    ok = cairo_surface_write_to_png_stream(surface, collect, &png) ==
+         CAIRO_STATUS_SUCCESS;
+  }
+  if (surface) cairo_surface_destroy(surface);
+
+  if (ok)
+    ok = solid ? write_tile(seed, x, y, solid->data, solid->length)
+               : write_tile(seed, x, y, png.data, png.length);
+  free(png.data);
+
+  pthread_mutex_lock(&seed->lock);
+  if (ok) {
+    seed->drawn++;
+  } else {
+    const char *error = simplet_map_status_to_string(map);
+    fprintf(stderr, "tile %u/%u/%u failed: %s\n", seed->z, x, y,
+            error ? error : "couldn't write it");
+    seed->failed++;
+  }
+  pthread_mutex_unlock(&seed->lock);
+
+  // A map keeps its error, the worker starts over with a fresh clone. The
+  // layers keep no trace of it, so the next tile draws as usual.
+  if (simplet_map_get_status(map) != SIMPLET_OK) {
+    simplet_map_t *fresh;
+    if ((fresh = simplet_map_clone(seed->map))) {
+      simplet_map_free(map);
+      seed->maps[worker] = fresh;
+    }
+  }
+  return ok;
+}
+
+// Say how far along the seed is, every REPORT seconds unless last. The
+// caller holds the lock.
+static void report(seed_t *seed, bool last) {
+  double time = now();
+  if (!last && time - seed->reported < REPORT) return;
+  seed->reported = time;
+
+  uint64_t finished = seed->drawn + seed->inherited;
+  double elapsed = time - seed->started, rate = finished / elapsed;
+  uint64_t left = seed->total - seed->skipped - finished - seed->failed;
+  fprintf(stderr, "zoom %u: %llu of %llu tiles, %.1f tiles/s", seed->z,
+          (unsigned long long)(seed->skipped + finished + seed->failed),
+          (unsigned long long)seed->total, rate);
+  if (!last && rate > 0) fprintf(stderr, ", %.0fs left", left / rate);
+  fputc('\n', stderr);
+}
+
+// Take blocks of the current zoom, stealing from other workers once this
+// one's run out, until there are none left.
+static void seed_work(void *data, int worker) {
+  seed_t *seed = data;
+  unsigned int z = seed->z;
+  size_t chunk;
+  while (!stopping &&
+         simplet_pool_ranges_next(seed->ranges, worker, &chunk)) {
+    hilbert_t tiles[BLOCK * BLOCK];
+    int length = tiles_of(seed, z, &seed->blocks[chunk], tiles);
+
+    pthread_mutex_lock(&seed->lock);
+    bool done = is_done(seed, z, chunk);
+    if (done) seed->skipped += length;
+    pthread_mutex_unlock(&seed->lock);
+    if (done) continue;
+
+    bool ok = true;
+    for (int i = 0; i < length && !stopping; i++)
+      ok = seed_tile(seed, worker, tiles[i].x, tiles[i].y) && ok;
+
+    pthread_mutex_lock(&seed->lock);
+    if (ok && !stopping) {
+      mark_done(seed, z, chunk);
+      if (seed->progress) {
+        fprintf(seed->progress, "%u %llu\n", z, (unsigned long long)chunk);
+        fflush(seed->progress);
+      }
+    }
+    report(seed, false);
+    pthread_mutex_unlock(&seed->lock);
+  }
+}
+
+// The first line of the progress file, which has to match to carry on. The
+// map's fingerprint starts over any seed of a changed map.
+static char *progress_header(seed_t *seed, const double bounds[4]) {
+  char key[SIMPLET_HASH_LENGTH * 2 + 1];
+  for (int i = 0; i < SIMPLET_HASH_LENGTH; i++)
+    sprintf(key + i * 2, "%02x", seed->key[i]);
+
+  char *header;
+  if (asprintf(&header,
+               "simplet-seed %s %.9g %.9g %.9g %.9g %u %u hilbert %d\n", key,
+               bounds[0], bounds[1], bounds[2], bounds[3], seed->min_zoom,
+               seed->max_zoom, BLOCK) < 0)
+    return NULL;
+  return header;
+}
+
+// Mark the chunks a previous run finished. Returns whether there were any.
+static bool read_progress(seed_t *seed, const char *path, const char *header) {
+  FILE *file;
+  if (!(file = fopen(path, "r"))) return false;
+
+  char *line = NULL;
+  size_t size = 0;
+  bool any = false;
+  if (getline(&line, &size, file) >= 0 && !strcmp(line, header)) {
+    unsigned int z;
+    unsigned long long chunk;
+    while (fscanf(file, "%u %llu", &z, &chunk) == 2)
+      if (z >= seed->min_zoom && z <= seed->max_zoom &&
+          chunk < chunks_in(seed, z)) {
+        mark_done(seed, z, chunk);
+        any = true;
+      }
+  } else {
+    fprintf(stderr, "%s is from a different seed, starting over\n", path);
+  }
+  free(line);
+  fclose(file);
+  return any;
+}
+
+// Write out every chunk that's done.
+static bool write_progress(seed_t *seed, const char *path,
+                           const char *header) {
+  FILE *file;
+  if (!(file = fopen(path, "w"))) return false;
+  fputs(header, file);
+  for (unsigned int z = seed->min_zoom; z <= seed->max_zoom; z++)
+    for (uint64_t chunk = 0; chunk < chunks_in(seed, z); chunk++)
+      if (is_done(seed, z, chunk))
+        fprintf(file, "%u %llu\n", z, (unsigned long long)chunk);
+  return !fclose(file);
+}
+
+// Copy the finished chunks out of the archive a previous run wrote.
+static bool copy_done(seed_t *seed, simplet_archive_t *from) {
+  for (unsigned int z = seed->min_zoom; z <= seed->max_zoom; z++) {
+    hilbert_t *blocks;
+    if (!(blocks = blocks_in(seed, z))) return false;
+    seed->z = z;
+    for (uint64_t chunk = 0; chunk < chunks_in(seed, z); chunk++) {
+      if (!is_done(seed, z, chunk)) continue;
+      hilbert_t tiles[BLOCK * BLOCK];
+      int length = tiles_of(seed, z, &blocks[chunk], tiles);
+      for (int i = 0; i < length; i++) {
+        size_t size;
+        unsigned char *data;
+        if ((data = simplet_archive_get(from, tiles[i].x, tiles[i].y, z,
+                                        &size))) {
+          write_tile(seed, tiles[i].x, tiles[i].y, data, size);
+          free(data);
+        }
+      }
+    }
+    free(blocks);
+  }
+  return true;
+}
+
+static bool ends_with(const char *string, const char *suffix) {
+  size_t length = strlen(string), suffix_length = strlen(suffix);
+  return length >= suffix_length &&
+         !strcmp(string + length - suffix_length, suffix);
+}
+
+int main(int argc, char **argv) {
+  seed_t seed;
+  memset(&seed, 0, sizeof(seed));
+  pthread_mutex_init(&seed.lock, NULL);
+  seed.max_zoom = 5;
+  double bounds[4] = {-180, -MAX_LATITUDE, 180, MAX_LATITUDE};
+  int threads = simplet_pool_size(), option;
+  while ((option = getopt(argc, argv, "b:z:t:s")) != -1) {
+    bool ok = true;
+    if (option == 'b')
+      ok = sscanf(optarg, "%lf,%lf,%lf,%lf", &bounds[0], &bounds[1],
+                  &bounds[2], &bounds[3]) == 4 &&
+           bounds[0] < bounds[2] && bounds[1] < bounds[3];
+    else if (option == 'z')
+      ok = sscanf(optarg, "%u-%u", &seed.min_zoom, &seed.max_zoom) == 2 &&
+           seed.min_zoom <= seed.max_zoom &&
+           seed.max_zoom <= SIMPLET_ARCHIVE_MAX_ZOOM;
+    else if (option == 't')
+      ok = (threads = atoi(optarg)) > 0;
+    else if (option == 's')
+      seed.inherit = true;
+    else
+      ok = false;
+    if (!ok) {
+      fputs(usage, stderr);
+      return 2;
+    }
+  }
+  if (argc - optind != 2) {
+    fputs(usage, stderr);
+    return 2;
+  }
+  const char *output = argv[optind + 1];
+  set_bounds(&seed, bounds[0], bounds[1], bounds[2], bounds[3]);
+
+  if (!(seed.map = load_map(argv[optind])) ||
+      !(seed.maps = calloc(threads, sizeof(*seed.maps))))
+    return 1;
+  for (int i = 0; i < threads; i++)
+    if (!(seed.maps[i] = simplet_map_clone(seed.map))) return 1;
+
+  for (unsigned int z = seed.min_zoom; z <= seed.max_zoom; z++) {
+    seed.total += tiles_in(&seed, z);
+    if (!(seed.done[z] = calloc(chunks_in(&seed, z) / 8 + 1, 1))) return 1;
+  }
+
+  char *progress, *resume, *header;
+  if (simplet_map_fingerprint(seed.map, seed.key) != SIMPLET_OK ||
+      asprintf(&progress, "%s.progress", output) < 0 ||
+      asprintf(&resume, "%s.resume", output) < 0 ||
+      !(header = progress_header(&seed, bounds)))
+    return 1;
+  bool resuming = read_progress(&seed, progress, header);
+
+  simplet_archive_t *from = NULL;
+  bool archive = ends_with(output, ".mbtiles") || ends_with(output, ".pmtiles");
+  if (archive) {
+    // The last run's archive is moved aside and what it finished copied.
+    if (resuming) {
+      if (access(resume, F_OK)) rename(output, resume);
+      if (!(from = simplet_archive_open(resume))) {
+        fprintf(stderr, "can't carry on from %s, starting over\n", resume);
+        for (unsigned int z = seed.min_zoom; z <= seed.max_zoom; z++)
+          memset(seed.done[z], 0, chunks_in(&seed, z) / 8 + 1);
+      }
+    }
+    if (!(seed.archive = simplet_archive_create(
+              output, ends_with(output, ".mbtiles") ? SIMPLET_MBTILES
+                                                    : SIMPLET_PMTILES))) {
+      fprintf(stderr, "can't create %s\n", output);
+      return 1;
+    }
+    if (from) {
+      bool copied = copy_done(&seed, from);
+      simplet_archive_free(from);
+      if (!copied) return 1;
+    }
+  } else {
+    if (!(seed.cache = simplet_tile_cache_new(0, output))) return 1;
+    if (!(seed.progress = fopen(progress, resuming ? "a" : "w"))) {
+      perror(progress);
+      return 1;
+    }
+    if (!resuming) fputs(header, seed.progress);
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  seed.started = seed.reported = now();
+  for (unsigned int z = seed.min_zoom; z <= seed.max_zoom && !stopping; z++) {
+    seed.z = z;
+    seed.solid = solid_new(&seed, z);
+    if (!(seed.blocks = blocks_in(&seed, z)) ||
+        !(seed.ranges = simplet_pool_ranges_new(chunks_in(&seed, z), threads)))
+      return 1;
+    simplet_pool_run(seed_work, &seed, threads);
+    simplet_pool_ranges_free(seed.ranges);
+    free(seed.blocks);
+    free(seed.parents);
+    seed.parents = seed.solid;
+    seed.solid = NULL;
+  }
+  report(&seed, true);
+
+  int status = 0;
+  if (seed.archive) {
+    if (simplet_archive_finish(seed.archive) != SIMPLET_OK) {
+      fprintf(stderr, "%s\n", simplet_archive_status_to_string(seed.archive));
+      status = 1;
+    } else {
+      write_progress(&seed, progress, header);
+      unlink(resume);
+    }
+    simplet_archive_free(seed.archive);
+  } else {
+    fclose(seed.progress);
+    simplet_tile_cache_free(seed.cache);
+  }
+
+  uint64_t finished = seed.drawn + seed.inherited;
+  fprintf(stderr, "drew %llu tiles, copied %llu from solid parents",
+          (unsigned long long)seed.drawn,
+          (unsigned long long)seed.inherited);
+  if (seed.failed)
+    fprintf(stderr, ", %llu failed", (unsigned long long)seed.failed);
+  fputc('\n', stderr);
+  if (stopping || seed.failed) {
+    fprintf(stderr, "rerun to finish the rest\n");
+    status = 1;
+  } else if (!status && finished + seed.skipped == seed.total) {
+    unlink(progress);
+  }
+
+  free(seed.parents);
+  for (int i = 0; i < seed.solids_length; i++) free(seed.solids[i]);
+  for (unsigned int z = seed.min_zoom; z <= seed.max_zoom; z++)
+    free(seed.done[z]);
+  for (int i = 0; i < threads; i++) simplet_map_free(seed.maps[i]);
+  free(seed.maps);
+  simplet_map_free(seed.map);
+  free(progress);
+  free(resume);
+  free(header);
+  return status;
+}
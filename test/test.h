@@ -25,5 +25,15 @@ TASK(style);
 TASK(map);
 TASK(integration);
 TASK(bounds);
+TASK(lru);
+TASK(resample);
+TASK(rtree);
+TASK(colorize);
+TASK(bandmath);
+TASK(pyramid);
+TASK(tile_cache);
+TASK(hash);
+TASK(archive);
+TASK(pool);
 
 #endif
@@ -0,0 +1,205 @@
+#include <sqlite3.h>
+#include <string.h>
+#include <unistd.h>
+#include "test.h"
+#include "archive.h"
+#include "mbtiles.h"
+#include "pmtiles.h"
+#include "tile_cache.h"
+
+static void test_tile_id() {
+  assert(simplet_tile_id(0, 0, 0) == 0);
+  assert(simplet_tile_id(0, 0, 1) == 1);
+  assert(simplet_tile_id(0, 1, 1) == 2);
+  assert(simplet_tile_id(1, 1, 1) == 3);
+  assert(simplet_tile_id(1, 0, 1) == 4);
+  assert(simplet_tile_id(0, 0, 2) == 5);
+  assert(simplet_tile_id(3, 3, 2) == 15);
+  assert(simplet_tile_id(0, 0, 3) == 21);
+  assert(simplet_tile_id((1 << 26) - 1, (1 << 26) - 1, 26) > 0);
+}
+
+// Append a tile whose bytes depend on value.
+static void append(simplet_archive_t *archive, unsigned int x, unsigned int y,
+                   unsigned int z, int value) {
+  char tile[32];
+  snprintf(tile, sizeof(tile), "tile %d", value);
+  assert(simplet_archive_append(archive, x, y, z, (unsigned char *)tile,
+                                strlen(tile)) == SIMPLET_OK);
+}
+
+// Check tile x, y, z holds value.
+static void check(simplet_archive_t *archive, unsigned int x, unsigned int y,
+                  unsigned int z, int value) {
+  char tile[32];
+  snprintf(tile, sizeof(tile), "tile %d", value);
+  size_t length;
+  unsigned char *out;
+  assert((out = simplet_archive_get(archive, x, y, z, &length)));
+  assert(length == strlen(tile) && !memcmp(out, tile, length));
+  free(out);
+}
+
+// Write a few zooms, some tiles repeated, and read them back.
+static void round_trip(simplet_archive_format_t format, const char *path) {
+  simplet_archive_t *archive;
+  assert((archive = simplet_archive_create(path, format)));
+  for (unsigned int z = 0; z <= 4; z++)
+    for (unsigned int x = 0; x < 1u << z; x++)
+      for (unsigned int y = 0; y < 1u << z; y++)
+        append(archive, x, y, z, (x + y) % 3);
+  // the later tile wins
+  append(archive, 3, 4, 4, 7);
+  assert(simplet_archive_set_metadata(archive, "name", "round \"trip\"") ==
+         SIMPLET_OK);
+  assert(simplet_archive_append(archive, 2, 0, 1, NULL, 0) == SIMPLET_ERR);
+  assert(!simplet_archive_get(archive, 0, 0, 0, &(size_t){0}));
+  assert(simplet_archive_finish(archive) == SIMPLET_OK);
+  simplet_archive_free(archive);
+
+  assert((archive = simplet_archive_open(path)));
+  assert(archive->format == format);
+  check(archive, 0, 0, 0, 0);
+  check(archive, 1, 2, 2, 0);
+  check(archive, 15, 14, 4, 2);
+  check(archive, 3, 4, 4, 7);
+  assert(!simplet_archive_get(archive, 0, 0, 5, &(size_t){0}));
+  assert(simplet_archive_append(archive, 0, 0, 0, NULL, 0) == SIMPLET_ERR);
+  simplet_archive_free(archive);
+}
+
+static void read_header(const char *path,
+                        unsigned char header[SIMPLET_PMTILES_HEADER]) {
+  FILE *file;
+  assert((file = fopen(path, "rb")));
+  assert(fread(header, 1, SIMPLET_PMTILES_HEADER, file) ==
+         SIMPLET_PMTILES_HEADER);
+  fclose(file);
+}
+
+static void test_mbtiles() {
+  char dir[] = "/tmp/simplet-archive-XXXXXX";
+  assert(mkdtemp(dir));
+  char *path;
+  assert(asprintf(&path, "%s/tiles.mbtiles", dir) > 0);
+  round_trip(SIMPLET_MBTILES, path);
+
+  // four distinct tiles stored once each
+  sqlite3 *db;
+  sqlite3_stmt *counts;
+  assert(sqlite3_open(path, &db) == SQLITE_OK);
+  assert(sqlite3_prepare_v2(db,
+                            "SELECT (SELECT COUNT(*) FROM images),"
+                            " (SELECT COUNT(*) FROM tiles)",
+                            -1, &counts, NULL) == SQLITE_OK);
+  assert(sqlite3_step(counts) == SQLITE_ROW);
+  assert(sqlite3_column_int(counts, 0) == 4);
+  assert(sqlite3_column_int(counts, 1) == 341);
+  sqlite3_finalize(counts);
+  sqlite3_close(db);
+
+  // nothing but the database is left behind
+  assert(unlink(path) == 0);
+  assert(rmdir(dir) == 0);
+  free(path);
+}
+
+// A tile the database refuses leaves the batch open for the next ones.
+static void test_mbtiles_failed() {
+  char dir[] = "/tmp/simplet-archive-XXXXXX";
+  assert(mkdtemp(dir));
+  char *path;
+  assert(asprintf(&path, "%s/tiles.mbtiles", dir) > 0);
+  simplet_archive_t *archive;
+  assert((archive = simplet_archive_create(path, SIMPLET_MBTILES)));
+  assert(sqlite3_exec(((simplet_mbtiles_t *)archive)->db,
+                      "CREATE TEMP TRIGGER refuse BEFORE INSERT ON map"
+                      " WHEN NEW.zoom_level = 1 BEGIN"
+                      " SELECT RAISE(ABORT, 'refused'); END",
+                      NULL, NULL, NULL) == SQLITE_OK);
+
+  char tile[] = "tile";
+  assert(simplet_archive_append(archive, 0, 0, 1, (unsigned char *)tile,
+                                4) != SIMPLET_OK);
+  append(archive, 0, 0, 0, 1);
+  assert(simplet_archive_append(archive, 1, 0, 1, (unsigned char *)tile,
+                                4) != SIMPLET_OK);
+  append(archive, 0, 0, 2, 2);
+  assert(simplet_archive_finish(archive) == SIMPLET_OK);
+  simplet_archive_free(archive);
+
+  assert((archive = simplet_archive_open(path)));
+  check(archive, 0, 0, 0, 1);
+  check(archive, 0, 0, 2, 2);
+  assert(!simplet_archive_get(archive, 0, 0, 1, &(size_t){0}));
+  simplet_archive_free(archive);
+
+  assert(unlink(path) == 0);
+  assert(rmdir(dir) == 0);
+  free(path);
+}
+
+static void test_pmtiles() {
+  char dir[] = "/tmp/simplet-archive-XXXXXX";
+  assert(mkdtemp(dir));
+  char *path;
+  assert(asprintf(&path, "%s/tiles.pmtiles", dir) > 0);
+  round_trip(SIMPLET_PMTILES, path);
+
+  // four distinct tiles stored once each, runs of them share entries
+  unsigned char header[SIMPLET_PMTILES_HEADER];
+  read_header(path, header);
+  assert(header[72] == 341 % 256 && header[73] == 341 / 256);
+  assert(header[88] == 4);
+  assert(header[80] < 341 && header[96] == 1);
+  assert(header[100] == 0 && header[101] == 4);
+
+  assert(unlink(path) == 0);
+  assert(rmdir(dir) == 0);
+  free(path);
+}
+
+// Enough distinct tiles that the directory spills into leaves.
+static void test_leaves() {
+  char path[] = "/tmp/simplet-leaves-XXXXXX";
+  int fd;
+  assert((fd = mkstemp(path)) >= 0);
+  close(fd);
+
+  simplet_archive_t *archive;
+  assert((archive = simplet_archive_create(path, SIMPLET_PMTILES)));
+  for (unsigned int x = 0; x < 128; x++)
+    for (unsigned int y = 0; y < 128; y++) append(archive, x, y, 7, x * y);
+  simplet_archive_free(archive);
+  unsigned char header[SIMPLET_PMTILES_HEADER];
+  read_header(path, header);
+  assert(header[48] || header[49] || header[50]);
+
+  assert((archive = simplet_archive_open(path)));
+  for (unsigned int x = 0; x < 128; x += 5)
+    for (unsigned int y = 0; y < 128; y += 3) check(archive, x, y, 7, x * y);
+  assert(!simplet_archive_get(archive, 0, 0, 6, &(size_t){0}));
+
+  // the cache serves straight from an archive
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, NULL)));
+  simplet_tile_cache_set_archive(cache, archive);
+  size_t length;
+  unsigned char *out;
+  assert((out = simplet_tile_cache_get(cache, "map", 3, 9, 9, 7, &length)));
+  assert(length == 7 && !memcmp(out, "tile 81", length));
+  free(out);
+  assert(simplet_tile_cache_get_length(cache) == 1);
+  simplet_tile_cache_free(cache);
+
+  simplet_archive_free(archive);
+  assert(unlink(path) == 0);
+}
+
+TASK(archive) {
+  test(tile_id);
+  test(mbtiles);
+  test(mbtiles_failed);
+  test(pmtiles);
+  test(leaves);
+}
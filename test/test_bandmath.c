@@ -0,0 +1,94 @@
+#include <math.h>
+#include "test.h"
+#include "bandmath.h"
+
+#define VALUES 1000
+
+static void test_compile() {
+  simplet_expr_t *expr;
+  assert((expr = simplet_expr_new("(b4 - b3) / (b4 + b3)")));
+  assert(expr->bands == 4);
+  simplet_expr_free(expr);
+  assert((expr = simplet_expr_new(" max(b1, -b2) * sqrt(abs(b16)) + .5")));
+  assert(expr->bands == 16);
+  simplet_expr_free(expr);
+
+  const char *invalid[] = {"", "b0", "b17", "(b1", "b1 b2", "b1 +",
+                           "min(b1)", "log(b1)", "b", "1)"};
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); i++)
+    assert(!simplet_expr_new(invalid[i]));
+}
+
+static void test_eval() {
+  float *bands[3];
+  for (int band = 0; band < 3; band++) {
+    assert((bands[band] = malloc(VALUES * sizeof(float))));
+    for (int i = 0; i < VALUES; i++) bands[band][i] = (i * (band + 3)) % 97;
+  }
+  float *out;
+  assert((out = malloc(VALUES * sizeof(float))));
+
+  simplet_expr_t *expr;
+  assert((expr = simplet_expr_new("(b3 - b2) / (b3 + b2) - min(b1, 2) * -b1")));
+  simplet_expr_eval(expr, (const float *const *)bands, VALUES, out);
+  for (int i = 0; i < VALUES; i++) {
+    float a = bands[0][i], b = bands[1][i], c = bands[2][i];
+    float expected = (c - b) / (c + b) - (a < 2 ? a : 2) * -a;
+    // both bands at zero divide to nothing
+    if (expected != expected)
+      assert(out[i] != out[i]);
+    else
+      assert(fabsf(out[i] - expected) < 1e-4);
+  }
+  simplet_expr_free(expr);
+
+  for (int band = 0; band < 3; band++) free(bands[band]);
+  free(out);
+}
+
+// A plane facing east is lit fully by light from the east at its slope,
+// not at all from the west, and flat ground by the sine of the altitude.
+static void test_hillshade() {
+  float dem[5 * 4], out[5 * 4];
+  for (int i = 0; i < 5 * 4; i++) dem[i] = 100 - (i % 5) * 10;
+
+  simplet_relief_t relief = {90, 45, 1, 10, -10};
+  simplet_hillshade(dem, 5, 4, &relief, out);
+  assert(fabsf(out[7] - 255) < 0.01);
+  relief.azimuth = 270;
+  simplet_hillshade(dem, 5, 4, &relief, out);
+  assert(out[7] == 0);
+
+  for (int i = 0; i < 5 * 4; i++) dem[i] = 7;
+  dem[12] = NAN;
+  simplet_hillshade(dem, 5, 4, &relief, out);
+  assert(out[12] != out[12]);
+  for (int i = 0; i < 5 * 4; i++)
+    if (i != 12) assert(fabsf(out[i] - 255 * sinf(M_PI / 4)) < 0.01);
+}
+
+// Rows wide enough to shade four cells at a time, with holes scattered
+// through them, shade the same as one cell at a time.
+static void test_hillshade_best() {
+  float dem[37 * 9], scalar[37 * 9], best[37 * 9];
+  srand(3);
+  for (int i = 0; i < 37 * 9; i++) dem[i] = rand() % 500 / 3.0f;
+  for (int i = 5; i < 37 * 9; i += 13) dem[i] = NAN;
+
+  simplet_relief_t relief = {315, 45, 2, 30, -30};
+  simplet_hillshade_scalar(dem, 37, 9, &relief, scalar);
+  simplet_hillshade(dem, 37, 9, &relief, best);
+  for (int i = 0; i < 37 * 9; i++) {
+    if (dem[i] != dem[i])
+      assert(best[i] != best[i] && scalar[i] != scalar[i]);
+    else
+      assert(fabsf(best[i] - scalar[i]) < 0.01);
+  }
+}
+
+TASK(bandmath) {
+  test(compile);
+  test(eval);
+  test(hillshade);
+  test(hillshade_best);
+}
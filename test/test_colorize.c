@@ -0,0 +1,107 @@
+#include <math.h>
+#include "test.h"
+#include "colorize.h"
+
+#define VALUES 1000
+
+static const simplet_color_stop_t ramp[] = {
+    {0, 0, 0, 0, 255}, {100, 255, 255, 255, 255}, {200, 255, 0, 0, 0}};
+
+static uint32_t color_of(simplet_lut_t *lut, float value) {
+  uint32_t out;
+  simplet_colorize_scalar(lut, &value, 1, &out);
+  return out;
+}
+
+static void test_ramp() {
+  simplet_lut_t *lut;
+  assert((lut = simplet_lut_new(ramp, 3, false)));
+  assert(color_of(lut, -50) == 0xff000000);
+  assert(color_of(lut, 0) == 0xff000000);
+  assert(color_of(lut, 100) == 0xffffffff);
+  assert(color_of(lut, 1000) == 0);
+  // halfway to a transparent red is premultiplied
+  uint32_t half = color_of(lut, 150);
+  assert(abs((int)(half >> 24) - 128) <= 1);
+  assert((half >> 16 & 0xff) == half >> 24);
+  assert(abs((int)(half >> 8 & 0xff) - 64) <= 1);
+  free(lut);
+}
+
+static void test_classified() {
+  simplet_color_stop_t classes[] = {
+      {1, 255, 0, 0, 255}, {2, 0, 255, 0, 255}, {3, 0, 0, 255, 255}};
+  simplet_lut_t *lut;
+  assert((lut = simplet_lut_new(classes, 3, true)));
+  assert(color_of(lut, 1) == 0xffff0000);
+  assert(color_of(lut, 1.99f) == 0xffff0000);
+  assert(color_of(lut, 2) == 0xff00ff00);
+  assert(color_of(lut, 3) == 0xff0000ff);
+  free(lut);
+
+  // edges one apart across a sixteen bit range stay apart
+  simplet_color_stop_t wide[] = {{0, 255, 0, 0, 255},
+                                 {30000, 0, 255, 0, 255},
+                                 {30001, 0, 0, 255, 255},
+                                 {65535, 255, 255, 255, 255}};
+  assert((lut = simplet_lut_new(wide, 4, true)));
+  assert(color_of(lut, -1) == 0xffff0000);
+  assert(color_of(lut, 29999.5f) == 0xffff0000);
+  assert(color_of(lut, 30000) == 0xff00ff00);
+  assert(color_of(lut, 30000.5f) == 0xff00ff00);
+  assert(color_of(lut, 30001) == 0xff0000ff);
+  assert(color_of(lut, 65534) == 0xff0000ff);
+  assert(color_of(lut, 65535) == 0xffffffff);
+  assert(color_of(lut, 1e9f) == 0xffffffff);
+
+  float values[VALUES];
+  uint32_t scalar[VALUES], best[VALUES];
+  for (int i = 0; i < VALUES; i++) values[i] = 29500 + i;
+  values[5] = NAN;
+  simplet_colorize_scalar(lut, values, VALUES, scalar);
+  simplet_colorize_best()(lut, values, VALUES, best);
+  for (int i = 0; i < VALUES; i++) assert(best[i] == scalar[i]);
+  assert(scalar[5] == 0);
+  free(lut);
+}
+
+static void test_no_data() {
+  simplet_lut_t *lut;
+  assert((lut = simplet_lut_new(ramp, 3, false)));
+  lut->has_no_data = true;
+  lut->no_data = -9999;
+  assert(color_of(lut, -9999) == 0);
+  assert(color_of(lut, NAN) == 0);
+  assert(color_of(lut, -9998) == 0xff000000);
+  free(lut);
+}
+
+// the fastest lookup matches the scalar one, in place too
+static void test_best() {
+  simplet_lut_t *lut;
+  assert((lut = simplet_lut_new(ramp, 3, false)));
+  lut->has_no_data = true;
+  lut->no_data = 7;
+
+  float values[VALUES];
+  uint32_t scalar[VALUES];
+  for (int i = 0; i < VALUES; i++) values[i] = i * 0.37f - 50;
+  values[3] = NAN;
+  values[10] = INFINITY;
+  values[11] = -INFINITY;
+  values[12] = 7;
+  simplet_colorize_scalar(lut, values, VALUES, scalar);
+  simplet_colorize_best()(lut, values, VALUES, (uint32_t *)values);
+  for (int i = 0; i < VALUES; i++)
+    assert(((uint32_t *)values)[i] == scalar[i]);
+  assert(scalar[3] == 0 && scalar[12] == 0);
+  assert(scalar[10] == color_of(lut, 200));
+  free(lut);
+}
+
+TASK(colorize) {
+  test(ramp);
+  test(classified);
+  test(no_data);
+  test(best);
+}
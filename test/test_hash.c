@@ -0,0 +1,48 @@
+#include <string.h>
+#include "test.h"
+#include "hash.h"
+
+static void digest_of(const void *data, size_t length, size_t step,
+                      char *hex) {
+  simplet_hash_t hash;
+  simplet_hash_init(&hash);
+  for (size_t i = 0; i < length; i += step)
+    simplet_hash_update(&hash, (const uint8_t *)data + i,
+                        length - i < step ? length - i : step);
+  uint8_t out[SIMPLET_HASH_LENGTH];
+  simplet_hash_final(&hash, out);
+  for (int i = 0; i < SIMPLET_HASH_LENGTH; i++)
+    sprintf(hex + i * 2, "%02x", out[i]);
+}
+
+static void test_vectors() {
+  char hex[SIMPLET_HASH_LENGTH * 2 + 1];
+  digest_of("", 0, 1, hex);
+  assert(!strcmp(
+      hex, "69217a3079908094e11121d042354a7c1f55b6482ca1a51e1b250dfd1ed0eef9"));
+  digest_of("abc", 3, 3, hex);
+  assert(!strcmp(
+      hex, "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982"));
+}
+
+// A whole block held back for the end, and pieces across block boundaries.
+static void test_blocks() {
+  uint8_t data[200];
+  for (int i = 0; i < 200; i++) data[i] = i;
+  char whole[SIMPLET_HASH_LENGTH * 2 + 1], pieces[SIMPLET_HASH_LENGTH * 2 + 1];
+  digest_of(data, 64, 64, whole);
+  assert(!strcmp(
+      whole,
+      "56f34e8b96557e90c1f24b52d0c89d51086acf1b00f634cf1dde9233b8eaaa3e"));
+  digest_of(data, 200, 200, whole);
+  digest_of(data, 200, 7, pieces);
+  assert(!strcmp(whole, pieces));
+  assert(!strcmp(
+      whole,
+      "6d244e1a06ce4ef578dd0f63aff0936706735119ca9c8d22d86c801414ab9741"));
+}
+
+TASK(hash) {
+  test(vectors);
+  test(blocks);
+}
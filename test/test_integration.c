@@ -1,8 +1,11 @@
+#include <string.h>
 #include "map.h"
 #include "vector_layer.h"
 #include "raster_layer.h"
 #include "query.h"
 #include "list.h"
+#include "blocks.h"
+#include "tile_cache.h"
 #include "test.h"
 
 simplet_map_t *build_map() {
@@ -54,6 +57,73 @@ void test_raster_lanczos() {
   run_test_raster(SIMPLET_LANCZOS, "./raster-lanczos.png");
 }
 
+void test_raster_colorized() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_map_set_slippy(map, 1219, 1539, 12);
+  simplet_raster_layer_t *layer = simplet_map_add_raster_layer(
+      map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  simplet_raster_layer_add_color_stop(layer, 0, "#08306b");
+  simplet_raster_layer_add_color_stop(layer, 128, "#f7fbff");
+  simplet_raster_layer_add_color_stop(layer, 255, "#67000d");
+  simplet_map_render_to_png(map, "./raster-colorized.png");
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+  simplet_map_free(map);
+}
+
+void test_raster_band_math() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_map_set_slippy(map, 1219, 1539, 12);
+  simplet_raster_layer_t *layer = simplet_map_add_raster_layer(
+      map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  assert(SIMPLET_OK ==
+         simplet_raster_layer_set_expression(layer, "(b1 - b2) / (b1 + b2)"));
+  simplet_raster_layer_add_color_stop(layer, -0.2, "#1a9850");
+  simplet_raster_layer_add_color_stop(layer, 0, "#ffffbf");
+  simplet_raster_layer_add_color_stop(layer, 0.2, "#d73027");
+
+  // shade the brightness of the same raster as if it were terrain
+  layer = simplet_map_add_raster_layer(
+      map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  simplet_raster_layer_set_hillshade(layer, 315, 45, 1);
+  simplet_raster_layer_add_color_stop(layer, 0, "#00000080");
+  simplet_raster_layer_add_color_stop(layer, 180, "#00000000");
+  simplet_map_render_to_png(map, "./raster-band-math.png");
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+  simplet_map_free(map);
+}
+
+void test_mosaic() {
+  FILE *list;
+  assert((list = fopen("./mosaic.txt", "w")));
+  fputs("./data/nyc2-rgb-pansharpened-8bit-nodata.tif\n", list);
+  fputs("./data/loss_1932_2010.tif\n", list);
+  fclose(list);
+
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_map_set_slippy(map, 1219, 1539, 12);
+  simplet_raster_layer_t *layer =
+      simplet_map_add_mosaic_layer(map, "./mosaic.txt");
+  assert(layer);
+  assert(SIMPLET_OK ==
+         simplet_raster_layer_set_mosaic_index(layer, "./mosaic.index"));
+  uint8_t before[SIMPLET_HASH_LENGTH], after[SIMPLET_HASH_LENGTH];
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, before));
+  simplet_map_render_to_png(map, "./mosaic.png");
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+
+  // drawing doesn't change what the fingerprint sees
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, after));
+  assert(!memcmp(before, after, SIMPLET_HASH_LENGTH));
+  simplet_map_free(map);
+
+  // the footprints were saved for the next process
+  assert((list = fopen("./mosaic.index", "r")));
+  fclose(list);
+}
+
 void test_many_layers() {
   simplet_map_t *map;
   assert((map = build_map()));
@@ -88,6 +158,117 @@ void test_many_queries() {
   simplet_map_free(map);
 }
 
+// Add the two queries the shared test stacks on layer.
+void add_shared_queries(simplet_vector_layer_t *layer, bool second) {
+  simplet_query_t *query;
+  if (!second) {
+    query = simplet_vector_layer_add_query(
+        layer, "SELECT * from ne_10m_admin_0_countries");
+    simplet_query_add_style(query, "weight", "1");
+    simplet_query_add_style(query, "stroke", "#ffffffff");
+    simplet_query_add_style(query, "text-field", "ABBREV");
+    simplet_query_add_style(query, "color", "#226688");
+    return;
+  }
+  query = simplet_vector_layer_add_query(
+      layer, "SELECT * from ne_10m_admin_0_countries");
+  simplet_query_add_style(query, "fill", "#cc000055");
+  simplet_query_add_style(query, "blend", "multiply");
+}
+
+// Queries sharing a scan draw exactly what they draw scanning on their own,
+// here from layers of their own.
+void test_shared_queries() {
+  simplet_map_t *map, *apart;
+  assert((map = build_map()));
+  simplet_vector_layer_t *layer = simplet_list_tail(map->layers);
+  add_shared_queries(layer, false);
+  add_shared_queries(layer, true);
+  simplet_map_render_to_png(map, "./shared.png");
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+
+  assert((apart = build_map()));
+  for (int i = 0; i < 2; i++)
+    add_shared_queries(
+        simplet_map_add_vector_layer(apart,
+                                     "./data/ne_10m_admin_0_countries.shp"),
+        i);
+
+  cairo_surface_t *shared, *unshared;
+  assert((shared = simplet_map_build_surface(map)));
+  assert((unshared = simplet_map_build_surface(apart)));
+  assert(SIMPLET_OK == simplet_map_get_status(apart));
+  cairo_surface_flush(shared);
+  cairo_surface_flush(unshared);
+  int stride = cairo_image_surface_get_stride(shared);
+  assert(stride == cairo_image_surface_get_stride(unshared));
+  assert(!memcmp(cairo_image_surface_get_data(shared),
+                 cairo_image_surface_get_data(unshared),
+                 stride * cairo_image_surface_get_height(shared)));
+  cairo_surface_destroy(shared);
+  cairo_surface_destroy(unshared);
+  simplet_map_free(apart);
+  simplet_map_free(map);
+}
+
+// A map drawing the world's country codes, placed across the whole layer.
+simplet_map_t *global_labels_map() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_vector_layer_t *layer = simplet_map_add_vector_layer(
+      map, "./data/ne_10m_admin_0_countries.shp");
+  simplet_query_t *query = simplet_vector_layer_add_query(
+      layer, "SELECT * from ne_10m_admin_0_countries");
+  simplet_query_add_style(query, "text-field", "ABBREV");
+  simplet_query_add_style(query, "text-placement", "global");
+  simplet_query_add_style(query, "color", "#226688");
+  return map;
+}
+
+// Both tiles of a row draw from one index, and draw exactly the halves of a
+// map covering the two, labels straddling their edge included.
+void test_global_labels() {
+  simplet_map_t *wide;
+  assert((wide = global_labels_map()));
+  simplet_map_set_slippy(wide, 0, 0, 1);
+  simplet_map_set_size(wide, 512, 256);
+  simplet_map_set_bounds(wide, 20037508.34, 0, -20037508.34, 20037508.34);
+  assert(simplet_map_is_valid(wide));
+  unsigned int cached = simplet_label_index_get_length();
+  cairo_surface_t *whole;
+  assert((whole = simplet_map_build_surface(wide)));
+  assert(SIMPLET_OK == simplet_map_get_status(wide));
+  assert(simplet_label_index_get_length() == cached + 1);
+  cairo_surface_flush(whole);
+  int whole_stride = cairo_image_surface_get_stride(whole);
+  unsigned char *whole_data = cairo_image_surface_get_data(whole);
+
+  char *tiles[] = {"./global-0.png", "./global-1.png"};
+  for (unsigned int x = 0; x < 2; x++) {
+    simplet_map_t *map;
+    assert((map = global_labels_map()));
+    simplet_map_set_slippy(map, x, 0, 1);
+    assert(simplet_map_is_valid(map));
+    simplet_map_render_to_png(map, tiles[x]);
+    assert(SIMPLET_OK == simplet_map_get_status(map));
+
+    cairo_surface_t *tile;
+    assert((tile = simplet_map_build_surface(map)));
+    cairo_surface_flush(tile);
+    int stride = cairo_image_surface_get_stride(tile);
+    unsigned char *data = cairo_image_surface_get_data(tile);
+    for (int y = 0; y < 256; y++)
+      assert(!memcmp(data + y * stride, whole_data + y * whole_stride +
+                                            x * 256 * 4,
+                     256 * 4));
+    cairo_surface_destroy(tile);
+    simplet_map_free(map);
+  }
+  assert(simplet_label_index_get_length() == cached + 1);
+  cairo_surface_destroy(whole);
+  simplet_map_free(wide);
+}
+
 void test_projection() {
   simplet_map_t *map;
   assert((map = build_map()));
@@ -201,6 +382,225 @@ void test_stream() {
   simplet_map_free(map);
 }
 
+// Rendering a tile again finds every block it needs already decoded.
+void test_raster_blocks() {
+  simplet_blocks_clear();
+  unsigned int length = 0;
+  for (int i = 0; i < 2; i++) {
+    simplet_map_t *map;
+    assert((map = simplet_map_new()));
+    simplet_map_set_slippy(map, 1219, 1539, 12);
+    simplet_map_add_raster_layer(
+        map, "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+    char *data = NULL;
+    simplet_map_render_to_stream(map, data, stream);
+    assert(SIMPLET_OK == simplet_map_get_status(map));
+    simplet_map_free(map);
+
+    if (!i) length = simplet_blocks_get_length();
+    assert(length > 0 && simplet_blocks_get_length() == length);
+  }
+
+  simplet_blocks_set_budget(0);
+  assert(simplet_blocks_get_length() == 0);
+  simplet_blocks_set_budget(SIMPLET_BLOCK_CACHE);
+}
+
+// Collects a streamed png.
+typedef struct {
+  unsigned char data[1 << 18];
+  size_t length;
+} png_t;
+
+cairo_status_t collect(void *closure, const unsigned char *data,
+                       unsigned int length) {
+  png_t *png = closure;
+  assert(png->length + length <= sizeof(png->data));
+  memcpy(png->data + png->length, data, length);
+  png->length += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+// The second render comes from the cache, until the map draws differently.
+void test_cached() {
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, NULL)));
+  static png_t first, second;
+  simplet_map_t *map;
+  assert((map = build_map()));
+  simplet_map_render_cached(map, cache, 0, 0, 1, &first, collect);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+  assert(simplet_tile_cache_get_length(cache) == 1);
+
+  simplet_map_render_cached(map, cache, 0, 0, 1, &second, collect);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+  assert(first.length == second.length &&
+         !memcmp(first.data, second.data, first.length));
+  assert(simplet_tile_cache_get_length(cache) == 1);
+
+  simplet_map_set_bgcolor(map, "#CC0000");
+  second.length = 0;
+  simplet_map_render_cached(map, cache, 0, 0, 1, &second, collect);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+  assert(simplet_tile_cache_get_length(cache) == 2);
+  simplet_map_free(map);
+  simplet_tile_cache_free(cache);
+}
+
+simplet_status_t pyramid_tile(void *closure, unsigned int x,
+                              unsigned int y, unsigned int z,
+                              cairo_surface_t *tile) {
+  (void)x, (void)y;
+  unsigned int *tiles = closure;
+  assert(cairo_image_surface_get_width(tile) == 256);
+  if (z == 11) cairo_surface_write_to_png(tile, "./raster-pyramid.png");
+  tiles[z - 11]++;
+  return SIMPLET_OK;
+}
+
+// The parent is shrunk from the four tiles rendered under it.
+void test_raster_pyramid() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_map_add_raster_layer(map,
+                               "./data/nyc2-rgb-pansharpened-8bit-nodata.tif");
+  unsigned int tiles[2] = {0, 0};
+  assert(SIMPLET_OK == simplet_map_render_pyramid(map, 609, 769, 11, 12,
+                                                  SIMPLET_LANCZOS, tiles,
+                                                  pyramid_tile));
+  assert(tiles[0] == 1 && tiles[1] == 4);
+  assert(SIMPLET_OK != simplet_map_render_pyramid(map, 609, 769, 11, 10,
+                                                  SIMPLET_NEAREST, tiles,
+                                                  pyramid_tile));
+  simplet_map_free(map);
+}
+
+// Tiles of a batch, in the order they were handed over.
+typedef struct {
+  simplet_tile_id_t ids[4];
+  png_t pngs[4];
+  int length;
+  int stop_after;
+} batch_t;
+
+simplet_status_t batch_tile(void *closure, simplet_tile_id_t id,
+                            const unsigned char *data, size_t length) {
+  batch_t *batch = closure;
+  if (batch->length == batch->stop_after) return SIMPLET_ERR;
+  batch->ids[batch->length] = id;
+  collect(&batch->pngs[batch->length++], data, length);
+  return SIMPLET_OK;
+}
+
+// A batch draws the same tiles as rendering them one by one, and leaves the
+// map alone.
+void test_batch() {
+  static batch_t batch;
+  static png_t single;
+  simplet_tile_id_t ids[4] = {{0, 0, 1}, {1, 1, 1}, {1, 0, 1}, {0, 1, 1}};
+  simplet_map_t *map;
+  assert((map = build_map()));
+  batch.stop_after = -1;
+  assert(SIMPLET_OK == simplet_map_render_tiles(map, ids, 4, 2, &batch,
+                                                batch_tile));
+  assert(batch.length == 4);
+  assert(map->width == 256 && map->bounds->nw.x < -179);
+
+  for (int i = 0; i < 4; i++) {
+    simplet_map_t *tile;
+    assert((tile = build_map()));
+    simplet_map_set_slippy(tile, batch.ids[i].x, batch.ids[i].y,
+                           batch.ids[i].z);
+    single.length = 0;
+    simplet_map_render_to_stream(tile, &single, collect);
+    assert(SIMPLET_OK == simplet_map_get_status(tile));
+    assert(single.length == batch.pngs[i].length &&
+           !memcmp(single.data, batch.pngs[i].data, single.length));
+    simplet_map_free(tile);
+  }
+
+  // The callback stops the batch.
+  memset(&batch, 0, sizeof(batch));
+  batch.stop_after = 1;
+  assert(SIMPLET_OK != simplet_map_render_tiles(map, ids, 4, 1, &batch,
+                                                batch_tile));
+  assert(batch.length == 1);
+  simplet_map_free(map);
+}
+
+// A tile failing on one clone leaves the shared layer to draw on the others.
+void test_clone_failure() {
+  assert(!system("cp ./data/nyc2-rgb-pansharpened-8bit-nodata.tif "
+                 "./clone.tif"));
+  simplet_map_t *map, *failing, *other;
+  assert((map = simplet_map_new()));
+  simplet_map_add_raster_layer(map, "./clone.tif");
+  assert((failing = simplet_map_clone(map)));
+  assert((other = simplet_map_clone(map)));
+
+  static png_t png;
+  assert(!rename("./clone.tif", "./clone.tif.away"));
+  simplet_map_set_slippy(failing, 1219, 1539, 12);
+  simplet_map_render_to_stream(failing, &png, collect);
+  assert(SIMPLET_OK != simplet_map_get_status(failing));
+  assert(!rename("./clone.tif.away", "./clone.tif"));
+
+  png.length = 0;
+  simplet_map_set_slippy(other, 1219, 1539, 12);
+  simplet_map_render_to_stream(other, &png, collect);
+  assert(SIMPLET_OK == simplet_map_get_status(other));
+  assert(png.length > 0);
+
+  simplet_map_free(failing);
+  simplet_map_free(other);
+  simplet_map_free(map);
+  remove("./clone.tif");
+}
+
+static bool one_color(cairo_surface_t *surface) {
+  cairo_surface_flush(surface);
+  const unsigned char *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  for (int y = 0; y < cairo_image_surface_get_height(surface); y++)
+    for (int x = 0; x < cairo_image_surface_get_width(surface); x++)
+      if (memcmp(data + y * stride + x * 4, data, 4)) return false;
+  return true;
+}
+
+// A country too small to show at zoom 0 still counts under the tiles that
+// cover it, so a seed draws them instead of copying their solid ancestor,
+// while a tile with nothing under it counts none.
+void test_sub_pixel() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_map_set_bgcolor(map, "#0000ff");
+  simplet_vector_layer_t *layer =
+      simplet_map_add_vector_layer(map, "./data/ne_10m_admin_0_countries.shp");
+  simplet_query_t *query = simplet_vector_layer_add_query(
+      layer, "SELECT * from ne_10m_admin_0_countries WHERE ADMIN = 'Vatican'");
+  simplet_query_add_style(query, "fill", "#ff0000");
+
+  cairo_surface_t *surface;
+  simplet_map_set_slippy(map, 0, 0, 0);
+  assert((surface = simplet_map_build_surface(map)));
+  assert(one_color(surface));
+  cairo_surface_destroy(surface);
+
+  uint64_t count;
+  simplet_map_set_slippy(map, 8758, 6087, 14);
+  assert(SIMPLET_OK == simplet_map_count_features(map, &count));
+  assert(count == 1);
+  assert((surface = simplet_map_build_surface(map)));
+  assert(!one_color(surface));
+  cairo_surface_destroy(surface);
+
+  simplet_map_set_slippy(map, 0, 0, 14);
+  assert(SIMPLET_OK == simplet_map_count_features(map, &count));
+  assert(count == 0);
+  assert(SIMPLET_OK == simplet_map_get_status(map));
+  simplet_map_free(map);
+}
+
 TASK(integration) {
   test(projection);
   puts("check projection.png");
@@ -208,15 +608,32 @@ TASK(integration) {
   puts("check queries.png");
   test(many_layers);
   puts("check layers.png");
+  test(shared_queries);
+  puts("check shared.png");
+  test(global_labels);
+  puts("check global-0.png and global-1.png");
+  test(sub_pixel);
   test(raster);
   puts("check raster.png");
   test(raster_bilinear);
   puts("check raster-bilinear.png");
   test(raster_lanczos);
   puts("check raster-lanczos.png");
+  test(raster_colorized);
+  puts("check raster-colorized.png");
+  test(raster_band_math);
+  puts("check raster-band-math.png");
+  test(mosaic);
+  puts("check mosaic.png");
+  test(raster_pyramid);
+  puts("check raster-pyramid.png");
   test(slippy_gen);
   puts("check slippy.png");
   test(stream);
+  test(cached);
+  test(batch);
+  test(clone_failure);
+  test(raster_blocks);
   puts("check holes.png");
   test(holes);
   puts("check lines.png");
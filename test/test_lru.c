@@ -0,0 +1,94 @@
+#include "test.h"
+#include "lru.h"
+
+static int frees = 0;
+
+static void freed(void *value) {
+  frees++;
+  free(value);
+}
+
+static int *int_new(int val) {
+  int *i;
+  assert((i = malloc(sizeof(*i))));
+  *i = val;
+  return i;
+}
+
+static void test_get() {
+  simplet_lru_t *lru;
+  assert((lru = simplet_lru_new(10, freed)));
+  simplet_lru_set(lru, "a", 1, int_new(1), 1);
+  simplet_lru_set(lru, "b", 1, int_new(2), 1);
+  assert(*(int *)simplet_lru_get(lru, "a", 1) == 1);
+  assert(*(int *)simplet_lru_get(lru, "b", 1) == 2);
+  assert(!simplet_lru_get(lru, "c", 1));
+  assert(simplet_lru_get_length(lru) == 2);
+  simplet_lru_free(lru);
+}
+
+static void test_replace() {
+  simplet_lru_t *lru;
+  assert((lru = simplet_lru_new(10, freed)));
+  frees = 0;
+  simplet_lru_set(lru, "a", 1, int_new(1), 1);
+  simplet_lru_set(lru, "a", 1, int_new(2), 1);
+  assert(frees == 1);
+  assert(*(int *)simplet_lru_get(lru, "a", 1) == 2);
+  assert(simplet_lru_get_length(lru) == 1);
+  simplet_lru_free(lru);
+}
+
+static void test_evict() {
+  simplet_lru_t *lru;
+  assert((lru = simplet_lru_new(3, freed)));
+  simplet_lru_set(lru, "a", 1, int_new(1), 1);
+  simplet_lru_set(lru, "b", 1, int_new(2), 1);
+  simplet_lru_set(lru, "c", 1, int_new(3), 1);
+  // touch a so b is the least recently used
+  assert(simplet_lru_get(lru, "a", 1));
+  simplet_lru_set(lru, "d", 1, int_new(4), 1);
+  assert(!simplet_lru_get(lru, "b", 1));
+  assert(simplet_lru_get(lru, "a", 1));
+  assert(simplet_lru_get(lru, "c", 1));
+  assert(simplet_lru_get(lru, "d", 1));
+  // a value bigger than the budget pushes everything else out
+  simplet_lru_set(lru, "e", 1, int_new(5), 5);
+  assert(simplet_lru_get_length(lru) == 1);
+  assert(simplet_lru_get(lru, "e", 1));
+  simplet_lru_free(lru);
+}
+
+static void test_budget() {
+  simplet_lru_t *lru;
+  assert((lru = simplet_lru_new(10, freed)));
+  simplet_lru_set(lru, "a", 1, int_new(1), 2);
+  simplet_lru_set(lru, "b", 1, int_new(2), 2);
+  simplet_lru_set(lru, "c", 1, int_new(3), 2);
+  simplet_lru_set_budget(lru, 4);
+  assert(simplet_lru_get_length(lru) == 2);
+  assert(!simplet_lru_get(lru, "a", 1));
+  simplet_lru_set_budget(lru, 0);
+  assert(simplet_lru_get_length(lru) == 0);
+  simplet_lru_free(lru);
+}
+
+static void test_grow() {
+  simplet_lru_t *lru;
+  assert((lru = simplet_lru_new(100000, freed)));
+  for (int i = 0; i < 1000; i++)
+    simplet_lru_set(lru, &i, sizeof(i), int_new(i), 1);
+  for (int i = 0; i < 1000; i++)
+    assert(*(int *)simplet_lru_get(lru, &i, sizeof(i)) == i);
+  frees = 0;
+  simplet_lru_free(lru);
+  assert(frees == 1000);
+}
+
+TASK(lru) {
+  test(get);
+  test(replace);
+  test(evict);
+  test(budget);
+  test(grow);
+}
@@ -1,5 +1,8 @@
+#include <string.h>
 #include "test.h"
 #include "map.h"
+#include "list.h"
+#include "pool.h"
 
 static void close_enough(float number, float test) {
   assert((number - test) < 0.001);
@@ -72,10 +75,82 @@ static void test_user_data() {
   simplet_map_free(map);
 }
 
+static void test_fingerprint() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_map_set_slippy(map, 0, 0, 1);
+  simplet_map_add_vector_layer(map, "./data/ne_10m_admin_0_countries.shp");
+  uint8_t first[SIMPLET_HASH_LENGTH], second[SIMPLET_HASH_LENGTH];
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, first));
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, second));
+  assert(!memcmp(first, second, SIMPLET_HASH_LENGTH));
+
+  // anything changing the output changes the fingerprint
+  simplet_map_set_bgcolor(map, "#CC0000");
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, second));
+  assert(memcmp(first, second, SIMPLET_HASH_LENGTH));
+  simplet_map_set_slippy(map, 1, 0, 1);
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, first));
+  assert(memcmp(first, second, SIMPLET_HASH_LENGTH));
+  simplet_map_free(map);
+}
+
+// Clones share layers and nothing else.
+static void test_clone() {
+  simplet_map_t *map, *clone;
+  assert((map = simplet_map_new()));
+  simplet_map_set_slippy(map, 0, 0, 1);
+  simplet_map_set_bgcolor(map, "#CC0000");
+  simplet_layer_t *layer = (simplet_layer_t *)simplet_map_add_vector_layer(
+      map, "./data/ne_10m_admin_0_countries.shp");
+  assert((clone = simplet_map_clone(map)));
+  assert(simplet_list_head(clone->layers) == layer && layer->refcount == 2);
+  assert(clone->proj && clone->proj != map->proj);
+  assert(clone->bgcolor != map->bgcolor && !strcmp(clone->bgcolor, "#CC0000"));
+  assert(clone->width == 256 && clone->bounds->nw.x == map->bounds->nw.x);
+
+  uint8_t first[SIMPLET_HASH_LENGTH], second[SIMPLET_HASH_LENGTH];
+  assert(SIMPLET_OK == simplet_map_fingerprint(map, first));
+  assert(SIMPLET_OK == simplet_map_fingerprint(clone, second));
+  assert(!memcmp(first, second, SIMPLET_HASH_LENGTH));
+
+  // moving the clone leaves the map where it was
+  simplet_map_set_slippy(clone, 1, 1, 1);
+  close_enough(map->bounds->se.y, 0.0);
+  assert(map->bounds->se.y != clone->bounds->se.y);
+
+  simplet_map_free(map);
+  assert(layer->refcount == 1);
+  simplet_map_free(clone);
+}
+
+static void clone_and_free(void *data, int worker) {
+  (void)worker;
+  for (int i = 0; i < 1000; i++) {
+    simplet_map_t *clone;
+    assert((clone = simplet_map_clone(data)));
+    simplet_map_free(clone);
+  }
+}
+
+// Clones come and go on many threads at once.
+static void test_clone_threads() {
+  simplet_map_t *map;
+  assert((map = simplet_map_new()));
+  simplet_layer_t *layer = (simplet_layer_t *)simplet_map_add_vector_layer(
+      map, "./data/ne_10m_admin_0_countries.shp");
+  simplet_pool_run(clone_and_free, map, 8);
+  assert(layer->refcount == 1);
+  simplet_map_free(map);
+}
+
 TASK(map) {
   test(resetting);
   test(map);
   test(proj);
   test(slippy);
+  test(fingerprint);
   test(user_data);
+  test(clone);
+  test(clone_threads);
 }
@@ -0,0 +1,64 @@
+#include <string.h>
+#include "test.h"
+#include "pool.h"
+
+// Each worker starts on its own contiguous range.
+static void test_ranges() {
+  simplet_pool_ranges_t *ranges;
+  assert((ranges = simplet_pool_ranges_new(10, 3)));
+  size_t index;
+  assert(simplet_pool_ranges_next(ranges, 0, &index) && index == 0);
+  assert(simplet_pool_ranges_next(ranges, 1, &index) && index == 4);
+  assert(simplet_pool_ranges_next(ranges, 2, &index) && index == 7);
+  assert(simplet_pool_ranges_next(ranges, 1, &index) && index == 5);
+  simplet_pool_ranges_free(ranges);
+
+  assert((ranges = simplet_pool_ranges_new(0, 2)));
+  assert(!simplet_pool_ranges_next(ranges, 1, &index));
+  simplet_pool_ranges_free(ranges);
+}
+
+// An idle worker takes the back half of the largest range left.
+static void test_stealing() {
+  simplet_pool_ranges_t *ranges;
+  assert((ranges = simplet_pool_ranges_new(8, 2)));
+  size_t index;
+  for (size_t i = 4; i < 8; i++)
+    assert(simplet_pool_ranges_next(ranges, 1, &index) && index == i);
+  assert(simplet_pool_ranges_next(ranges, 1, &index) && index == 2);
+  assert(simplet_pool_ranges_next(ranges, 0, &index) && index == 0);
+  assert(simplet_pool_ranges_next(ranges, 0, &index) && index == 1);
+  assert(simplet_pool_ranges_next(ranges, 0, &index) && index == 3);
+  assert(!simplet_pool_ranges_next(ranges, 0, &index));
+  assert(!simplet_pool_ranges_next(ranges, 1, &index));
+  simplet_pool_ranges_free(ranges);
+}
+
+typedef struct {
+  simplet_pool_ranges_t *ranges;
+  unsigned char seen[1000];
+} shared_t;
+
+static void take_all(void *data, int worker) {
+  shared_t *shared = data;
+  size_t index;
+  while (simplet_pool_ranges_next(shared->ranges, worker, &index))
+    shared->seen[index]++;
+}
+
+// Every index is handed out once across threads, even to fewer workers than
+// the ranges were split for.
+static void test_threads() {
+  shared_t shared;
+  memset(&shared, 0, sizeof(shared));
+  assert((shared.ranges = simplet_pool_ranges_new(1000, 8)));
+  simplet_pool_run(take_all, &shared, 4);
+  for (int i = 0; i < 1000; i++) assert(shared.seen[i] == 1);
+  simplet_pool_ranges_free(shared.ranges);
+}
+
+TASK(pool) {
+  test(ranges);
+  test(stealing);
+  test(threads);
+}
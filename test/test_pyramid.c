@@ -0,0 +1,46 @@
+#include <string.h>
+#include "test.h"
+#include "pyramid.h"
+
+#define SIZE 38
+
+static void test_box() {
+  uint32_t src[4] = {0xff000000, 0xff0000ff, 0xff00ff00, 0x00000000}, out;
+  simplet_downsample_box(src, 2, &out, 1, 1, 1);
+  // (255 * 3 + 0 + 2) / 4 for alpha, (255 + 2) / 4 for each color
+  assert(out == 0xbf004040);
+}
+
+// The fastest box reduction is exact, so it matches the scalar one, even on
+// the leftover pixels at the end of a row.
+static void test_best() {
+  uint32_t src[SIZE * 2 * SIZE * 2], scalar[SIZE * SIZE], best[SIZE * SIZE];
+  for (int i = 0; i < SIZE * 2 * SIZE * 2; i++)
+    src[i] = (uint32_t)i * 2654435761u;
+  simplet_downsample_box(src, SIZE * 2, scalar, SIZE, SIZE - 1, SIZE);
+  memcpy(best, scalar, sizeof(best));
+  simplet_downsample_best()(src, SIZE * 2, best, SIZE, SIZE - 1, SIZE);
+  assert(!memcmp(scalar, best, sizeof(best)));
+}
+
+static void test_lanczos() {
+  uint32_t src[SIZE * 2 * SIZE * 2], out[SIZE * SIZE];
+  for (int i = 0; i < SIZE * 2 * SIZE * 2; i++) src[i] = 0x80402010;
+  assert(simplet_downsample_lanczos(src, SIZE * 2, out, SIZE, SIZE, SIZE));
+  for (int i = 0; i < SIZE * SIZE; i++) assert(out[i] == 0x80402010);
+
+  // a sharp edge rings, but colors stay premultiplied
+  for (int i = 0; i < SIZE * 2 * SIZE * 2; i++)
+    src[i] = i % (SIZE * 2) < SIZE ? 0xffffffff : 0x40000000;
+  assert(simplet_downsample_lanczos(src, SIZE * 2, out, SIZE, SIZE, SIZE));
+  for (int i = 0; i < SIZE * SIZE; i++)
+    for (int c = 0; c < 24; c += 8)
+      assert((out[i] >> c & 0xff) <= out[i] >> 24);
+  assert(out[0] == 0xffffffff && out[SIZE - 1] == 0x40000000);
+}
+
+TASK(pyramid) {
+  test(box);
+  test(best);
+  test(lanczos);
+}
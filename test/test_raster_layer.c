@@ -1,5 +1,6 @@
 #include "test.h"
 #include "raster_layer.h"
+#include "bandmath.h"
 
 static void test_raster_layer() {
   simplet_raster_layer_t *layer;
@@ -22,7 +23,92 @@ static void test_user_data() {
   simplet_raster_layer_free(layer);
 }
 
+static void test_max_error() {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new("./data/loss_1932_2010.tif")))
+    assert(0);
+  assert(simplet_raster_layer_get_max_error(layer) == 0.125);
+  simplet_raster_layer_set_max_error(layer, 0);
+  assert(simplet_raster_layer_get_max_error(layer) == 0);
+  simplet_raster_layer_set_max_error(layer, -1);
+  assert(simplet_raster_layer_get_max_error(layer) == 0);
+  simplet_raster_layer_free(layer);
+}
+
+static void test_threads() {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new("./data/loss_1932_2010.tif")))
+    assert(0);
+  assert(simplet_raster_layer_get_threads(layer) == 0);
+  simplet_raster_layer_set_threads(layer, 4);
+  assert(simplet_raster_layer_get_threads(layer) == 4);
+  simplet_raster_layer_set_threads(layer, -1);
+  assert(simplet_raster_layer_get_threads(layer) == 0);
+  simplet_raster_layer_free(layer);
+}
+
+static void test_mosaic() {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new_mosaic("./data")))
+    assert(0);
+  assert(layer->type == SIMPLET_RASTER);
+  assert(layer->mosaic);
+  assert(SIMPLET_OK ==
+         simplet_raster_layer_set_mosaic_index(layer, "./data.index"));
+  assert(SIMPLET_OK == simplet_raster_layer_set_mosaic_index(layer, NULL));
+  simplet_raster_layer_free(layer);
+
+  if (!(layer = simplet_raster_layer_new("./data/loss_1932_2010.tif")))
+    assert(0);
+  assert(SIMPLET_OK !=
+         simplet_raster_layer_set_mosaic_index(layer, "./data.index"));
+  simplet_raster_layer_free(layer);
+}
+
+static void test_color_stops() {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new("./data/loss_1932_2010.tif")))
+    assert(0);
+  assert(SIMPLET_OK ==
+         simplet_raster_layer_add_color_stop(layer, 10, "#ff000080"));
+  assert(SIMPLET_OK ==
+         simplet_raster_layer_add_color_stop(layer, -5, "#00ff00"));
+  assert(SIMPLET_OK != simplet_raster_layer_add_color_stop(layer, 0, "red"));
+  assert(layer->stops_length == 2);
+  assert(layer->stops[0].value == -5 && layer->stops[0].a == 255);
+  assert(layer->stops[1].value == 10 && layer->stops[1].a == 0x80);
+  assert(!simplet_raster_layer_get_classified(layer));
+  simplet_raster_layer_set_classified(layer, true);
+  assert(simplet_raster_layer_get_classified(layer));
+  simplet_raster_layer_free(layer);
+}
+
+static void test_band_math() {
+  simplet_raster_layer_t *layer;
+  if (!(layer = simplet_raster_layer_new("./data/loss_1932_2010.tif")))
+    assert(0);
+  assert(SIMPLET_OK ==
+         simplet_raster_layer_set_expression(layer, "(b4 - b3) / (b4 + b3)"));
+  assert(layer->expr && layer->expr->bands == 4);
+  assert(SIMPLET_OK != simplet_raster_layer_set_expression(layer, "b4 -"));
+  assert(layer->expr);
+  assert(SIMPLET_OK == simplet_raster_layer_set_expression(layer, NULL));
+  assert(!layer->expr);
+
+  assert(!simplet_raster_layer_get_hillshade(layer));
+  simplet_raster_layer_set_hillshade(layer, 315, 45, 2);
+  assert(simplet_raster_layer_get_hillshade(layer));
+  simplet_raster_layer_set_hillshade(layer, 315, 45, 0);
+  assert(!simplet_raster_layer_get_hillshade(layer));
+  simplet_raster_layer_free(layer);
+}
+
 TASK(raster_layer) {
   test(raster_layer);
   test(user_data);
+  test(max_error);
+  test(threads);
+  test(mosaic);
+  test(color_stops);
+  test(band_math);
 }
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "test.h"
+#include "resample.h"
+#include "raster_layer.h"
+
+static void test_kernels() {
+  assert(simplet_bilinear(0) == 1);
+  assert(simplet_bilinear(1) == 0);
+  assert(simplet_bicubic(0) == 1);
+  assert(simplet_bicubic(2) == 0);
+  assert(simplet_lanczos(0) == 1);
+  assert(fabs(simplet_lanczos(1)) < 1e-9);
+  assert(simplet_lanczos(3) == 0);
+  assert(simplet_average(0.25) == 1);
+}
+
+static void test_weights() {
+  simplet_kern_t kerns[] = {SIMPLET_NEAREST, SIMPLET_BILINEAR, SIMPLET_BICUBIC,
+                            SIMPLET_LANCZOS};
+  for (int k = 0; k < 4; k++) {
+    int taps;
+    float *weights;
+    assert((weights = simplet_resample_weights(kerns[k], &taps)));
+    for (int phase = 0; phase <= SIMPLET_PHASES; phase++) {
+      double total = 0;
+      for (int i = 0; i < taps; i++) total += weights[phase * taps + i];
+      assert(fabs(total - 1) < 1e-5);
+    }
+    free(weights);
+  }
+}
+
+static void test_locate() {
+  int first, phase;
+  simplet_resample_locate(10.5, 2, &first, &phase);
+  assert(first == 10 && phase == 0);
+  simplet_resample_locate(10.75, 2, &first, &phase);
+  assert(first == 10 && phase == SIMPLET_PHASES / 4);
+  simplet_resample_locate(10.25, 6, &first, &phase);
+  assert(first == 7 && phase == SIMPLET_PHASES * 3 / 4);
+}
+
+// The fastest convolution should draw the same bytes as the scalar one.
+static void test_convolve() {
+  int size = 32;
+  uint8_t window[32 * 32 * 4];
+  for (int i = 0; i < size * size * 4; i++) window[i] = (i * 7919) % 251;
+
+  int taps;
+  float *weights;
+  assert((weights = simplet_resample_weights(SIMPLET_LANCZOS, &taps)));
+  simplet_tap_t pixels[100];
+  for (int k = 0; k < 100; k++) {
+    pixels[k].offset = ((k % 20) * size + k % 23) * 4;
+    pixels[k].x_phase = (k * 13) % (SIMPLET_PHASES + 1);
+    pixels[k].y_phase = (k * 29) % (SIMPLET_PHASES + 1);
+  }
+
+  uint32_t expected[100], actual[100];
+  simplet_convolve_scalar(window, size * 4, taps, weights, pixels, 100,
+                          expected);
+  simplet_convolve_best()(window, size * 4, taps, weights, pixels, 100,
+                          actual);
+  for (int k = 0; k < 100; k++) assert(expected[k] == actual[k]);
+
+  // a pixel away from the edges comes out the same clamped or not
+  simplet_tap_t pixel = {(8 * size + 9) * 4, 5, 40};
+  uint32_t clamped = simplet_resample_clamped(window, size, size, taps,
+                                              weights, 9, 8, 5, 40);
+  simplet_convolve_scalar(window, size * 4, taps, weights, &pixel, 1,
+                          expected);
+  assert(clamped == expected[0]);
+  free(weights);
+}
+
+TASK(resample) {
+  test(kernels);
+  test(weights);
+  test(locate);
+  test(convolve);
+}
@@ -0,0 +1,85 @@
+#include <math.h>
+#include "test.h"
+#include "rtree.h"
+
+#define BOXES 1000
+
+static int overlaps(simplet_box_t *a, simplet_box_t *b) {
+  return a->min_x <= b->max_x && b->min_x <= a->max_x &&
+         a->min_y <= b->max_y && b->min_y <= a->max_y;
+}
+
+static void test_empty() {
+  simplet_rtree_t *tree;
+  assert((tree = simplet_rtree_new(NULL, 0)));
+  simplet_box_t box = {0, 0, 1, 1};
+  int hits[1];
+  assert(simplet_rtree_search(tree, &box, hits) == 0);
+  simplet_rtree_free(tree);
+}
+
+static void test_search() {
+  simplet_box_t boxes[BOXES];
+  srand(1);
+  for (int i = 0; i < BOXES; i++) {
+    boxes[i].min_x = rand() % 1000;
+    boxes[i].min_y = rand() % 1000;
+    boxes[i].max_x = boxes[i].min_x + rand() % 50;
+    boxes[i].max_y = boxes[i].min_y + rand() % 50;
+  }
+
+  simplet_rtree_t *tree;
+  assert((tree = simplet_rtree_new(boxes, BOXES)));
+  int hits[BOXES];
+  for (int q = 0; q < 100; q++) {
+    simplet_box_t box;
+    box.min_x = rand() % 1000;
+    box.min_y = rand() % 1000;
+    box.max_x = box.min_x + rand() % 100;
+    box.max_y = box.min_y + rand() % 100;
+
+    // hits match a scan of every box, in order
+    int count = simplet_rtree_search(tree, &box, hits), found = 0;
+    for (int i = 0; i < BOXES; i++)
+      if (overlaps(&boxes[i], &box)) assert(hits[found++] == i);
+    assert(count == found);
+  }
+  simplet_rtree_free(tree);
+}
+
+// Empty boxes, like mosaic scenes without a footprint, are never found and
+// don't disturb the others.
+static void test_invalid() {
+  simplet_box_t boxes[BOXES];
+  srand(2);
+  for (int i = 0; i < BOXES; i++) {
+    boxes[i].min_x = rand() % 1000;
+    boxes[i].min_y = rand() % 1000;
+    boxes[i].max_x = boxes[i].min_x + rand() % 50;
+    boxes[i].max_y = boxes[i].min_y + rand() % 50;
+    if (i % 7 == 3)
+      boxes[i] = (simplet_box_t){INFINITY, INFINITY, -INFINITY, -INFINITY};
+    if (i % 11 == 5) boxes[i].max_x = NAN;
+  }
+
+  simplet_rtree_t *tree;
+  assert((tree = simplet_rtree_new(boxes, BOXES)));
+  int hits[BOXES];
+  simplet_box_t all = {-INFINITY, -INFINITY, INFINITY, INFINITY};
+  int count = simplet_rtree_search(tree, &all, hits), found = 0;
+  for (int i = 0; i < BOXES; i++)
+    if (i % 7 != 3 && i % 11 != 5) assert(hits[found++] == i);
+  assert(count == found);
+  simplet_rtree_free(tree);
+
+  boxes[0] = (simplet_box_t){INFINITY, INFINITY, -INFINITY, -INFINITY};
+  assert((tree = simplet_rtree_new(boxes, 1)));
+  assert(simplet_rtree_search(tree, &all, hits) == 0);
+  simplet_rtree_free(tree);
+}
+
+TASK(rtree) {
+  test(empty);
+  test(search);
+  test(invalid);
+}
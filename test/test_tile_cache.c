@@ -0,0 +1,161 @@
+#include <string.h>
+#include <unistd.h>
+#include "test.h"
+#include "tile_cache.h"
+
+static const char key[] = "map";
+
+static void test_memory() {
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(1000, NULL)));
+  size_t length;
+  assert(!simplet_tile_cache_get(cache, key, 3, 1, 2, 3, &length));
+
+  unsigned char tile[400];
+  memset(tile, 7, sizeof(tile));
+  assert(simplet_tile_cache_set(cache, key, 3, 1, 2, 3, tile, sizeof(tile)));
+  unsigned char *out;
+  assert((out = simplet_tile_cache_get(cache, key, 3, 1, 2, 3, &length)));
+  assert(length == sizeof(tile) && !memcmp(out, tile, length));
+  free(out);
+
+  // the position and the key both pick the tile
+  assert(!simplet_tile_cache_get(cache, key, 3, 2, 1, 3, &length));
+  assert(!simplet_tile_cache_get(cache, "other", 5, 1, 2, 3, &length));
+
+  // a third tile doesn't fit, evicting the oldest
+  assert(simplet_tile_cache_set(cache, key, 3, 2, 2, 3, tile, sizeof(tile)));
+  assert(simplet_tile_cache_set(cache, key, 3, 3, 2, 3, tile, sizeof(tile)));
+  assert(simplet_tile_cache_get_length(cache) == 2);
+  assert(!simplet_tile_cache_get(cache, key, 3, 1, 2, 3, &length));
+
+  simplet_tile_cache_clear(cache);
+  assert(simplet_tile_cache_get_length(cache) == 0);
+  simplet_tile_cache_free(cache);
+}
+
+// Tiles that can't fit the budget skip memory and replace what's there.
+static void test_oversized() {
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(1000, NULL)));
+  unsigned char tile[2000];
+  memset(tile, 7, sizeof(tile));
+  assert(simplet_tile_cache_set(cache, key, 3, 1, 2, 3, tile, 400));
+  assert(simplet_tile_cache_set(cache, key, 3, 1, 2, 3, tile, sizeof(tile)));
+  assert(simplet_tile_cache_get_length(cache) == 0);
+  size_t length;
+  assert(!simplet_tile_cache_get(cache, key, 3, 1, 2, 3, &length));
+  simplet_tile_cache_free(cache);
+
+  assert((cache = simplet_tile_cache_new(0, NULL)));
+  assert(simplet_tile_cache_set(cache, key, 3, 1, 2, 3, tile, 1));
+  assert(simplet_tile_cache_get_length(cache) == 0);
+  simplet_tile_cache_free(cache);
+}
+
+static void test_disk() {
+  char dir[] = "/tmp/simplet-cache-XXXXXX";
+  assert(mkdtemp(dir));
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, dir)));
+  unsigned char tile[] = "not really a png";
+  assert(simplet_tile_cache_set(cache, key, 3, 1234567, 89, 21, tile,
+                                sizeof(tile)));
+  simplet_tile_cache_free(cache);
+
+  // a new cache over the same directory finds the tile on disk
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, dir)));
+  size_t length;
+  unsigned char *out;
+  assert((out = simplet_tile_cache_get(cache, key, 3, 1234567, 89, 21,
+                                       &length)));
+  assert(length == sizeof(tile) && !memcmp(out, tile, length));
+  free(out);
+  assert(simplet_tile_cache_get_length(cache) == 1);
+  simplet_tile_cache_free(cache);
+
+  char *command;
+  assert(asprintf(&command, "rm -r %s", dir) > 0);
+  assert(!system(command));
+  free(command);
+}
+
+// Count the files below dir.
+static int count_files(const char *dir) {
+  char *command;
+  assert(asprintf(&command, "find %s -type f | wc -l", dir) > 0);
+  FILE *out;
+  assert((out = popen(command, "r")));
+  int count = -1;
+  assert(fscanf(out, "%d", &count) == 1);
+  pclose(out);
+  free(command);
+  return count;
+}
+
+static void test_dedup() {
+  char dir[] = "/tmp/simplet-cache-XXXXXX";
+  assert(mkdtemp(dir));
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, dir)));
+  unsigned char ocean[] = "ocean", land[] = "land";
+  for (unsigned int x = 0; x < 4; x++)
+    assert(simplet_tile_cache_set(cache, key, 3, x, 0, 2, ocean,
+                                  sizeof(ocean)));
+  assert(simplet_tile_cache_set(cache, key, 3, 0, 1, 2, land, sizeof(land)));
+  // replacing a tile leaves the other links to its contents alone
+  assert(simplet_tile_cache_set(cache, key, 3, 3, 0, 2, land, sizeof(land)));
+  simplet_tile_cache_free(cache);
+
+  char *blobs;
+  assert(asprintf(&blobs, "%s/blobs", dir) > 0);
+  assert(count_files(blobs) == 2);
+  free(blobs);
+
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, dir)));
+  size_t length;
+  unsigned char *out;
+  assert((out = simplet_tile_cache_get(cache, key, 3, 2, 0, 2, &length)));
+  assert(length == sizeof(ocean) && !memcmp(out, ocean, length));
+  free(out);
+  assert((out = simplet_tile_cache_get(cache, key, 3, 3, 0, 2, &length)));
+  assert(length == sizeof(land) && !memcmp(out, land, length));
+  free(out);
+  simplet_tile_cache_free(cache);
+
+  char *command;
+  assert(asprintf(&command, "rm -r %s", dir) > 0);
+  assert(!system(command));
+  free(command);
+}
+
+static void test_duplicates() {
+  simplet_tile_cache_t *cache;
+  assert((cache = simplet_tile_cache_new(SIMPLET_TILE_CACHE, NULL)));
+  uint8_t pixels[SIMPLET_HASH_LENGTH] = {1}, other[SIMPLET_HASH_LENGTH] = {2};
+  unsigned char png[] = "encoded";
+  size_t length;
+
+  // drawn once the encoding isn't kept
+  assert(!simplet_tile_cache_get_duplicate(cache, other, &length));
+  simplet_tile_cache_set_duplicate(cache, other, png, sizeof(png));
+  assert(!simplet_tile_cache_get_duplicate(cache, other, &length));
+
+  // drawn twice it is, and the third time skips the encode
+  assert(!simplet_tile_cache_get_duplicate(cache, pixels, &length));
+  assert(!simplet_tile_cache_get_duplicate(cache, pixels, &length));
+  simplet_tile_cache_set_duplicate(cache, pixels, png, sizeof(png));
+  unsigned char *out;
+  assert((out = simplet_tile_cache_get_duplicate(cache, pixels, &length)));
+  assert(length == sizeof(png) && !memcmp(out, png, length));
+  free(out);
+  simplet_tile_cache_free(cache);
+}
+
+TASK(tile_cache) {
+  test(memory);
+  test(oversized);
+  test(disk);
+  test(dedup);
+  test(duplicates);
+}